@@ -0,0 +1,1005 @@
+/*-------------------------------------------------------------------------
+ *
+ * pg_collation_check.c: Report the objects depending on an outdated collation
+ *                       in many databases in parallel.
+ *
+ * Each database is checked using its own non-blocking libpq connection, with
+ * up to --jobs connections active at the same time, and all the results are
+ * aggregated in a single report.  Only Unix-domain socket connections are
+ * allowed, as the tool is meant to be run on the database server itself.
+ *
+ * Exit status is 0 if no broken dependency was found, 1 if some were found
+ * and 2 if some database couldn't be checked, including the ones that didn't
+ * answer within the timeout.
+ *
+ * This program is open source, licensed under the PostgreSQL license.
+ * For license terms, see the LICENSE file.
+ *
+ * Copyright (C) 2022-2023: Julien Rouhaud
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres_fe.h"
+
+#include <sys/select.h>
+#include <time.h>
+
+#include "getopt_long.h"
+#include "libpq-fe.h"
+
+#define PGCD_EXTNAME		"pg_collation_dependencies"
+
+#define EXIT_BROKEN			1
+#define EXIT_FAILURE_CHECK	2
+
+/* Seconds allowed to establish each connection */
+#define CONNECT_TIMEOUT		10
+
+typedef enum CheckFormat
+{
+	FORMAT_TABLE,
+	FORMAT_CSV,
+	FORMAT_JSON
+} CheckFormat;
+
+typedef enum SlotState
+{
+	SLOT_IDLE,
+	SLOT_CONNECTING,			/* waiting for PQconnectPoll */
+	SLOT_SCHEMA,				/* looking for the extension schema */
+	SLOT_REPORT					/* fetching the broken dependencies */
+} SlotState;
+
+typedef struct CheckSlot
+{
+	SlotState	state;
+	PGconn	   *conn;
+	PostgresPollingStatusType poll;
+	const char *dbname;
+	bool		failed;			/* got an error for the current query */
+	bool		flushing;		/* part of the query is still to be sent */
+	time_t		deadline;		/* when to give up, or 0 */
+	PGresult   *schema_res;		/* result of the schema query */
+	int			nresults;		/* results received for the report query */
+} CheckSlot;
+
+/* Columns of the report, the database name being the first one */
+#define REPORT_NCOLS		7
+
+static const char *const report_headers[REPORT_NCOLS] = {
+	"database",
+	"dep_kind",
+	"table_name",
+	"object_name",
+	"collname",
+	"coll_recorded_version",
+	"coll_actual_version"
+};
+
+typedef struct ReportRow
+{
+	char	   *values[REPORT_NCOLS];	/* NULL for SQL NULL */
+} ReportRow;
+
+static const char *progname;
+
+/* connection options */
+static const char *host = NULL;
+static const char *port = NULL;
+static const char *username = NULL;
+static const char *maintenance_db = NULL;
+
+/* check options */
+static bool all_databases = false;
+static bool report_errors = false;
+static int	jobs = 1;
+static int	timeout = 0;
+static CheckFormat format = FORMAT_TABLE;
+
+/* accumulated results */
+static ReportRow *rows = NULL;
+static int	nrows = 0;
+static int	maxrows = 0;
+static int	nfailures = 0;
+static int	nobject_errors = 0;
+
+static void help(void);
+static bool is_socket_path(const char *path);
+static PGconn *connect_database(const char *dbname, bool async);
+static char **get_all_databases(int *ndbs);
+static void start_slot(CheckSlot *slot, const char *dbname);
+static void finish_slot(CheckSlot *slot, bool failed);
+static void flush_slot(CheckSlot *slot);
+static void send_schema_query(CheckSlot *slot);
+static void send_report_query(CheckSlot *slot);
+static void handle_connecting(CheckSlot *slot);
+static void handle_results(CheckSlot *slot);
+static void add_report_rows(CheckSlot *slot, PGresult *res);
+static void add_object_errors(CheckSlot *slot, PGresult *res);
+static int	compare_rows(const void *a, const void *b);
+static void print_table(void);
+static void print_csv(void);
+static void print_json(void);
+static void print_json_string(const char *str);
+
+static void
+help(void)
+{
+	printf("%s reports the objects depending on an outdated collation in one or more databases.\n\n",
+		   progname);
+	printf("Usage:\n");
+	printf("  %s [OPTION]... [DBNAME]...\n", progname);
+	printf("\nOptions:\n");
+	printf("  -a, --all                 check all databases\n");
+	printf("  -e, --errors              also report the objects that couldn't be processed\n");
+	printf("  -f, --format=FORMAT       output format: table (default), csv or json\n");
+	printf("  -j, --jobs=NUM            use this many concurrent connections\n");
+	printf("  -t, --timeout=SECS        give up on a database after this many seconds\n"
+		   "                            (default: 0, no limit once connected)\n");
+	printf("  -?, --help                show this help, then exit\n");
+	printf("  -V, --version             output version information, then exit\n");
+	printf("\nConnection options:\n");
+	printf("  -h, --host=DIRECTORY      database server socket directory\n");
+	printf("  -p, --port=PORT           database server port\n");
+	printf("  -U, --username=USERNAME   user name to connect as\n");
+	printf("  --maintenance-db=DBNAME   alternate maintenance database\n");
+	printf("\nExit status is 0 if no broken dependency was found, 1 if some were found\n"
+		   "and 2 if some databases couldn't be checked.\n");
+}
+
+/*
+ * Only Unix-domain sockets are allowed, which are specified as an absolute
+ * path, or an abstract socket name starting with '@' on Linux.
+ */
+static bool
+is_socket_path(const char *path)
+{
+	return path != NULL && (is_absolute_path(path) || path[0] == '@');
+}
+
+/*
+ * Open a connection to the given database, either synchronously or only
+ * starting it for use with PQconnectPoll.  Returns NULL if the connection
+ * couldn't be started.
+ */
+static PGconn *
+connect_database(const char *dbname, bool async)
+{
+	const char *keywords[7];
+	const char *values[7];
+	int			i = 0;
+
+	keywords[i] = "host";
+	values[i++] = host;
+	keywords[i] = "port";
+	values[i++] = port;
+	keywords[i] = "user";
+	values[i++] = username;
+	keywords[i] = "dbname";
+	values[i++] = dbname;
+	keywords[i] = "fallback_application_name";
+	values[i++] = progname;
+	/* only used by synchronous connections, see start_slot() */
+	keywords[i] = "connect_timeout";
+	values[i++] = CppAsString2(CONNECT_TIMEOUT);
+	keywords[i] = NULL;
+	values[i] = NULL;
+
+	if (async)
+		return PQconnectStartParams(keywords, values, true);
+
+	return PQconnectdbParams(keywords, values, true);
+}
+
+/*
+ * Get the name of all the databases accepting connections, using the
+ * maintenance database.
+ */
+static char **
+get_all_databases(int *ndbs)
+{
+	PGconn	   *conn;
+	PGresult   *res;
+	char	  **dbnames;
+	int			i;
+
+	conn = connect_database(maintenance_db ? maintenance_db : "postgres",
+							false);
+	if (PQstatus(conn) != CONNECTION_OK && maintenance_db == NULL)
+	{
+		PQfinish(conn);
+		conn = connect_database("template1", false);
+	}
+
+	if (PQstatus(conn) != CONNECTION_OK)
+	{
+		fprintf(stderr, "%s: could not connect to the maintenance database: %s",
+				progname, PQerrorMessage(conn));
+		exit(EXIT_FAILURE_CHECK);
+	}
+
+	if (!is_socket_path(PQhost(conn)))
+	{
+		fprintf(stderr, "%s: only Unix-domain socket connections are allowed\n",
+				progname);
+		exit(EXIT_FAILURE_CHECK);
+	}
+
+	res = PQexec(conn,
+				 "SELECT datname FROM pg_catalog.pg_database"
+				 " WHERE datallowconn ORDER BY datname");
+	if (PQresultStatus(res) != PGRES_TUPLES_OK)
+	{
+		fprintf(stderr, "%s: could not get the list of databases: %s",
+				progname, PQerrorMessage(conn));
+		exit(EXIT_FAILURE_CHECK);
+	}
+
+	*ndbs = PQntuples(res);
+	dbnames = pg_malloc(sizeof(char *) * (*ndbs));
+	for (i = 0; i < *ndbs; i++)
+		dbnames[i] = pg_strdup(PQgetvalue(res, i, 0));
+
+	PQclear(res);
+	PQfinish(conn);
+
+	return dbnames;
+}
+
+/*
+ * Start checking the given database on the given slot.
+ */
+static void
+start_slot(CheckSlot *slot, const char *dbname)
+{
+	slot->dbname = dbname;
+	slot->failed = false;
+	slot->flushing = false;
+	slot->schema_res = NULL;
+	slot->nresults = 0;
+	slot->conn = connect_database(dbname, true);
+
+	/* connect_timeout is ignored by PQconnectPoll(), so enforce it here */
+	slot->deadline = time(NULL) + CONNECT_TIMEOUT;
+
+	if (slot->conn == NULL || PQstatus(slot->conn) == CONNECTION_BAD)
+	{
+		fprintf(stderr, "%s: could not connect to database \"%s\": %s",
+				progname, dbname,
+				slot->conn ? PQerrorMessage(slot->conn) : "out of memory\n");
+		finish_slot(slot, true);
+		return;
+	}
+
+	/* behave as if PQconnectPoll() had returned PGRES_POLLING_WRITING */
+	slot->state = SLOT_CONNECTING;
+	slot->poll = PGRES_POLLING_WRITING;
+}
+
+/*
+ * Close the connection of the given slot, making it available for another
+ * database.
+ */
+static void
+finish_slot(CheckSlot *slot, bool failed)
+{
+	if (failed)
+		nfailures++;
+
+	if (slot->schema_res != NULL)
+		PQclear(slot->schema_res);
+	if (slot->conn != NULL)
+		PQfinish(slot->conn);
+
+	slot->schema_res = NULL;
+	slot->conn = NULL;
+	slot->state = SLOT_IDLE;
+	slot->dbname = NULL;
+	slot->flushing = false;
+	slot->deadline = 0;
+}
+
+/*
+ * Send as much as possible of the query queued on the given slot.  As the
+ * connection is non-blocking, the rest is sent once the socket is writable
+ * again.
+ */
+static void
+flush_slot(CheckSlot *slot)
+{
+	int			ret = PQflush(slot->conn);
+
+	if (ret < 0)
+	{
+		fprintf(stderr, "%s: could not send query to database \"%s\": %s",
+				progname, slot->dbname, PQerrorMessage(slot->conn));
+		finish_slot(slot, true);
+		return;
+	}
+
+	slot->flushing = (ret == 1);
+}
+
+/*
+ * The extension is relocatable, so first find the schema it's installed in.
+ */
+static void
+send_schema_query(CheckSlot *slot)
+{
+	if (!PQsendQuery(slot->conn,
+					 "SELECT n.nspname"
+					 " FROM pg_catalog.pg_extension e"
+					 " JOIN pg_catalog.pg_namespace n"
+					 " ON n.oid = e.extnamespace"
+					 " WHERE e.extname = '" PGCD_EXTNAME "'"))
+	{
+		fprintf(stderr, "%s: could not send query to database \"%s\": %s",
+				progname, slot->dbname, PQerrorMessage(slot->conn));
+		finish_slot(slot, true);
+		return;
+	}
+
+	slot->state = SLOT_SCHEMA;
+	flush_slot(slot);
+}
+
+/*
+ * Send all the report queries for the database in a single batch.
+ */
+static void
+send_report_query(CheckSlot *slot)
+{
+	PGresult   *res = slot->schema_res;
+	char	   *nspname;
+	char	   *query;
+
+	if (PQntuples(res) == 0)
+	{
+		fprintf(stderr, "%s: warning: skipping database \"%s\": %s is not installed\n",
+				progname, slot->dbname, PGCD_EXTNAME);
+		finish_slot(slot, false);
+		return;
+	}
+
+	nspname = PQescapeIdentifier(slot->conn, PQgetvalue(res, 0, 0),
+								 strlen(PQgetvalue(res, 0, 0)));
+	if (nspname == NULL)
+	{
+		fprintf(stderr, "%s: could not quote schema name in database \"%s\": %s",
+				progname, slot->dbname, PQerrorMessage(slot->conn));
+		finish_slot(slot, true);
+		return;
+	}
+
+	query = psprintf("SELECT dep_kind, table_name, object_name, collname,"
+					 " coll_recorded_version, coll_actual_version"
+					 " FROM %s.pg_collation_broken_dependencies;"
+					 "%s%s%s",
+					 nspname,
+					 report_errors ?
+					 " SELECT dep_kind, object_oid, error FROM " : "",
+					 report_errors ? nspname : "",
+					 report_errors ? ".pg_collation_dependency_errors" : "");
+	PQfreemem(nspname);
+
+	if (!PQsendQuery(slot->conn, query))
+	{
+		fprintf(stderr, "%s: could not send query to database \"%s\": %s",
+				progname, slot->dbname, PQerrorMessage(slot->conn));
+		pg_free(query);
+		finish_slot(slot, true);
+		return;
+	}
+
+	pg_free(query);
+	slot->state = SLOT_REPORT;
+	flush_slot(slot);
+}
+
+/*
+ * Advance the connection establishment of the given slot.
+ */
+static void
+handle_connecting(CheckSlot *slot)
+{
+	slot->poll = PQconnectPoll(slot->conn);
+
+	if (slot->poll == PGRES_POLLING_FAILED)
+	{
+		fprintf(stderr, "%s: could not connect to database \"%s\": %s",
+				progname, slot->dbname, PQerrorMessage(slot->conn));
+		finish_slot(slot, true);
+		return;
+	}
+
+	if (slot->poll != PGRES_POLLING_OK)
+		return;
+
+	if (!is_socket_path(PQhost(slot->conn)))
+	{
+		fprintf(stderr, "%s: only Unix-domain socket connections are allowed\n",
+				progname);
+		exit(EXIT_FAILURE_CHECK);
+	}
+
+	if (PQsetnonblocking(slot->conn, 1) != 0)
+	{
+		fprintf(stderr, "%s: could not set non-blocking mode for database \"%s\": %s",
+				progname, slot->dbname, PQerrorMessage(slot->conn));
+		finish_slot(slot, true);
+		return;
+	}
+
+	slot->deadline = timeout > 0 ? time(NULL) + timeout : 0;
+
+	send_schema_query(slot);
+}
+
+/*
+ * Consume the available input of the given slot, and process all the results
+ * once the current query is fully received.
+ */
+static void
+handle_results(CheckSlot *slot)
+{
+	PGresult   *res;
+
+	if (!PQconsumeInput(slot->conn))
+	{
+		fprintf(stderr, "%s: could not receive data from database \"%s\": %s",
+				progname, slot->dbname, PQerrorMessage(slot->conn));
+		finish_slot(slot, true);
+		return;
+	}
+
+	while (!PQisBusy(slot->conn))
+	{
+		res = PQgetResult(slot->conn);
+
+		/* the query is complete */
+		if (res == NULL)
+		{
+			if (slot->failed)
+				finish_slot(slot, true);
+			else if (slot->state == SLOT_SCHEMA)
+				send_report_query(slot);
+			else
+				finish_slot(slot, false);
+			return;
+		}
+
+		if (PQresultStatus(res) != PGRES_TUPLES_OK)
+		{
+			if (!slot->failed)
+				fprintf(stderr, "%s: query failed in database \"%s\": %s",
+						progname, slot->dbname, PQerrorMessage(slot->conn));
+			slot->failed = true;
+			PQclear(res);
+			continue;
+		}
+
+		if (slot->state == SLOT_SCHEMA)
+		{
+			slot->schema_res = res;
+			continue;
+		}
+
+		/* the first result is the report, the second one the errors */
+		if (slot->nresults++ == 0)
+			add_report_rows(slot, res);
+		else
+			add_object_errors(slot, res);
+		PQclear(res);
+	}
+}
+
+/*
+ * Save the broken dependencies found in the given database.
+ */
+static void
+add_report_rows(CheckSlot *slot, PGresult *res)
+{
+	int			i;
+	int			j;
+
+	for (i = 0; i < PQntuples(res); i++)
+	{
+		ReportRow  *row;
+
+		if (nrows >= maxrows)
+		{
+			maxrows = maxrows ? maxrows * 2 : 64;
+			rows = pg_realloc(rows, sizeof(ReportRow) * maxrows);
+		}
+
+		row = &rows[nrows++];
+		row->values[0] = pg_strdup(slot->dbname);
+		for (j = 1; j < REPORT_NCOLS; j++)
+		{
+			if (PQgetisnull(res, i, j - 1))
+				row->values[j] = NULL;
+			else
+				row->values[j] = pg_strdup(PQgetvalue(res, i, j - 1));
+		}
+	}
+}
+
+/*
+ * Report the objects that couldn't be processed in the given database.  They
+ * may depend on an outdated collation, so they're counted as failures.
+ */
+static void
+add_object_errors(CheckSlot *slot, PGresult *res)
+{
+	int			i;
+
+	for (i = 0; i < PQntuples(res); i++)
+	{
+		fprintf(stderr, "%s: error: could not process %s %s in database \"%s\": %s\n",
+				progname, PQgetvalue(res, i, 0), PQgetvalue(res, i, 1),
+				slot->dbname, PQgetvalue(res, i, 2));
+		nobject_errors++;
+	}
+}
+
+static int
+compare_rows(const void *a, const void *b)
+{
+	const ReportRow *ra = (const ReportRow *) a;
+	const ReportRow *rb = (const ReportRow *) b;
+	int			i;
+
+	for (i = 0; i < REPORT_NCOLS; i++)
+	{
+		int			cmp;
+
+		if (ra->values[i] == NULL || rb->values[i] == NULL)
+		{
+			if (ra->values[i] == rb->values[i])
+				continue;
+			return ra->values[i] == NULL ? 1 : -1;
+		}
+
+		cmp = strcmp(ra->values[i], rb->values[i]);
+		if (cmp != 0)
+			return cmp;
+	}
+
+	return 0;
+}
+
+static void
+print_table(void)
+{
+	int			widths[REPORT_NCOLS];
+	int			i;
+	int			j;
+
+	for (j = 0; j < REPORT_NCOLS; j++)
+	{
+		widths[j] = strlen(report_headers[j]);
+		for (i = 0; i < nrows; i++)
+		{
+			if (rows[i].values[j] != NULL)
+				widths[j] = Max(widths[j], (int) strlen(rows[i].values[j]));
+		}
+	}
+
+	for (j = 0; j < REPORT_NCOLS; j++)
+		printf("%s %-*s ", j > 0 ? "|" : "", widths[j], report_headers[j]);
+	printf("\n");
+
+	for (j = 0; j < REPORT_NCOLS; j++)
+	{
+		int			k;
+
+		printf("%s", j > 0 ? "+" : "");
+		for (k = 0; k < widths[j] + 2; k++)
+			printf("-");
+	}
+	printf("\n");
+
+	for (i = 0; i < nrows; i++)
+	{
+		for (j = 0; j < REPORT_NCOLS; j++)
+			printf("%s %-*s ", j > 0 ? "|" : "", widths[j],
+				   rows[i].values[j] ? rows[i].values[j] : "");
+		printf("\n");
+	}
+
+	printf("(%d %s)\n", nrows, nrows == 1 ? "row" : "rows");
+}
+
+static void
+print_csv(void)
+{
+	int			i;
+	int			j;
+
+	for (j = 0; j < REPORT_NCOLS; j++)
+		printf("%s%s", j > 0 ? "," : "", report_headers[j]);
+	printf("\n");
+
+	for (i = 0; i < nrows; i++)
+	{
+		for (j = 0; j < REPORT_NCOLS; j++)
+		{
+			const char *value = rows[i].values[j];
+
+			if (j > 0)
+				printf(",");
+
+			if (value == NULL)
+				continue;
+
+			if (strpbrk(value, ",\"\r\n") == NULL)
+				printf("%s", value);
+			else
+			{
+				const char *p;
+
+				printf("\"");
+				for (p = value; *p; p++)
+				{
+					if (*p == '"')
+						printf("\"");
+					printf("%c", *p);
+				}
+				printf("\"");
+			}
+		}
+		printf("\n");
+	}
+}
+
+static void
+print_json_string(const char *str)
+{
+	const char *p;
+
+	if (str == NULL)
+	{
+		printf("null");
+		return;
+	}
+
+	printf("\"");
+	for (p = str; *p; p++)
+	{
+		switch (*p)
+		{
+			case '"':
+				printf("\\\"");
+				break;
+			case '\\':
+				printf("\\\\");
+				break;
+			case '\n':
+				printf("\\n");
+				break;
+			case '\r':
+				printf("\\r");
+				break;
+			case '\t':
+				printf("\\t");
+				break;
+			default:
+				if ((unsigned char) *p < ' ')
+					printf("\\u%04x", (unsigned char) *p);
+				else
+					printf("%c", *p);
+				break;
+		}
+	}
+	printf("\"");
+}
+
+static void
+print_json(void)
+{
+	int			i;
+	int			j;
+
+	printf("[");
+	for (i = 0; i < nrows; i++)
+	{
+		printf("%s\n  {", i > 0 ? "," : "");
+		for (j = 0; j < REPORT_NCOLS; j++)
+		{
+			printf("%s\"%s\": ", j > 0 ? ", " : "", report_headers[j]);
+			print_json_string(rows[i].values[j]);
+		}
+		printf("}");
+	}
+	printf("%s]\n", nrows > 0 ? "\n" : "");
+}
+
+int
+main(int argc, char **argv)
+{
+	static struct option long_options[] = {
+		{"all", no_argument, NULL, 'a'},
+		{"errors", no_argument, NULL, 'e'},
+		{"format", required_argument, NULL, 'f'},
+		{"host", required_argument, NULL, 'h'},
+		{"jobs", required_argument, NULL, 'j'},
+		{"timeout", required_argument, NULL, 't'},
+		{"port", required_argument, NULL, 'p'},
+		{"username", required_argument, NULL, 'U'},
+		{"maintenance-db", required_argument, NULL, 1},
+		{NULL, 0, NULL, 0}
+	};
+
+	int			c;
+	int			optindex;
+	char	  **dbnames;
+	int			ndbs;
+	int			next_db = 0;
+	int			nactive = 0;
+	CheckSlot  *slots;
+	int			i;
+
+	progname = get_progname(argv[0]);
+
+	if (argc > 1)
+	{
+		if (strcmp(argv[1], "--help") == 0 || strcmp(argv[1], "-?") == 0)
+		{
+			help();
+			exit(0);
+		}
+		if (strcmp(argv[1], "--version") == 0 || strcmp(argv[1], "-V") == 0)
+		{
+			puts("pg_collation_check (" PGCD_EXTNAME ") " PG_VERSION);
+			exit(0);
+		}
+	}
+
+	while ((c = getopt_long(argc, argv, "aef:h:j:p:t:U:", long_options,
+							&optindex)) != -1)
+	{
+		switch (c)
+		{
+			case 'a':
+				all_databases = true;
+				break;
+			case 'e':
+				report_errors = true;
+				break;
+			case 'f':
+				if (pg_strcasecmp(optarg, "table") == 0)
+					format = FORMAT_TABLE;
+				else if (pg_strcasecmp(optarg, "csv") == 0)
+					format = FORMAT_CSV;
+				else if (pg_strcasecmp(optarg, "json") == 0)
+					format = FORMAT_JSON;
+				else
+				{
+					fprintf(stderr, "%s: invalid output format \"%s\", must be \"table\", \"csv\" or \"json\"\n",
+							progname, optarg);
+					exit(EXIT_FAILURE_CHECK);
+				}
+				break;
+			case 'h':
+				host = pg_strdup(optarg);
+				break;
+			case 'j':
+				jobs = atoi(optarg);
+				if (jobs < 1 || jobs > FD_SETSIZE)
+				{
+					fprintf(stderr, "%s: number of parallel jobs must be between 1 and %d\n",
+							progname, FD_SETSIZE);
+					exit(EXIT_FAILURE_CHECK);
+				}
+				break;
+			case 'p':
+				port = pg_strdup(optarg);
+				break;
+			case 't':
+				timeout = atoi(optarg);
+				if (timeout < 0)
+				{
+					fprintf(stderr, "%s: timeout must be a positive number of seconds, or 0\n",
+							progname);
+					exit(EXIT_FAILURE_CHECK);
+				}
+				break;
+			case 'U':
+				username = pg_strdup(optarg);
+				break;
+			case 1:
+				maintenance_db = pg_strdup(optarg);
+				break;
+			default:
+				fprintf(stderr, "Try \"%s --help\" for more information.\n",
+						progname);
+				exit(EXIT_FAILURE_CHECK);
+		}
+	}
+
+	/* Refuse any TCP connection, even through the environment. */
+	if (host == NULL)
+		host = getenv("PGHOST");
+	if ((host != NULL && host[0] != '\0' && !is_socket_path(host)) ||
+		getenv("PGHOSTADDR") != NULL)
+	{
+		fprintf(stderr, "%s: only Unix-domain socket connections are allowed\n",
+				progname);
+		exit(EXIT_FAILURE_CHECK);
+	}
+
+	if (all_databases)
+	{
+		if (optind < argc)
+		{
+			fprintf(stderr, "%s: cannot check all databases and specific ones at the same time\n",
+					progname);
+			exit(EXIT_FAILURE_CHECK);
+		}
+		dbnames = get_all_databases(&ndbs);
+	}
+	else if (optind < argc)
+	{
+		dbnames = &argv[optind];
+		ndbs = argc - optind;
+	}
+	else
+	{
+		const char *dbname = getenv("PGDATABASE");
+
+		if (dbname == NULL)
+			dbname = username ? username : getenv("PGUSER");
+		if (dbname == NULL)
+		{
+			fprintf(stderr, "%s: no database specified\n", progname);
+			exit(EXIT_FAILURE_CHECK);
+		}
+		dbnames = pg_malloc(sizeof(char *));
+		dbnames[0] = pg_strdup(dbname);
+		ndbs = 1;
+	}
+
+	slots = pg_malloc0(sizeof(CheckSlot) * jobs);
+
+	while (next_db < ndbs || nactive > 0)
+	{
+		fd_set		input_mask;
+		fd_set		output_mask;
+		int			maxfd = -1;
+		time_t		now;
+		time_t		next_deadline = 0;
+		struct timeval tv;
+
+		/* Start a new connection on all idle slots. */
+		for (i = 0; i < jobs && next_db < ndbs; i++)
+		{
+			if (slots[i].state == SLOT_IDLE)
+				start_slot(&slots[i], dbnames[next_db++]);
+		}
+
+		FD_ZERO(&input_mask);
+		FD_ZERO(&output_mask);
+		nactive = 0;
+
+		for (i = 0; i < jobs; i++)
+		{
+			int			sock;
+
+			if (slots[i].state == SLOT_IDLE)
+				continue;
+
+			sock = PQsocket(slots[i].conn);
+			if (sock < 0)
+			{
+				fprintf(stderr, "%s: invalid socket for database \"%s\": %s",
+						progname, slots[i].dbname,
+						PQerrorMessage(slots[i].conn));
+				finish_slot(&slots[i], true);
+				continue;
+			}
+
+			nactive++;
+			if (slots[i].state == SLOT_CONNECTING &&
+				slots[i].poll == PGRES_POLLING_WRITING)
+				FD_SET(sock, &output_mask);
+			else
+			{
+				/* libpq may need to read input to be able to send more */
+				if (slots[i].flushing)
+					FD_SET(sock, &output_mask);
+				FD_SET(sock, &input_mask);
+			}
+			maxfd = Max(maxfd, sock);
+
+			if (slots[i].deadline != 0 &&
+				(next_deadline == 0 || slots[i].deadline < next_deadline))
+				next_deadline = slots[i].deadline;
+		}
+
+		if (nactive == 0)
+			continue;
+
+		if (next_deadline != 0)
+		{
+			now = time(NULL);
+			tv.tv_sec = next_deadline > now ? next_deadline - now : 0;
+			tv.tv_usec = 0;
+		}
+
+		if (select(maxfd + 1, &input_mask, &output_mask, NULL,
+				   next_deadline != 0 ? &tv : NULL) < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "%s: select() failed: %s\n", progname,
+					strerror(errno));
+			exit(EXIT_FAILURE_CHECK);
+		}
+
+		now = time(NULL);
+		for (i = 0; i < jobs; i++)
+		{
+			CheckSlot  *slot = &slots[i];
+			int			sock;
+
+			if (slot->state == SLOT_IDLE)
+				continue;
+
+			sock = PQsocket(slot->conn);
+			if (!FD_ISSET(sock, &input_mask) && !FD_ISSET(sock, &output_mask))
+			{
+				if (slot->deadline != 0 && now >= slot->deadline)
+				{
+					fprintf(stderr, "%s: timeout expired for database \"%s\"\n",
+							progname, slot->dbname);
+					finish_slot(slot, true);
+				}
+				continue;
+			}
+
+			if (slot->state == SLOT_CONNECTING)
+				handle_connecting(slot);
+			else if (slot->flushing)
+			{
+				if (FD_ISSET(sock, &input_mask) && !PQconsumeInput(slot->conn))
+				{
+					fprintf(stderr, "%s: could not receive data from database \"%s\": %s",
+							progname, slot->dbname, PQerrorMessage(slot->conn));
+					finish_slot(slot, true);
+					continue;
+				}
+				flush_slot(slot);
+
+				/* process what may have been read while sending */
+				if (slot->state != SLOT_IDLE && !slot->flushing)
+					handle_results(slot);
+			}
+			else
+				handle_results(slot);
+		}
+	}
+
+	if (nrows > 1)
+		qsort(rows, nrows, sizeof(ReportRow), compare_rows);
+
+	switch (format)
+	{
+		case FORMAT_TABLE:
+			print_table();
+			break;
+		case FORMAT_CSV:
+			print_csv();
+			break;
+		case FORMAT_JSON:
+			print_json();
+			break;
+	}
+
+	if (nfailures > 0 || nobject_errors > 0)
+		exit(EXIT_FAILURE_CHECK);
+	if (nrows > 0)
+		exit(EXIT_BROKEN);
+
+	return 0;
+}
@@ -0,0 +1,198 @@
+#-------------------------------------------------------------------------
+#
+# 001_basic.pl: Test the options, output formats and exit status of
+#               pg_collation_check.
+#
+# This program is open source, licensed under the PostgreSQL license.
+# For license terms, see the LICENSE file.
+#
+# Copyright (C) 2022-2023: Julien Rouhaud
+#
+#-------------------------------------------------------------------------
+
+use strict;
+use warnings;
+
+use IPC::Run;
+use PostgreSQL::Test::Cluster;
+use PostgreSQL::Test::Utils;
+use Test::More;
+
+program_options_handling_ok('pg_collation_check');
+
+command_like([ 'pg_collation_check', '--help' ],
+	qr/Usage:/, 'pg_collation_check --help');
+command_like([ 'pg_collation_check', '--version' ],
+	qr/^pg_collation_check \(pg_collation_dependencies\) /,
+	'pg_collation_check --version');
+
+# invalid options
+command_checks_all([ 'pg_collation_check', '--format=xml' ],
+	2, [qr/^$/], [qr/invalid output format "xml"/],
+	'invalid output format');
+command_checks_all([ 'pg_collation_check', '--jobs=0' ],
+	2, [qr/^$/], [qr/number of parallel jobs must be between 1 and/],
+	'invalid number of jobs');
+command_checks_all([ 'pg_collation_check', '--timeout=-1' ],
+	2, [qr/^$/], [qr/timeout must be a positive number of seconds, or 0/],
+	'invalid timeout');
+
+# only Unix-domain sockets are allowed, even through the environment
+command_checks_all([ 'pg_collation_check', '--host=localhost', 'postgres' ],
+	2, [qr/^$/], [qr/only Unix-domain socket connections are allowed/],
+	'TCP host refused');
+{
+	local $ENV{PGHOST} = 'localhost';
+	command_checks_all([ 'pg_collation_check', 'postgres' ],
+		2, [qr/^$/], [qr/only Unix-domain socket connections are allowed/],
+		'TCP host refused in PGHOST');
+}
+{
+	local $ENV{PGHOSTADDR} = '127.0.0.1';
+	command_checks_all([ 'pg_collation_check', 'postgres' ],
+		2, [qr/^$/], [qr/only Unix-domain socket connections are allowed/],
+		'PGHOSTADDR refused');
+}
+
+my $node = PostgreSQL::Test::Cluster->new('main');
+# the default collation must not be reported as outdated
+$node->init(extra => ['--locale=C']);
+$node->start;
+
+$node->safe_psql('postgres', "CREATE DATABASE db_clean");
+$node->safe_psql('db_clean', "CREATE EXTENSION pg_collation_dependencies");
+
+$node->safe_psql('postgres', "CREATE DATABASE db_noext");
+
+# simulate an outdated collation by changing its recorded version
+$node->safe_psql('postgres', "CREATE DATABASE db_broken");
+$node->safe_psql(
+	'db_broken', q{
+	CREATE EXTENSION pg_collation_dependencies;
+	CREATE COLLATION coll_tap (provider = libc, locale = 'C');
+	CREATE TABLE "tbl,1" (val text COLLATE coll_tap);
+	CREATE INDEX tbl_val_idx ON "tbl,1" (val);
+	UPDATE pg_collation SET collversion = 'not_a_version'
+	WHERE collname = 'coll_tap';
+});
+
+# break a view by removing its rewrite rule, so that it can't be processed
+$node->safe_psql('postgres', "CREATE DATABASE db_error");
+$node->safe_psql(
+	'db_error', q{
+	CREATE EXTENSION pg_collation_dependencies;
+	CREATE VIEW err_view AS SELECT 'a'::text AS val;
+	DELETE FROM pg_rewrite WHERE ev_class = 'err_view'::regclass;
+});
+
+$node->safe_psql('postgres', "CREATE DATABASE db_slow");
+$node->safe_psql(
+	'db_slow', q{
+	CREATE EXTENSION pg_collation_dependencies;
+	CREATE VIEW slow_view AS SELECT 'a'::text AS val;
+});
+
+# exit status
+$node->command_checks_all([ 'pg_collation_check', 'db_clean' ],
+	0, [qr/\(0 rows\)/], [qr/^$/], 'no broken dependency');
+
+$node->command_checks_all(
+	[ 'pg_collation_check', 'db_broken' ],
+	1,
+	[
+		qr/^ db_broken \| index +\| "tbl,1" +\| tbl_val_idx +\| coll_tap +\| not_a_version +\| +$/m,
+		qr/\(1 row\)/
+	],
+	[qr/^$/],
+	'broken dependency reported');
+
+$node->command_checks_all([ 'pg_collation_check', 'db_noext' ],
+	0, [qr/\(0 rows\)/],
+	[qr/warning: skipping database "db_noext": pg_collation_dependencies is not installed/],
+	'database without the extension skipped');
+
+$node->command_checks_all(
+	[ 'pg_collation_check', 'db_missing', 'db_broken' ],
+	2,
+	[qr/db_broken/],
+	[qr/could not connect to database "db_missing"/],
+	'database that can\'t be connected to reported');
+
+# objects that can't be processed are only reported with --errors
+$node->command_checks_all([ 'pg_collation_check', 'db_error' ],
+	0, [qr/\(0 rows\)/], [qr/^$/], 'object errors ignored by default');
+$node->command_checks_all(
+	[ 'pg_collation_check', '--errors', 'db_error' ],
+	2,
+	[qr/\(0 rows\)/],
+	[
+		qr/error: could not process view \d+ in database "db_error": view "err_view" is missing rewrite information/
+	],
+	'object errors reported with --errors');
+
+# several databases, in parallel or not
+$node->command_checks_all(
+	[ 'pg_collation_check', '--jobs=3', 'db_clean', 'db_broken', 'db_noext' ],
+	1,
+	[ qr/db_broken/, qr/\(1 row\)/ ],
+	[qr/skipping database "db_noext"/],
+	'several databases checked in parallel');
+
+$node->command_checks_all(
+	[ 'pg_collation_check', '--all' ],
+	1,
+	[ qr/db_broken/, qr/\(1 row\)/ ],
+	[qr/skipping database "postgres"/],
+	'all databases checked');
+$node->command_checks_all(
+	[ 'pg_collation_check', '--all', 'db_clean' ],
+	2, [qr/^$/],
+	[qr/cannot check all databases and specific ones at the same time/],
+	'--all with a database name');
+
+# output formats
+$node->command_checks_all(
+	[ 'pg_collation_check', '--format=csv', 'db_broken', 'db_clean' ],
+	1,
+	[
+		qr/\Adatabase,dep_kind,table_name,object_name,collname,coll_recorded_version,coll_actual_version\ndb_broken,index,"""tbl,1""",tbl_val_idx,coll_tap,not_a_version,\n\z/
+	],
+	[qr/^$/],
+	'CSV output');
+
+my $json_row =
+  '{"database": "db_broken", "dep_kind": "index", "table_name": "\"tbl,1\"", '
+  . '"object_name": "tbl_val_idx", "collname": "coll_tap", '
+  . '"coll_recorded_version": "not_a_version", "coll_actual_version": null}';
+$node->command_checks_all(
+	[ 'pg_collation_check', '--format=json', 'db_broken' ],
+	1, [qr/\A\[\n  \Q$json_row\E\n\]\n\z/],
+	[qr/^$/], 'JSON output');
+$node->command_checks_all([ 'pg_collation_check', '--format=json', 'db_clean' ],
+	0, [qr/\A\[\]\n\z/], [qr/^$/], 'empty JSON output');
+
+# a database that isn't checked within the timeout doesn't delay the others
+my ($stdin, $stdout, $stderr) = ('', '', '');
+my $locker = IPC::Run::start(
+	[ 'psql', '-XAtq', '-v', 'ON_ERROR_STOP=1', '-d', $node->connstr('db_slow') ],
+	'<', \$stdin, '>', \$stdout, '2>', \$stderr,
+	IPC::Run::timeout($PostgreSQL::Test::Utils::timeout_default));
+$stdin .= "BEGIN;\nLOCK TABLE slow_view IN ACCESS EXCLUSIVE MODE;\nSELECT 'locked';\n";
+$locker->pump until $stdout =~ /locked/;
+
+$node->command_checks_all(
+	[ 'pg_collation_check', '--timeout=1', '--jobs=2', 'db_slow', 'db_broken' ],
+	2,
+	[ qr/db_broken/, qr/\(1 row\)/ ],
+	[qr/timeout expired for database "db_slow"/],
+	'database not checked within the timeout');
+
+$stdin .= "COMMIT;\n\\q\n";
+$locker->finish;
+
+$node->command_checks_all([ 'pg_collation_check', '--timeout=10', 'db_slow' ],
+	0, [qr/\(0 rows\)/], [qr/^$/], 'database checked within the timeout');
+
+$node->stop;
+
+done_testing();
@@ -6,6 +6,26 @@
 -- complain if script is sourced in psql, rather than via CREATE EXTENSION
 \echo Use "CREATE EXTENSION pg_collation_dependencies" to load this file. \quit
 
+CREATE TABLE pg_collation_verified_objects (
+    classid oid NOT NULL,
+    objid oid NOT NULL,
+    collid oid NOT NULL,
+    collversion text,
+    fingerprint text,
+    verified_at timestamptz NOT NULL DEFAULT now(),
+    method text NOT NULL,
+    PRIMARY KEY (classid, objid, collid)
+);
+SELECT pg_catalog.pg_extension_config_dump('pg_collation_verified_objects', '');
+
+CREATE TABLE pg_collation_fingerprints (
+    collid oid PRIMARY KEY,
+    collversion text,
+    fingerprint text NOT NULL,
+    recorded_at timestamptz NOT NULL DEFAULT now()
+);
+SELECT pg_catalog.pg_extension_config_dump('pg_collation_fingerprints', '');
+
 CREATE FUNCTION pg_collation_constraint_dependencies(
         IN conoid oid, OUT colloid oid
     )
@@ -27,6 +47,251 @@ CREATE FUNCTION pg_collation_matview_dependencies(
     LANGUAGE C STRICT VOLATILE COST 100
 AS '$libdir/pg_collation_dependencies', 'pg_collation_matview_dependencies';
 
+CREATE FUNCTION pg_collation_partition_dependencies(
+        IN relid regclass, OUT colloid oid
+    )
+    RETURNS SETOF oid
+    LANGUAGE C STRICT VOLATILE COST 1000
+AS '$libdir/pg_collation_dependencies', 'pg_collation_partition_dependencies';
+
+CREATE FUNCTION pg_collation_generated_dependencies(
+        IN relid regclass, OUT attnum smallint, OUT colloid oid
+    )
+    RETURNS SETOF record
+    LANGUAGE C STRICT VOLATILE COST 1000
+AS '$libdir/pg_collation_dependencies', 'pg_collation_generated_dependencies';
+
+CREATE FUNCTION pg_collation_rule_dependencies(
+        OUT relid oid, OUT relkind "char", OUT colloid oid
+    )
+    RETURNS SETOF record
+    LANGUAGE C STRICT STABLE COST 1000
+AS '$libdir/pg_collation_dependencies', 'pg_collation_rule_dependencies';
+
+CREATE FUNCTION pg_collation_statistics_dependencies(
+        OUT relid oid, OUT attnum smallint, OUT statid oid, OUT colloid oid
+    )
+    RETURNS SETOF record
+    LANGUAGE C STRICT STABLE COST 1000
+AS '$libdir/pg_collation_dependencies', 'pg_collation_statistics_dependencies';
+
+CREATE FUNCTION pg_collation_all_dependencies(
+        OUT dep_kind text, OUT tbl_oid oid, OUT object_oid oid,
+        OUT colloid oid, OUT error text
+    )
+    RETURNS SETOF record
+    LANGUAGE C STRICT VOLATILE COST 10000
+AS '$libdir/pg_collation_dependencies', 'pg_collation_all_dependencies';
+
+-- value-per-call variant, only streams when called in a target list
+CREATE FUNCTION pg_collation_all_dependencies_stream(
+        IN broken_only boolean DEFAULT false,
+        OUT dep_kind text, OUT tbl_oid oid, OUT object_oid oid,
+        OUT colloid oid, OUT error text
+    )
+    RETURNS SETOF record
+    LANGUAGE C STRICT VOLATILE COST 10000
+AS '$libdir/pg_collation_dependencies', 'pg_collation_all_dependencies_stream';
+
+CREATE FUNCTION pg_collation_mark_verified(
+        IN classid regclass, IN objid oid, IN method text DEFAULT 'manual'
+    )
+    RETURNS integer
+    LANGUAGE C STRICT VOLATILE COST 100
+AS '$libdir/pg_collation_dependencies', 'pg_collation_mark_verified';
+
+-- objects verified by this backend during recovery, see pg_collation_mark_verified
+CREATE FUNCTION pg_collation_session_verified_objects(
+        OUT classid oid, OUT objid oid, OUT collid oid, OUT collversion text,
+        OUT fingerprint text, OUT verified_at timestamptz, OUT method text
+    )
+    RETURNS SETOF record
+    LANGUAGE C STRICT VOLATILE COST 100
+AS '$libdir/pg_collation_dependencies', 'pg_collation_session_verified_objects';
+
+CREATE FUNCTION pg_collation_dependencies_trace(
+        IN classid regclass, IN objid oid,
+        OUT colloid oid, OUT path text
+    )
+    RETURNS SETOF record
+    LANGUAGE C STRICT VOLATILE COST 100
+AS '$libdir/pg_collation_dependencies', 'pg_collation_dependencies_trace';
+
+CREATE FUNCTION pg_collation_snapshot_export(IN path text)
+    RETURNS bigint
+    LANGUAGE C STRICT VOLATILE COST 10000
+AS '$libdir/pg_collation_dependencies', 'pg_collation_snapshot_export';
+-- writes server-side files, so restrict it to superusers by default
+REVOKE ALL ON FUNCTION pg_collation_snapshot_export(text) FROM PUBLIC;
+
+CREATE FUNCTION pg_collation_snapshot_read(
+        IN path text,
+        OUT dep_kind text, OUT object_oid oid, OUT colloid oid,
+        OUT collversion text
+    )
+    RETURNS SETOF record
+    LANGUAGE C STRICT VOLATILE COST 1000
+AS '$libdir/pg_collation_dependencies', 'pg_collation_snapshot_read';
+REVOKE ALL ON FUNCTION pg_collation_snapshot_read(text) FROM PUBLIC;
+
+CREATE FUNCTION pg_collation_snapshot_diff(
+        IN old_path text,
+        OUT dep_kind text, OUT object_oid oid, OUT change text,
+        OUT colloid oid, OUT old_version text, OUT new_version text
+    )
+    RETURNS SETOF record
+    LANGUAGE C STRICT VOLATILE COST 10000
+AS '$libdir/pg_collation_dependencies', 'pg_collation_snapshot_diff';
+REVOKE ALL ON FUNCTION pg_collation_snapshot_diff(text) FROM PUBLIC;
+
+CREATE FUNCTION pg_collation_snapshot_diff(
+        IN old_path text, IN new_path text,
+        OUT dep_kind text, OUT object_oid oid, OUT change text,
+        OUT colloid oid, OUT old_version text, OUT new_version text
+    )
+    RETURNS SETOF record
+    LANGUAGE C STRICT VOLATILE COST 1000
+AS '$libdir/pg_collation_dependencies', 'pg_collation_snapshot_diff';
+REVOKE ALL ON FUNCTION pg_collation_snapshot_diff(text, text) FROM PUBLIC;
+
+CREATE FUNCTION pg_collation_index_check(
+        IN indexid regclass,
+        IN sample_fraction float8 DEFAULT 1.0,
+        IN max_violations integer DEFAULT 10,
+        IN parallel_workers integer DEFAULT -1,
+        OUT blkno bigint, OUT offnum integer, OUT kind text,
+        OUT prev_key text, OUT key text
+    )
+    RETURNS SETOF record
+    LANGUAGE C STRICT VOLATILE COST 1000
+AS '$libdir/pg_collation_dependencies', 'pg_collation_index_check';
+-- reads raw index pages, so restrict it to superusers by default
+REVOKE ALL ON FUNCTION pg_collation_index_check(regclass, float8, integer, integer)
+    FROM PUBLIC;
+
+CREATE FUNCTION pg_collation_index_ascii_check(
+        IN indexid regclass,
+        IN from_heap boolean DEFAULT false,
+        IN mark_safe boolean DEFAULT false,
+        OUT stable boolean, OUT nvalues bigint, OUT reason text
+    )
+    RETURNS record
+    LANGUAGE C STRICT VOLATILE COST 1000
+AS '$libdir/pg_collation_dependencies', 'pg_collation_index_ascii_check';
+REVOKE ALL ON FUNCTION pg_collation_index_ascii_check(regclass, boolean, boolean)
+    FROM PUBLIC;
+
+CREATE FUNCTION pg_collation_constraint_check(
+        IN conoid oid,
+        IN max_violations integer DEFAULT 10,
+        IN prune boolean DEFAULT true,
+        OUT relid regclass, OUT ctid tid
+    )
+    RETURNS SETOF record
+    LANGUAGE C STRICT VOLATILE COST 1000
+AS '$libdir/pg_collation_dependencies', 'pg_collation_constraint_check';
+REVOKE ALL ON FUNCTION pg_collation_constraint_check(oid, integer, boolean)
+    FROM PUBLIC;
+
+CREATE FUNCTION pg_collation_unique_check(
+        IN indexid regclass,
+        IN max_violations integer DEFAULT 10,
+        OUT key text, OUT duplicates bigint
+    )
+    RETURNS SETOF record
+    LANGUAGE C STRICT VOLATILE COST 1000
+AS '$libdir/pg_collation_dependencies', 'pg_collation_unique_check';
+REVOKE ALL ON FUNCTION pg_collation_unique_check(regclass, integer)
+    FROM PUBLIC;
+
+CREATE FUNCTION pg_collation_matview_check(
+        IN matviewid regclass,
+        OUT refresh_needed boolean, OUT stored_rows bigint,
+        OUT query_rows bigint
+    )
+    RETURNS SETOF record
+    LANGUAGE C STRICT VOLATILE COST 1000
+AS '$libdir/pg_collation_dependencies', 'pg_collation_matview_check';
+REVOKE ALL ON FUNCTION pg_collation_matview_check(regclass) FROM PUBLIC;
+
+CREATE FUNCTION pg_collation_partition_check(
+        IN relid regclass,
+        IN max_violations integer DEFAULT 10,
+        IN minmax boolean DEFAULT false,
+        OUT partition regclass, OUT ctid tid
+    )
+    RETURNS SETOF record
+    LANGUAGE C STRICT VOLATILE COST 1000
+AS '$libdir/pg_collation_dependencies', 'pg_collation_partition_check';
+REVOKE ALL ON FUNCTION pg_collation_partition_check(regclass, integer, boolean)
+    FROM PUBLIC;
+
+CREATE FUNCTION pg_collation_generated_check(
+        IN relid regclass,
+        IN max_violations integer DEFAULT 10,
+        OUT relation regclass, OUT attname name, OUT ctid tid
+    )
+    RETURNS SETOF record
+    LANGUAGE C STRICT VOLATILE COST 1000
+AS '$libdir/pg_collation_dependencies', 'pg_collation_generated_check';
+REVOKE ALL ON FUNCTION pg_collation_generated_check(regclass, integer)
+    FROM PUBLIC;
+
+CREATE FUNCTION pg_collation_range_check(
+        IN relid regclass,
+        IN max_violations integer DEFAULT 10,
+        OUT relation regclass, OUT attname name, OUT ctid tid
+    )
+    RETURNS SETOF record
+    LANGUAGE C STRICT VOLATILE COST 1000
+AS '$libdir/pg_collation_dependencies', 'pg_collation_range_check';
+REVOKE ALL ON FUNCTION pg_collation_range_check(regclass, integer)
+    FROM PUBLIC;
+
+CREATE FUNCTION pg_collation_exclusion_check(
+        IN conoid oid,
+        IN max_violations integer DEFAULT 10,
+        OUT ctid1 tid, OUT ctid2 tid
+    )
+    RETURNS SETOF record
+    LANGUAGE C STRICT VOLATILE COST 1000
+AS '$libdir/pg_collation_dependencies', 'pg_collation_exclusion_check';
+REVOKE ALL ON FUNCTION pg_collation_exclusion_check(oid, integer)
+    FROM PUBLIC;
+
+CREATE FUNCTION pg_collation_foreign_key_check(
+        IN conoid oid,
+        IN max_violations integer DEFAULT 10,
+        OUT relation regclass, OUT ctid tid
+    )
+    RETURNS SETOF record
+    LANGUAGE C STRICT VOLATILE COST 1000
+AS '$libdir/pg_collation_dependencies', 'pg_collation_foreign_key_check';
+REVOKE ALL ON FUNCTION pg_collation_foreign_key_check(oid, integer)
+    FROM PUBLIC;
+
+CREATE FUNCTION pg_collation_gist_check(
+        IN indexid regclass,
+        IN max_violations integer DEFAULT 10,
+        OUT blkno bigint, OUT offnum integer, OUT attnum integer,
+        OUT kind text, OUT key text, OUT parent_key text
+    )
+    RETURNS SETOF record
+    LANGUAGE C STRICT VOLATILE COST 1000
+AS '$libdir/pg_collation_dependencies', 'pg_collation_gist_check';
+REVOKE ALL ON FUNCTION pg_collation_gist_check(regclass, integer)
+    FROM PUBLIC;
+
+CREATE FUNCTION pg_collation_fingerprint(IN colloid oid)
+    RETURNS text
+    LANGUAGE C STRICT STABLE COST 10000
+AS '$libdir/pg_collation_dependencies', 'pg_collation_fingerprint';
+
+CREATE FUNCTION pg_collation_fingerprint_record(IN colloid oid)
+    RETURNS text
+    LANGUAGE C STRICT VOLATILE COST 10000
+AS '$libdir/pg_collation_dependencies', 'pg_collation_fingerprint_record';
+
 CREATE VIEW pg_collation_index_dependencies AS
     SELECT tc.oid AS tbl_oid, tc.oid::regclass::name AS table_name,
           ic.oid AS index_oid, ic.oid::regclass::name AS index_name,
@@ -48,32 +313,297 @@ CREATE VIEW pg_collation_constraint_dependencies AS
     LATERAL pg_collation_constraint_dependencies(con.oid) d(colloid)
     JOIN pg_catalog.pg_collation coll ON coll.oid = d.colloid;
 
+-- a foreign key, the referenced columns and the unique index used by the
+-- referential integrity triggers all have to agree, so report them together
+CREATE VIEW pg_collation_foreign_key_dependencies AS
+    SELECT con.oid AS constraint_oid, quote_ident(n.nspname) || '.' ||
+            quote_ident(con.conname) AS constraint_name,
+          con.conrelid AS tbl_oid, con.conrelid::regclass::name AS table_name,
+          ARRAY(SELECT a.attname
+              FROM unnest(con.conkey) WITH ORDINALITY k(attnum, ord)
+              JOIN pg_catalog.pg_attribute a ON a.attrelid = con.conrelid
+                  AND a.attnum = k.attnum
+              ORDER BY k.ord) AS columns,
+          con.confrelid AS ref_tbl_oid,
+          con.confrelid::regclass::name AS ref_table_name,
+          ARRAY(SELECT a.attname
+              FROM unnest(con.confkey) WITH ORDINALITY k(attnum, ord)
+              JOIN pg_catalog.pg_attribute a ON a.attrelid = con.confrelid
+                  AND a.attnum = k.attnum
+              ORDER BY k.ord) AS ref_columns,
+          con.conindid AS ref_index_oid,
+          con.conindid::regclass::name AS ref_index_name,
+          coll.oid AS coll_oid, coll.collname
+    FROM pg_catalog.pg_constraint con
+    JOIN pg_catalog.pg_namespace n ON n.oid = con.connamespace,
+    LATERAL pg_collation_constraint_dependencies(con.oid) d(colloid)
+    JOIN pg_catalog.pg_collation coll ON coll.oid = d.colloid
+    WHERE con.contype = 'f';
+
 CREATE VIEW pg_collation_matview_dependencies AS
-    SELECT c.oid AS matview_oid, c.oid::regclass::name AS matview_name,
+    SELECT d.relid AS matview_oid, d.relid::regclass::name AS matview_name,
+          coll.oid AS coll_oid, coll.collname
+    FROM pg_collation_rule_dependencies() d
+    JOIN pg_catalog.pg_collation coll ON coll.oid = d.colloid
+    WHERE d.relkind = 'm';
+
+CREATE VIEW pg_collation_partition_dependencies AS
+    SELECT c.oid AS tbl_oid, c.oid::regclass::name AS table_name,
+          coll.oid AS coll_oid, coll.collname
+    FROM pg_catalog.pg_class c,
+    LATERAL pg_collation_partition_dependencies(c.oid) d(colloid)
+    JOIN pg_catalog.pg_collation coll ON coll.oid = d.colloid
+    WHERE c.relkind = 'p' OR c.relispartition;
+
+CREATE VIEW pg_collation_generated_dependencies AS
+    SELECT c.oid AS tbl_oid, c.oid::regclass::name AS table_name,
+          ad.oid AS attrdef_oid, a.attname,
           coll.oid AS coll_oid, coll.collname
     FROM pg_catalog.pg_class c,
-    LATERAL pg_collation_matview_dependencies(c.oid) d(colloid)
+    LATERAL pg_collation_generated_dependencies(c.oid) d(attnum, colloid)
+    JOIN pg_catalog.pg_attribute a ON a.attrelid = c.oid
+        AND a.attnum = d.attnum
+    JOIN pg_catalog.pg_attrdef ad ON ad.adrelid = c.oid
+        AND ad.adnum = d.attnum
     JOIN pg_catalog.pg_collation coll ON coll.oid = d.colloid
-    WHERE relkind = 'm';
+    WHERE c.relkind IN ('r', 'p');
+
+CREATE VIEW pg_collation_view_dependencies AS
+    SELECT d.relid AS view_oid, d.relid::regclass::name AS view_name,
+          coll.oid AS coll_oid, coll.collname
+    FROM pg_collation_rule_dependencies() d
+    JOIN pg_catalog.pg_collation coll ON coll.oid = d.colloid
+    WHERE d.relkind = 'v';
 
 CREATE VIEW pg_collation_broken_dependencies AS
     SELECT s.*,
         coll.collversion AS coll_recorded_version,
         pg_collation_actual_version(coll.oid) AS coll_actual_version
     FROM (
-        SELECT 'index' AS dep_kind, tbl_oid, table_name,
-            index_oid AS object_oid, index_name AS object_name,
-            coll_oid, collname
-        FROM pg_collation_index_dependencies
-        UNION ALL
-        SELECT 'constraint', * FROM pg_collation_constraint_dependencies
-        UNION ALL
-        SELECT 'materialized view', NULL, NULL, * FROM pg_collation_matview_dependencies
+        -- rely on the fault-isolated bulk scan, so that a single object that
+        -- can't be processed doesn't abort the whole report
+        SELECT d.dep_kind, d.tbl_oid, d.tbl_oid::regclass::name AS table_name,
+            d.object_oid,
+            CASE d.dep_kind
+                WHEN 'constraint' THEN quote_ident(n.nspname) || '.' ||
+                    quote_ident(con.conname)
+                WHEN 'generated column' THEN d.tbl_oid::regclass::name ||
+                    '.' || quote_ident(a.attname)
+                ELSE d.object_oid::regclass::name::text
+            END AS object_name,
+            coll.oid AS coll_oid, coll.collname
+        FROM pg_collation_all_dependencies() d
+        JOIN pg_catalog.pg_collation coll ON coll.oid = d.colloid
+        LEFT JOIN pg_catalog.pg_constraint con
+            ON d.dep_kind = 'constraint' AND con.oid = d.object_oid
+        LEFT JOIN pg_catalog.pg_namespace n ON n.oid = con.connamespace
+        LEFT JOIN pg_catalog.pg_attrdef ad
+            ON d.dep_kind = 'generated column' AND ad.oid = d.object_oid
+        LEFT JOIN pg_catalog.pg_attribute a ON a.attrelid = ad.adrelid
+            AND a.attnum = ad.adnum
+        -- views don't store anything, so there's nothing to rebuild or verify
+        WHERE d.dep_kind <> 'view'
     ) s
     JOIN pg_catalog.pg_collation coll ON coll.oid = s.coll_oid
-    WHERE coll.collversion IS DISTINCT FROM pg_collation_actual_version(coll.oid)
+    LEFT JOIN pg_collation_fingerprints fp ON fp.collid = coll.oid
+    -- if a fingerprint was recorded, only trust it rather than the version
+    WHERE CASE WHEN fp.fingerprint IS NOT NULL
+            THEN fp.fingerprint IS DISTINCT FROM pg_collation_fingerprint(coll.oid)
+            ELSE coll.collversion IS DISTINCT FROM pg_collation_actual_version(coll.oid)
+        END
     AND NOT (
         coll.collnamespace = 'pg_catalog'::regnamespace
         AND collencoding = -1
         AND coll.collname IN ('C', 'POSIX')
+    )
+    -- ignore the objects already rebuilt or verified under the current version
+    AND NOT EXISTS (
+        SELECT 1
+        FROM (
+            SELECT classid, objid, collid, collversion, fingerprint
+            FROM pg_collation_verified_objects
+            UNION ALL
+            SELECT classid, objid, collid, collversion, fingerprint
+            FROM pg_collation_session_verified_objects()
+        ) v
+        WHERE v.classid = CASE s.dep_kind
+                WHEN 'constraint' THEN 'pg_catalog.pg_constraint'::regclass
+                WHEN 'generated column' THEN 'pg_catalog.pg_attrdef'::regclass
+                ELSE 'pg_catalog.pg_class'::regclass
+            END
+        AND v.objid = s.object_oid
+        AND v.collid = coll.oid
+        AND v.collversion IS NOT DISTINCT FROM pg_collation_actual_version(coll.oid)
+        AND (fp.fingerprint IS NULL
+            OR v.fingerprint = pg_collation_fingerprint(coll.oid))
     );
+
+CREATE VIEW pg_collation_dependency_errors AS
+    SELECT d.dep_kind, d.tbl_oid, d.object_oid, d.error
+    FROM pg_collation_all_dependencies() d
+    WHERE d.error IS NOT NULL;
+
+CREATE FUNCTION pg_collation_impact_summary(
+        OUT colloid oid, OUT objects bigint,
+        OUT indexes bigint, OUT index_bytes bigint,
+        OUT matviews bigint, OUT matview_bytes bigint,
+        OUT constraints bigint, OUT tables bigint, OUT table_rows bigint,
+        OUT partitions bigint, OUT rebuild_seconds float8
+    )
+    RETURNS SETOF record
+    LANGUAGE C STRICT VOLATILE COST 10000
+AS '$libdir/pg_collation_dependencies', 'pg_collation_impact_summary';
+
+CREATE VIEW pg_collation_impact AS
+    SELECT coll.oid AS coll_oid, coll.collname, i.objects,
+        i.indexes, i.matviews, i.constraints,
+        pg_catalog.pg_size_pretty(i.index_bytes + i.matview_bytes)
+            AS rebuild_size,
+        i.tables, i.table_rows, i.partitions,
+        pg_catalog.make_interval(secs => pg_catalog.round(i.rebuild_seconds))
+            AS rebuild_time
+    FROM pg_collation_impact_summary() i
+    JOIN pg_catalog.pg_collation coll ON coll.oid = i.colloid;
+
+CREATE VIEW pg_collation_statistics_dependencies AS
+    SELECT DISTINCT d.relid AS tbl_oid, d.relid::regclass::name AS table_name,
+          a.attname, d.statid AS stat_oid, s.stxname AS stat_name,
+          coll.oid AS coll_oid, coll.collname
+    FROM pg_collation_statistics_dependencies() d
+    JOIN pg_catalog.pg_collation coll ON coll.oid = d.colloid
+    LEFT JOIN pg_catalog.pg_attribute a ON a.attrelid = d.relid
+        AND a.attnum = d.attnum
+    LEFT JOIN pg_catalog.pg_statistic_ext s ON s.oid = d.statid;
+
+CREATE VIEW pg_collation_broken_statistics AS
+    SELECT s.*,
+        coll.collversion AS coll_recorded_version,
+        pg_collation_actual_version(coll.oid) AS coll_actual_version
+    FROM pg_collation_statistics_dependencies s
+    JOIN pg_catalog.pg_collation coll ON coll.oid = s.coll_oid
+    LEFT JOIN pg_collation_fingerprints fp ON fp.collid = coll.oid
+    WHERE CASE WHEN fp.fingerprint IS NOT NULL
+            THEN fp.fingerprint IS DISTINCT FROM pg_collation_fingerprint(coll.oid)
+            ELSE coll.collversion IS DISTINCT FROM pg_collation_actual_version(coll.oid)
+        END
+    AND NOT (
+        coll.collnamespace = 'pg_catalog'::regnamespace
+        AND collencoding = -1
+        AND coll.collname IN ('C', 'POSIX')
+    );
+
+CREATE FUNCTION pg_collation_reanalyze(
+        IN modulus integer DEFAULT 1,
+        IN remainder integer DEFAULT 0,
+        IN dry_run boolean DEFAULT false,
+        OUT command text
+    )
+    RETURNS SETOF text
+    LANGUAGE C STRICT VOLATILE COST 1000
+AS '$libdir/pg_collation_dependencies', 'pg_collation_reanalyze';
+REVOKE ALL ON FUNCTION pg_collation_reanalyze(integer, integer, boolean)
+    FROM PUBLIC;
+
+-- Near-free triage of the broken dependencies, only relying on the planner
+-- statistics of the underlying columns: if the most common values and
+-- histogram bounds only contain ASCII digits and letters, whose ordering is
+-- stable across library versions, the object is likely not affected.
+CREATE VIEW pg_collation_broken_dependencies_triage AS
+    WITH broken AS (
+        SELECT DISTINCT b.dep_kind, b.tbl_oid, b.table_name, b.object_oid,
+            b.object_name::text AS object_name, b.coll_oid, b.collname,
+            CASE WHEN b.dep_kind IN ('constraint', 'generated column')
+                THEN b.tbl_oid
+                ELSE b.object_oid
+            END AS data_oid
+        FROM pg_collation_broken_dependencies b
+    ), cols AS (
+        -- relation and attribute holding the statistics for each object
+        SELECT o.dep_kind, o.object_oid, s.relid, s.attnum
+        FROM (SELECT DISTINCT dep_kind, object_oid FROM broken) o,
+        LATERAL (
+            SELECT CASE WHEN i.indkey[k.n - 1] = 0 THEN i.indexrelid
+                    ELSE i.indrelid
+                END AS relid,
+                CASE WHEN i.indkey[k.n - 1] = 0 THEN k.n::smallint
+                    ELSE i.indkey[k.n - 1]
+                END AS attnum
+            FROM pg_catalog.pg_index i,
+            generate_series(1, i.indnkeyatts) k(n)
+            WHERE o.dep_kind = 'index' AND i.indexrelid = o.object_oid
+            UNION ALL
+            SELECT con.conrelid, k.attnum
+            FROM pg_catalog.pg_constraint con,
+            unnest(con.conkey) k(attnum)
+            WHERE o.dep_kind = 'constraint' AND con.oid = o.object_oid
+            UNION ALL
+            SELECT ad.adrelid, ad.adnum
+            FROM pg_catalog.pg_attrdef ad
+            WHERE o.dep_kind = 'generated column' AND ad.oid = o.object_oid
+            UNION ALL
+            SELECT a.attrelid, a.attnum
+            FROM pg_catalog.pg_attribute a
+            WHERE o.dep_kind = 'materialized view'
+            AND a.attrelid = o.object_oid
+            AND a.attnum > 0 AND NOT a.attisdropped
+        ) s
+    ), stats AS (
+        SELECT c.dep_kind, c.object_oid,
+            s.attname IS NOT NULL AND (s.null_frac = 1
+                OR s.most_common_vals IS NOT NULL
+                OR s.histogram_bounds IS NOT NULL) AS has_stats,
+            EXISTS (
+                SELECT 1
+                FROM unnest(s.most_common_vals::text::text[]
+                    || s.histogram_bounds::text::text[]) v(val)
+                WHERE v.val COLLATE "C" ~ '[^0-9A-Za-z]'
+            ) AS unstable
+        FROM cols c
+        JOIN pg_catalog.pg_class r ON r.oid = c.relid
+        JOIN pg_catalog.pg_namespace n ON n.oid = r.relnamespace
+        JOIN pg_catalog.pg_attribute a ON a.attrelid = c.relid
+            AND a.attnum = c.attnum
+        JOIN pg_catalog.pg_type t ON t.oid = a.atttypid
+        LEFT JOIN pg_catalog.pg_stats s ON s.schemaname = n.nspname
+            AND s.tablename = r.relname AND s.attname = a.attname
+            AND s.inherited = (r.relkind = 'p')
+        -- only columns that can depend on a collation
+        WHERE a.attcollation <> 0 OR t.typtype IN ('c', 'd', 'r', 'm')
+    ), verdict AS (
+        SELECT dep_kind, object_oid,
+            bool_or(unstable) AS unstable,
+            bool_and(has_stats) AS has_stats
+        FROM stats
+        GROUP BY dep_kind, object_oid
+    )
+    SELECT b.dep_kind, b.tbl_oid, b.table_name, b.object_oid, b.object_name,
+        b.coll_oid, b.collname, r.reltuples,
+        -- by verdict, then biggest relations first as their statistics only
+        -- cover a sample of the rows
+        pg_catalog.rank() OVER (ORDER BY
+            CASE WHEN r.isempty THEN 3
+                WHEN v.unstable THEN 1
+                WHEN v.has_stats THEN 3
+                ELSE 2
+            END,
+            r.reltuples DESC NULLS LAST) AS triage_rank,
+        CASE WHEN r.isempty THEN 'likely safe'
+            WHEN v.unstable THEN 'likely affected'
+            WHEN v.has_stats THEN 'likely safe'
+            ELSE 'uncertain'
+        END AS triage,
+        CASE WHEN r.isempty THEN 'empty relation'
+            WHEN v.unstable THEN 'statistics contain unstable characters'
+            WHEN v.has_stats THEN 'statistics only contain ASCII digits and letters'
+            ELSE 'no usable statistics'
+        END AS reason
+    FROM broken b
+    LEFT JOIN verdict v ON v.dep_kind = b.dep_kind
+        AND v.object_oid = b.object_oid
+    LEFT JOIN LATERAL (
+        SELECT c.reltuples,
+            c.relkind IN ('r', 'm')
+                AND pg_catalog.pg_relation_size(c.oid) = 0 AS isempty
+        FROM pg_catalog.pg_class c
+        WHERE c.oid = b.data_oid
+    ) r ON true;
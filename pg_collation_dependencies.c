@@ -15,9 +15,7 @@
 #include "postgres.h"
 
 #include "access/genam.h"
-#if PG_VERSION_NUM < 120000
 #include "access/htup_details.h"
-#endif
 #if PG_VERSION_NUM >= 120000
 #include "access/relation.h"
 #include "access/table.h"
@@ -25,68 +23,54 @@
 #if PG_VERSION_NUM < 120000
 #include "access/sysattr.h"
 #endif
+#include "access/transam.h"
+#include "access/xact.h"
+#include "access/xlog.h"
 #if PG_VERSION_NUM < 140000
 #include "catalog/indexing.h"
 #endif
+#include "catalog/partition.h"
+#include "catalog/pg_attrdef.h"
 #include "catalog/pg_constraint.h"
 #include "catalog/pg_depend.h"
+#include "catalog/pg_partitioned_table.h"
 #include "catalog/pg_range.h"
+#include "catalog/pg_rewrite.h"
 #include "catalog/pg_type.h"
+#include "executor/spi.h"
 #include "fmgr.h"
 #include "funcapi.h"
+#include "lib/stringinfo.h"
 #include "miscadmin.h"
 #include "nodes/nodeFuncs.h"
+#include "rewrite/rewriteSupport.h"
 #include "storage/lmgr.h"
 #include "utils/array.h"
 #include "utils/builtins.h"
 #include "utils/fmgroids.h"
+#include "utils/guc.h"
+#include "utils/hsearch.h"
 #include "utils/lsyscache.h"
+#include "utils/memutils.h"
 #include "utils/rel.h"
 #include "utils/syscache.h"
+#include "utils/timestamp.h"
+
+#include "pg_collation_dependencies.h"
 
 PG_MODULE_MAGIC;
 
+void		_PG_init(void);
+
 #define PG_COLL_DEP_COLS         1
+#define PG_COLL_RULE_DEP_COLS    3
+#define PG_COLL_GEN_DEP_COLS     2
+#define PG_COLL_VERIFIED_COLS    7
 
 #if PG_VERSION_NUM < 120000
-#define table_open(o, l)	heap_open(o, l)
-#define table_close(o, l)	heap_close(o, l)
 #define Anum_pg_constraint_oid	ObjectIdAttributeNumber
 #endif
 
-#if PG_VERSION_NUM < 130000
-#define IsOidList(l)			((l) == NIL || IsA((l), OidList))
-#define list_sort(l, c)		list_qsort(l, c)
-#ifdef USE_ASSERT_CHECKING
-/*
- * Check that the specified List is valid (so far as we can tell).
- */
-static void
-check_list_invariants(const List *list)
-{
-	if (list == NIL)
-		return;
-
-	Assert(list->length > 0);
-	Assert(list->head != NULL);
-	Assert(list->tail != NULL);
-
-	Assert(list->type == T_List ||
-		   list->type == T_IntList ||
-		   list->type == T_OidList);
-
-	if (list->length == 1)
-		Assert(list->head == list->tail);
-	if (list->length == 2)
-		Assert(list->head->next == list->tail);
-	Assert(list->tail->next == NULL);
-}
-#else
-#define check_list_invariants(l)
-#endif							/* USE_ASSERT_CHECKING */
-
-#endif							/* pg13- */
-
 /*
  * Used when inspecting expressions.  Just stored all the seen collations.
  */
@@ -95,93 +79,87 @@ typedef struct pgcdWalkerContext
 	List *collations;
 } pgcdWalkerContext;
 
+/*
+ * Handler for a given node type, returning whether the walker should still
+ * descend into the node's subnodes.
+ */
+typedef bool (*pgcdNodeHandler) (Node *node, pgcdWalkerContext *context);
+
+typedef struct pgcdNodeHandlerEntry
+{
+	const char *name;			/* node type name, NULL if unexpected */
+	pgcdNodeHandler handler;	/* NULL if nothing specific to do */
+} pgcdNodeHandlerEntry;
+
 /*--- Functions --- */
 
 extern PGDLLEXPORT Datum	pg_collation_constraint_dependencies(PG_FUNCTION_ARGS);
 extern PGDLLEXPORT Datum	pg_collation_index_dependencies(PG_FUNCTION_ARGS);
 extern PGDLLEXPORT Datum	pg_collation_matview_dependencies(PG_FUNCTION_ARGS);
+extern PGDLLEXPORT Datum	pg_collation_partition_dependencies(PG_FUNCTION_ARGS);
+extern PGDLLEXPORT Datum	pg_collation_generated_dependencies(PG_FUNCTION_ARGS);
+extern PGDLLEXPORT Datum	pg_collation_rule_dependencies(PG_FUNCTION_ARGS);
+extern PGDLLEXPORT Datum	pg_collation_mark_verified(PG_FUNCTION_ARGS);
+extern PGDLLEXPORT Datum	pg_collation_session_verified_objects(PG_FUNCTION_ARGS);
 
 PG_FUNCTION_INFO_V1(pg_collation_constraint_dependencies);
 PG_FUNCTION_INFO_V1(pg_collation_index_dependencies);
 PG_FUNCTION_INFO_V1(pg_collation_matview_dependencies);
-
-#if PG_VERSION_NUM < 150000
-/* flag bits for InitMaterializedSRF() */
-#define MAT_SRF_USE_EXPECTED_DESC	0x01	/* use expectedDesc as tupdesc. */
-#define MAT_SRF_BLESS				0x02	/* "Bless" a tuple descriptor with
-											 * BlessTupleDesc(). */
-static void InitMaterializedSRF(FunctionCallInfo fcinfo, bits32 flags);
-#endif
-
-#if PG_VERSION_NUM < 130000
-/*
- * list_sort comparator for sorting a list into ascending OID order.
- */
-static int
-list_oid_cmp(const void *a, const void *b)
-{
-	Oid			v1 = lfirst_oid(*(ListCell **) a);
-	Oid			v2 = lfirst_oid(*(ListCell **) b);
-
-	if (v1 < v2)
-		return -1;
-	if (v1 > v2)
-		return 1;
-	return 0;
-}
-
-/*
- * Remove adjacent duplicates in a list of OIDs.
- *
- * It is caller's responsibility to have sorted the list to bring duplicates
- * together, perhaps via list_sort(list, list_oid_cmp).
- *
- * Note that this takes time proportional to the length of the list.
- */
-static void
-list_deduplicate_oid(List *list)
-{
-	int			len;
-
-	Assert(IsOidList(list));
-	len = list_length(list);
-	if (len > 1)
-	{
-		ListCell   *lc = list->head;
-
-		list->length = 1;
-
-		while (lc->next)
-		{
-			ListCell   *next = lc->next;
-
-			if (lc->data.oid_value == next->data.oid_value)
-				lc->next = next->next;
-			else
-			{
-				list->length++;
-				lc = next;
-			}
-		}
-
-		list->tail = lc;
-	}
-	check_list_invariants(list);
-}
-#endif
+PG_FUNCTION_INFO_V1(pg_collation_partition_dependencies);
+PG_FUNCTION_INFO_V1(pg_collation_generated_dependencies);
+PG_FUNCTION_INFO_V1(pg_collation_rule_dependencies);
+PG_FUNCTION_INFO_V1(pg_collation_mark_verified);
+PG_FUNCTION_INFO_V1(pg_collation_session_verified_objects);
 
 static bool pgcd_query_expression_walker(Node *node, pgcdWalkerContext *context);
 static List *pgcd_get_rel_collations(Oid relid);
 static List *pgcd_get_constraint_collations(Oid conid);
-static List *pgcd_get_query_expression_collations(Node *expr);
+static List *pgcd_get_fkey_referenced_collations(HeapTuple contup,
+												 Oid relid);
 static List *pgcd_get_range_type_collations(Oid rngid, bool ismultirange);
 static List *pgcd_get_type_collations(Oid typid);
-static List *pgcd_constraint_deps(Oid index_oid);
-static List *pgcd_index_deps(Oid index_oid);
-static List *pgcd_matview_deps(Oid matview_oid);
+
+/*
+ * Module load callback.
+ */
+void
+_PG_init(void)
+{
+	DefineCustomIntVariable("pg_collation_dependencies.rebuild_mb_per_second",
+							"Throughput assumed when projecting the rebuild time of an index or materialized view, in megabytes per second.",
+							"Zero ignores the relation size.",
+							&pgcd_rebuild_mb_per_second,
+							100,
+							0,
+							INT_MAX,
+							PGC_USERSET,
+							0,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomIntVariable("pg_collation_dependencies.rebuild_rows_per_second",
+							"Throughput assumed when projecting the rebuild time of an index or materialized view, in rows per second.",
+							"Zero ignores the number of rows.",
+							&pgcd_rebuild_rows_per_second,
+							1000000,
+							0,
+							INT_MAX,
+							PGC_USERSET,
+							0,
+							NULL,
+							NULL,
+							NULL);
+
+#if PG_VERSION_NUM >= 150000
+	MarkGUCPrefixReserved("pg_collation_dependencies");
+#else
+	EmitWarningsOnPlaceholders("pg_collation_dependencies");
+#endif
+}
 
 #if PG_VERSION_NUM < 150000
-static void
+void
 InitMaterializedSRF(FunctionCallInfo fcinfo, bits32 flags)
 {
 	bool		random_access;
@@ -233,373 +211,604 @@ InitMaterializedSRF(FunctionCallInfo fcinfo, bits32 flags)
 #endif
 
 /*
- * Walker function to find collations in expressions.
- *
- * Don't try to be smart here for now, just remember all collations seen,
- * coming from explicit collation or underlying types even if there can be
- * false positive or redundant values.
+ * Helpers for the node handlers below, which all get the node as "node" and
+ * the walker context as "context".  The field name is only used for tracing.
  */
+#define APPEND_COLL_FIELD(o, f) \
+	do { \
+		if (OidIsValid(o)) \
+		{ \
+			context->collations = lappend_oid(context->collations, o); \
+			PGCD_TRACE_COLL(o, "%s.%s", pgcd_trace_node_name(node), f); \
+		} \
+	} while (0)
+
+#define APPEND_TYPE_COLLS_FIELD(o, f) \
+	do { \
+		PGCD_TRACE_PUSH("%s.%s", pgcd_trace_node_name(node), f); \
+		context->collations = list_concat(context->collations, \
+										  pgcd_get_type_collations(o)); \
+		PGCD_TRACE_POP(); \
+	} while (0)
+
+#define APPEND_COLL(o) \
+	APPEND_COLL_FIELD(o, pgcd_trace_field(#o))
+#define APPEND_TYPE_COLLS(o) \
+	APPEND_TYPE_COLLS_FIELD(o, pgcd_trace_field(#o))
+
+/*
+ * Node handlers.  Each of them remembers the collations directly referenced
+ * by the given node, and returns whether its subnodes should still be walked.
+ */
+
 static bool
-pgcd_query_expression_walker(Node *node, pgcdWalkerContext *context)
+pgcd_walk_tablefunc(Node *node, pgcdWalkerContext *context)
 {
-	if (!node)
-		return false;
+	TableFunc  *func = (TableFunc *) node;
+	ListCell   *lc;
 
-#define APPEND_COLL(l, o) { \
-	if (OidIsValid(o)) \
-		(l) = lappend_oid(l, o); \
-}
+	foreach(lc, func->colcollations)
+		APPEND_COLL_FIELD(lfirst_oid(lc), "colcollations");
 
-#define APPEND_TYPE_COLLS(l, o) { \
-	(l) = list_concat((l), pgcd_get_type_collations(o)); \
+	foreach(lc, func->coltypes)
+		APPEND_TYPE_COLLS_FIELD(lfirst_oid(lc), "coltypes");
+
+	return true;
 }
 
-	switch (node->type)
-	{
-		case T_TableFunc:
-		{
-			TableFunc *func = (TableFunc *) node;
-			ListCell  *lc;
+static bool
+pgcd_walk_var(Node *node, pgcdWalkerContext *context)
+{
+	Var		   *var = (Var *) node;
 
-			foreach(lc, func->colcollations)
-				APPEND_COLL(context->collations, lfirst_oid(lc));
+	APPEND_COLL(var->varcollid);
+	APPEND_TYPE_COLLS(var->vartype);
 
-			foreach(lc, func->coltypes)
-				APPEND_TYPE_COLLS(context->collations, lfirst_oid(lc));
+	return false;
+}
 
-			break;
-		}
-		case T_Var:
-		{
-			Var *var = (Var *) node;
+static bool
+pgcd_walk_const(Node *node, pgcdWalkerContext *context)
+{
+	Const	   *c = (Const *) node;
 
-			APPEND_COLL(context->collations, var->varcollid);
-			APPEND_TYPE_COLLS(context->collations, var->vartype);
+	APPEND_COLL(c->constcollid);
+	APPEND_TYPE_COLLS(c->consttype);
 
-			break;
-		}
-		case T_Const:
-		{
-			Const *c = (Const *) node;
+	return false;
+}
 
-			APPEND_COLL(context->collations, c->constcollid);
-			APPEND_TYPE_COLLS(context->collations, c->consttype);
+static bool
+pgcd_walk_param(Node *node, pgcdWalkerContext *context)
+{
+	Param	   *param = (Param *) node;
 
-			break;
-		}
-		case T_Param:
-		{
-			Param *param = (Param *) node;
+	APPEND_COLL(param->paramcollid);
+	APPEND_TYPE_COLLS(param->paramtype);
 
-			APPEND_COLL(context->collations, param->paramcollid);
-			APPEND_TYPE_COLLS(context->collations, param->paramtype);
+	return false;
+}
 
-			break;
-		}
-#if PG_VERSION_NUM >= 120000
-		case T_SubscriptingRef:
-		{
-			SubscriptingRef *ref = (SubscriptingRef *) node;
+static bool
+pgcd_walk_subscriptingref(Node *node, pgcdWalkerContext *context)
+{
+	SubscriptingRef *ref = (SubscriptingRef *) node;
 
-			APPEND_COLL(context->collations, ref->refcollid);
-			APPEND_COLL(context->collations, ref->refcontainertype);
-			APPEND_COLL(context->collations, ref->refelemtype);
+	APPEND_COLL(ref->refcollid);
+	APPEND_TYPE_COLLS(ref->refcontainertype);
+	APPEND_TYPE_COLLS(ref->refelemtype);
 #if PG_VERSION_NUM >= 140000
-			APPEND_COLL(context->collations, ref->refrestype);
+	APPEND_TYPE_COLLS(ref->refrestype);
 #endif
 
-			break;
-		}
-#endif
-		case T_FuncExpr:
-		{
-			FuncExpr *func = (FuncExpr *) node;
+	return true;
+}
 
-			APPEND_COLL(context->collations, func->funccollid);
-			APPEND_COLL(context->collations, func->inputcollid);
-			APPEND_TYPE_COLLS(context->collations, func->funcresulttype);
+static bool
+pgcd_walk_funcexpr(Node *node, pgcdWalkerContext *context)
+{
+	FuncExpr   *func = (FuncExpr *) node;
 
-			break;
-		}
-		case T_OpExpr:
-		case T_DistinctExpr:
-		case T_NullIfExpr:
-		{
-			OpExpr *op = (OpExpr *) node;
+	APPEND_COLL(func->funccollid);
+	APPEND_COLL(func->inputcollid);
+	APPEND_TYPE_COLLS(func->funcresulttype);
+	context->collations = list_concat(context->collations,
+									  pgcd_get_function_collations(func->funcid));
 
-			APPEND_COLL(context->collations, op->opcollid);
-			APPEND_COLL(context->collations, op->inputcollid);
-			APPEND_TYPE_COLLS(context->collations, op->opresulttype);
+	return true;
+}
 
-			break;
-		}
-		case T_ScalarArrayOpExpr:
-		{
-			ScalarArrayOpExpr *op = (ScalarArrayOpExpr *) node;
+/* Also used for DistinctExpr and NullIfExpr, which are OpExpr too. */
+static bool
+pgcd_walk_opexpr(Node *node, pgcdWalkerContext *context)
+{
+	OpExpr	   *op = (OpExpr *) node;
 
-			APPEND_COLL(context->collations, op->inputcollid);
+	APPEND_COLL(op->opcollid);
+	APPEND_COLL(op->inputcollid);
+	APPEND_TYPE_COLLS(op->opresulttype);
+	/* Only user-defined operators can be implemented in SQL. */
+	if (op->opno >= FirstNormalObjectId)
+		context->collations = list_concat(context->collations,
+										  pgcd_get_function_collations(get_opcode(op->opno)));
 
-			break;
-		}
-		case T_FieldSelect:
-		{
-			FieldSelect *f = (FieldSelect *) node;
+	return true;
+}
 
-			APPEND_COLL(context->collations, f->resultcollid);
-			APPEND_TYPE_COLLS(context->collations, f->resulttype);
+static bool
+pgcd_walk_scalararrayopexpr(Node *node, pgcdWalkerContext *context)
+{
+	ScalarArrayOpExpr *op = (ScalarArrayOpExpr *) node;
 
-			break;
-		}
-		case T_RelabelType:
-		{
-			RelabelType *relabel = (RelabelType *) node;
+	APPEND_COLL(op->inputcollid);
 
-			APPEND_COLL(context->collations, relabel->resultcollid);
-			APPEND_TYPE_COLLS(context->collations, relabel->resulttype);
+	return true;
+}
 
-			break;
-		}
-		case T_CoerceViaIO:
-		{
-			CoerceViaIO *coerce = (CoerceViaIO *) node;
+static bool
+pgcd_walk_fieldselect(Node *node, pgcdWalkerContext *context)
+{
+	FieldSelect *f = (FieldSelect *) node;
 
-			APPEND_COLL(context->collations, coerce->resultcollid);
-			APPEND_TYPE_COLLS(context->collations, coerce->resulttype);
+	APPEND_COLL(f->resultcollid);
+	APPEND_TYPE_COLLS(f->resulttype);
 
-			break;
-		}
-		case T_ArrayCoerceExpr:
-		{
-			ArrayCoerceExpr *coerce = (ArrayCoerceExpr *) node;
+	return true;
+}
 
-			APPEND_COLL(context->collations, coerce->resultcollid);
-			APPEND_TYPE_COLLS(context->collations, coerce->resulttype);
+static bool
+pgcd_walk_relabeltype(Node *node, pgcdWalkerContext *context)
+{
+	RelabelType *relabel = (RelabelType *) node;
 
-			break;
-		}
-		case T_ConvertRowtypeExpr:
-		{
-			ConvertRowtypeExpr *crte = (ConvertRowtypeExpr *) node;
+	APPEND_COLL(relabel->resultcollid);
+	APPEND_TYPE_COLLS(relabel->resulttype);
 
-			APPEND_TYPE_COLLS(context->collations, crte->resulttype);
+	return true;
+}
 
-			break;
-		}
-		case T_CollateExpr:
-		{
-			CollateExpr *expr = (CollateExpr *) node;
+static bool
+pgcd_walk_coerceviaio(Node *node, pgcdWalkerContext *context)
+{
+	CoerceViaIO *coerce = (CoerceViaIO *) node;
 
-			APPEND_COLL(context->collations, expr->collOid);
+	APPEND_COLL(coerce->resultcollid);
+	APPEND_TYPE_COLLS(coerce->resulttype);
 
-			break;
-		}
-		case T_CaseExpr:
-		{
-			CaseExpr *expr = (CaseExpr *) node;
+	return true;
+}
 
-			APPEND_COLL(context->collations, expr->casecollid);
-			APPEND_TYPE_COLLS(context->collations, expr->casetype);
+static bool
+pgcd_walk_arraycoerceexpr(Node *node, pgcdWalkerContext *context)
+{
+	ArrayCoerceExpr *coerce = (ArrayCoerceExpr *) node;
 
-			break;
-		}
-		case T_CaseTestExpr:
-		{
-			CaseTestExpr *expr = (CaseTestExpr *) node;
+	APPEND_COLL(coerce->resultcollid);
+	APPEND_TYPE_COLLS(coerce->resulttype);
 
-			APPEND_COLL(context->collations, expr->collation);
+	return true;
+}
 
-			break;
-		}
-		case T_ArrayExpr:
-		{
-			ArrayExpr *expr = (ArrayExpr *) node;
+static bool
+pgcd_walk_convertrowtypeexpr(Node *node, pgcdWalkerContext *context)
+{
+	ConvertRowtypeExpr *crte = (ConvertRowtypeExpr *) node;
 
-			APPEND_COLL(context->collations, expr->array_collid);
-			APPEND_TYPE_COLLS(context->collations, expr->array_typeid);
+	APPEND_TYPE_COLLS(crte->resulttype);
 
-			break;
-		}
-		case T_RowExpr:
-		{
-			RowExpr *expr = (RowExpr *) node;
+	return true;
+}
 
-			if (expr->row_typeid != RECORDOID)
-				APPEND_TYPE_COLLS(context->collations, expr->row_typeid);
+static bool
+pgcd_walk_collateexpr(Node *node, pgcdWalkerContext *context)
+{
+	CollateExpr *expr = (CollateExpr *) node;
 
-			break;
-		}
-		case T_RowCompareExpr:
-		{
-			RowCompareExpr *expr = (RowCompareExpr *) node;
-			ListCell	   *lc;
+	APPEND_COLL(expr->collOid);
 
-			foreach(lc, expr->inputcollids)
-				APPEND_COLL(context->collations, lfirst_oid(lc));
+	return true;
+}
 
-			break;
-		}
-		case T_CoalesceExpr:
-		{
-			CoalesceExpr *expr = (CoalesceExpr *) node;
+static bool
+pgcd_walk_caseexpr(Node *node, pgcdWalkerContext *context)
+{
+	CaseExpr   *expr = (CaseExpr *) node;
 
-			APPEND_COLL(context->collations, expr->coalescecollid);
-			APPEND_TYPE_COLLS(context->collations, expr->coalescetype);
+	APPEND_COLL(expr->casecollid);
+	APPEND_TYPE_COLLS(expr->casetype);
 
-			break;
-		}
-#if PG_VERSION_NUM < 160000
-		case T_SQLValueFunction:
-		{
-			SQLValueFunction *expr = (SQLValueFunction *) node;
+	return true;
+}
 
-			APPEND_COLL(context->collations, expr->type);
+static bool
+pgcd_walk_casetestexpr(Node *node, pgcdWalkerContext *context)
+{
+	CaseTestExpr *expr = (CaseTestExpr *) node;
 
-			break;
-		}
-#endif
-		case T_MinMaxExpr:
-		{
-			MinMaxExpr *expr = (MinMaxExpr *) node;
+	APPEND_COLL(expr->collation);
 
-			APPEND_COLL(context->collations, expr->minmaxcollid);
-			APPEND_COLL(context->collations, expr->inputcollid);
-			APPEND_TYPE_COLLS(context->collations, expr->minmaxtype);
+	return false;
+}
 
-			break;
-		}
-		case T_CoerceToDomain:
-		{
-			CoerceToDomain *coerce = (CoerceToDomain *) node;
+static bool
+pgcd_walk_arrayexpr(Node *node, pgcdWalkerContext *context)
+{
+	ArrayExpr  *expr = (ArrayExpr *) node;
 
-			APPEND_COLL(context->collations, coerce->resultcollid);
+	APPEND_COLL(expr->array_collid);
+	APPEND_TYPE_COLLS(expr->array_typeid);
 
-			APPEND_TYPE_COLLS(context->collations, coerce->resulttype);
+	return true;
+}
 
-			/*
-			 * If the underlying expression is a direct scalar reference we can
-			 * guarantee that the underlying collations won't be used, so
-			 * ignore them.
-			 */
-			if (IsA(coerce->arg, Const) || IsA(coerce->arg, Var))
-				return false;
+static bool
+pgcd_walk_rowexpr(Node *node, pgcdWalkerContext *context)
+{
+	RowExpr    *expr = (RowExpr *) node;
 
-			break;
-		}
-		case T_CoerceToDomainValue:
-		{
-			CoerceToDomainValue *coerce = (CoerceToDomainValue *) node;
+	if (expr->row_typeid != RECORDOID)
+		APPEND_TYPE_COLLS(expr->row_typeid);
 
-			APPEND_COLL(context->collations, coerce->collation);
-			APPEND_TYPE_COLLS(context->collations, coerce->typeId);
+	return true;
+}
 
-			break;
-		}
-		case T_Aggref:
-		{
-			Aggref *ref = (Aggref *) node;
+static bool
+pgcd_walk_rowcompareexpr(Node *node, pgcdWalkerContext *context)
+{
+	RowCompareExpr *expr = (RowCompareExpr *) node;
+	ListCell   *lc;
 
-			APPEND_COLL(context->collations, ref->aggcollid);
-			APPEND_COLL(context->collations, ref->inputcollid);
-			APPEND_TYPE_COLLS(context->collations, ref->aggtype);
+	foreach(lc, expr->inputcollids)
+		APPEND_COLL_FIELD(lfirst_oid(lc), "inputcollids");
 
-			break;
-		}
-		case T_Query:
-		{
-			return query_tree_walker((Query *) node,
-									 pgcd_query_expression_walker,
-									 context, 0);
-		}
-		case T_RangeTblFunction:
-		{
-			RangeTblFunction *func = (RangeTblFunction *) node;
-			ListCell	   *lc;
+	return true;
+}
 
-			foreach(lc, func->funccolcollations)
-				APPEND_COLL(context->collations, lfirst_oid(lc));
+static bool
+pgcd_walk_coalesceexpr(Node *node, pgcdWalkerContext *context)
+{
+	CoalesceExpr *expr = (CoalesceExpr *) node;
 
-			foreach(lc, func->funccoltypes)
-				APPEND_TYPE_COLLS(context->collations, lfirst_oid(lc));
+	APPEND_COLL(expr->coalescecollid);
+	APPEND_TYPE_COLLS(expr->coalescetype);
 
-			break;
-		}
-		case T_SetOperationStmt:
-		{
-			SetOperationStmt *stmt = (SetOperationStmt *) node;
-			ListCell	 *lc;
+	return true;
+}
 
-			foreach(lc, stmt->colCollations)
-				APPEND_COLL(context->collations, lfirst_oid(lc));
+#if PG_VERSION_NUM < 160000
+static bool
+pgcd_walk_sqlvaluefunction(Node *node, pgcdWalkerContext *context)
+{
+	SQLValueFunction *expr = (SQLValueFunction *) node;
 
-			foreach(lc, stmt->colTypes)
-				APPEND_TYPE_COLLS(context->collations, lfirst_oid(lc));
+	APPEND_COLL(expr->type);
 
-			break;
-		}
-		case T_WindowFunc:
-		{
-			WindowFunc *func = (WindowFunc *) node;
+	return false;
+}
+#endif
 
-			APPEND_COLL(context->collations, func->wincollid);
-			APPEND_COLL(context->collations, func->inputcollid);
-			APPEND_TYPE_COLLS(context->collations, func->wintype);
+static bool
+pgcd_walk_minmaxexpr(Node *node, pgcdWalkerContext *context)
+{
+	MinMaxExpr *expr = (MinMaxExpr *) node;
 
-			break;
-		}
-		case T_CommonTableExpr:
-		{
-			CommonTableExpr *expr = (CommonTableExpr *) node;
-			ListCell		*lc;
+	APPEND_COLL(expr->minmaxcollid);
+	APPEND_COLL(expr->inputcollid);
+	APPEND_TYPE_COLLS(expr->minmaxtype);
 
-			foreach(lc, expr->ctecolcollations)
-				APPEND_COLL(context->collations, lfirst_oid(lc));
-			foreach(lc, expr->ctecoltypes)
-				APPEND_TYPE_COLLS(context->collations, lfirst_oid(lc));
+	return true;
+}
 
-			break;
-		}
-		/* Those nodes can appear but nothing specific to do. */
-		case T_JoinExpr:
-		case T_FromExpr:
-		case T_RangeTblRef:
-		case T_SortGroupClause:
-		case T_SubLink:
-		case T_TableSampleClause:
-		case T_TargetEntry:
-		case T_Alias:
-		case T_RangeVar:
-		case T_IntoClause:
-		case T_NamedArgExpr:
-		case T_BoolExpr:
-		case T_CaseWhen:
-		case T_XmlExpr:
-		case T_NullTest:
-		case T_BooleanTest:
-		case T_List:
-			/* Nothing to do, normal exprssion walker is enough. */
-			break;
-		/* The rest shouldn't be reachable in the supported objects. */
-		default:
-			elog(ERROR, "unexpected node type %d (%s)", node->type,
-				 nodeToString(node));
-			break;
-	}
+static bool
+pgcd_walk_coercetodomain(Node *node, pgcdWalkerContext *context)
+{
+	CoerceToDomain *coerce = (CoerceToDomain *) node;
 
-#undef APPEND_COLL
-#undef APPEND_TYPE_COLLS
+	APPEND_COLL(coerce->resultcollid);
 
-	return expression_tree_walker(node, pgcd_query_expression_walker, context);
+	APPEND_TYPE_COLLS(coerce->resulttype);
+
+	/*
+	 * If the underlying expression is a direct scalar reference we can
+	 * guarantee that the underlying collations won't be used, so ignore them.
+	 */
+	return !IsA(coerce->arg, Const) && !IsA(coerce->arg, Var);
 }
 
-/*
- * Get full list of collation dependencies for the given composite type or
- * relation.
- *
- * This only looks at the column list, so it's not usable for more complex
- * objects like materialized views.
- */
-static List *
-pgcd_get_rel_collations(Oid relid)
+static bool
+pgcd_walk_coercetodomainvalue(Node *node, pgcdWalkerContext *context)
+{
+	CoerceToDomainValue *coerce = (CoerceToDomainValue *) node;
+
+	APPEND_COLL(coerce->collation);
+	APPEND_TYPE_COLLS(coerce->typeId);
+
+	return false;
+}
+
+static bool
+pgcd_walk_settodefault(Node *node, pgcdWalkerContext *context)
+{
+	SetToDefault *def = (SetToDefault *) node;
+
+	APPEND_COLL(def->collation);
+	APPEND_TYPE_COLLS(def->typeId);
+
+	return false;
+}
+
+static bool
+pgcd_walk_inferenceelem(Node *node, pgcdWalkerContext *context)
+{
+	InferenceElem *elem = (InferenceElem *) node;
+
+	APPEND_COLL(elem->infercollid);
+
+	return true;
+}
+
+static bool
+pgcd_walk_aggref(Node *node, pgcdWalkerContext *context)
+{
+	Aggref	   *ref = (Aggref *) node;
+
+	APPEND_COLL(ref->aggcollid);
+	APPEND_COLL(ref->inputcollid);
+	APPEND_TYPE_COLLS(ref->aggtype);
+
+	return true;
+}
+
+static bool
+pgcd_walk_query(Node *node, pgcdWalkerContext *context)
+{
+	(void) query_tree_walker((Query *) node, pgcd_query_expression_walker,
+							 context, 0);
+
+	return false;
+}
+
+static bool
+pgcd_walk_rangetblfunction(Node *node, pgcdWalkerContext *context)
+{
+	RangeTblFunction *func = (RangeTblFunction *) node;
+	ListCell   *lc;
+
+	foreach(lc, func->funccolcollations)
+		APPEND_COLL_FIELD(lfirst_oid(lc), "funccolcollations");
+
+	foreach(lc, func->funccoltypes)
+		APPEND_TYPE_COLLS_FIELD(lfirst_oid(lc), "funccoltypes");
+
+	return true;
+}
+
+static bool
+pgcd_walk_setoperationstmt(Node *node, pgcdWalkerContext *context)
+{
+	SetOperationStmt *stmt = (SetOperationStmt *) node;
+	ListCell   *lc;
+
+	foreach(lc, stmt->colCollations)
+		APPEND_COLL_FIELD(lfirst_oid(lc), "colCollations");
+
+	foreach(lc, stmt->colTypes)
+		APPEND_TYPE_COLLS_FIELD(lfirst_oid(lc), "colTypes");
+
+	return true;
+}
+
+static bool
+pgcd_walk_windowfunc(Node *node, pgcdWalkerContext *context)
+{
+	WindowFunc *func = (WindowFunc *) node;
+
+	APPEND_COLL(func->wincollid);
+	APPEND_COLL(func->inputcollid);
+	APPEND_TYPE_COLLS(func->wintype);
+
+	return true;
+}
+
+static bool
+pgcd_walk_commontableexpr(Node *node, pgcdWalkerContext *context)
+{
+	CommonTableExpr *expr = (CommonTableExpr *) node;
+	ListCell   *lc;
+
+	foreach(lc, expr->ctecolcollations)
+		APPEND_COLL_FIELD(lfirst_oid(lc), "ctecolcollations");
+	foreach(lc, expr->ctecoltypes)
+		APPEND_TYPE_COLLS_FIELD(lfirst_oid(lc), "ctecoltypes");
+
+	return true;
+}
+
+#if PG_VERSION_NUM >= 160000
+static bool
+pgcd_walk_jsonconstructorexpr(Node *node, pgcdWalkerContext *context)
+{
+	JsonConstructorExpr *expr = (JsonConstructorExpr *) node;
+
+	APPEND_TYPE_COLLS(expr->returning->typid);
+
+	return true;
+}
+#endif
+
+#if PG_VERSION_NUM >= 170000
+static bool
+pgcd_walk_jsonexpr(Node *node, pgcdWalkerContext *context)
+{
+	JsonExpr   *expr = (JsonExpr *) node;
+
+	APPEND_COLL(expr->collation);
+	APPEND_TYPE_COLLS(expr->returning->typid);
+
+	return true;
+}
+
+static bool
+pgcd_walk_mergesupportfunc(Node *node, pgcdWalkerContext *context)
+{
+	MergeSupportFunc *func = (MergeSupportFunc *) node;
+
+	APPEND_COLL(func->msfcollid);
+	APPEND_TYPE_COLLS(func->msftype);
+
+	return false;
+}
+#endif
+
+#undef APPEND_COLL_FIELD
+#undef APPEND_TYPE_COLLS_FIELD
+#undef APPEND_COLL
+#undef APPEND_TYPE_COLLS
+
+/*
+ * Node handlers, indexed by node tag.  The node tags differ between major
+ * versions, so the table is built at compile time for each of them.  Nodes
+ * with a NULL handler have nothing specific to do, the walker only descends
+ * into their subnodes.  Nodes missing here shouldn't be reachable in the
+ * supported objects.
+ */
+#define PGCD_NODE(tag, handler) [T_##tag] = {#tag, handler}
+
+static const pgcdNodeHandlerEntry pgcd_node_handlers[] = {
+	PGCD_NODE(TableFunc, pgcd_walk_tablefunc),
+	PGCD_NODE(Var, pgcd_walk_var),
+	PGCD_NODE(Const, pgcd_walk_const),
+	PGCD_NODE(Param, pgcd_walk_param),
+	PGCD_NODE(SubscriptingRef, pgcd_walk_subscriptingref),
+	PGCD_NODE(FuncExpr, pgcd_walk_funcexpr),
+	PGCD_NODE(OpExpr, pgcd_walk_opexpr),
+	PGCD_NODE(DistinctExpr, pgcd_walk_opexpr),
+	PGCD_NODE(NullIfExpr, pgcd_walk_opexpr),
+	PGCD_NODE(ScalarArrayOpExpr, pgcd_walk_scalararrayopexpr),
+	PGCD_NODE(FieldSelect, pgcd_walk_fieldselect),
+	PGCD_NODE(RelabelType, pgcd_walk_relabeltype),
+	PGCD_NODE(CoerceViaIO, pgcd_walk_coerceviaio),
+	PGCD_NODE(ArrayCoerceExpr, pgcd_walk_arraycoerceexpr),
+	PGCD_NODE(ConvertRowtypeExpr, pgcd_walk_convertrowtypeexpr),
+	PGCD_NODE(CollateExpr, pgcd_walk_collateexpr),
+	PGCD_NODE(CaseExpr, pgcd_walk_caseexpr),
+	PGCD_NODE(CaseTestExpr, pgcd_walk_casetestexpr),
+	PGCD_NODE(ArrayExpr, pgcd_walk_arrayexpr),
+	PGCD_NODE(RowExpr, pgcd_walk_rowexpr),
+	PGCD_NODE(RowCompareExpr, pgcd_walk_rowcompareexpr),
+	PGCD_NODE(CoalesceExpr, pgcd_walk_coalesceexpr),
+#if PG_VERSION_NUM < 160000
+	PGCD_NODE(SQLValueFunction, pgcd_walk_sqlvaluefunction),
+#endif
+	PGCD_NODE(MinMaxExpr, pgcd_walk_minmaxexpr),
+	PGCD_NODE(CoerceToDomain, pgcd_walk_coercetodomain),
+	PGCD_NODE(CoerceToDomainValue, pgcd_walk_coercetodomainvalue),
+	PGCD_NODE(SetToDefault, pgcd_walk_settodefault),
+	PGCD_NODE(InferenceElem, pgcd_walk_inferenceelem),
+	PGCD_NODE(Aggref, pgcd_walk_aggref),
+	PGCD_NODE(Query, pgcd_walk_query),
+	PGCD_NODE(RangeTblFunction, pgcd_walk_rangetblfunction),
+	PGCD_NODE(SetOperationStmt, pgcd_walk_setoperationstmt),
+	PGCD_NODE(WindowFunc, pgcd_walk_windowfunc),
+	PGCD_NODE(CommonTableExpr, pgcd_walk_commontableexpr),
+#if PG_VERSION_NUM >= 160000
+	PGCD_NODE(JsonConstructorExpr, pgcd_walk_jsonconstructorexpr),
+	PGCD_NODE(JsonValueExpr, NULL),
+	PGCD_NODE(JsonIsPredicate, NULL),
+#endif
+#if PG_VERSION_NUM >= 170000
+	PGCD_NODE(JsonExpr, pgcd_walk_jsonexpr),
+	PGCD_NODE(JsonBehavior, NULL),
+	PGCD_NODE(MergeSupportFunc, pgcd_walk_mergesupportfunc),
+#endif
+#if PG_VERSION_NUM >= 150000
+	PGCD_NODE(MergeAction, NULL),
+#endif
+	PGCD_NODE(JoinExpr, NULL),
+	PGCD_NODE(FromExpr, NULL),
+	PGCD_NODE(RangeTblRef, NULL),
+	PGCD_NODE(SortGroupClause, NULL),
+	PGCD_NODE(SubLink, NULL),
+	PGCD_NODE(TableSampleClause, NULL),
+	PGCD_NODE(TargetEntry, NULL),
+	PGCD_NODE(Alias, NULL),
+	PGCD_NODE(RangeVar, NULL),
+	PGCD_NODE(IntoClause, NULL),
+	PGCD_NODE(NamedArgExpr, NULL),
+	PGCD_NODE(BoolExpr, NULL),
+	PGCD_NODE(CaseWhen, NULL),
+	PGCD_NODE(XmlExpr, NULL),
+	PGCD_NODE(NullTest, NULL),
+	PGCD_NODE(BooleanTest, NULL),
+	PGCD_NODE(GroupingFunc, NULL),
+	PGCD_NODE(NextValueExpr, NULL),
+	PGCD_NODE(OnConflictExpr, NULL),
+	PGCD_NODE(List, NULL),
+};
+
+#undef PGCD_NODE
+
+/*
+ * Get the handler entry for the given node tag, or NULL if the node type is
+ * not expected.
+ */
+static inline const pgcdNodeHandlerEntry *
+pgcd_get_node_handler(NodeTag tag)
+{
+	if ((size_t) tag >= lengthof(pgcd_node_handlers) ||
+		pgcd_node_handlers[tag].name == NULL)
+		return NULL;
+
+	return &pgcd_node_handlers[tag];
+}
+
+/*
+ * Get the name of the given node tag, or NULL if the node type is not
+ * expected.
+ */
+const char *
+pgcd_node_name(NodeTag tag)
+{
+	const pgcdNodeHandlerEntry *entry = pgcd_get_node_handler(tag);
+
+	return entry ? entry->name : NULL;
+}
+
+/*
+ * Walker function to find collations in expressions.
+ *
+ * Don't try to be smart here for now, just remember all collations seen,
+ * coming from explicit collation or underlying types even if there can be
+ * false positive or redundant values.
+ */
+static bool
+pgcd_query_expression_walker(Node *node, pgcdWalkerContext *context)
+{
+	const pgcdNodeHandlerEntry *entry;
+
+	if (!node)
+		return false;
+
+	entry = pgcd_get_node_handler(nodeTag(node));
+	if (unlikely(entry == NULL))
+		elog(ERROR, "unexpected node type %d (%s)", node->type,
+			 nodeToString(node));
+
+	if (entry->handler != NULL && !entry->handler(node, context))
+		return false;
+
+	return expression_tree_walker(node, pgcd_query_expression_walker, context);
+}
+
+/*
+ * Get full list of collation dependencies for the given composite type or
+ * relation.
+ *
+ * This only looks at the column list, so it's not usable for more complex
+ * objects like materialized views.
+ */
+static List *
+pgcd_get_rel_collations(Oid relid)
 {
 	List	   *res = NIL;
 	Relation	typRel;
@@ -631,12 +840,19 @@ pgcd_get_rel_collations(Oid relid)
 			continue;
 		}
 
+		PGCD_TRACE_PUSH("column %s", NameStr(pg_att->attname));
+
 		/* If the attribute has a collation, use it. */
 		if (OidIsValid(pg_att->attcollation))
+		{
 			res = lappend_oid(res, pg_att->attcollation);
+			PGCD_TRACE_COLL(pg_att->attcollation, "attcollation");
+		}
 
 		/* And recurse in case there's nested types. */
 		res = list_concat(res, pgcd_get_type_collations(pg_att->atttypid));
+
+		PGCD_TRACE_POP();
 	}
 
 	systable_endscan(scan);
@@ -673,6 +889,9 @@ pgcd_get_constraint_collations(Oid conid)
 	if (!HeapTupleIsValid(tup))
 		elog(ERROR, "could not find constraint %u", conid);
 
+	PGCD_TRACE_PUSH("constraint %s",
+					NameStr(((Form_pg_constraint) GETSTRUCT(tup))->conname));
+
 	/* Get the collations from the stored expression, if any. */
 	datum = SysCacheGetAttr(CONSTROID, tup, Anum_pg_constraint_conbin, &isnull);
 	if (!isnull)
@@ -715,7 +934,7 @@ pgcd_get_constraint_collations(Oid conid)
 		for (int i = 0; i < numkeys; i++)
 		{
 			Oid		attnum = conkeys[i];
-			Oid		atttypid;
+			Form_pg_attribute att;
 
 			/*
 			 * Constraints on whole-row don't have a valid attnum, we can
@@ -730,14 +949,50 @@ pgcd_get_constraint_collations(Oid conid)
 				continue;
 			}
 
-			atttypid = TupleDescAttr(rel->rd_att, attnum - 1)->atttypid;
+			att = TupleDescAttr(rel->rd_att, attnum - 1);
+
+			PGCD_TRACE_PUSH("key column %s", NameStr(att->attname));
 
-			res = list_concat(res, pgcd_get_type_collations(atttypid));
+			/*
+			 * Foreign keys compare the referencing columns using their own
+			 * collation.
+			 */
+			if (pg_constraint->contype == CONSTRAINT_FOREIGN &&
+				OidIsValid(att->attcollation))
+			{
+				res = lappend_oid(res, att->attcollation);
+				PGCD_TRACE_COLL(att->attcollation, "attcollation");
+			}
+			res = list_concat(res, pgcd_get_type_collations(att->atttypid));
+			PGCD_TRACE_POP();
 		}
 
 		relation_close(rel, NoLock);
 	}
 
+	/*
+	 * Foreign keys also depend on the referenced columns, and on the unique
+	 * index the referential integrity triggers use to look them up.
+	 */
+	if (((Form_pg_constraint) GETSTRUCT(tup))->contype == CONSTRAINT_FOREIGN)
+	{
+		Form_pg_constraint pg_constraint = (Form_pg_constraint) GETSTRUCT(tup);
+
+		res = list_concat(res,
+						  pgcd_get_fkey_referenced_collations(tup,
+															  pg_constraint->confrelid));
+
+		if (OidIsValid(pg_constraint->conindid))
+		{
+			PGCD_TRACE_PUSH("referenced index %s",
+							get_rel_name(pg_constraint->conindid));
+			res = list_concat(res, pgcd_index_deps(pg_constraint->conindid));
+			PGCD_TRACE_POP();
+		}
+	}
+
+	PGCD_TRACE_POP();
+
 	systable_endscan(scan);
 	table_close(conRel, NoLock);
 
@@ -745,9 +1000,59 @@ pgcd_get_constraint_collations(Oid conid)
 }
 
 /*
- * Get full list of collation dependencies for the given expression.
+ * Get the collations of the referenced columns of the given foreign key
+ * constraint.
  */
 static List *
+pgcd_get_fkey_referenced_collations(HeapTuple contup, Oid relid)
+{
+	List	   *res = NIL;
+	Datum		datum;
+	bool		isnull;
+	ArrayType  *arr;
+	AttrNumber *keys;
+	int			numkeys;
+	Relation	rel;
+
+	datum = SysCacheGetAttr(CONSTROID, contup, Anum_pg_constraint_confkey,
+							&isnull);
+	if (isnull)
+		elog(ERROR, "null confkey for foreign key constraint");
+
+	arr = DatumGetArrayTypeP(datum);	/* ensure not toasted */
+	if (ARR_NDIM(arr) != 1 ||
+		ARR_HASNULL(arr) ||
+		ARR_ELEMTYPE(arr) != INT2OID)
+		elog(ERROR, "confkey is not a 1-D smallint array");
+
+	numkeys = ARR_DIMS(arr)[0];
+	keys = (AttrNumber *) ARR_DATA_PTR(arr);
+
+	rel = relation_open(relid, AccessShareLock);
+
+	for (int i = 0; i < numkeys; i++)
+	{
+		Form_pg_attribute att = TupleDescAttr(rel->rd_att, keys[i] - 1);
+
+		PGCD_TRACE_PUSH("referenced column %s", NameStr(att->attname));
+		if (OidIsValid(att->attcollation))
+		{
+			res = lappend_oid(res, att->attcollation);
+			PGCD_TRACE_COLL(att->attcollation, "attcollation");
+		}
+		res = list_concat(res, pgcd_get_type_collations(att->atttypid));
+		PGCD_TRACE_POP();
+	}
+
+	relation_close(rel, NoLock);
+
+	return res;
+}
+
+/*
+ * Get full list of collation dependencies for the given expression.
+ */
+List *
 pgcd_get_query_expression_collations(Node *expr)
 {
 	pgcdWalkerContext context;
@@ -797,7 +1102,10 @@ pgcd_get_range_type_collations(Oid rngid, bool ismultirange)
 
 	/* Remember the range collation if any. */
 	if (OidIsValid(pg_range->rngcollation))
+	{
 		res = lappend_oid(res, pg_range->rngcollation);
+		PGCD_TRACE_COLL(pg_range->rngcollation, "rngcollation");
+	}
 
 	/* And recurse in case there's nested types. */
 	res = list_concat(res, pgcd_get_type_collations(pg_range->rngsubtype));
@@ -835,12 +1143,17 @@ pgcd_get_type_collations(Oid typid)
 
 	typtup = (Form_pg_type) GETSTRUCT(tp);
 
+	PGCD_TRACE_PUSH("type %s", format_type_be(typid));
+
 	/*
 	 * If the recorded collation is valid, just use it.  Otherwise inspect the
 	 * type to see if there's any underlying collation.
 	 */
 	if (OidIsValid(typtup->typcollation))
+	{
 		res = lappend_oid(res, typtup->typcollation);
+		PGCD_TRACE_COLL(typtup->typcollation, "typcollation");
+	}
 	else if (OidIsValid(typtup->typelem))
 	{
 		/* Subscripting, get the info for the underlying type. */
@@ -910,6 +1223,8 @@ pgcd_get_type_collations(Oid typid)
 
 	table_close(depRel, NoLock);
 
+	PGCD_TRACE_POP();
+
 	ReleaseSysCache(tp);
 	return res;
 }
@@ -919,16 +1234,13 @@ pgcd_get_type_collations(Oid typid)
  *
  * This takes care of removing any duplicated collation.
  */
-static List *
+List *
 pgcd_constraint_deps(Oid constraint_oid)
 {
 	List	   *res;
 
 	res = pgcd_get_constraint_collations(constraint_oid);
-#if PG_VERSION_NUM < 130000
-	res =
-#endif
-	list_sort(res, list_oid_cmp);
+	res = pgcd_list_sort(res, list_oid_cmp);
 	list_deduplicate_oid(res);
 
 	return res;
@@ -940,7 +1252,7 @@ pgcd_constraint_deps(Oid constraint_oid)
  * This takes care of looking into index expressions and predicates and
  * removing any duplicated collation.
  */
-static List *
+List *
 pgcd_index_deps(Oid index_oid)
 {
 	List	   *res = NIL;
@@ -982,6 +1294,8 @@ pgcd_index_deps(Oid index_oid)
 	{
 		int indkey = rd_index->indkey.values[i];
 
+		PGCD_TRACE_PUSH("index column %d", i + 1);
+
 		if (AttributeNumberIsValid(indkey))
 		{
 			Oid typid = get_atttype(rd_index->indrelid, indkey);
@@ -1000,6 +1314,7 @@ pgcd_index_deps(Oid index_oid)
 				{
 					foundcoll = true;
 					res = lappend_oid(res, indcollation->values[i]);
+					PGCD_TRACE_COLL(indcollation->values[i], "indcollation");
 				}
 			}
 
@@ -1010,6 +1325,11 @@ pgcd_index_deps(Oid index_oid)
 			 */
 			if (!foundcoll)
 				res = list_concat(res, pgcd_get_type_collations(typid));
+
+			/* The stored value depends on the generation expression. */
+			res = list_concat(res,
+							  pgcd_generated_column_deps(rd_index->indrelid,
+														 indkey));
 		}
 		else
 		{
@@ -1021,14 +1341,12 @@ pgcd_index_deps(Oid index_oid)
 				elog(ERROR, "too few entries in indexprs list");
 
 			indexkey = (Node *) lfirst(indexpr_item);
-			indexpr_item = lnext(
-#if PG_VERSION_NUM >= 130000
-								 indexprs,
-#endif
-								 indexpr_item);
+			indexpr_item = pgcd_lnext(indexprs, indexpr_item);
 
 			res = list_concat(res, pgcd_get_query_expression_collations(indexkey));
 		}
+
+		PGCD_TRACE_POP();
 	}
 
 	datum = SysCacheGetAttr(INDEXRELID, tup,
@@ -1041,13 +1359,12 @@ pgcd_index_deps(Oid index_oid)
 		expr = TextDatumGetCString(datum);
 		indpred = (Node *) stringToNode(expr);
 
+		PGCD_TRACE_PUSH("index predicate");
 		res = list_concat(res, pgcd_get_query_expression_collations(indpred));
+		PGCD_TRACE_POP();
 	}
 
-#if PG_VERSION_NUM < 130000
-	res =
-#endif
-	list_sort(res, list_oid_cmp);
+	res = pgcd_list_sort(res, list_oid_cmp);
 	list_deduplicate_oid(res);
 
 	ReleaseSysCache(tup);
@@ -1056,109 +1373,712 @@ pgcd_index_deps(Oid index_oid)
 }
 
 /*
- * Get full list of collation dependencies for the given materialized view.
+ * Get full list of collation dependencies for the given _RETURN rule action,
+ * as stored in pg_rewrite.ev_action.
  *
- * This takes care of removing any duplicated collation.
+ * The stored query was rewritten at the time of the view definition, but has
+ * not been scribbled on by the planner.  This takes care of removing any
+ * duplicated collation.
  */
 static List *
-pgcd_matview_deps(Oid matview_oid)
+pgcd_rule_action_deps(Datum ev_action)
 {
 	List	   *res = NIL;
-	Relation	matviewRel;
-	RewriteRule *rule;
 	List	   *actions;
-	Query	   *dataQuery;
+	ListCell   *lc;
 
-	matviewRel = table_open(matview_oid, AccessShareLock);
+	actions = (List *) stringToNode(TextDatumGetCString(ev_action));
 
-	/* Make sure it is a materialized view. */
-	if (matviewRel->rd_rel->relkind != RELKIND_MATVIEW)
-		ereport(ERROR,
-				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
-				 errmsg("\"%s\" is not a materialized view",
-						RelationGetRelationName(matviewRel))));
+	foreach(lc, actions)
+	{
+		Query	   *dataQuery = lfirst_node(Query, lc);
 
-	/*
-	 * Check that everything is correct for a refresh. Problems at this point
-	 * are internal errors, so elog is sufficient.
-	 */
-	if (matviewRel->rd_rel->relhasrules == false ||
-		matviewRel->rd_rules->numLocks < 1)
-		elog(ERROR,
-			 "materialized view \"%s\" is missing rewrite information",
-			 RelationGetRelationName(matviewRel));
+		res = list_concat(res,
+						  pgcd_get_query_expression_collations((Node *) dataQuery));
+	}
 
-	if (matviewRel->rd_rules->numLocks > 1)
-		elog(ERROR,
-			 "materialized view \"%s\" has too many rules",
-			 RelationGetRelationName(matviewRel));
+	res = pgcd_list_sort(res, list_oid_cmp);
+	list_deduplicate_oid(res);
 
-	rule = matviewRel->rd_rules->rules[0];
-	if (rule->event != CMD_SELECT || !(rule->isInstead))
-		elog(ERROR,
-			 "the rule for materialized view \"%s\" is not a SELECT INSTEAD OF rule",
-			 RelationGetRelationName(matviewRel));
+	return res;
+}
 
-	actions = rule->actions;
-	if (list_length(actions) != 1)
-		elog(ERROR,
-			 "the rule for materialized view \"%s\" is not a single action",
-			 RelationGetRelationName(matviewRel));
+/*
+ * Get full list of collation dependencies for the given view or materialized
+ * view.
+ *
+ * The rule is directly read from the catalog cache, so there's no need to
+ * build the relcache entry and all its rules.  Caller must have locked the
+ * relation and checked its relkind.
+ */
+static List *
+pgcd_get_view_collations(Oid view_oid)
+{
+	List	   *res;
+	HeapTuple	tup;
+	Form_pg_rewrite rule;
+	Datum		datum;
+	bool		isnull;
 
 	/*
-	 * The stored query was rewritten at the time of the MV definition, but
-	 * has not been scribbled on by the planner.
+	 * Check that everything is correct for a refresh. Problems at this point
+	 * are internal errors, so elog is sufficient.
 	 */
-	dataQuery = linitial_node(Query, actions);
+	tup = SearchSysCache2(RULERELNAME, ObjectIdGetDatum(view_oid),
+						  PointerGetDatum(ViewSelectRuleName));
+	if (!HeapTupleIsValid(tup))
+		elog(ERROR, "view \"%s\" is missing rewrite information",
+			 get_rel_name(view_oid));
 
-	res = list_concat(res, pgcd_get_query_expression_collations((Node *) dataQuery));
+	rule = (Form_pg_rewrite) GETSTRUCT(tup);
+	if (rule->ev_type != '0' + CMD_SELECT || !rule->is_instead)
+		elog(ERROR,
+			 "the rule for view \"%s\" is not a SELECT INSTEAD OF rule",
+			 get_rel_name(view_oid));
 
-	table_close(matviewRel, NoLock);
+	datum = SysCacheGetAttr(RULERELNAME, tup, Anum_pg_rewrite_ev_action,
+							&isnull);
+	if (isnull)
+		elog(ERROR, "null ev_action for view \"%s\"",
+			 get_rel_name(view_oid));
 
-#if PG_VERSION_NUM < 130000
-	res =
-#endif
-	list_sort(res, list_oid_cmp);
-	list_deduplicate_oid(res);
+	res = pgcd_rule_action_deps(datum);
+
+	ReleaseSysCache(tup);
 
 	return res;
 }
 
 /*
- * SRF returning all found collation dependencies for the given dependency.
+ * Get full list of collation dependencies for the given materialized view.
  */
-Datum
-pg_collation_constraint_dependencies(PG_FUNCTION_ARGS)
+List *
+pgcd_matview_deps(Oid matview_oid)
 {
-	Oid				constraint_oid = PG_GETARG_OID(0);
-	ReturnSetInfo  *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
-	ListCell	   *lc;
-
-	InitMaterializedSRF(fcinfo, MAT_SRF_USE_EXPECTED_DESC);
+	LockRelationOid(matview_oid, AccessShareLock);
 
-	foreach(lc, pgcd_constraint_deps(constraint_oid))
-	{
-		Datum			values[PG_COLL_DEP_COLS];
-		bool			nulls[PG_COLL_DEP_COLS];
+	/* Make sure it is a materialized view. */
+	if (get_rel_relkind(matview_oid) != RELKIND_MATVIEW)
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("\"%s\" is not a materialized view",
+						get_rel_name(matview_oid))));
 
-		memset(values, 0, sizeof(values));
-		memset(nulls, 0, sizeof(nulls));
+	return pgcd_get_view_collations(matview_oid);
+}
 
-		values[0] = ObjectIdGetDatum(lfirst_oid(lc));
+/*
+ * Get full list of collation dependencies for the given view.
+ */
+List *
+pgcd_view_deps(Oid view_oid)
+{
+	LockRelationOid(view_oid, AccessShareLock);
 
-		tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values, nulls);
-	}
+	/* Make sure it is a view. */
+	if (get_rel_relkind(view_oid) != RELKIND_VIEW)
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("\"%s\" is not a view",
+						get_rel_name(view_oid))));
 
-	return (Datum) 0;
+	return pgcd_get_view_collations(view_oid);
 }
 
 /*
- * SRF returning all found collation dependencies for the given index.
+ * Get full list of collation dependencies for the given stored generated
+ * column, or NIL if the column isn't a stored generated column.
+ *
+ * The stored values were computed using the collations of the generation
+ * expression, so they can differ from what the expression now returns.  This
+ * takes care of removing any duplicated collation.
  */
-Datum
-pg_collation_index_dependencies(PG_FUNCTION_ARGS)
+List *
+pgcd_generated_column_deps(Oid relid, AttrNumber attnum)
 {
-	Oid				index_oid = PG_GETARG_OID(0);
+	List	   *res = NIL;
+#if PG_VERSION_NUM >= 120000
+	Relation	attrdefRel;
+	ScanKeyData key[2];
+	SysScanDesc scan;
+	HeapTuple	tup;
+
+	if (get_attgenerated(relid, attnum) != ATTRIBUTE_GENERATED_STORED)
+		return NIL;
+
+	attrdefRel = table_open(AttrDefaultRelationId, AccessShareLock);
+
+	ScanKeyInit(&key[0],
+				Anum_pg_attrdef_adrelid,
+				BTEqualStrategyNumber, F_OIDEQ,
+				ObjectIdGetDatum(relid));
+	ScanKeyInit(&key[1],
+				Anum_pg_attrdef_adnum,
+				BTEqualStrategyNumber, F_INT2EQ,
+				Int16GetDatum(attnum));
+
+	scan = systable_beginscan(attrdefRel, AttrDefaultIndexId, true,
+							  NULL, 2, key);
+
+	if (HeapTupleIsValid(tup = systable_getnext(scan)))
+	{
+		Datum		datum;
+		bool		isnull;
+
+		datum = heap_getattr(tup, Anum_pg_attrdef_adbin,
+							 RelationGetDescr(attrdefRel), &isnull);
+		if (!isnull)
+		{
+			PGCD_TRACE_PUSH("generated column %s",
+							get_attname(relid, attnum, false));
+			res = pgcd_get_query_expression_collations(stringToNode(TextDatumGetCString(datum)));
+			PGCD_TRACE_POP();
+		}
+	}
+
+	systable_endscan(scan);
+	table_close(attrdefRel, NoLock);
+
+	res = pgcd_list_sort(res, list_oid_cmp);
+	list_deduplicate_oid(res);
+#endif							/* pg12+ */
+
+	return res;
+}
+
+/*
+ * Get the collations used by the partition key of the given partitioned
+ * table.
+ */
+static List *
+pgcd_get_partkey_collations(Oid relid)
+{
+	List	   *res = NIL;
+	HeapTuple	tup;
+	Form_pg_partitioned_table form;
+	Datum		datum;
+	bool		isnull;
+	oidvector  *partcollation;
+	List	   *partexprs = NIL;
+	ListCell   *partexpr_item;
+
+	tup = SearchSysCache1(PARTRELID, ObjectIdGetDatum(relid));
+	if (!HeapTupleIsValid(tup))
+		elog(ERROR, "cache lookup failed for partition key of relation %u",
+			 relid);
+
+	form = (Form_pg_partitioned_table) GETSTRUCT(tup);
+
+	datum = SysCacheGetAttr(PARTRELID, tup,
+							Anum_pg_partitioned_table_partcollation, &isnull);
+	Assert(!isnull);
+	partcollation = (oidvector *) DatumGetPointer(datum);
+
+	datum = SysCacheGetAttr(PARTRELID, tup,
+							Anum_pg_partitioned_table_partexprs, &isnull);
+	if (!isnull)
+		partexprs = (List *) stringToNode(TextDatumGetCString(datum));
+
+	PGCD_TRACE_PUSH("partition key of %s", get_rel_name(relid));
+
+	partexpr_item = list_head(partexprs);
+	for (int i = 0; i < form->partnatts; i++)
+	{
+		AttrNumber	attnum = form->partattrs.values[i];
+
+		PGCD_TRACE_PUSH("partition column %d", i + 1);
+
+		if (OidIsValid(partcollation->values[i]))
+			PGCD_TRACE_COLL(partcollation->values[i], "partcollation");
+
+		if (AttributeNumberIsValid(attnum))
+		{
+			/* Same as for indexes, an explicit collation is enough. */
+			if (OidIsValid(partcollation->values[i]))
+				res = lappend_oid(res, partcollation->values[i]);
+			else
+				res = list_concat(res,
+								  pgcd_get_type_collations(get_atttype(relid,
+																	   attnum)));
+		}
+		else
+		{
+			Node	   *partexpr;
+
+			if (partexpr_item == NULL)
+				elog(ERROR, "too few entries in partexprs list");
+
+			partexpr = (Node *) lfirst(partexpr_item);
+			partexpr_item = pgcd_lnext(partexprs, partexpr_item);
+
+			if (OidIsValid(partcollation->values[i]))
+				res = lappend_oid(res, partcollation->values[i]);
+			res = list_concat(res, pgcd_get_query_expression_collations(partexpr));
+		}
+
+		PGCD_TRACE_POP();
+	}
+
+	PGCD_TRACE_POP();
+
+	ReleaseSysCache(tup);
+
+	return res;
+}
+
+/*
+ * Get full list of collation dependencies for the given partitioned table or
+ * partition.
+ *
+ * For a partitioned table, this is the collations used by its partition key.
+ * For a partition, this is the collations used by the partition key of its
+ * parent, as its bound values are compared using them during tuple routing
+ * and partition pruning.  This also applies to default partitions, which
+ * implicitly depend on the bounds of all the other partitions.  This takes
+ * care of removing any duplicated collation.
+ */
+List *
+pgcd_partition_deps(Oid relid)
+{
+	List	   *res = NIL;
+	char		relkind;
+
+	LockRelationOid(relid, AccessShareLock);
+
+	relkind = get_rel_relkind(relid);
+	if (relkind == RELKIND_PARTITIONED_TABLE)
+		res = pgcd_get_partkey_collations(relid);
+
+	/* Index partitions don't have bounds of their own. */
+	if (get_rel_relispartition(relid) &&
+		relkind != RELKIND_INDEX && relkind != RELKIND_PARTITIONED_INDEX)
+	{
+		Oid			parentid;
+
+#if PG_VERSION_NUM >= 140000
+		parentid = get_partition_parent(relid, true);
+#else
+		parentid = get_partition_parent(relid);
+#endif
+		res = list_concat(res, pgcd_get_partkey_collations(parentid));
+	}
+
+	res = pgcd_list_sort(res, list_oid_cmp);
+	list_deduplicate_oid(res);
+
+	return res;
+}
+
+/*
+ * Backend-local ledger of verified objects.
+ *
+ * No table can be written during recovery, so on a hot standby the objects
+ * are recorded here instead of in the pg_collation_verified_objects table,
+ * for the lifetime of the backend.
+ *
+ * The ledger follows the transaction semantics of the table: each entry keeps
+ * a stack of versions, the ones recorded by a transaction still in progress
+ * being tagged with the subtransaction that recorded them, so that they can
+ * be discarded if it rolls back.
+ */
+typedef struct pgcdVerifiedKey
+{
+	Oid			classid;
+	Oid			objid;
+	Oid			collid;
+} pgcdVerifiedKey;
+
+typedef struct pgcdVerifiedVersion
+{
+	char	   *collversion;
+	char	   *fingerprint;
+	TimestampTz verified_at;
+	char	   *method;
+	SubTransactionId subid;		/* InvalidSubTransactionId once committed */
+	struct pgcdVerifiedVersion *prev;	/* version it replaces, if any */
+} pgcdVerifiedVersion;
+
+typedef struct pgcdVerifiedEntry
+{
+	pgcdVerifiedKey key;		/* hash key of entry - MUST BE FIRST */
+	pgcdVerifiedVersion *cur;	/* latest version */
+} pgcdVerifiedEntry;
+
+static HTAB *pgcd_session_verified = NULL;
+
+static void pgcd_session_free_version(pgcdVerifiedVersion *version);
+static void pgcd_session_xact_end(SubTransactionId subid, bool commit,
+								  SubTransactionId parentsubid);
+static void pgcd_session_xact_callback(XactEvent event, void *arg);
+static void pgcd_session_subxact_callback(SubXactEvent event,
+										  SubTransactionId mySubid,
+										  SubTransactionId parentSubid,
+										  void *arg);
+
+/*
+ * Free the given version of a backend-local ledger entry.
+ */
+static void
+pgcd_session_free_version(pgcdVerifiedVersion *version)
+{
+	if (version->collversion)
+		pfree(version->collversion);
+	if (version->fingerprint)
+		pfree(version->fingerprint);
+	pfree(version->method);
+	pfree(version);
+}
+
+/*
+ * Apply the end of the given subtransaction, or of the top-level transaction
+ * if subid is InvalidSubTransactionId, to the backend-local ledger.  On
+ * subtransaction commit, the versions are transferred to parentsubid.
+ */
+static void
+pgcd_session_xact_end(SubTransactionId subid, bool commit,
+					  SubTransactionId parentsubid)
+{
+	HASH_SEQ_STATUS hash_seq;
+	pgcdVerifiedEntry *entry;
+
+	hash_seq_init(&hash_seq, pgcd_session_verified);
+	while ((entry = hash_seq_search(&hash_seq)) != NULL)
+	{
+		pgcdVerifiedVersion *cur = entry->cur;
+
+		if (!commit)
+		{
+			/* The newest versions are the ones of the innermost levels. */
+			while (cur != NULL && cur->subid != InvalidSubTransactionId &&
+				   (subid == InvalidSubTransactionId || cur->subid == subid))
+			{
+				pgcdVerifiedVersion *prev = cur->prev;
+
+				pgcd_session_free_version(cur);
+				cur = prev;
+			}
+		}
+		else if (subid != InvalidSubTransactionId)
+		{
+			for (pgcdVerifiedVersion *v = cur;
+				 v != NULL && v->subid == subid; v = v->prev)
+				v->subid = parentsubid;
+		}
+		else if (cur != NULL && cur->subid != InvalidSubTransactionId)
+		{
+			/* Only the latest version is visible from now on. */
+			while (cur->prev != NULL)
+			{
+				pgcdVerifiedVersion *prev = cur->prev;
+
+				cur->prev = prev->prev;
+				pgcd_session_free_version(prev);
+			}
+			cur->subid = InvalidSubTransactionId;
+		}
+
+		entry->cur = cur;
+		if (cur == NULL)
+			hash_search(pgcd_session_verified, &entry->key, HASH_REMOVE, NULL);
+	}
+}
+
+/*
+ * Transaction callback for the backend-local ledger.
+ */
+static void
+pgcd_session_xact_callback(XactEvent event, void *arg)
+{
+	switch (event)
+	{
+		case XACT_EVENT_COMMIT:
+		case XACT_EVENT_PARALLEL_COMMIT:
+			pgcd_session_xact_end(InvalidSubTransactionId, true,
+								  InvalidSubTransactionId);
+			break;
+		case XACT_EVENT_ABORT:
+		case XACT_EVENT_PARALLEL_ABORT:
+			pgcd_session_xact_end(InvalidSubTransactionId, false,
+								  InvalidSubTransactionId);
+			break;
+		default:
+			break;
+	}
+}
+
+/*
+ * Subtransaction callback for the backend-local ledger.
+ */
+static void
+pgcd_session_subxact_callback(SubXactEvent event, SubTransactionId mySubid,
+							  SubTransactionId parentSubid, void *arg)
+{
+	switch (event)
+	{
+		case SUBXACT_EVENT_COMMIT_SUB:
+			pgcd_session_xact_end(mySubid, true, parentSubid);
+			break;
+		case SUBXACT_EVENT_ABORT_SUB:
+			pgcd_session_xact_end(mySubid, false, InvalidSubTransactionId);
+			break;
+		default:
+			break;
+	}
+}
+
+/*
+ * Copy the given SPI result column in TopMemoryContext, or return NULL.
+ */
+static char *
+pgcd_session_getvalue(HeapTuple tup, TupleDesc tupdesc, int fnumber)
+{
+	char	   *value = SPI_getvalue(tup, tupdesc, fnumber);
+
+	if (value == NULL)
+		return NULL;
+
+	return MemoryContextStrdup(TopMemoryContext, value);
+}
+
+/*
+ * Record the given object in the backend-local ledger.  Caller must be
+ * connected to SPI.
+ */
+static void
+pgcd_record_verified_session(const char *nspname, Oid classid, Oid objid,
+							 Datum collations, const char *method)
+{
+	StringInfoData query;
+	Oid			argtypes[1] = {OIDARRAYOID};
+	TimestampTz now = GetCurrentTransactionStartTimestamp();
+	int			ret;
+
+	if (pgcd_session_verified == NULL)
+	{
+		HASHCTL		info;
+
+		memset(&info, 0, sizeof(info));
+		info.keysize = sizeof(pgcdVerifiedKey);
+		info.entrysize = sizeof(pgcdVerifiedEntry);
+		pgcd_session_verified = hash_create("pg_collation_dependencies verified objects",
+											64, &info,
+											HASH_ELEM | HASH_BLOBS);
+		RegisterXactCallback(pgcd_session_xact_callback, NULL);
+		RegisterSubXactCallback(pgcd_session_subxact_callback, NULL);
+	}
+
+	initStringInfo(&query);
+	appendStringInfo(&query,
+					 "SELECT c.colloid,"
+					 " pg_catalog.pg_collation_actual_version(c.colloid),"
+					 " (SELECT %s.pg_collation_fingerprint(f.collid)"
+					 " FROM %s.pg_collation_fingerprints f"
+					 " WHERE f.collid = c.colloid)"
+					 " FROM pg_catalog.unnest($1) AS c(colloid)",
+					 nspname, nspname);
+
+	ret = SPI_execute_with_args(query.data, 1, argtypes, &collations, NULL,
+								true, 0);
+	if (ret != SPI_OK_SELECT)
+		elog(ERROR, "could not record verified object: %s",
+			 SPI_result_code_string(ret));
+
+	for (uint64 i = 0; i < SPI_processed; i++)
+	{
+		HeapTuple	tup = SPI_tuptable->vals[i];
+		TupleDesc	tupdesc = SPI_tuptable->tupdesc;
+		pgcdVerifiedKey key;
+		pgcdVerifiedEntry *entry;
+		pgcdVerifiedVersion *version;
+		bool		isnull;
+		bool		found;
+
+		memset(&key, 0, sizeof(key));
+		key.classid = classid;
+		key.objid = objid;
+		key.collid = DatumGetObjectId(SPI_getbinval(tup, tupdesc, 1,
+													&isnull));
+
+		entry = (pgcdVerifiedEntry *) hash_search(pgcd_session_verified, &key,
+												  HASH_ENTER, &found);
+		if (!found)
+			entry->cur = NULL;
+
+		version = MemoryContextAlloc(TopMemoryContext,
+									 sizeof(pgcdVerifiedVersion));
+		version->collversion = pgcd_session_getvalue(tup, tupdesc, 2);
+		version->fingerprint = pgcd_session_getvalue(tup, tupdesc, 3);
+		version->verified_at = now;
+		version->method = MemoryContextStrdup(TopMemoryContext, method);
+		version->subid = GetCurrentSubTransactionId();
+
+		/* A version recorded by the same subtransaction can be replaced. */
+		if (entry->cur != NULL && entry->cur->subid == version->subid)
+		{
+			version->prev = entry->cur->prev;
+			pgcd_session_free_version(entry->cur);
+		}
+		else
+			version->prev = entry->cur;
+		entry->cur = version;
+	}
+
+	pfree(query.data);
+}
+
+/*
+ * Record in the pg_collation_verified_objects ledger that the given object
+ * was verified under the current version of each of the given collations,
+ * and their current fingerprint if one was recorded.  During recovery, the
+ * object is recorded in the backend-local ledger instead.
+ *
+ * extnspid is the schema the extension is installed in, as the extension is
+ * relocatable.
+ */
+void
+pgcd_record_verified(Oid extnspid, Oid classid, Oid objid, List *collations,
+					 const char *method)
+{
+	StringInfoData query;
+	const char	   *nspname;
+	Datum		   *elems;
+	Datum			args[4];
+	Oid				argtypes[4] = {OIDOID, OIDOID, OIDARRAYOID, TEXTOID};
+	ListCell	   *lc;
+	int				i = 0;
+	int				ret;
+
+	if (collations == NIL)
+		return;
+
+	elems = palloc(sizeof(Datum) * list_length(collations));
+	foreach(lc, collations)
+		elems[i++] = ObjectIdGetDatum(lfirst_oid(lc));
+
+	args[0] = ObjectIdGetDatum(classid);
+	args[1] = ObjectIdGetDatum(objid);
+	args[2] = PointerGetDatum(construct_array(elems, i, OIDOID, sizeof(Oid),
+											  true, 'i'));
+	args[3] = CStringGetTextDatum(method);
+
+	nspname = quote_identifier(get_namespace_name(extnspid));
+
+	if (SPI_connect() != SPI_OK_CONNECT)
+		elog(ERROR, "SPI_connect failed");
+
+	if (RecoveryInProgress())
+	{
+		pgcd_record_verified_session(nspname, classid, objid, args[2],
+									 method);
+		SPI_finish();
+		return;
+	}
+
+	initStringInfo(&query);
+	appendStringInfo(&query,
+					 "INSERT INTO %s.pg_collation_verified_objects"
+					 " (classid, objid, collid, collversion, fingerprint, method)"
+					 " SELECT $1, $2, c.colloid,"
+					 " pg_catalog.pg_collation_actual_version(c.colloid),"
+					 " (SELECT %s.pg_collation_fingerprint(f.collid)"
+					 " FROM %s.pg_collation_fingerprints f"
+					 " WHERE f.collid = c.colloid), $4"
+					 " FROM pg_catalog.unnest($3) AS c(colloid)"
+					 " ON CONFLICT (classid, objid, collid) DO UPDATE"
+					 " SET collversion = EXCLUDED.collversion,"
+					 " fingerprint = EXCLUDED.fingerprint,"
+					 " verified_at = pg_catalog.now(),"
+					 " method = EXCLUDED.method",
+					 nspname, nspname, nspname);
+
+	ret = SPI_execute_with_args(query.data, 4, argtypes, args, NULL, false, 0);
+	if (ret != SPI_OK_INSERT)
+		elog(ERROR, "could not record verified object: %s",
+			 SPI_result_code_string(ret));
+
+	SPI_finish();
+	pfree(query.data);
+}
+
+/*
+ * Return the content of the backend-local ledger, with the same columns as
+ * the pg_collation_verified_objects table.
+ */
+Datum
+pg_collation_session_verified_objects(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	HASH_SEQ_STATUS hash_seq;
+	pgcdVerifiedEntry *entry;
+
+	InitMaterializedSRF(fcinfo, MAT_SRF_USE_EXPECTED_DESC);
+
+	if (pgcd_session_verified == NULL)
+		return (Datum) 0;
+
+	hash_seq_init(&hash_seq, pgcd_session_verified);
+	while ((entry = hash_seq_search(&hash_seq)) != NULL)
+	{
+		pgcdVerifiedVersion *cur = entry->cur;
+		Datum		values[PG_COLL_VERIFIED_COLS];
+		bool		nulls[PG_COLL_VERIFIED_COLS] = {0};
+
+		values[0] = ObjectIdGetDatum(entry->key.classid);
+		values[1] = ObjectIdGetDatum(entry->key.objid);
+		values[2] = ObjectIdGetDatum(entry->key.collid);
+		if (cur->collversion)
+			values[3] = CStringGetTextDatum(cur->collversion);
+		else
+			nulls[3] = true;
+		if (cur->fingerprint)
+			values[4] = CStringGetTextDatum(cur->fingerprint);
+		else
+			nulls[4] = true;
+		values[5] = TimestampTzGetDatum(cur->verified_at);
+		values[6] = CStringGetTextDatum(cur->method);
+
+		tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values,
+							 nulls);
+	}
+
+	return (Datum) 0;
+}
+
+/*
+ * SRF returning all found collation dependencies for the given dependency.
+ */
+Datum
+pg_collation_constraint_dependencies(PG_FUNCTION_ARGS)
+{
+	Oid				constraint_oid = PG_GETARG_OID(0);
+	ReturnSetInfo  *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	ListCell	   *lc;
+
+	InitMaterializedSRF(fcinfo, MAT_SRF_USE_EXPECTED_DESC);
+
+	foreach(lc, pgcd_constraint_deps(constraint_oid))
+	{
+		Datum			values[PG_COLL_DEP_COLS];
+		bool			nulls[PG_COLL_DEP_COLS];
+
+		memset(values, 0, sizeof(values));
+		memset(nulls, 0, sizeof(nulls));
+
+		values[0] = ObjectIdGetDatum(lfirst_oid(lc));
+
+		tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values, nulls);
+	}
+
+	return (Datum) 0;
+}
+
+/*
+ * SRF returning all found collation dependencies for the given index.
+ */
+Datum
+pg_collation_index_dependencies(PG_FUNCTION_ARGS)
+{
+	Oid				index_oid = PG_GETARG_OID(0);
 	ReturnSetInfo  *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
 	ListCell	   *lc;
 
@@ -1212,3 +2132,269 @@ pg_collation_matview_dependencies(PG_FUNCTION_ARGS)
 	tuplestore_donestoring(tupstore);
 	return (Datum) 0;
 }
+
+/*
+ * SRF returning all found collation dependencies for the given partitioned
+ * table or partition.
+ */
+Datum
+pg_collation_partition_dependencies(PG_FUNCTION_ARGS)
+{
+	Oid				relid = PG_GETARG_OID(0);
+	ReturnSetInfo  *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	ListCell	   *lc;
+
+	InitMaterializedSRF(fcinfo, MAT_SRF_USE_EXPECTED_DESC);
+
+	foreach(lc, pgcd_partition_deps(relid))
+	{
+		Datum			values[PG_COLL_DEP_COLS];
+		bool			nulls[PG_COLL_DEP_COLS];
+
+		memset(values, 0, sizeof(values));
+		memset(nulls, 0, sizeof(nulls));
+
+		values[0] = ObjectIdGetDatum(lfirst_oid(lc));
+
+		tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values, nulls);
+	}
+
+	return (Datum) 0;
+}
+
+/*
+ * SRF returning all found collation dependencies for the stored generated
+ * columns of the given relation.
+ */
+Datum
+pg_collation_generated_dependencies(PG_FUNCTION_ARGS)
+{
+	Oid				relid = PG_GETARG_OID(0);
+	ReturnSetInfo  *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	HeapTuple		tup;
+	Form_pg_class	classform;
+
+	InitMaterializedSRF(fcinfo, MAT_SRF_USE_EXPECTED_DESC);
+
+	tup = SearchSysCache1(RELOID, ObjectIdGetDatum(relid));
+	if (!HeapTupleIsValid(tup))
+		elog(ERROR, "cache lookup failed for relation %u", relid);
+	classform = (Form_pg_class) GETSTRUCT(tup);
+
+	for (AttrNumber attnum = 1; attnum <= classform->relnatts; attnum++)
+	{
+		ListCell	   *lc;
+
+		foreach(lc, pgcd_generated_column_deps(relid, attnum))
+		{
+			Datum			values[PG_COLL_GEN_DEP_COLS];
+			bool			nulls[PG_COLL_GEN_DEP_COLS];
+
+			memset(nulls, 0, sizeof(nulls));
+
+			values[0] = Int16GetDatum(attnum);
+			values[1] = ObjectIdGetDatum(lfirst_oid(lc));
+
+			tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values,
+								 nulls);
+		}
+	}
+
+	ReleaseSysCache(tup);
+
+	return (Datum) 0;
+}
+
+/*
+ * SRF returning all found collation dependencies for all the materialized
+ * views and views.
+ *
+ * pg_rewrite is scanned only once and the rule actions are directly parsed,
+ * so no relcache entry is built.  Each rule is processed in a short lived
+ * memory context so memory usage doesn't depend on the number of rules.
+ * Objects created during initdb are ignored.
+ */
+Datum
+pg_collation_rule_dependencies(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo  *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	Relation		rewriteRel;
+	SysScanDesc		scan;
+	HeapTuple		tup;
+	MemoryContext	tmpctx;
+	MemoryContext	oldctx;
+
+	InitMaterializedSRF(fcinfo, MAT_SRF_USE_EXPECTED_DESC);
+
+	tmpctx = AllocSetContextCreate(CurrentMemoryContext,
+								   "pg_collation_rule_dependencies",
+								   ALLOCSET_DEFAULT_SIZES);
+
+	rewriteRel = table_open(RewriteRelationId, AccessShareLock);
+	scan = systable_beginscan(rewriteRel, InvalidOid, false, NULL, 0, NULL);
+
+	while (HeapTupleIsValid(tup = systable_getnext(scan)))
+	{
+		Form_pg_rewrite rule = (Form_pg_rewrite) GETSTRUCT(tup);
+		char		relkind;
+		Datum		datum;
+		bool		isnull;
+		ListCell   *lc;
+
+		if (rule->ev_class < FirstNormalObjectId ||
+			rule->ev_type != '0' + CMD_SELECT ||
+			strcmp(NameStr(rule->rulename), ViewSelectRuleName) != 0)
+			continue;
+
+		relkind = get_rel_relkind(rule->ev_class);
+		if (relkind != RELKIND_VIEW && relkind != RELKIND_MATVIEW)
+			continue;
+
+		datum = heap_getattr(tup, Anum_pg_rewrite_ev_action,
+							 RelationGetDescr(rewriteRel), &isnull);
+		if (isnull)
+			continue;
+
+		oldctx = MemoryContextSwitchTo(tmpctx);
+
+		foreach(lc, pgcd_rule_action_deps(datum))
+		{
+			Datum			values[PG_COLL_RULE_DEP_COLS];
+			bool			nulls[PG_COLL_RULE_DEP_COLS];
+
+			memset(nulls, 0, sizeof(nulls));
+
+			values[0] = ObjectIdGetDatum(rule->ev_class);
+			values[1] = CharGetDatum(relkind);
+			values[2] = ObjectIdGetDatum(lfirst_oid(lc));
+
+			tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values,
+								 nulls);
+		}
+
+		MemoryContextSwitchTo(oldctx);
+		MemoryContextReset(tmpctx);
+	}
+
+	systable_endscan(scan);
+	table_close(rewriteRel, AccessShareLock);
+
+	MemoryContextDelete(tmpctx);
+
+	return (Datum) 0;
+}
+
+/*
+ * Get full list of collation dependencies for the given object.
+ *
+ * The object is identified by its catalog and oid, as in pg_depend: pg_class
+ * for indexes, materialized views, views and partitioned tables and
+ * partitions, pg_constraint for constraints and pg_attrdef for stored
+ * generated columns.
+ */
+List *
+pgcd_object_deps(Oid classid, Oid objid)
+{
+	List	   *collations = NIL;
+
+	if (classid == RelationRelationId)
+	{
+		char		relkind = get_rel_relkind(objid);
+
+		if (relkind == '\0')
+			ereport(ERROR,
+					(errcode(ERRCODE_UNDEFINED_OBJECT),
+					 errmsg("relation with OID %u does not exist", objid)));
+
+		if (relkind == RELKIND_INDEX || relkind == RELKIND_PARTITIONED_INDEX)
+			collations = pgcd_index_deps(objid);
+		else if (relkind == RELKIND_MATVIEW)
+			collations = pgcd_matview_deps(objid);
+		else if (relkind == RELKIND_VIEW)
+			collations = pgcd_view_deps(objid);
+		else if (relkind == RELKIND_PARTITIONED_TABLE ||
+				 get_rel_relispartition(objid))
+			collations = pgcd_partition_deps(objid);
+		else
+			ereport(ERROR,
+					(errcode(ERRCODE_WRONG_OBJECT_TYPE),
+					 errmsg("\"%s\" does not depend on any collation by itself",
+							get_rel_name(objid)),
+					 errhint("Mark its indexes, constraints or generated columns instead.")));
+	}
+	else if (classid == ConstraintRelationId)
+	{
+		if (!SearchSysCacheExists1(CONSTROID, ObjectIdGetDatum(objid)))
+			ereport(ERROR,
+					(errcode(ERRCODE_UNDEFINED_OBJECT),
+					 errmsg("constraint with OID %u does not exist", objid)));
+
+		collations = pgcd_constraint_deps(objid);
+	}
+#if PG_VERSION_NUM >= 120000
+	else if (classid == AttrDefaultRelationId)
+	{
+		Relation	attrdefRel;
+		ScanKeyData key[1];
+		SysScanDesc scan;
+		HeapTuple	tup;
+		Oid			relid;
+		AttrNumber	attnum;
+
+		attrdefRel = table_open(AttrDefaultRelationId, AccessShareLock);
+
+		ScanKeyInit(&key[0],
+					Anum_pg_attrdef_oid,
+					BTEqualStrategyNumber, F_OIDEQ,
+					ObjectIdGetDatum(objid));
+
+		scan = systable_beginscan(attrdefRel, AttrDefaultOidIndexId, true,
+								  NULL, 1, key);
+
+		tup = systable_getnext(scan);
+		if (!HeapTupleIsValid(tup))
+			ereport(ERROR,
+					(errcode(ERRCODE_UNDEFINED_OBJECT),
+					 errmsg("column default with OID %u does not exist",
+							objid)));
+
+		relid = ((Form_pg_attrdef) GETSTRUCT(tup))->adrelid;
+		attnum = ((Form_pg_attrdef) GETSTRUCT(tup))->adnum;
+
+		systable_endscan(scan);
+		table_close(attrdefRel, AccessShareLock);
+
+		collations = pgcd_generated_column_deps(relid, attnum);
+	}
+#endif
+	else
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("unsupported catalog \"%s\"", get_rel_name(classid))));
+
+	return collations;
+}
+
+/*
+ * Record in the pg_collation_verified_objects ledger that the given object
+ * was rebuilt or verified under the current version of all its collations,
+ * so that it's not reported as broken anymore until one of its collations
+ * changes again.  Returns the number of recorded collations.
+ *
+ * The object is identified as for pgcd_object_deps().
+ */
+Datum
+pg_collation_mark_verified(PG_FUNCTION_ARGS)
+{
+	Oid			classid = PG_GETARG_OID(0);
+	Oid			objid = PG_GETARG_OID(1);
+	char	   *method = text_to_cstring(PG_GETARG_TEXT_PP(2));
+	List	   *collations;
+
+	collations = pgcd_object_deps(classid, objid);
+
+	pgcd_record_verified(get_func_namespace(fcinfo->flinfo->fn_oid),
+						 classid, objid, collations, method);
+
+	PG_RETURN_INT32(list_length(collations));
+}
@@ -0,0 +1,226 @@
+/*-------------------------------------------------------------------------
+ *
+ * pg_collation_dependencies.h: Declarations shared between the various
+ *                              pg_collation_dependencies source files.
+ *
+ * This program is open source, licensed under the PostgreSQL license.
+ * For license terms, see the LICENSE file.
+ *
+ * Copyright (C) 2022-2023: Julien Rouhaud
+ *
+ *-------------------------------------------------------------------------
+ */
+#ifndef PG_COLLATION_DEPENDENCIES_H
+#define PG_COLLATION_DEPENDENCIES_H
+
+#include "access/attnum.h"
+#include "fmgr.h"
+#include "nodes/pg_list.h"
+
+#if PG_VERSION_NUM < 120000
+#define table_open(o, l)	heap_open(o, l)
+#define table_close(o, l)	heap_close(o, l)
+#endif
+
+#if PG_VERSION_NUM < 120000
+#define SubscriptingRef			ArrayRef
+#define T_SubscriptingRef		T_ArrayRef
+#define refcontainertype		refarraytype
+#endif
+
+#if PG_VERSION_NUM >= 130000
+#define pgcd_lnext(l, lc)		lnext(l, lc)
+#define pgcd_list_sort(l, c)	(list_sort(l, c), (l))
+#else
+#define pgcd_lnext(l, lc)		lnext(lc)
+#define pgcd_list_sort(l, c)	list_qsort(l, c)
+#define IsOidList(l)			((l) == NIL || IsA((l), OidList))
+
+#ifdef USE_ASSERT_CHECKING
+/*
+ * Check that the specified List is valid (so far as we can tell).
+ */
+static inline void
+check_list_invariants(const List *list)
+{
+	if (list == NIL)
+		return;
+
+	Assert(list->length > 0);
+	Assert(list->head != NULL);
+	Assert(list->tail != NULL);
+
+	Assert(list->type == T_List ||
+		   list->type == T_IntList ||
+		   list->type == T_OidList);
+
+	if (list->length == 1)
+		Assert(list->head == list->tail);
+	if (list->length == 2)
+		Assert(list->head->next == list->tail);
+	Assert(list->tail->next == NULL);
+}
+#else
+#define check_list_invariants(l)
+#endif							/* USE_ASSERT_CHECKING */
+
+/*
+ * list_sort comparator for sorting a list into ascending OID order.
+ */
+static inline int
+list_oid_cmp(const void *a, const void *b)
+{
+	Oid			v1 = lfirst_oid(*(ListCell **) a);
+	Oid			v2 = lfirst_oid(*(ListCell **) b);
+
+	if (v1 < v2)
+		return -1;
+	if (v1 > v2)
+		return 1;
+	return 0;
+}
+
+/*
+ * Remove adjacent duplicates in a list of OIDs.
+ *
+ * It is caller's responsibility to have sorted the list to bring duplicates
+ * together, perhaps via pgcd_list_sort(list, list_oid_cmp).
+ *
+ * Note that this takes time proportional to the length of the list.
+ */
+static inline void
+list_deduplicate_oid(List *list)
+{
+	int			len;
+
+	Assert(IsOidList(list));
+	len = list_length(list);
+	if (len > 1)
+	{
+		ListCell   *lc = list->head;
+
+		list->length = 1;
+
+		while (lc->next)
+		{
+			ListCell   *next = lc->next;
+
+			if (lc->data.oid_value == next->data.oid_value)
+				lc->next = next->next;
+			else
+			{
+				list->length++;
+				lc = next;
+			}
+		}
+
+		list->tail = lc;
+	}
+	check_list_invariants(list);
+}
+#endif							/* pg13- */
+
+#if PG_VERSION_NUM < 150000
+/* flag bits for InitMaterializedSRF() */
+#define MAT_SRF_USE_EXPECTED_DESC	0x01	/* use expectedDesc as tupdesc. */
+#define MAT_SRF_BLESS				0x02	/* "Bless" a tuple descriptor with
+											 * BlessTupleDesc(). */
+extern void InitMaterializedSRF(FunctionCallInfo fcinfo, bits32 flags);
+#endif
+
+/* pg_collation_dependencies.c */
+extern const char *pgcd_node_name(NodeTag tag);
+extern List *pgcd_get_query_expression_collations(Node *expr);
+extern List *pgcd_constraint_deps(Oid constraint_oid);
+extern List *pgcd_index_deps(Oid index_oid);
+extern List *pgcd_matview_deps(Oid matview_oid);
+extern List *pgcd_view_deps(Oid view_oid);
+extern List *pgcd_partition_deps(Oid relid);
+extern List *pgcd_generated_column_deps(Oid relid, AttrNumber attnum);
+extern List *pgcd_object_deps(Oid classid, Oid objid);
+extern void pgcd_record_verified(Oid extnspid, Oid classid, Oid objid,
+								 List *collations, const char *method);
+
+/* pgcd_btree.c */
+extern PGDLLEXPORT void pgcd_btree_check_worker_main(Datum main_arg);
+
+/* pgcd_bulk.c */
+typedef enum pgcdBulkKind
+{
+	PGCD_BULK_INDEX,
+	PGCD_BULK_CONSTRAINT,
+	PGCD_BULK_MATVIEW,
+	PGCD_BULK_VIEW,
+	PGCD_BULK_PARTITION,
+	PGCD_BULK_GENERATED
+} pgcdBulkKind;
+
+#define PGCD_BULK_NUM_KINDS		(PGCD_BULK_GENERATED + 1)
+
+typedef struct pgcdBulkObject
+{
+	pgcdBulkKind kind;
+	Oid			tbloid;			/* underlying table, if any */
+	Oid			objoid;			/* the object itself */
+	AttrNumber	attnum;			/* generated column number */
+	List	   *collations;		/* found dependencies, sorted by oid */
+	char	   *error;			/* error message, if processing failed */
+} pgcdBulkObject;
+
+extern const char *pgcd_bulk_kind_name(pgcdBulkKind kind);
+extern pgcdBulkObject *pgcd_bulk_scan(int *nobjects);
+
+/* pgcd_function.c */
+extern List *pgcd_get_function_collations(Oid funcid);
+
+/* pgcd_impact.c */
+extern int	pgcd_rebuild_mb_per_second;
+extern int	pgcd_rebuild_rows_per_second;
+
+/* pgcd_trace.c */
+typedef struct pgcdTrace pgcdTrace;
+
+extern pgcdTrace *pgcd_trace;
+
+/*
+ * Tracing helpers for the dependency lookup.  Those only evaluate their
+ * arguments if tracing is enabled.
+ */
+#define PGCD_TRACE_PUSH(...) \
+	do { \
+		if (unlikely(pgcd_trace != NULL)) \
+			pgcd_trace_push(psprintf(__VA_ARGS__)); \
+	} while (0)
+
+#define PGCD_TRACE_POP() \
+	do { \
+		if (unlikely(pgcd_trace != NULL)) \
+			pgcd_trace_pop(); \
+	} while (0)
+
+#define PGCD_TRACE_COLL(collid, ...) \
+	do { \
+		if (unlikely(pgcd_trace != NULL)) \
+			pgcd_trace_collation(collid, psprintf(__VA_ARGS__)); \
+	} while (0)
+
+/* Record a note about the current chain, without any collation. */
+#define PGCD_TRACE_NOTE(...) \
+	do { \
+		if (unlikely(pgcd_trace != NULL)) \
+			pgcd_trace_collation(InvalidOid, psprintf(__VA_ARGS__)); \
+	} while (0)
+
+extern void pgcd_trace_push(char *frame);
+extern void pgcd_trace_pop(void);
+extern void pgcd_trace_collation(Oid collid, char *what);
+extern const char *pgcd_trace_node_name(Node *node);
+extern const char *pgcd_trace_field(const char *expr);
+
+/* pgcd_verify.c */
+#define PGCD_VERIFY_SORT_ONLY		0x01	/* disable hash aggregation */
+#define PGCD_VERIFY_USE_INDEXES		0x02	/* allow index usage */
+
+extern int	pgcd_verify_execute(const char *query, int flags, long tcount);
+
+#endif							/* PG_COLLATION_DEPENDENCIES_H */
@@ -0,0 +1,629 @@
+/*-------------------------------------------------------------------------
+ *
+ * pgcd_ascii.c: Prove that an index doesn't depend on the collation library
+ *               version by checking that all its keys only contain
+ *               characters whose ordering is stable.
+ *
+ * Strings only made of ASCII digits and letters sort the same way with every
+ * glibc or ICU version, while punctuation, whitespace and non-ASCII characters
+ * are the ones whose ordering changes between versions.  Many collatable
+ * indexes only store codes, identifiers or hashes, so checking the raw bytes
+ * of the keys is enough to prove that they can't be corrupted, and is far
+ * cheaper than a REINDEX.
+ *
+ * This program is open source, licensed under the PostgreSQL license.
+ * For license terms, see the LICENSE file.
+ *
+ * Copyright (C) 2022-2023: Julien Rouhaud
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include "access/genam.h"
+#include "access/heapam.h"
+#include "access/htup_details.h"
+#include "access/nbtree.h"
+#if PG_VERSION_NUM >= 120000
+#include "access/tableam.h"
+#endif
+#include "catalog/pg_am.h"
+#include "catalog/pg_class.h"
+#include "catalog/pg_collation.h"
+#include "catalog/pg_type.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "nodes/makefuncs.h"
+#include "nodes/nodeFuncs.h"
+#if PG_VERSION_NUM < 120000
+#include "optimizer/clauses.h"
+#endif
+#include "storage/bufmgr.h"
+#include "storage/procarray.h"
+#include "utils/builtins.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/rel.h"
+#include "utils/relcache.h"
+#include "utils/snapmgr.h"
+#if PG_VERSION_NUM < 120000
+#include "utils/tqual.h"
+#endif
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "pg_collation_dependencies.h"
+
+#define PGCD_ASCII_COLS			3
+
+/* Number of blocks to prefetch ahead of the current one. */
+#define PGCD_ASCII_PREFETCH		32
+
+#if PG_VERSION_NUM < 120000
+#define table_beginscan(r, s, n, k)	heap_beginscan(r, s, n, k)
+#define table_endscan(s)			heap_endscan(s)
+#define TableScanDesc				HeapScanDesc
+#define pgcd_scan_buffer(s)			((s)->rs_cbuf)
+#else
+#define pgcd_scan_buffer(s)			(((HeapScanDesc) (s))->rs_cbuf)
+#endif
+
+/*
+ * Kind of collatable attribute to check.
+ */
+typedef enum pgcdAsciiKind
+{
+	PGCD_ASCII_SKIP = 0,		/* not collatable, nothing to check */
+	PGCD_ASCII_TEXT,			/* text, varchar */
+	PGCD_ASCII_BPCHAR,			/* bpchar, trailing spaces are ignored */
+	PGCD_ASCII_NAME				/* name */
+} pgcdAsciiKind;
+
+typedef struct pgcdAsciiState
+{
+	int				natts;
+	pgcdAsciiKind  *kinds;		/* per attribute */
+	uint64			nvalues;	/* number of values checked */
+	char		   *reason;		/* why the index isn't stable, if so */
+} pgcdAsciiState;
+
+extern PGDLLEXPORT Datum	pg_collation_index_ascii_check(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(pg_collation_index_ascii_check);
+
+static inline bool pgcd_ascii_stable_byte(unsigned char c);
+static bool pgcd_ascii_stable_bytes(const char *s, size_t len);
+static bool pgcd_ascii_check_value(pgcdAsciiState *state, int attno,
+								   Datum value);
+static bool pgcd_ascii_expr_walker(Node *node, Oid *collid);
+static void pgcd_ascii_prepare(Relation indrel, pgcdAsciiState *state);
+static bool pgcd_ascii_tuple_is_dead(TableScanDesc scan, HeapTuple tup,
+									 TransactionId oldestxmin);
+static void pgcd_ascii_scan_heap(Relation indrel, pgcdAsciiState *state);
+static void pgcd_ascii_scan_index(Relation indrel, pgcdAsciiState *state);
+
+/*
+ * Is the given byte a character whose ordering is stable across collation
+ * library versions, i.e. an ASCII digit or letter?
+ */
+static inline bool
+pgcd_ascii_stable_byte(unsigned char c)
+{
+	return (c >= '0' && c <= '9') ||
+		(c >= 'A' && c <= 'Z') ||
+		(c >= 'a' && c <= 'z');
+}
+
+/*
+ * Check that the given string only contains stable characters.
+ *
+ * When SSE2 is available, 16 bytes are classified at once: a byte is in the
+ * [lo, hi] range iff (byte - lo), as an unsigned wrapping subtraction, is not
+ * greater than (hi - lo), which a saturating subtraction turns into a
+ * comparison with zero.
+ */
+static bool
+pgcd_ascii_stable_bytes(const char *s, size_t len)
+{
+	size_t		i = 0;
+
+#ifdef __SSE2__
+	{
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i digit_lo = _mm_set1_epi8('0');
+		const __m128i digit_len = _mm_set1_epi8('9' - '0');
+		const __m128i upper_lo = _mm_set1_epi8('A');
+		const __m128i lower_lo = _mm_set1_epi8('a');
+		const __m128i alpha_len = _mm_set1_epi8('Z' - 'A');
+
+		for (; i + sizeof(__m128i) <= len; i += sizeof(__m128i))
+		{
+			__m128i		v = _mm_loadu_si128((const __m128i *) (s + i));
+			__m128i		digit,
+						upper,
+						lower;
+
+			digit = _mm_cmpeq_epi8(_mm_subs_epu8(_mm_sub_epi8(v, digit_lo),
+												 digit_len), zero);
+			upper = _mm_cmpeq_epi8(_mm_subs_epu8(_mm_sub_epi8(v, upper_lo),
+												 alpha_len), zero);
+			lower = _mm_cmpeq_epi8(_mm_subs_epu8(_mm_sub_epi8(v, lower_lo),
+												 alpha_len), zero);
+
+			if (_mm_movemask_epi8(_mm_or_si128(digit,
+											   _mm_or_si128(upper, lower))) != 0xFFFF)
+				return false;
+		}
+	}
+#endif
+
+	for (; i < len; i++)
+	{
+		if (!pgcd_ascii_stable_byte((unsigned char) s[i]))
+			return false;
+	}
+
+	return true;
+}
+
+/*
+ * Check a single non-NULL value of the given (0-based) attribute.
+ */
+static bool
+pgcd_ascii_check_value(pgcdAsciiState *state, int attno, Datum value)
+{
+	const char *s;
+	size_t		len;
+	bool		res;
+	struct varlena *detoasted = NULL;
+
+	switch (state->kinds[attno])
+	{
+		case PGCD_ASCII_SKIP:
+			return true;
+		case PGCD_ASCII_NAME:
+			s = NameStr(*DatumGetName(value));
+			len = strnlen(s, NAMEDATALEN);
+			break;
+		case PGCD_ASCII_TEXT:
+		case PGCD_ASCII_BPCHAR:
+			detoasted = PG_DETOAST_DATUM_PACKED(value);
+			s = VARDATA_ANY(detoasted);
+			len = VARSIZE_ANY_EXHDR(detoasted);
+
+			/* Trailing spaces are not significant for bpchar. */
+			if (state->kinds[attno] == PGCD_ASCII_BPCHAR)
+			{
+				while (len > 0 && s[len - 1] == ' ')
+					len--;
+			}
+			break;
+		default:
+			elog(ERROR, "unexpected kind %d", state->kinds[attno]);
+			return false;		/* keep compiler quiet */
+	}
+
+	state->nvalues++;
+	res = pgcd_ascii_stable_bytes(s, len);
+
+	if (detoasted != NULL && detoasted != (struct varlena *) DatumGetPointer(value))
+		pfree(detoasted);
+
+	return res;
+}
+
+/*
+ * Is a collation other than the given one, or C or POSIX, used to compute
+ * the given index expression?  The collations only carried by the expression
+ * don't matter, as only the stored value is checked.
+ */
+static bool
+pgcd_ascii_expr_walker(Node *node, Oid *collid)
+{
+	Oid			inputcollid;
+	Oid			funcid = InvalidOid;
+
+	if (node == NULL)
+		return false;
+
+	inputcollid = exprInputCollation(node);
+	if (OidIsValid(inputcollid) && inputcollid != *collid &&
+		inputcollid != C_COLLATION_OID && inputcollid != POSIX_COLLATION_OID)
+		return true;
+
+	if (IsA(node, FuncExpr))
+		funcid = ((FuncExpr *) node)->funcid;
+	else if (IsA(node, OpExpr))
+		funcid = ((OpExpr *) node)->opfuncid;
+
+	/* SQL function bodies can compare text internally. */
+	if (OidIsValid(funcid))
+	{
+		ListCell   *lc;
+
+		foreach(lc, pgcd_get_function_collations(funcid))
+		{
+			if (lfirst_oid(lc) != C_COLLATION_OID &&
+				lfirst_oid(lc) != POSIX_COLLATION_OID)
+				return true;
+		}
+	}
+
+	return expression_tree_walker(node, pgcd_ascii_expr_walker,
+								  (void *) collid);
+}
+
+/*
+ * Figure out which key attributes need to be checked, and whether the index
+ * can be proven stable at all by looking at its keys.
+ *
+ * On failure state->reason is set.
+ */
+static void
+pgcd_ascii_prepare(Relation indrel, pgcdAsciiState *state)
+{
+	List	   *indexprs = RelationGetIndexExpressions(indrel);
+	List	   *indpred = RelationGetIndexPredicate(indrel);
+	ListCell   *indexpr_item = list_head(indexprs);
+
+	state->natts = IndexRelationGetNumberOfKeyAttributes(indrel);
+	state->kinds = palloc0(sizeof(pgcdAsciiKind) * state->natts);
+	state->nvalues = 0;
+	state->reason = NULL;
+
+	/*
+	 * The set of rows stored in a partial index depends on the collations
+	 * used in its predicate, which we can't check here.
+	 */
+	if (indpred != NIL &&
+		pgcd_get_query_expression_collations((Node *) make_ands_explicit(indpred)) != NIL)
+	{
+		state->reason = psprintf("index predicate depends on a collation");
+		return;
+	}
+
+	for (int i = 0; i < state->natts; i++)
+	{
+		Oid			collid = indrel->rd_indcollation[i];
+		Oid			typid;
+		Node	   *indexpr = NULL;
+
+		if (indrel->rd_index->indkey.values[i] == 0)
+		{
+			indexpr = (Node *) lfirst(indexpr_item);
+			indexpr_item = pgcd_lnext(indexprs, indexpr_item);
+		}
+
+		/*
+		 * An expression can hide a collation dependent result whatever the
+		 * collation of the key, e.g. (val > 'x') or
+		 * (lower(val COLLATE "en_US") COLLATE "C"), which we can't check by
+		 * looking at the stored value.
+		 */
+		if (indexpr != NULL && pgcd_ascii_expr_walker(indexpr, &collid))
+		{
+			state->reason = psprintf("index expression %d depends on a collation",
+									 i + 1);
+			return;
+		}
+
+		if (!OidIsValid(collid))
+			continue;
+
+		/* The C collation never changes, for plain columns at least. */
+		if (indexpr == NULL &&
+			(collid == C_COLLATION_OID || collid == POSIX_COLLATION_OID))
+			continue;
+
+		typid = getBaseType(TupleDescAttr(RelationGetDescr(indrel), i)->atttypid);
+		switch (typid)
+		{
+			case TEXTOID:
+			case VARCHAROID:
+				state->kinds[i] = PGCD_ASCII_TEXT;
+				break;
+			case BPCHAROID:
+				state->kinds[i] = PGCD_ASCII_BPCHAR;
+				break;
+			case NAMEOID:
+				state->kinds[i] = PGCD_ASCII_NAME;
+				break;
+			default:
+				state->reason = psprintf("index column %d of type %s cannot be checked",
+										 i + 1, format_type_be(typid));
+				return;
+		}
+	}
+}
+
+/*
+ * Check all the keys stored in the leaf pages of the given btree index.
+ */
+static void
+pgcd_ascii_scan_index(Relation indrel, pgcdAsciiState *state)
+{
+	TupleDesc	tupdesc = RelationGetDescr(indrel);
+	BlockNumber	nblocks = RelationGetNumberOfBlocks(indrel);
+	BlockNumber	prefetched = BTREE_METAPAGE + 1;
+	BufferAccessStrategy strategy = GetAccessStrategy(BAS_BULKREAD);
+	MemoryContext tmpctx,
+				oldcontext;
+
+	tmpctx = AllocSetContextCreate(CurrentMemoryContext,
+								   "pg_collation_index_ascii_check",
+								   ALLOCSET_DEFAULT_SIZES);
+
+	for (BlockNumber blkno = BTREE_METAPAGE + 1; blkno < nblocks; blkno++)
+	{
+		Buffer		buf;
+		Page		page;
+		BTPageOpaque opaque;
+		OffsetNumber off,
+					maxoff;
+		bool		unstable = false;
+
+		CHECK_FOR_INTERRUPTS();
+
+		/* Keep the read-ahead window full. */
+		for (; prefetched < nblocks && prefetched < blkno + PGCD_ASCII_PREFETCH;
+			 prefetched++)
+			(void) PrefetchBuffer(indrel, MAIN_FORKNUM, prefetched);
+
+		buf = ReadBufferExtended(indrel, MAIN_FORKNUM, blkno, RBM_NORMAL,
+								 strategy);
+		LockBuffer(buf, BT_READ);
+		page = BufferGetPage(buf);
+
+		if (PageIsNew(page))
+		{
+			UnlockReleaseBuffer(buf);
+			continue;
+		}
+
+		opaque = (BTPageOpaque) PageGetSpecialPointer(page);
+		if (!P_ISLEAF(opaque) || P_IGNORE(opaque))
+		{
+			UnlockReleaseBuffer(buf);
+			continue;
+		}
+
+		oldcontext = MemoryContextSwitchTo(tmpctx);
+
+		maxoff = PageGetMaxOffsetNumber(page);
+		for (off = P_FIRSTDATAKEY(opaque);
+			 off <= maxoff && !unstable;
+			 off = OffsetNumberNext(off))
+		{
+			IndexTuple	itup;
+
+			itup = (IndexTuple) PageGetItem(page, PageGetItemId(page, off));
+
+			for (int i = 0; i < state->natts; i++)
+			{
+				Datum		value;
+				bool		isnull;
+
+				if (state->kinds[i] == PGCD_ASCII_SKIP)
+					continue;
+
+				value = index_getattr(itup, i + 1, tupdesc, &isnull);
+				if (!isnull && !pgcd_ascii_check_value(state, i, value))
+				{
+					unstable = true;
+					break;
+				}
+			}
+
+			if (unstable)
+				break;
+		}
+
+		MemoryContextSwitchTo(oldcontext);
+		MemoryContextReset(tmpctx);
+
+		UnlockReleaseBuffer(buf);
+
+		if (unstable)
+		{
+			state->reason = psprintf("block %u offset %u contains a key with unstable characters",
+									 blkno, off);
+			break;
+		}
+	}
+
+	MemoryContextDelete(tmpctx);
+	FreeAccessStrategy(strategy);
+}
+
+/*
+ * Is the given tuple, returned by the heap scan, dead to everyone?
+ */
+static bool
+pgcd_ascii_tuple_is_dead(TableScanDesc scan, HeapTuple tup,
+						 TransactionId oldestxmin)
+{
+	Buffer		buf = pgcd_scan_buffer(scan);
+	HTSV_Result	res;
+
+	LockBuffer(buf, BUFFER_LOCK_SHARE);
+	res = HeapTupleSatisfiesVacuum(tup, oldestxmin, buf);
+	LockBuffer(buf, BUFFER_LOCK_UNLOCK);
+
+	return res == HEAPTUPLE_DEAD;
+}
+
+/*
+ * Check all the indexed columns in the underlying table.
+ *
+ * This works for any index access method, but only for plain column keys and
+ * heap tables.  All tuples are checked, including dead ones, as they can
+ * still be present in the index.  The TOAST data of the tuples that are dead
+ * to everyone, e.g. inserted by an aborted transaction, may already have been
+ * removed by a vacuum of the TOAST table, so their out of line values are
+ * skipped.
+ */
+static void
+pgcd_ascii_scan_heap(Relation indrel, pgcdAsciiState *state)
+{
+	Relation	heaprel;
+	TupleDesc	tupdesc;
+	TableScanDesc scan;
+	HeapTuple	tup;
+	TransactionId oldestxmin;
+	MemoryContext tmpctx,
+				oldcontext;
+
+	for (int i = 0; i < state->natts; i++)
+	{
+		if (state->kinds[i] != PGCD_ASCII_SKIP &&
+			indrel->rd_index->indkey.values[i] == 0)
+		{
+			state->reason = psprintf("index expression %d cannot be checked in the table",
+									 i + 1);
+			return;
+		}
+	}
+
+	heaprel = table_open(indrel->rd_index->indrelid, AccessShareLock);
+	tupdesc = RelationGetDescr(heaprel);
+
+#if PG_VERSION_NUM >= 120000
+	if (heaprel->rd_rel->relam != HEAP_TABLE_AM_OID)
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("cannot check table \"%s\"",
+						RelationGetRelationName(heaprel)),
+				 errdetail("Only tables using the heap access method can be checked.")));
+#endif
+
+#if PG_VERSION_NUM >= 140000
+	oldestxmin = GetOldestNonRemovableTransactionId(heaprel);
+#else
+	oldestxmin = GetOldestXmin(heaprel, PROCARRAY_FLAGS_VACUUM);
+#endif
+
+	tmpctx = AllocSetContextCreate(CurrentMemoryContext,
+								   "pg_collation_index_ascii_check",
+								   ALLOCSET_DEFAULT_SIZES);
+
+	scan = table_beginscan(heaprel, SnapshotAny, 0, NULL);
+
+	while (state->reason == NULL &&
+		   (tup = heap_getnext(scan, ForwardScanDirection)) != NULL)
+	{
+		int			dead = -1;	/* unknown yet */
+
+		CHECK_FOR_INTERRUPTS();
+
+		oldcontext = MemoryContextSwitchTo(tmpctx);
+
+		for (int i = 0; i < state->natts; i++)
+		{
+			Datum		value;
+			bool		isnull;
+
+			if (state->kinds[i] == PGCD_ASCII_SKIP)
+				continue;
+
+			value = heap_getattr(tup, indrel->rd_index->indkey.values[i],
+								 tupdesc, &isnull);
+			if (isnull)
+				continue;
+
+			/* Only look at the tuple visibility if it's needed. */
+			if (state->kinds[i] != PGCD_ASCII_NAME &&
+				VARATT_IS_EXTERNAL(DatumGetPointer(value)))
+			{
+				if (dead == -1)
+					dead = pgcd_ascii_tuple_is_dead(scan, tup, oldestxmin);
+				if (dead)
+					continue;
+			}
+
+			if (!pgcd_ascii_check_value(state, i, value))
+			{
+				state->reason = psprintf("row %s contains a value with unstable characters",
+										 DatumGetCString(DirectFunctionCall1(tidout,
+																			 PointerGetDatum(&tup->t_self))));
+				break;
+			}
+		}
+
+		MemoryContextSwitchTo(oldcontext);
+		if (state->reason == NULL)
+			MemoryContextReset(tmpctx);
+	}
+
+	table_endscan(scan);
+	table_close(heaprel, NoLock);
+
+	/* The reason may have been allocated there, so keep it for now. */
+	if (state->reason != NULL)
+		state->reason = pstrdup(state->reason);
+	MemoryContextDelete(tmpctx);
+}
+
+/*
+ * Return whether all the collatable keys of the given index only contain
+ * stable characters, and optionally record the index as verified for its
+ * current collation versions.
+ */
+Datum
+pg_collation_index_ascii_check(PG_FUNCTION_ARGS)
+{
+	Oid				indexoid = PG_GETARG_OID(0);
+	bool			from_heap = PG_GETARG_BOOL(1);
+	bool			mark_safe = PG_GETARG_BOOL(2);
+	Relation		indrel;
+	pgcdAsciiState	state;
+	TupleDesc		tupdesc;
+	Datum			values[PGCD_ASCII_COLS];
+	bool			nulls[PGCD_ASCII_COLS];
+
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	indrel = index_open(indexoid, AccessShareLock);
+
+	if (indrel->rd_rel->relkind == RELKIND_PARTITIONED_INDEX)
+		ereport(ERROR,
+				(errcode(ERRCODE_WRONG_OBJECT_TYPE),
+				 errmsg("cannot check partitioned index \"%s\"",
+						RelationGetRelationName(indrel)),
+				 errhint("Check each partition's index instead.")));
+
+	if (RELATION_IS_OTHER_TEMP(indrel))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("cannot check temporary indexes of other sessions")));
+
+	pgcd_ascii_prepare(indrel, &state);
+
+	if (state.reason == NULL)
+	{
+		if (from_heap || indrel->rd_rel->relam != BTREE_AM_OID)
+			pgcd_ascii_scan_heap(indrel, &state);
+		else
+			pgcd_ascii_scan_index(indrel, &state);
+	}
+
+	if (state.reason == NULL && mark_safe)
+		pgcd_record_verified(get_func_namespace(fcinfo->flinfo->fn_oid),
+							 RelationRelationId, indexoid,
+							 pgcd_index_deps(indexoid), "ascii");
+
+	index_close(indrel, NoLock);
+
+	memset(nulls, 0, sizeof(nulls));
+	values[0] = BoolGetDatum(state.reason == NULL);
+	values[1] = Int64GetDatum((int64) state.nvalues);
+	if (state.reason != NULL)
+		values[2] = CStringGetTextDatum(state.reason);
+	else
+		nulls[2] = true;
+
+	PG_RETURN_DATUM(HeapTupleGetDatum(heap_form_tuple(tupdesc, values, nulls)));
+}
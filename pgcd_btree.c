@@ -0,0 +1,683 @@
+/*-------------------------------------------------------------------------
+ *
+ * pgcd_btree.c: Verify that the content of a btree index is still correctly
+ *               ordered according to the current collation libraries.
+ *
+ * A collation version mismatch doesn't mean that an index is corrupted, only
+ * that it may be.  The code here reads the leaf pages directly and checks
+ * that adjacent keys, the page high key and the first key of the right
+ * sibling still compare in the expected order using the index support
+ * functions and collations, so that only
+ * indexes that are actually misordered need to be rebuilt.
+ *
+ * The work can be split between the backend and a set of dynamic background
+ * workers, which claim chunks of blocks from a shared counter.
+ *
+ * This program is open source, licensed under the PostgreSQL license.
+ * For license terms, see the LICENSE file.
+ *
+ * Copyright (C) 2022-2023: Julien Rouhaud
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include "access/genam.h"
+#include "access/nbtree.h"
+#include "access/xact.h"
+#include "catalog/pg_am.h"
+#if PG_VERSION_NUM >= 130000
+#include "common/hashfn.h"
+#endif
+#if PG_VERSION_NUM >= 150000
+#include "common/pg_prng.h"
+#endif
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "port/atomics.h"
+#include "postmaster/bgworker.h"
+#include "storage/bufmgr.h"
+#include "storage/dsm.h"
+#include "storage/proc.h"
+#include "storage/spin.h"
+#include "tcop/tcopprot.h"
+#include "utils/builtins.h"
+#if PG_VERSION_NUM < 130000
+#include "utils/hashutils.h"
+#endif
+#include "utils/memutils.h"
+#include "utils/rel.h"
+
+#include "pg_collation_dependencies.h"
+
+#define PGCD_BT_CHECK_COLS		5
+
+/* Number of blocks claimed at once by each participant. */
+#define PGCD_BT_CHUNK_SIZE		32
+
+/* Maximum length of the recorded key descriptions, including trailing \0. */
+#define PGCD_BT_KEY_LEN			256
+
+/*
+ * A single ordering violation, as reported by any of the participants.
+ */
+typedef struct pgcdBtViolation
+{
+	BlockNumber		blkno;
+	OffsetNumber	offnum;
+	bool			hikey;		/* violation against the page high key */
+	bool			has_prev;	/* is prev_key set? */
+	char			prev_key[PGCD_BT_KEY_LEN];
+	char			key[PGCD_BT_KEY_LEN];
+} pgcdBtViolation;
+
+/*
+ * State shared between the backend and the background workers, stored in a
+ * dynamic shared memory segment.
+ */
+typedef struct pgcdBtCheckShared
+{
+	/* Immutable once the workers are launched. */
+	Oid				dboid;
+	Oid				userid;
+	Oid				indexoid;
+	PGPROC		   *leader;
+	int				leader_pid;
+	BlockNumber		nblocks;
+	double			sample_fraction;
+	uint32			seed;
+	int				max_violations;
+
+	/* Next block to claim, and number of blocks processed. */
+	pg_atomic_uint64 next_block;
+	pg_atomic_uint64 blocks_done;
+
+	/* Set when participants should stop as soon as possible. */
+	pg_atomic_uint32 abort;
+
+	/* Protected by mutex. */
+	slock_t			mutex;
+	int				nviolations;
+	pgcdBtViolation	violations[FLEXIBLE_ARRAY_MEMBER];
+} pgcdBtCheckShared;
+
+/*
+ * Per-participant state.
+ */
+typedef struct pgcdBtCheckState
+{
+	Relation		indrel;
+	TupleDesc		tupdesc;
+	int				nkeyatts;
+	FmgrInfo	  **procs;
+	BufferAccessStrategy strategy;
+	MemoryContext	tmpctx;
+	pgcdBtCheckShared *shared;
+} pgcdBtCheckState;
+
+extern PGDLLEXPORT Datum	pg_collation_index_check(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(pg_collation_index_check);
+
+static void pgcd_bt_abort_callback(dsm_segment *seg, Datum arg);
+static Page pgcd_bt_read_page(pgcdBtCheckState *state, BlockNumber blkno);
+static void pgcd_bt_check_block(pgcdBtCheckState *state, BlockNumber blkno);
+static void pgcd_bt_check_index(Relation indrel, pgcdBtCheckShared *shared);
+static int pgcd_bt_compare(pgcdBtCheckState *state, IndexTuple a,
+						   IndexTuple b, int natts);
+static void pgcd_bt_describe(pgcdBtCheckState *state, IndexTuple itup,
+							 char *dst);
+static bool pgcd_bt_report(pgcdBtCheckState *state, BlockNumber blkno,
+						   OffsetNumber offnum, bool hikey, IndexTuple prev,
+						   IndexTuple itup);
+static bool pgcd_bt_sampled(pgcdBtCheckShared *shared, BlockNumber blkno);
+static int pgcd_bt_violation_cmp(const void *a, const void *b);
+
+/*
+ * Make sure that the other participants stop if the backend goes away, for
+ * instance after an error or a query cancel.
+ */
+static void
+pgcd_bt_abort_callback(dsm_segment *seg, Datum arg)
+{
+	pgcdBtCheckShared *shared = (pgcdBtCheckShared *) DatumGetPointer(arg);
+
+	pg_atomic_write_u32(&shared->abort, 1);
+}
+
+/*
+ * Should the given block be inspected?
+ *
+ * The decision only depends on the block number and the seed chosen by the
+ * backend, so all participants agree without having to share any state.
+ */
+static bool
+pgcd_bt_sampled(pgcdBtCheckShared *shared, BlockNumber blkno)
+{
+	uint32		h;
+
+	if (shared->sample_fraction >= 1.0)
+		return true;
+
+	h = murmurhash32(blkno ^ shared->seed);
+
+	return ((double) h / (double) PG_UINT32_MAX) < shared->sample_fraction;
+}
+
+/*
+ * Compare the first natts key attributes of the given index tuples, in the
+ * index order.
+ */
+static int
+pgcd_bt_compare(pgcdBtCheckState *state, IndexTuple a, IndexTuple b,
+				int natts)
+{
+	for (int i = 0; i < natts; i++)
+	{
+		int16		option = state->indrel->rd_indoption[i];
+		Datum		da,
+					db;
+		bool		na,
+					nb;
+		int32		cmp;
+
+		da = index_getattr(a, i + 1, state->tupdesc, &na);
+		db = index_getattr(b, i + 1, state->tupdesc, &nb);
+
+		if (na && nb)
+			cmp = 0;
+		else if (na)
+			cmp = (option & INDOPTION_NULLS_FIRST) ? -1 : 1;
+		else if (nb)
+			cmp = (option & INDOPTION_NULLS_FIRST) ? 1 : -1;
+		else
+		{
+			cmp = DatumGetInt32(FunctionCall2Coll(state->procs[i],
+												  state->indrel->rd_indcollation[i],
+												  da, db));
+			if (option & INDOPTION_DESC)
+				INVERT_COMPARE_RESULT(cmp);
+		}
+
+		if (cmp != 0)
+			return cmp;
+	}
+
+	return 0;
+}
+
+/*
+ * Store a human readable description of the given leaf tuple in dst.
+ *
+ * Returns an empty string if the user isn't allowed to see the underlying
+ * data.
+ */
+static void
+pgcd_bt_describe(pgcdBtCheckState *state, IndexTuple itup, char *dst)
+{
+	Datum		values[INDEX_MAX_KEYS];
+	bool		isnull[INDEX_MAX_KEYS];
+	char	   *desc;
+
+	index_deform_tuple(itup, state->tupdesc, values, isnull);
+	desc = BuildIndexValueDescription(state->indrel, values, isnull);
+
+	if (desc == NULL)
+		dst[0] = '\0';
+	else
+		strlcpy(dst, desc, PGCD_BT_KEY_LEN);
+}
+
+/*
+ * Remember a violation in the shared state.
+ *
+ * Returns false if enough violations have been found and the caller should
+ * stop.
+ */
+static bool
+pgcd_bt_report(pgcdBtCheckState *state, BlockNumber blkno,
+			   OffsetNumber offnum, bool hikey, IndexTuple prev,
+			   IndexTuple itup)
+{
+	pgcdBtCheckShared *shared = state->shared;
+	pgcdBtViolation v;
+	bool		cont = true;
+
+	v.blkno = blkno;
+	v.offnum = offnum;
+	v.hikey = hikey;
+	v.has_prev = (prev != NULL);
+	v.prev_key[0] = '\0';
+
+	/* High keys can be truncated, so don't try to describe them. */
+	if (prev != NULL)
+		pgcd_bt_describe(state, prev, v.prev_key);
+	pgcd_bt_describe(state, itup, v.key);
+
+	SpinLockAcquire(&shared->mutex);
+	if (shared->nviolations < shared->max_violations)
+		shared->violations[shared->nviolations++] = v;
+	if (shared->nviolations >= shared->max_violations)
+		cont = false;
+	SpinLockRelease(&shared->mutex);
+
+	if (!cont)
+		pg_atomic_write_u32(&shared->abort, 1);
+
+	return cont;
+}
+
+/*
+ * Return a local copy of the given block, allocated in the current memory
+ * context.
+ *
+ * The comparison support functions can be user-defined SQL functions, and
+ * describing a violation calls output functions and accesses the catalogs, so
+ * none of them can run while holding a buffer content lock.  As amcheck does,
+ * the checks are done on a copy of the page instead.
+ */
+static Page
+pgcd_bt_read_page(pgcdBtCheckState *state, BlockNumber blkno)
+{
+	Buffer		buf;
+	Page		page;
+
+	page = (Page) palloc(BLCKSZ);
+
+	buf = ReadBufferExtended(state->indrel, MAIN_FORKNUM, blkno, RBM_NORMAL,
+							 state->strategy);
+	LockBuffer(buf, BT_READ);
+	memcpy(page, BufferGetPage(buf), BLCKSZ);
+	UnlockReleaseBuffer(buf);
+
+	return page;
+}
+
+/*
+ * Check the ordering of a single block, if it's a live leaf page.
+ */
+static void
+pgcd_bt_check_block(pgcdBtCheckState *state, BlockNumber blkno)
+{
+	Page		page;
+	BTPageOpaque opaque;
+	OffsetNumber off,
+				maxoff;
+	IndexTuple	prev = NULL;
+	IndexTuple	hikey = NULL;
+	int			natts = 0;
+	BlockNumber	rightblk = P_NONE;
+	MemoryContext oldcontext;
+
+	oldcontext = MemoryContextSwitchTo(state->tmpctx);
+
+	page = pgcd_bt_read_page(state, blkno);
+
+	if (PageIsNew(page))
+		goto done;
+
+	opaque = (BTPageOpaque) PageGetSpecialPointer(page);
+
+	if (!P_ISLEAF(opaque) || P_IGNORE(opaque))
+		goto done;
+
+	maxoff = PageGetMaxOffsetNumber(page);
+	for (off = P_FIRSTDATAKEY(opaque); off <= maxoff; off = OffsetNumberNext(off))
+	{
+		IndexTuple	itup;
+
+		itup = (IndexTuple) PageGetItem(page, PageGetItemId(page, off));
+
+		if (prev != NULL &&
+			pgcd_bt_compare(state, prev, itup, state->nkeyatts) > 0)
+		{
+			if (!pgcd_bt_report(state, blkno, off, false, prev, itup))
+				break;
+		}
+
+		prev = itup;
+	}
+
+	/*
+	 * All items must be less than or equal to the high key, if any.  The high
+	 * key can have some of its trailing attributes truncated, only compare
+	 * the ones that are still present.  Since the items are ordered, it's
+	 * enough to check the last one.
+	 */
+	if (!P_RIGHTMOST(opaque) &&
+		pg_atomic_read_u32(&state->shared->abort) == 0)
+	{
+		hikey = (IndexTuple) PageGetItem(page, PageGetItemId(page, P_HIKEY));
+		natts = Min(BTreeTupleGetNAtts(hikey, state->indrel), state->nkeyatts);
+
+		if (prev != NULL && pgcd_bt_compare(state, prev, hikey, natts) > 0)
+			pgcd_bt_report(state, blkno, maxoff, true, NULL, prev);
+
+		rightblk = opaque->btpo_next;
+	}
+
+	/*
+	 * The items of the right sibling must also be greater than or equal to
+	 * the high key, otherwise an inversion across the page boundary would go
+	 * unnoticed.  Again it's enough to check its first item.  The sibling is
+	 * read after the page, but a concurrent split only moves items further
+	 * right, and deleted or half-dead pages are ignored.
+	 */
+	if (hikey != NULL && pg_atomic_read_u32(&state->shared->abort) == 0)
+	{
+		page = pgcd_bt_read_page(state, rightblk);
+
+		if (!PageIsNew(page))
+		{
+			opaque = (BTPageOpaque) PageGetSpecialPointer(page);
+
+			if (P_ISLEAF(opaque) && !P_IGNORE(opaque) &&
+				P_FIRSTDATAKEY(opaque) <= PageGetMaxOffsetNumber(page))
+			{
+				IndexTuple	first;
+
+				off = P_FIRSTDATAKEY(opaque);
+				first = (IndexTuple) PageGetItem(page, PageGetItemId(page, off));
+
+				if (pgcd_bt_compare(state, hikey, first, natts) > 0)
+					pgcd_bt_report(state, rightblk, off, true, NULL, first);
+			}
+		}
+	}
+
+done:
+	MemoryContextSwitchTo(oldcontext);
+	MemoryContextReset(state->tmpctx);
+}
+
+/*
+ * Main loop for all participants: claim chunks of blocks until there's
+ * nothing left to do or enough violations have been found.
+ */
+static void
+pgcd_bt_check_index(Relation indrel, pgcdBtCheckShared *shared)
+{
+	pgcdBtCheckState state;
+
+	state.indrel = indrel;
+	state.tupdesc = RelationGetDescr(indrel);
+	state.nkeyatts = IndexRelationGetNumberOfKeyAttributes(indrel);
+	state.procs = palloc(sizeof(FmgrInfo *) * state.nkeyatts);
+	for (int i = 0; i < state.nkeyatts; i++)
+		state.procs[i] = index_getprocinfo(indrel, i + 1, BTORDER_PROC);
+	state.strategy = GetAccessStrategy(BAS_BULKREAD);
+	state.tmpctx = AllocSetContextCreate(CurrentMemoryContext,
+										 "pg_collation_index_check",
+										 ALLOCSET_DEFAULT_SIZES);
+	state.shared = shared;
+
+	while (pg_atomic_read_u32(&shared->abort) == 0)
+	{
+		uint64		start;
+		BlockNumber	end;
+
+		start = pg_atomic_fetch_add_u64(&shared->next_block,
+										PGCD_BT_CHUNK_SIZE);
+		if (start >= shared->nblocks)
+			break;
+		end = Min(start + PGCD_BT_CHUNK_SIZE, shared->nblocks);
+
+		/* Issue read-ahead for the sampled blocks of the chunk. */
+		for (BlockNumber blkno = start; blkno < end; blkno++)
+		{
+			if (pgcd_bt_sampled(shared, blkno))
+				(void) PrefetchBuffer(indrel, MAIN_FORKNUM, blkno);
+		}
+
+		for (BlockNumber blkno = start; blkno < end; blkno++)
+		{
+			CHECK_FOR_INTERRUPTS();
+
+			/* The metapage doesn't need any check. */
+			if (blkno != BTREE_METAPAGE && pgcd_bt_sampled(shared, blkno))
+				pgcd_bt_check_block(&state, blkno);
+
+			pg_atomic_fetch_add_u64(&shared->blocks_done, 1);
+
+			if (pg_atomic_read_u32(&shared->abort) != 0)
+				break;
+		}
+	}
+
+	FreeAccessStrategy(state.strategy);
+	MemoryContextDelete(state.tmpctx);
+}
+
+/*
+ * Entry point for the dynamic background workers.
+ */
+void
+pgcd_btree_check_worker_main(Datum main_arg)
+{
+	dsm_segment *seg;
+	pgcdBtCheckShared *shared;
+	Relation	indrel;
+
+	pqsignal(SIGTERM, die);
+	BackgroundWorkerUnblockSignals();
+
+	seg = dsm_attach(DatumGetUInt32(main_arg));
+	if (seg == NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("could not map dynamic shared memory segment")));
+	shared = (pgcdBtCheckShared *) dsm_segment_address(seg);
+
+	/*
+	 * Join the backend lock group, so that our locks can't deadlock with the
+	 * ones it's holding.  If the backend already exited there's nothing left
+	 * to do.
+	 */
+	if (!BecomeLockGroupMember(shared->leader, shared->leader_pid))
+		return;
+
+	BackgroundWorkerInitializeConnectionByOid(shared->dboid, shared->userid,
+											  0);
+
+	StartTransactionCommand();
+
+	indrel = index_open(shared->indexoid, AccessShareLock);
+	pgcd_bt_check_index(indrel, shared);
+	index_close(indrel, AccessShareLock);
+
+	CommitTransactionCommand();
+
+	dsm_detach(seg);
+}
+
+/*
+ * qsort comparator for violations, in physical order.
+ */
+static int
+pgcd_bt_violation_cmp(const void *a, const void *b)
+{
+	const pgcdBtViolation *v1 = (const pgcdBtViolation *) a;
+	const pgcdBtViolation *v2 = (const pgcdBtViolation *) b;
+
+	if (v1->blkno != v2->blkno)
+		return (v1->blkno < v2->blkno) ? -1 : 1;
+	if (v1->offnum != v2->offnum)
+		return (v1->offnum < v2->offnum) ? -1 : 1;
+	return (int) v1->hikey - (int) v2->hikey;
+}
+
+/*
+ * SRF returning the ordering violations found in the given btree index,
+ * according to the current collation libraries.
+ */
+Datum
+pg_collation_index_check(PG_FUNCTION_ARGS)
+{
+	Oid				indexoid = PG_GETARG_OID(0);
+	double			sample_fraction = PG_GETARG_FLOAT8(1);
+	int				max_violations = PG_GETARG_INT32(2);
+	int				nworkers = PG_GETARG_INT32(3);
+	ReturnSetInfo  *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	Relation		indrel;
+	dsm_segment	   *seg;
+	pgcdBtCheckShared *shared;
+	BackgroundWorkerHandle **handles;
+	int				nlaunched = 0;
+	bool			aborted;
+
+	if (sample_fraction <= 0 || sample_fraction > 1)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("sample_fraction must be in the (0, 1] range")));
+
+	if (max_violations < 1)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("max_violations must be at least 1")));
+
+	if (nworkers < 0)
+		nworkers = max_parallel_maintenance_workers;
+
+	InitMaterializedSRF(fcinfo, MAT_SRF_USE_EXPECTED_DESC);
+
+	indrel = index_open(indexoid, AccessShareLock);
+
+	if (indrel->rd_rel->relam != BTREE_AM_OID)
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("\"%s\" is not a btree index",
+						RelationGetRelationName(indrel))));
+
+	if (RELATION_IS_OTHER_TEMP(indrel))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("cannot check temporary indexes of other sessions")));
+
+	if (!indrel->rd_index->indisvalid)
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("cannot check index \"%s\"",
+						RelationGetRelationName(indrel)),
+				 errdetail("Index is not valid.")));
+
+	/* Temporary relations can only be read by the owning backend. */
+	if (indrel->rd_rel->relpersistence == RELPERSISTENCE_TEMP)
+		nworkers = 0;
+
+	seg = dsm_create(offsetof(pgcdBtCheckShared, violations) +
+					 sizeof(pgcdBtViolation) * max_violations, 0);
+	shared = (pgcdBtCheckShared *) dsm_segment_address(seg);
+
+	shared->dboid = MyDatabaseId;
+	shared->userid = GetUserId();
+	shared->indexoid = indexoid;
+	shared->leader = MyProc;
+	shared->leader_pid = MyProcPid;
+	shared->nblocks = RelationGetNumberOfBlocks(indrel);
+	shared->sample_fraction = sample_fraction;
+#if PG_VERSION_NUM >= 150000
+	shared->seed = pg_prng_uint32(&pg_global_prng_state);
+#else
+	shared->seed = (uint32) random();
+#endif
+	shared->max_violations = max_violations;
+	pg_atomic_init_u64(&shared->next_block, 0);
+	pg_atomic_init_u64(&shared->blocks_done, 0);
+	pg_atomic_init_u32(&shared->abort, 0);
+	SpinLockInit(&shared->mutex);
+	shared->nviolations = 0;
+
+	on_dsm_detach(seg, pgcd_bt_abort_callback, PointerGetDatum(shared));
+
+	/* Don't bother with workers for small indexes. */
+	nworkers = Min(nworkers,
+				   (int) (shared->nblocks / PGCD_BT_CHUNK_SIZE));
+
+	handles = palloc0(sizeof(BackgroundWorkerHandle *) * Max(nworkers, 1));
+	if (nworkers > 0)
+		BecomeLockGroupLeader();
+
+	for (int i = 0; i < nworkers; i++)
+	{
+		BackgroundWorker worker;
+
+		memset(&worker, 0, sizeof(worker));
+		worker.bgw_flags = BGWORKER_SHMEM_ACCESS |
+			BGWORKER_BACKEND_DATABASE_CONNECTION;
+		worker.bgw_start_time = BgWorkerStart_ConsistentState;
+		worker.bgw_restart_time = BGW_NEVER_RESTART;
+		snprintf(worker.bgw_library_name, BGW_MAXLEN,
+				 "pg_collation_dependencies");
+		snprintf(worker.bgw_function_name, BGW_MAXLEN,
+				 "pgcd_btree_check_worker_main");
+		snprintf(worker.bgw_name, BGW_MAXLEN,
+				 "pg_collation_dependencies index check for %u", indexoid);
+		snprintf(worker.bgw_type, BGW_MAXLEN,
+				 "pg_collation_dependencies index check");
+		worker.bgw_main_arg = UInt32GetDatum(dsm_segment_handle(seg));
+		worker.bgw_notify_pid = MyProcPid;
+
+		/* Simply go on with fewer workers if there's no slot available. */
+		if (!RegisterDynamicBackgroundWorker(&worker, &handles[nlaunched]))
+			break;
+		nlaunched++;
+	}
+
+	/* Participate in the check too. */
+	pgcd_bt_check_index(indrel, shared);
+
+	for (int i = 0; i < nlaunched; i++)
+		WaitForBackgroundWorkerShutdown(handles[i]);
+
+	/*
+	 * If a worker failed, the blocks it claimed may not have been checked.
+	 * That's only acceptable if we stopped early on purpose.
+	 */
+	SpinLockAcquire(&shared->mutex);
+	aborted = (shared->nviolations >= shared->max_violations);
+	SpinLockRelease(&shared->mutex);
+
+	if (!aborted &&
+		pg_atomic_read_u64(&shared->blocks_done) < shared->nblocks)
+		ereport(ERROR,
+				(errcode(ERRCODE_INTERNAL_ERROR),
+				 errmsg("could not check all blocks of index \"%s\"",
+						RelationGetRelationName(indrel)),
+				 errhint("A background worker probably failed, check the server logs.")));
+
+	qsort(shared->violations, shared->nviolations, sizeof(pgcdBtViolation),
+		  pgcd_bt_violation_cmp);
+
+	for (int i = 0; i < shared->nviolations; i++)
+	{
+		pgcdBtViolation *v = &shared->violations[i];
+		Datum			values[PGCD_BT_CHECK_COLS];
+		bool			nulls[PGCD_BT_CHECK_COLS];
+		int				col = 0;
+
+		memset(values, 0, sizeof(values));
+		memset(nulls, 0, sizeof(nulls));
+
+		values[col++] = Int64GetDatum((int64) v->blkno);
+		values[col++] = Int32GetDatum((int32) v->offnum);
+		values[col++] = CStringGetTextDatum(v->hikey ? "high key" : "order");
+
+		if (v->has_prev && v->prev_key[0] != '\0')
+			values[col++] = CStringGetTextDatum(v->prev_key);
+		else
+			nulls[col++] = true;
+
+		if (v->key[0] != '\0')
+			values[col++] = CStringGetTextDatum(v->key);
+		else
+			nulls[col++] = true;
+
+		tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values, nulls);
+	}
+
+	dsm_detach(seg);
+	index_close(indrel, AccessShareLock);
+
+	return (Datum) 0;
+}
@@ -0,0 +1,732 @@
+/*-------------------------------------------------------------------------
+ *
+ * pgcd_bulk.c: Find the collation dependencies of all the objects in the
+ *              database in a single pass, isolating per-object failures.
+ *
+ * A database-wide scan can take a long time, and a single unexpected object
+ * (a node type introduced in a newer major version, an object concurrently
+ * dropped...) should not throw away all the work already done.  The objects
+ * are processed in batches, each in its own subtransaction.  If a batch
+ * fails, its objects are processed again one at a time, so that only the
+ * faulty ones are reported as errors.
+ *
+ * This program is open source, licensed under the PostgreSQL license.
+ * For license terms, see the LICENSE file.
+ *
+ * Copyright (C) 2022-2023: Julien Rouhaud
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include "access/genam.h"
+#include "access/htup_details.h"
+#if PG_VERSION_NUM >= 120000
+#include "access/table.h"
+#endif
+#include "access/transam.h"
+#include "access/xact.h"
+#if PG_VERSION_NUM < 140000
+#include "catalog/indexing.h"
+#endif
+#include "catalog/pg_attrdef.h"
+#include "catalog/pg_class.h"
+#include "catalog/pg_constraint.h"
+#include "catalog/pg_index.h"
+#include "executor/spi.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "utils/builtins.h"
+#include "utils/fmgroids.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/resowner.h"
+#include "utils/syscache.h"
+
+#include "pg_collation_dependencies.h"
+
+#define PGCD_ALL_DEP_COLS			5
+
+/* Number of objects processed in a single subtransaction */
+#define PGCD_BULK_BATCH_SIZE		64
+
+/* Keep in sync with pgcdBulkKind */
+static const char *const pgcdBulkKindNames[] = {
+	"index",
+	"constraint",
+	"materialized view",
+	"view",
+	"partition",
+	"generated column"
+};
+
+typedef struct pgcdBulkState
+{
+	pgcdBulkObject *objects;
+	int			nobjects;
+	int			maxobjects;
+} pgcdBulkState;
+
+/* State of pg_collation_all_dependencies_stream() across calls */
+typedef struct pgcdBulkStream
+{
+	pgcdBulkState state;		/* all the objects to process */
+	int			batch_end;		/* end of the current batch */
+	int			cur;			/* current object */
+	int			curcoll;		/* next collation of the current object */
+	bool		broken_only;	/* only return broken dependencies */
+	char	   *coll_query;		/* is a collation outdated? */
+	char	   *ledger_query;	/* was an object verified? */
+	List	   *outdated;		/* collations known to be outdated */
+	List	   *uptodate;		/* collations known to be up to date */
+	MemoryContext batchcxt;		/* dependencies of the current batch */
+} pgcdBulkStream;
+
+extern PGDLLEXPORT Datum	pg_collation_all_dependencies(PG_FUNCTION_ARGS);
+extern PGDLLEXPORT Datum	pg_collation_all_dependencies_stream(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(pg_collation_all_dependencies);
+PG_FUNCTION_INFO_V1(pg_collation_all_dependencies_stream);
+
+static void pgcd_bulk_add(pgcdBulkState *state, pgcdBulkKind kind,
+						  Oid tbloid, Oid objoid, AttrNumber attnum);
+static void pgcd_bulk_collect(pgcdBulkState *state);
+static List *pgcd_bulk_object_deps(pgcdBulkObject *obj);
+static bool pgcd_bulk_object_exists(pgcdBulkObject *obj);
+static bool pgcd_bulk_process(pgcdBulkObject *objects, int nobjects,
+							  char **error);
+static void pgcd_bulk_process_batch(pgcdBulkObject *objects, int nobjects);
+static void pgcd_bulk_values(pgcdBulkObject *obj, Oid collid, Datum *values,
+							 bool *nulls);
+static bool pgcd_bulk_query_bool(const char *query, int nargs, Oid *argtypes,
+								 Datum *args);
+static bool pgcd_bulk_is_broken(pgcdBulkStream *stream, pgcdBulkObject *obj,
+								Oid collid);
+
+/*
+ * Add an object to process.
+ */
+static void
+pgcd_bulk_add(pgcdBulkState *state, pgcdBulkKind kind, Oid tbloid,
+			  Oid objoid, AttrNumber attnum)
+{
+	pgcdBulkObject *obj;
+
+	if (state->nobjects >= state->maxobjects)
+	{
+		state->maxobjects *= 2;
+		state->objects = repalloc(state->objects,
+								  sizeof(pgcdBulkObject) * state->maxobjects);
+	}
+
+	obj = &state->objects[state->nobjects++];
+	obj->kind = kind;
+	obj->tbloid = tbloid;
+	obj->objoid = objoid;
+	obj->attnum = attnum;
+	obj->collations = NIL;
+	obj->error = NULL;
+}
+
+/*
+ * Gather all the objects that can depend on a collation, with the same
+ * filtering as the underlying per-kind views.  Only the catalogs are read
+ * here, so this part isn't expected to fail.
+ */
+static void
+pgcd_bulk_collect(pgcdBulkState *state)
+{
+	Relation	rel;
+	SysScanDesc scan;
+	HeapTuple	tup;
+
+	rel = table_open(IndexRelationId, AccessShareLock);
+	scan = systable_beginscan(rel, InvalidOid, false, NULL, 0, NULL);
+	while (HeapTupleIsValid(tup = systable_getnext(scan)))
+	{
+		Form_pg_index index = (Form_pg_index) GETSTRUCT(tup);
+
+		pgcd_bulk_add(state, PGCD_BULK_INDEX, index->indrelid,
+					  index->indexrelid, InvalidAttrNumber);
+	}
+	systable_endscan(scan);
+	table_close(rel, AccessShareLock);
+
+	rel = table_open(ConstraintRelationId, AccessShareLock);
+	scan = systable_beginscan(rel, InvalidOid, false, NULL, 0, NULL);
+	while (HeapTupleIsValid(tup = systable_getnext(scan)))
+	{
+		Form_pg_constraint con = (Form_pg_constraint) GETSTRUCT(tup);
+		Oid			conoid;
+
+		if (!OidIsValid(con->conrelid))
+			continue;
+
+#if PG_VERSION_NUM >= 120000
+		conoid = con->oid;
+#else
+		conoid = HeapTupleGetOid(tup);
+#endif
+		pgcd_bulk_add(state, PGCD_BULK_CONSTRAINT, con->conrelid, conoid,
+					  InvalidAttrNumber);
+	}
+	systable_endscan(scan);
+	table_close(rel, AccessShareLock);
+
+	/* Views and partitions, in a single pass over pg_class */
+	rel = table_open(RelationRelationId, AccessShareLock);
+	scan = systable_beginscan(rel, InvalidOid, false, NULL, 0, NULL);
+	while (HeapTupleIsValid(tup = systable_getnext(scan)))
+	{
+		Form_pg_class classForm = (Form_pg_class) GETSTRUCT(tup);
+		Oid			relid;
+
+#if PG_VERSION_NUM >= 120000
+		relid = classForm->oid;
+#else
+		relid = HeapTupleGetOid(tup);
+#endif
+
+		if (relid >= FirstNormalObjectId)
+		{
+			if (classForm->relkind == RELKIND_MATVIEW)
+				pgcd_bulk_add(state, PGCD_BULK_MATVIEW, InvalidOid, relid,
+							  InvalidAttrNumber);
+			else if (classForm->relkind == RELKIND_VIEW)
+				pgcd_bulk_add(state, PGCD_BULK_VIEW, InvalidOid, relid,
+							  InvalidAttrNumber);
+		}
+
+		if (classForm->relkind == RELKIND_PARTITIONED_TABLE ||
+			(classForm->relispartition &&
+			 classForm->relkind != RELKIND_INDEX &&
+			 classForm->relkind != RELKIND_PARTITIONED_INDEX))
+			pgcd_bulk_add(state, PGCD_BULK_PARTITION, relid, relid,
+						  InvalidAttrNumber);
+	}
+	systable_endscan(scan);
+	table_close(rel, AccessShareLock);
+
+#if PG_VERSION_NUM >= 120000
+	rel = table_open(AttrDefaultRelationId, AccessShareLock);
+	scan = systable_beginscan(rel, InvalidOid, false, NULL, 0, NULL);
+	while (HeapTupleIsValid(tup = systable_getnext(scan)))
+	{
+		Form_pg_attrdef attrdef = (Form_pg_attrdef) GETSTRUCT(tup);
+
+		if (get_attgenerated(attrdef->adrelid, attrdef->adnum) !=
+			ATTRIBUTE_GENERATED_STORED)
+			continue;
+
+		pgcd_bulk_add(state, PGCD_BULK_GENERATED, attrdef->adrelid,
+					  attrdef->oid, attrdef->adnum);
+	}
+	systable_endscan(scan);
+	table_close(rel, AccessShareLock);
+#endif
+}
+
+/*
+ * Get the collation dependencies of a single object.
+ */
+static List *
+pgcd_bulk_object_deps(pgcdBulkObject *obj)
+{
+	switch (obj->kind)
+	{
+		case PGCD_BULK_INDEX:
+			return pgcd_index_deps(obj->objoid);
+		case PGCD_BULK_CONSTRAINT:
+			return pgcd_constraint_deps(obj->objoid);
+		case PGCD_BULK_MATVIEW:
+			return pgcd_matview_deps(obj->objoid);
+		case PGCD_BULK_VIEW:
+			return pgcd_view_deps(obj->objoid);
+		case PGCD_BULK_PARTITION:
+			return pgcd_partition_deps(obj->objoid);
+		case PGCD_BULK_GENERATED:
+			return pgcd_generated_column_deps(obj->tbloid, obj->attnum);
+	}
+
+	elog(ERROR, "unexpected object kind %d", obj->kind);
+	return NIL;					/* keep compiler quiet */
+}
+
+/*
+ * Check whether the given object still exists.  Objects dropped since they
+ * were collected aren't reported as errors, they're simply ignored.
+ */
+static bool
+pgcd_bulk_object_exists(pgcdBulkObject *obj)
+{
+	switch (obj->kind)
+	{
+		case PGCD_BULK_CONSTRAINT:
+			return SearchSysCacheExists1(CONSTROID,
+										 ObjectIdGetDatum(obj->objoid));
+#if PG_VERSION_NUM >= 120000
+		case PGCD_BULK_GENERATED:
+			{
+				Relation	rel;
+				ScanKeyData key;
+				SysScanDesc scan;
+				bool		found;
+
+				/* There's no syscache on pg_attrdef oid. */
+				rel = table_open(AttrDefaultRelationId, AccessShareLock);
+				ScanKeyInit(&key,
+							Anum_pg_attrdef_oid,
+							BTEqualStrategyNumber, F_OIDEQ,
+							ObjectIdGetDatum(obj->objoid));
+				scan = systable_beginscan(rel, AttrDefaultOidIndexId, true,
+										  NULL, 1, &key);
+				found = HeapTupleIsValid(systable_getnext(scan));
+				systable_endscan(scan);
+				table_close(rel, AccessShareLock);
+
+				return found;
+			}
+#endif
+		default:
+			/* Indexes, materialized views, views and partitions are relations. */
+			return SearchSysCacheExists1(RELOID,
+										 ObjectIdGetDatum(obj->objoid));
+	}
+}
+
+/*
+ * Get the collation dependencies of the given objects in a subtransaction,
+ * and return whether it succeeded.  On failure, the error message is returned
+ * in *error.
+ *
+ * The dependencies are allocated in the caller's memory context, so they
+ * survive the subtransaction.  Nothing is written, so the subtransaction is
+ * rolled back even on success: this releases the locks taken on the objects
+ * of the batch right away, rather than accumulating a lock per object until
+ * the end of the transaction.  This keeps the lock table usage bounded, and
+ * on a hot standby it also limits the conflicts with the replay of
+ * AccessExclusiveLock taken on the primary.
+ */
+static bool
+pgcd_bulk_process(pgcdBulkObject *objects, int nobjects, char **error)
+{
+	MemoryContext oldcontext = CurrentMemoryContext;
+	ResourceOwner oldowner = CurrentResourceOwner;
+	volatile bool ok = true;
+
+	BeginInternalSubTransaction(NULL);
+	MemoryContextSwitchTo(oldcontext);
+
+	PG_TRY();
+	{
+		int			i;
+
+		for (i = 0; i < nobjects; i++)
+		{
+			CHECK_FOR_INTERRUPTS();
+
+			objects[i].collations = pgcd_bulk_object_deps(&objects[i]);
+		}
+
+		RollbackAndReleaseCurrentSubTransaction();
+		MemoryContextSwitchTo(oldcontext);
+		CurrentResourceOwner = oldowner;
+	}
+	PG_CATCH();
+	{
+		ErrorData  *edata;
+
+		MemoryContextSwitchTo(oldcontext);
+		edata = CopyErrorData();
+		FlushErrorState();
+
+		RollbackAndReleaseCurrentSubTransaction();
+		MemoryContextSwitchTo(oldcontext);
+		CurrentResourceOwner = oldowner;
+
+		/*
+		 * Like plpgsql's WHEN OTHERS, don't swallow errors that aren't about
+		 * the object being processed, e.g. a query cancel, a shutdown request
+		 * or running out of memory.
+		 */
+		if (ERRCODE_TO_CATEGORY(edata->sqlerrcode) == ERRCODE_OPERATOR_INTERVENTION ||
+			ERRCODE_TO_CATEGORY(edata->sqlerrcode) == ERRCODE_INSUFFICIENT_RESOURCES)
+			ReThrowError(edata);
+
+		*error = edata->message;
+		ok = false;
+	}
+	PG_END_TRY();
+
+	return ok;
+}
+
+/*
+ * Get the collation dependencies of the given batch of objects.  If the batch
+ * fails, its objects are processed again one at a time to find the faulty
+ * ones, whose error message is saved in their error field.
+ */
+static void
+pgcd_bulk_process_batch(pgcdBulkObject *objects, int nobjects)
+{
+	char	   *error;
+	int			i;
+
+	if (pgcd_bulk_process(objects, nobjects, &error))
+		return;
+
+	for (i = 0; i < nobjects; i++)
+	{
+		pgcdBulkObject *obj = &objects[i];
+
+		obj->collations = NIL;
+		if (!pgcd_bulk_process(obj, 1, &error) &&
+			pgcd_bulk_object_exists(obj))
+			obj->error = error;
+	}
+}
+
+/*
+ * Get the name of the given object kind, as reported in the dep_kind columns.
+ */
+const char *
+pgcd_bulk_kind_name(pgcdBulkKind kind)
+{
+	return pgcdBulkKindNames[kind];
+}
+
+/*
+ * Get the collation dependencies of all the objects in the database, and
+ * return them as an array of *nobjects elements.
+ *
+ * Instead of aborting the whole scan, the error message of an object that
+ * can't be processed is saved in its error field.
+ */
+pgcdBulkObject *
+pgcd_bulk_scan(int *nobjects)
+{
+	pgcdBulkState	state;
+	int				start;
+
+	state.nobjects = 0;
+	state.maxobjects = 1024;
+	state.objects = palloc(sizeof(pgcdBulkObject) * state.maxobjects);
+
+	pgcd_bulk_collect(&state);
+
+	for (start = 0; start < state.nobjects; start += PGCD_BULK_BATCH_SIZE)
+		pgcd_bulk_process_batch(&state.objects[start],
+								Min(PGCD_BULK_BATCH_SIZE,
+									state.nobjects - start));
+
+	*nobjects = state.nobjects;
+
+	return state.objects;
+}
+
+/*
+ * Fill the output columns for the given object and collation, or for its
+ * error if the object couldn't be processed.
+ */
+static void
+pgcd_bulk_values(pgcdBulkObject *obj, Oid collid, Datum *values, bool *nulls)
+{
+	memset(nulls, 0, sizeof(bool) * PGCD_ALL_DEP_COLS);
+
+	values[0] = CStringGetTextDatum(pgcd_bulk_kind_name(obj->kind));
+	values[1] = ObjectIdGetDatum(obj->tbloid);
+	nulls[1] = !OidIsValid(obj->tbloid);
+	values[2] = ObjectIdGetDatum(obj->objoid);
+
+	if (obj->error != NULL)
+	{
+		nulls[3] = true;
+		values[4] = CStringGetTextDatum(obj->error);
+	}
+	else
+	{
+		values[3] = ObjectIdGetDatum(collid);
+		nulls[4] = true;
+	}
+}
+
+/*
+ * SRF returning the collation dependencies of all the objects in the
+ * database.
+ *
+ * An object that can't be processed is returned once with a NULL collation
+ * and the error message.
+ */
+Datum
+pg_collation_all_dependencies(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo  *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	pgcdBulkObject *objects;
+	int				nobjects;
+	int				i;
+
+	InitMaterializedSRF(fcinfo, MAT_SRF_USE_EXPECTED_DESC);
+
+	objects = pgcd_bulk_scan(&nobjects);
+
+	for (i = 0; i < nobjects; i++)
+	{
+		pgcdBulkObject *obj = &objects[i];
+		Datum			values[PGCD_ALL_DEP_COLS];
+		bool			nulls[PGCD_ALL_DEP_COLS];
+		ListCell	   *lc;
+
+		if (obj->error != NULL)
+		{
+			pgcd_bulk_values(obj, InvalidOid, values, nulls);
+			tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values,
+								 nulls);
+			continue;
+		}
+
+		foreach(lc, obj->collations)
+		{
+			pgcd_bulk_values(obj, lfirst_oid(lc), values, nulls);
+			tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values,
+								 nulls);
+		}
+	}
+
+	return (Datum) 0;
+}
+
+/*
+ * Execute the given read-only query returning a single boolean.
+ */
+static bool
+pgcd_bulk_query_bool(const char *query, int nargs, Oid *argtypes, Datum *args)
+{
+	bool		res = false;
+	bool		isnull;
+	int			ret;
+
+	if (SPI_connect() != SPI_OK_CONNECT)
+		elog(ERROR, "SPI_connect failed");
+
+	ret = SPI_execute_with_args(query, nargs, argtypes, args, NULL, true, 1);
+	if (ret != SPI_OK_SELECT)
+		elog(ERROR, "SPI_execute failed: %s", SPI_result_code_string(ret));
+
+	if (SPI_processed == 1)
+	{
+		Datum		datum = SPI_getbinval(SPI_tuptable->vals[0],
+										  SPI_tuptable->tupdesc, 1, &isnull);
+
+		res = !isnull && DatumGetBool(datum);
+	}
+
+	SPI_finish();
+
+	return res;
+}
+
+/*
+ * Check whether the given dependency would be reported by the
+ * pg_collation_broken_dependencies view.
+ *
+ * The status of each collation is only computed once per call, and the
+ * ledger is only looked up for the dependencies on an outdated collation.
+ */
+static bool
+pgcd_bulk_is_broken(pgcdBulkStream *stream, pgcdBulkObject *obj, Oid collid)
+{
+	Datum		args[3];
+	Oid			argtypes[3] = {OIDOID, OIDOID, OIDOID};
+
+	if (list_member_oid(stream->uptodate, collid))
+		return false;
+
+	if (!list_member_oid(stream->outdated, collid))
+	{
+		MemoryContext oldcontext;
+		bool		outdated;
+
+		args[0] = ObjectIdGetDatum(collid);
+		outdated = pgcd_bulk_query_bool(stream->coll_query, 1, argtypes, args);
+
+		/* The lists live as long as the stream. */
+		oldcontext = MemoryContextSwitchTo(GetMemoryChunkContext(stream));
+		if (outdated)
+			stream->outdated = lappend_oid(stream->outdated, collid);
+		else
+			stream->uptodate = lappend_oid(stream->uptodate, collid);
+		MemoryContextSwitchTo(oldcontext);
+
+		if (!outdated)
+			return false;
+	}
+
+	switch (obj->kind)
+	{
+		case PGCD_BULK_CONSTRAINT:
+			args[0] = ObjectIdGetDatum(ConstraintRelationId);
+			break;
+		case PGCD_BULK_GENERATED:
+			args[0] = ObjectIdGetDatum(AttrDefaultRelationId);
+			break;
+		default:
+			args[0] = ObjectIdGetDatum(RelationRelationId);
+			break;
+	}
+	args[1] = ObjectIdGetDatum(obj->objoid);
+	args[2] = ObjectIdGetDatum(collid);
+
+	return !pgcd_bulk_query_bool(stream->ledger_query, 3, argtypes, args);
+}
+
+/*
+ * Value-per-call variant of pg_collation_all_dependencies().
+ *
+ * Rather than processing all the objects before returning anything, the
+ * objects are processed one batch at a time when the previous batch has been
+ * returned, so that the first rows are returned quickly and the caller can
+ * stop the scan early.  If broken_only is true, only the dependencies that
+ * pg_collation_broken_dependencies would report are returned, so that a probe
+ * for any broken dependency stops at the first one found.
+ *
+ * Note that the executor materializes the result of set-returning functions
+ * used in FROM, so this needs to be called in a target list to stream.
+ */
+Datum
+pg_collation_all_dependencies_stream(PG_FUNCTION_ARGS)
+{
+	FuncCallContext *funcctx;
+	pgcdBulkStream *stream;
+
+	if (SRF_IS_FIRSTCALL())
+	{
+		MemoryContext oldcontext;
+		TupleDesc	tupdesc;
+		const char *nspname;
+
+		funcctx = SRF_FIRSTCALL_INIT();
+		oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+		if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+			elog(ERROR, "return type must be a row type");
+		funcctx->tuple_desc = BlessTupleDesc(tupdesc);
+
+		stream = (pgcdBulkStream *) palloc0(sizeof(pgcdBulkStream));
+		stream->broken_only = PG_GETARG_BOOL(0);
+		stream->batchcxt = AllocSetContextCreate(funcctx->multi_call_memory_ctx,
+												 "pg_collation_dependencies batch",
+												 ALLOCSET_DEFAULT_SIZES);
+
+		/* Same conditions as the pg_collation_broken_dependencies view. */
+		nspname = quote_identifier(get_namespace_name(get_func_namespace(fcinfo->flinfo->fn_oid)));
+		stream->coll_query = psprintf("SELECT CASE WHEN fp.fingerprint IS NOT NULL"
+									  " THEN fp.fingerprint IS DISTINCT FROM %s.pg_collation_fingerprint(coll.oid)"
+									  " ELSE coll.collversion IS DISTINCT FROM pg_catalog.pg_collation_actual_version(coll.oid)"
+									  " END"
+									  " AND NOT (coll.collnamespace = 'pg_catalog'::pg_catalog.regnamespace"
+									  " AND coll.collencoding = -1"
+									  " AND coll.collname IN ('C', 'POSIX'))"
+									  " FROM pg_catalog.pg_collation coll"
+									  " LEFT JOIN %s.pg_collation_fingerprints fp"
+									  " ON fp.collid = coll.oid"
+									  " WHERE coll.oid = $1",
+									  nspname, nspname);
+		stream->ledger_query = psprintf("SELECT EXISTS (SELECT 1 FROM ("
+										" SELECT classid, objid, collid, collversion, fingerprint"
+										" FROM %s.pg_collation_verified_objects"
+										" UNION ALL"
+										" SELECT classid, objid, collid, collversion, fingerprint"
+										" FROM %s.pg_collation_session_verified_objects()"
+										" ) v"
+										" WHERE v.classid = $1 AND v.objid = $2 AND v.collid = $3"
+										" AND v.collversion IS NOT DISTINCT FROM pg_catalog.pg_collation_actual_version($3)"
+										" AND (v.fingerprint = %s.pg_collation_fingerprint($3)"
+										" OR NOT EXISTS (SELECT 1 FROM %s.pg_collation_fingerprints fp"
+										" WHERE fp.collid = $3)))",
+										nspname, nspname, nspname, nspname);
+
+		/* Only the catalogs are read here, the objects are processed later. */
+		stream->state.maxobjects = 1024;
+		stream->state.objects = palloc(sizeof(pgcdBulkObject) *
+									   stream->state.maxobjects);
+		pgcd_bulk_collect(&stream->state);
+
+		funcctx->user_fctx = stream;
+		MemoryContextSwitchTo(oldcontext);
+	}
+
+	funcctx = SRF_PERCALL_SETUP();
+	stream = (pgcdBulkStream *) funcctx->user_fctx;
+
+	for (;;)
+	{
+		pgcdBulkObject *obj;
+		Datum		values[PGCD_ALL_DEP_COLS];
+		bool		nulls[PGCD_ALL_DEP_COLS];
+		Oid			collid;
+
+		/* Process the next batch if the current one has been returned. */
+		if (stream->cur >= stream->batch_end)
+		{
+			int			start = stream->batch_end;
+			int			nobjects;
+			MemoryContext oldcontext;
+
+			if (start >= stream->state.nobjects)
+				SRF_RETURN_DONE(funcctx);
+
+			nobjects = Min(PGCD_BULK_BATCH_SIZE,
+						   stream->state.nobjects - start);
+
+			MemoryContextReset(stream->batchcxt);
+			oldcontext = MemoryContextSwitchTo(stream->batchcxt);
+			pgcd_bulk_process_batch(&stream->state.objects[start], nobjects);
+			MemoryContextSwitchTo(oldcontext);
+
+			stream->cur = start;
+			stream->batch_end = start + nobjects;
+			stream->curcoll = 0;
+		}
+
+		obj = &stream->state.objects[stream->cur];
+
+		/* Views don't store anything, so they're never broken. */
+		if (stream->broken_only && obj->kind == PGCD_BULK_VIEW)
+		{
+			stream->cur++;
+			continue;
+		}
+
+		if (obj->error != NULL)
+		{
+			stream->cur++;
+
+			/* An object that can't be processed isn't known to be broken. */
+			if (stream->broken_only)
+				continue;
+
+			pgcd_bulk_values(obj, InvalidOid, values, nulls);
+			SRF_RETURN_NEXT(funcctx,
+							HeapTupleGetDatum(heap_form_tuple(funcctx->tuple_desc,
+															  values, nulls)));
+		}
+
+		if (stream->curcoll >= list_length(obj->collations))
+		{
+			stream->cur++;
+			stream->curcoll = 0;
+			continue;
+		}
+
+		collid = list_nth_oid(obj->collations, stream->curcoll++);
+
+		if (stream->broken_only && !pgcd_bulk_is_broken(stream, obj, collid))
+			continue;
+
+		pgcd_bulk_values(obj, collid, values, nulls);
+		SRF_RETURN_NEXT(funcctx,
+						HeapTupleGetDatum(heap_form_tuple(funcctx->tuple_desc,
+														  values, nulls)));
+	}
+}
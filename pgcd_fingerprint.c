@@ -0,0 +1,359 @@
+/*-------------------------------------------------------------------------
+ *
+ * pgcd_fingerprint.c: Compute a fingerprint of a collation behavior.
+ *
+ * The version reported by the collation libraries changes on every glibc
+ * upgrade, even when the ordering didn't change, and can fail to change when
+ * it did.  The fingerprint is a hash of the permutation obtained when sorting
+ * a built-in corpus of strings covering many scripts, punctuation, combining
+ * marks and well known problematic sequences, along with which adjacent
+ * strings compare equal.  Two library versions with the same fingerprint are
+ * very likely to sort the same way.
+ *
+ * This program is open source, licensed under the PostgreSQL license.
+ * For license terms, see the LICENSE file.
+ *
+ * Copyright (C) 2022-2023: Julien Rouhaud
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#if PG_VERSION_NUM >= 130000
+#include "common/hashfn.h"
+#else
+#include "access/hash.h"
+#endif
+#include "catalog/pg_type.h"
+#include "executor/spi.h"
+#include "lib/stringinfo.h"
+#include "mb/pg_wchar.h"
+#include "tcop/utility.h"
+#include "utils/builtins.h"
+#include "utils/hsearch.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/syscache.h"
+#include "utils/varlena.h"
+
+#include "pg_collation_dependencies.h"
+
+/*
+ * Version of the corpus and of the way it's hashed.  Must be bumped whenever
+ * any of them changes, so that previously recorded fingerprints are not
+ * compared with incompatible ones.
+ */
+#define PGCD_FINGERPRINT_VERSION	1
+
+/* Length of a fingerprint, including trailing \0. */
+#define PGCD_FINGERPRINT_LEN		32
+
+/* Flag set on a corpus index if it compares equal to the previous string. */
+#define PGCD_FINGERPRINT_EQUAL		0x80000000
+
+/*
+ * Single characters or short sequences the corpus is built from.
+ */
+static const char *const pgcd_corpus_atoms[] = {
+	/* ASCII, including all punctuation and whitespace */
+	" ", "!", "\"", "#", "$", "%", "&", "'", "(", ")", "*", "+", ",", "-",
+	".", "/", "0", "1", "9", ":", ";", "<", "=", ">", "?", "@", "A", "B",
+	"Z", "[", "\\", "]", "^", "_", "`", "a", "b", "z", "{", "|", "}", "~",
+	"\t",
+	/* Latin with diacritics, ligatures and special letters */
+	"\xc3\x80", "\xc3\xa0", "\xc3\x89", "\xc3\xa9", "\xc3\xaa", "\xc3\xab",
+	"\xc3\x96", "\xc3\xb6", "\xc3\x9c", "\xc3\xbc", "\xc3\x9f", "\xc3\x86",
+	"\xc3\xa6", "\xc3\x98", "\xc3\xb8", "\xc3\x85", "\xc3\xa5", "\xc3\xb1",
+	"\xc3\xa7", "\xc5\x81", "\xc5\x82", "\xc5\x9e", "\xc4\xb1", "\xc4\xb0",
+	"\xc4\x9f", "\xc5\x93", "\xef\xac\x81",
+	/* combining marks (acute, diaeresis, cedilla) */
+	"e\xcc\x81", "o\xcc\x88", "c\xcc\xa7", "\xcc\x81",
+	/* Greek, Cyrillic */
+	"\xce\xb1", "\xce\xa9", "\xce\xac", "\xd0\xb0", "\xd1\x8f", "\xd0\x81",
+	/* Hebrew, Arabic */
+	"\xd7\x90", "\xd7\xa9", "\xd8\xa7", "\xd8\xa8", "\xd9\xa3",
+	/* Devanagari, Thai */
+	"\xe0\xa4\x95", "\xe0\xa4\xbf", "\xe0\xb8\x81", "\xe0\xb9\x80",
+	/* CJK, kana, hangul */
+	"\xe4\xb8\xad", "\xe6\x97\xa5", "\xe3\x81\x82", "\xe3\x82\xa2",
+	"\xed\x95\x9c", "\xea\xb0\x80",
+	/* symbols, typographic punctuation, special spaces, fullwidth digit */
+	"\xe2\x82\xac", "\xc2\xa9", "\xc2\xbf", "\xc2\xa1", "\xe2\x80\x93",
+	"\xe2\x80\x94", "\xe2\x80\xa6", "\xc2\xab", "\xc2\xbb", "\xc2\xa0",
+	"\xe2\x80\x8b", "\xef\xbc\x91",
+	/* emoji */
+	"\xf0\x9f\x98\x80"
+};
+
+/*
+ * Atoms combined pairwise, mostly punctuation, whitespace, case and accents
+ * which are the most likely to change between versions.
+ */
+static const char *const pgcd_corpus_pair_atoms[] = {
+	"", " ", "-", "_", "'", ".", ",", "/", "@", "0", "1", "a", "A", "b", "B",
+	"e", "E", "\xc3\xa9", "\xc3\x89", "e\xcc\x81", "\xc3\x9f", "ss", "\xc3\xa6",
+	"ae", "\xc4\xb1", "i", "I", "\xc4\xb0", "\xc2\xa0", "\xd0\xb0"
+};
+
+/*
+ * Words known to sort differently depending on the locale or version:
+ * contractions, expansions, accent ordering and punctuation handling.
+ */
+static const char *const pgcd_corpus_words[] = {
+	"cote", "c\xc3\xb4te", "cot\xc3\xa9", "c\xc3\xb4t\xc3\xa9", "Cote", "co-op",
+	"coop", "co op", "co_op", "resume", "r\xc3\xa9sum\xc3\xa9", "Resume",
+	"na\xc3\xafve", "naive", "stra\xc3\x9f" "e", "strasse", "\xc3\x85ngstr\xc3\xb6m",
+	"angstrom", "\xc3\x86sir", "aesir", "ijssel", "IJssel", "llama", "Llama",
+	"luz", "chico", "cz", "ch", "h", "hz", "\xc4\xb0stanbul", "istanbul",
+	"Istanbul", "1-1", "1.1", "11", "1 1", "-1", "+1", "a-b", "a.b", "a,b",
+	"a'b", "a/b", "ab", "aB", "Ab", "AB", "a b", "a\tb", "a_b", "a\xc2\xa0" "b",
+	"O'Brien", "Obrien", "o'brien", "van der Berg", "vanderberg", "Van Der Berg",
+	"z\xc3\xa4", "zae", "\xc3\xa4", "ae", "\xc3\xb6", "oe", "\xc3\xbc", "ue"
+};
+
+/*
+ * A string of the corpus, with its position in the corpus.
+ */
+typedef struct pgcdCorpusEntry
+{
+	const char *str;
+	int			len;
+	uint32		idx;
+} pgcdCorpusEntry;
+
+typedef struct pgcdFingerprintCacheEntry
+{
+	Oid			collid;			/* hash key, must be first */
+	char		fingerprint[PGCD_FINGERPRINT_LEN];
+} pgcdFingerprintCacheEntry;
+
+/* Per-backend cache, the collation libraries can't change underneath us. */
+static HTAB *pgcd_fingerprint_cache = NULL;
+
+extern PGDLLEXPORT Datum	pg_collation_fingerprint(PG_FUNCTION_ARGS);
+extern PGDLLEXPORT Datum	pg_collation_fingerprint_record(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(pg_collation_fingerprint);
+PG_FUNCTION_INFO_V1(pg_collation_fingerprint_record);
+
+static bool pgcd_is_ascii(const char *str);
+static pgcdCorpusEntry *pgcd_build_corpus(int *nentries);
+static int pgcd_corpus_cmp(const void *a, const void *b, void *arg);
+static const char *pgcd_get_fingerprint(Oid collid);
+
+/*
+ * Does the given string only contain ASCII characters?
+ */
+static bool
+pgcd_is_ascii(const char *str)
+{
+	for (; *str; str++)
+	{
+		if (IS_HIGHBIT_SET(*str))
+			return false;
+	}
+
+	return true;
+}
+
+/*
+ * Build the full corpus.
+ *
+ * Non ASCII strings can only be used if the database encoding is UTF8, so
+ * they're discarded otherwise.
+ */
+static pgcdCorpusEntry *
+pgcd_build_corpus(int *nentries)
+{
+	bool		utf8 = (GetDatabaseEncoding() == PG_UTF8);
+	int			natoms = lengthof(pgcd_corpus_atoms);
+	int			npairs = lengthof(pgcd_corpus_pair_atoms);
+	int			nwords = lengthof(pgcd_corpus_words);
+	int			max;
+	int			n = 0;
+	pgcdCorpusEntry *corpus;
+
+	max = natoms * 2 + npairs * npairs + nwords;
+	corpus = palloc(sizeof(pgcdCorpusEntry) * max);
+
+#define ADD_ENTRY(s) \
+	do { \
+		const char *str_ = (s); \
+		int			len_ = strlen(str_); \
+		if (utf8 || pgcd_is_ascii(str_)) \
+		{ \
+			corpus[n].str = str_; \
+			corpus[n].len = len_; \
+			corpus[n].idx = n; \
+			n++; \
+		} \
+	} while (0)
+
+	for (int i = 0; i < natoms; i++)
+	{
+		ADD_ENTRY(pgcd_corpus_atoms[i]);
+		/* and in the middle of a word, where ignorable characters matter */
+		ADD_ENTRY(psprintf("a%sb", pgcd_corpus_atoms[i]));
+	}
+
+	for (int i = 0; i < npairs; i++)
+	{
+		for (int j = 0; j < npairs; j++)
+			ADD_ENTRY(psprintf("%s%s", pgcd_corpus_pair_atoms[i],
+							   pgcd_corpus_pair_atoms[j]));
+	}
+
+	for (int i = 0; i < nwords; i++)
+		ADD_ENTRY(pgcd_corpus_words[i]);
+
+#undef ADD_ENTRY
+
+	*nentries = n;
+	return corpus;
+}
+
+/*
+ * qsort_arg comparator, ties are broken using the position in the corpus so
+ * that the result is deterministic.
+ */
+static int
+pgcd_corpus_cmp(const void *a, const void *b, void *arg)
+{
+	const pgcdCorpusEntry *e1 = (const pgcdCorpusEntry *) a;
+	const pgcdCorpusEntry *e2 = (const pgcdCorpusEntry *) b;
+	Oid			collid = *(Oid *) arg;
+	int			cmp;
+
+	cmp = varstr_cmp(e1->str, e1->len, e2->str, e2->len, collid);
+	if (cmp != 0)
+		return cmp;
+
+	return (e1->idx < e2->idx) ? -1 : (e1->idx > e2->idx);
+}
+
+/*
+ * Compute, or get from the cache, the fingerprint of the given collation.
+ */
+static const char *
+pgcd_get_fingerprint(Oid collid)
+{
+	pgcdFingerprintCacheEntry *entry;
+	bool		found;
+	pgcdCorpusEntry *corpus;
+	uint32	   *perm;
+	int			n;
+	uint64		hash;
+	MemoryContext tmpctx,
+				oldcontext;
+
+	if (pgcd_fingerprint_cache == NULL)
+	{
+		HASHCTL		ctl;
+
+		memset(&ctl, 0, sizeof(ctl));
+		ctl.keysize = sizeof(Oid);
+		ctl.entrysize = sizeof(pgcdFingerprintCacheEntry);
+		pgcd_fingerprint_cache = hash_create("pg_collation_fingerprint cache",
+											 16, &ctl,
+											 HASH_ELEM | HASH_BLOBS);
+	}
+
+	entry = hash_search(pgcd_fingerprint_cache, &collid, HASH_FIND, NULL);
+	if (entry != NULL)
+		return entry->fingerprint;
+
+	if (!SearchSysCacheExists1(COLLOID, ObjectIdGetDatum(collid)))
+		ereport(ERROR,
+				(errcode(ERRCODE_UNDEFINED_OBJECT),
+				 errmsg("collation with OID %u does not exist", collid)));
+
+	tmpctx = AllocSetContextCreate(CurrentMemoryContext,
+								   "pg_collation_fingerprint",
+								   ALLOCSET_DEFAULT_SIZES);
+	oldcontext = MemoryContextSwitchTo(tmpctx);
+
+	corpus = pgcd_build_corpus(&n);
+	qsort_arg(corpus, n, sizeof(pgcdCorpusEntry), pgcd_corpus_cmp, &collid);
+
+	perm = palloc(sizeof(uint32) * n);
+	for (int i = 0; i < n; i++)
+	{
+		perm[i] = corpus[i].idx;
+
+		if (i > 0 && varstr_cmp(corpus[i - 1].str, corpus[i - 1].len,
+								corpus[i].str, corpus[i].len, collid) == 0)
+			perm[i] |= PGCD_FINGERPRINT_EQUAL;
+	}
+
+	hash = DatumGetUInt64(hash_any_extended((unsigned char *) perm,
+											sizeof(uint32) * n,
+											PGCD_FINGERPRINT_VERSION));
+
+	MemoryContextSwitchTo(oldcontext);
+	MemoryContextDelete(tmpctx);
+
+	/* Only add the entry once everything succeeded. */
+	entry = hash_search(pgcd_fingerprint_cache, &collid, HASH_ENTER, &found);
+	snprintf(entry->fingerprint, PGCD_FINGERPRINT_LEN, "%d-" UINT64_FORMAT,
+			 PGCD_FINGERPRINT_VERSION, hash);
+
+	return entry->fingerprint;
+}
+
+/*
+ * Return the fingerprint of the given collation with the current libraries.
+ */
+Datum
+pg_collation_fingerprint(PG_FUNCTION_ARGS)
+{
+	Oid			collid = PG_GETARG_OID(0);
+
+	PG_RETURN_TEXT_P(cstring_to_text(pgcd_get_fingerprint(collid)));
+}
+
+/*
+ * Record the current version and fingerprint of the given collation in the
+ * pg_collation_fingerprints table, and return the fingerprint.
+ */
+Datum
+pg_collation_fingerprint_record(PG_FUNCTION_ARGS)
+{
+	Oid			collid = PG_GETARG_OID(0);
+	Oid			extnspid = get_func_namespace(fcinfo->flinfo->fn_oid);
+	const char *fingerprint;
+	StringInfoData query;
+	Datum		args[2];
+	Oid			argtypes[2] = {OIDOID, TEXTOID};
+	int			ret;
+
+	PreventCommandDuringRecovery("pg_collation_fingerprint_record()");
+
+	fingerprint = pgcd_get_fingerprint(collid);
+
+	args[0] = ObjectIdGetDatum(collid);
+	args[1] = CStringGetTextDatum(fingerprint);
+
+	initStringInfo(&query);
+	appendStringInfo(&query,
+					 "INSERT INTO %s.pg_collation_fingerprints"
+					 " (collid, collversion, fingerprint)"
+					 " VALUES ($1, pg_catalog.pg_collation_actual_version($1), $2)"
+					 " ON CONFLICT (collid) DO UPDATE"
+					 " SET collversion = EXCLUDED.collversion,"
+					 " fingerprint = EXCLUDED.fingerprint,"
+					 " recorded_at = pg_catalog.now()",
+					 quote_identifier(get_namespace_name(extnspid)));
+
+	if (SPI_connect() != SPI_OK_CONNECT)
+		elog(ERROR, "SPI_connect failed");
+
+	ret = SPI_execute_with_args(query.data, 2, argtypes, args, NULL, false, 0);
+	if (ret != SPI_OK_INSERT)
+		elog(ERROR, "could not record collation fingerprint: %s",
+			 SPI_result_code_string(ret));
+
+	SPI_finish();
+
+	PG_RETURN_TEXT_P(cstring_to_text(fingerprint));
+}
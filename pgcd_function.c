@@ -0,0 +1,411 @@
+/*-------------------------------------------------------------------------
+ *
+ * pgcd_function.c: Find the collation dependencies of SQL function bodies.
+ *
+ * Index, constraint and materialized view expressions often call user SQL
+ * functions comparing text internally.  The expression itself only shows the
+ * function call and its input collation, so the collations used inside the
+ * function body are found here, by walking either the SQL-standard body
+ * (prosqlbody) or, for simple SQL functions, the analyzed prosrc.  A prosrc
+ * body records no dependency on the objects it reads, so a body that can't be
+ * analyzed anymore, e.g. because a table it reads was dropped, is ignored
+ * rather than failing the lookup of every object calling the function.
+ *
+ * The same functions are typically referenced by many objects, so the result
+ * is remembered for each function until the next invalidation of pg_proc,
+ * pg_type or of one of the relations read by a remembered body, including
+ * the bodies of the functions it calls, as a body doesn't record any
+ * dependency on the columns it reads.  Other relcache invalidations, e.g. the
+ * ones sent by VACUUM and ANALYZE, don't discard the memo.
+ *
+ * This program is open source, licensed under the PostgreSQL license.
+ * For license terms, see the LICENSE file.
+ *
+ * Copyright (C) 2022-2023: Julien Rouhaud
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include "access/htup_details.h"
+#include "access/transam.h"
+#include "access/xact.h"
+#include "catalog/pg_language.h"
+#include "catalog/pg_proc.h"
+#include "catalog/pg_type.h"
+#include "executor/functions.h"
+#include "nodes/nodeFuncs.h"
+#include "parser/analyze.h"
+#include "tcop/tcopprot.h"
+#include "utils/builtins.h"
+#include "utils/hsearch.h"
+#include "utils/inval.h"
+#include "utils/memutils.h"
+#include "utils/regproc.h"
+#include "utils/resowner.h"
+#include "utils/syscache.h"
+
+#include "pg_collation_dependencies.h"
+
+/* Remembered collation dependencies of a function body. */
+typedef struct pgcdFunctionEntry
+{
+	Oid			funcid;			/* hash key, must be first */
+	List	   *collations;		/* allocated in pgcd_function_cxt */
+	List	   *relids;			/* relations read by the body */
+} pgcdFunctionEntry;
+
+static HTAB *pgcd_function_memo = NULL;
+static MemoryContext pgcd_function_cxt = NULL;
+static bool pgcd_function_memo_stale = false;
+
+/* Relations read by any remembered body, allocated in pgcd_function_cxt. */
+static List *pgcd_function_memo_relids = NIL;
+
+/* Relations read by the body being walked and the functions it calls. */
+static List *pgcd_function_relids = NIL;
+
+/* Functions whose body is being walked, innermost first. */
+static List *pgcd_function_stack = NIL;
+
+/* Set when a function being walked is referenced again, i.e. recursion. */
+static bool pgcd_function_cycle = false;
+
+static void pgcd_function_inval_callback(Datum arg, int cacheid,
+										 uint32 hashvalue);
+static void pgcd_function_relcache_callback(Datum arg, Oid relid);
+static bool pgcd_function_relids_walker(Node *node, List **relids);
+static Node *pgcd_analyze_function_src(HeapTuple proctup, char *src);
+static Node *pgcd_get_function_body(HeapTuple proctup, Oid funcid,
+									bool *failed);
+
+/*
+ * Syscache invalidation callback.  The memo can be in use when invalidations
+ * are processed, so it's only flagged here and discarded by the next
+ * outermost lookup.
+ */
+static void
+pgcd_function_inval_callback(Datum arg, int cacheid, uint32 hashvalue)
+{
+	pgcd_function_memo_stale = true;
+}
+
+/*
+ * Relcache invalidation callback, e.g. for a column whose collation changed.
+ * Only the relations read by a remembered body matter.
+ */
+static void
+pgcd_function_relcache_callback(Datum arg, Oid relid)
+{
+	if (!OidIsValid(relid) ||
+		list_member_oid(pgcd_function_memo_relids, relid))
+		pgcd_function_memo_stale = true;
+}
+
+/*
+ * Add the relations read by the given function body to *relids, including
+ * the ones read in subqueries and CTEs.
+ */
+static bool
+pgcd_function_relids_walker(Node *node, List **relids)
+{
+	if (node == NULL)
+		return false;
+
+	if (IsA(node, Query))
+	{
+		Query	   *query = (Query *) node;
+		ListCell   *lc;
+
+		foreach(lc, query->rtable)
+		{
+			RangeTblEntry *rte = lfirst_node(RangeTblEntry, lc);
+
+			if (rte->rtekind == RTE_RELATION)
+				*relids = list_append_unique_oid(*relids, rte->relid);
+		}
+
+		return query_tree_walker(query, pgcd_function_relids_walker,
+								 (void *) relids, 0);
+	}
+
+	return expression_tree_walker(node, pgcd_function_relids_walker,
+								  (void *) relids);
+}
+
+/*
+ * Parse and analyze the given prosrc, or return NULL if it isn't a single
+ * SELECT.
+ */
+static Node *
+pgcd_analyze_function_src(HeapTuple proctup, char *src)
+{
+	List	   *raw_parsetree_list;
+	SQLFunctionParseInfoPtr pinfo;
+	ParseState *pstate;
+	Query	   *query;
+
+	raw_parsetree_list = pg_parse_query(src);
+	if (list_length(raw_parsetree_list) != 1 ||
+		!IsA(linitial_node(RawStmt, raw_parsetree_list)->stmt, SelectStmt))
+		return NULL;
+
+	pinfo = prepare_sql_fn_parse_info(proctup, NULL, InvalidOid);
+
+	pstate = make_parsestate(NULL);
+	pstate->p_sourcetext = src;
+	sql_fn_parser_setup(pstate, pinfo);
+	query = transformTopLevelStmt(pstate,
+								  linitial_node(RawStmt, raw_parsetree_list));
+	free_parsestate(pstate);
+
+	return (Node *) query;
+}
+
+/*
+ * Get the parsed body of the given SQL function, or NULL if it can't be
+ * analyzed without executing it.  *failed is set if the body couldn't be
+ * analyzed because of an error, so that the result isn't remembered.
+ */
+static Node *
+pgcd_get_function_body(HeapTuple proctup, Oid funcid, bool *failed)
+{
+	Form_pg_proc proc = (Form_pg_proc) GETSTRUCT(proctup);
+	MemoryContext oldcontext = CurrentMemoryContext;
+	ResourceOwner oldowner = CurrentResourceOwner;
+	Datum		datum;
+	bool		isnull;
+	char	   *src;
+	Node	   *volatile body = NULL;
+
+#if PG_VERSION_NUM >= 140000
+	datum = SysCacheGetAttr(PROCOID, proctup, Anum_pg_proc_prosqlbody,
+							&isnull);
+	if (!isnull)
+		return stringToNode(TextDatumGetCString(datum));
+#endif
+
+	/*
+	 * Otherwise, only handle the single SELECT bodies that the planner would
+	 * consider inlining.  Other bodies can depend on objects created by
+	 * previous statements, so can't be analyzed upfront.  Polymorphic
+	 * arguments can only be resolved for a given call, which wouldn't fit the
+	 * per-function memo.
+	 */
+	for (int i = 0; i < proc->pronargs; i++)
+	{
+		if (IsPolymorphicType(proc->proargtypes.values[i]))
+			return NULL;
+	}
+
+	/*
+	 * The body would be analyzed with the caller's settings rather than the
+	 * function's SET clauses, e.g. a different search_path, and could resolve
+	 * to other objects.  Like inline_function(), don't try.
+	 */
+	if (!heap_attisnull(proctup, Anum_pg_proc_proconfig, NULL))
+		return NULL;
+
+	datum = SysCacheGetAttr(PROCOID, proctup, Anum_pg_proc_prosrc, &isnull);
+	if (isnull)
+		elog(ERROR, "null prosrc for function %u", funcid);
+	src = TextDatumGetCString(datum);
+
+	/*
+	 * The objects read by the body may have been dropped or altered since the
+	 * function was created, so analyze it in a subtransaction and ignore it if
+	 * that fails.  On success, the subtransaction is committed to keep the
+	 * locks on the relations the body reads.
+	 */
+	BeginInternalSubTransaction(NULL);
+	MemoryContextSwitchTo(oldcontext);
+
+	PG_TRY();
+	{
+		body = pgcd_analyze_function_src(proctup, src);
+
+		ReleaseCurrentSubTransaction();
+		MemoryContextSwitchTo(oldcontext);
+		CurrentResourceOwner = oldowner;
+	}
+	PG_CATCH();
+	{
+		ErrorData  *edata;
+
+		MemoryContextSwitchTo(oldcontext);
+		edata = CopyErrorData();
+		FlushErrorState();
+
+		RollbackAndReleaseCurrentSubTransaction();
+		MemoryContextSwitchTo(oldcontext);
+		CurrentResourceOwner = oldowner;
+
+		/* Same as pgcd_bulk_process(), only swallow errors about the body. */
+		if (ERRCODE_TO_CATEGORY(edata->sqlerrcode) == ERRCODE_OPERATOR_INTERVENTION ||
+			ERRCODE_TO_CATEGORY(edata->sqlerrcode) == ERRCODE_INSUFFICIENT_RESOURCES)
+			ReThrowError(edata);
+
+		PGCD_TRACE_NOTE("body not analyzed: %s", edata->message);
+		*failed = true;
+		body = NULL;
+	}
+	PG_END_TRY();
+
+	return body;
+}
+
+/*
+ * Get full list of collation dependencies for the body of the given function.
+ *
+ * Built-in functions and functions not written in SQL have no dependencies.  Functions
+ * called from the body are handled recursively by the expression walker.
+ */
+List *
+pgcd_get_function_collations(Oid funcid)
+{
+	HeapTuple	proctup;
+	pgcdFunctionEntry *entry;
+	Node	   *body;
+	List	   *res = NIL;
+	List	   *save_relids;
+	List	   *relids;
+	bool		use_memo;
+	bool		save_cycle;
+	bool		failed = false;
+
+	if (funcid < FirstNormalObjectId)
+		return NIL;
+
+	if (list_member_oid(pgcd_function_stack, funcid))
+	{
+		/* Recursive call, the outer lookup covers this body. */
+		pgcd_function_cycle = true;
+		return NIL;
+	}
+
+	/* Tracing needs to walk the body every time to report the chains. */
+	use_memo = (pgcd_trace == NULL);
+
+	if (use_memo)
+	{
+		if (pgcd_function_memo != NULL && pgcd_function_memo_stale &&
+			pgcd_function_stack == NIL)
+		{
+			hash_destroy(pgcd_function_memo);
+			MemoryContextReset(pgcd_function_cxt);
+			pgcd_function_memo = NULL;
+			pgcd_function_memo_relids = NIL;
+		}
+
+		if (pgcd_function_memo == NULL)
+		{
+			HASHCTL		ctl;
+
+			if (pgcd_function_cxt == NULL)
+			{
+				pgcd_function_cxt = AllocSetContextCreate(TopMemoryContext,
+														  "pg_collation_dependencies function memo",
+														  ALLOCSET_SMALL_SIZES);
+				CacheRegisterSyscacheCallback(PROCOID,
+											  pgcd_function_inval_callback,
+											  (Datum) 0);
+				CacheRegisterSyscacheCallback(TYPEOID,
+											  pgcd_function_inval_callback,
+											  (Datum) 0);
+				CacheRegisterRelcacheCallback(pgcd_function_relcache_callback,
+											  (Datum) 0);
+			}
+
+			memset(&ctl, 0, sizeof(ctl));
+			ctl.keysize = sizeof(Oid);
+			ctl.entrysize = sizeof(pgcdFunctionEntry);
+			ctl.hcxt = pgcd_function_cxt;
+			pgcd_function_memo = hash_create("pg_collation_dependencies function memo",
+											 64, &ctl,
+											 HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+			pgcd_function_memo_stale = false;
+		}
+		else
+		{
+			entry = hash_search(pgcd_function_memo, &funcid, HASH_FIND, NULL);
+			if (entry != NULL)
+			{
+				/* The calling body also depends on those relations. */
+				if (pgcd_function_stack != NIL)
+					pgcd_function_relids = list_concat_unique_oid(pgcd_function_relids,
+																  entry->relids);
+				return list_copy(entry->collations);
+			}
+		}
+	}
+
+	proctup = SearchSysCache1(PROCOID, ObjectIdGetDatum(funcid));
+	if (!HeapTupleIsValid(proctup))
+		elog(ERROR, "cache lookup failed for function %u", funcid);
+
+	/* since this function recurses, it could be driven to stack overflow */
+	check_stack_depth();
+
+	save_cycle = pgcd_function_cycle;
+	pgcd_function_cycle = false;
+	save_relids = pgcd_function_relids;
+	pgcd_function_relids = NIL;
+	pgcd_function_stack = lcons_oid(funcid, pgcd_function_stack);
+	PG_TRY();
+	{
+		PGCD_TRACE_PUSH("function %s", format_procedure(funcid));
+
+		if (((Form_pg_proc) GETSTRUCT(proctup))->prolang != SQLlanguageId)
+			body = NULL;
+		else
+			body = pgcd_get_function_body(proctup, funcid, &failed);
+
+		if (body != NULL)
+		{
+			res = pgcd_get_query_expression_collations(body);
+			(void) pgcd_function_relids_walker(body, &pgcd_function_relids);
+		}
+
+		PGCD_TRACE_POP();
+	}
+	PG_CATCH();
+	{
+		pgcd_function_stack = list_delete_first(pgcd_function_stack);
+		pgcd_function_cycle = save_cycle;
+		pgcd_function_relids = save_relids;
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+	pgcd_function_stack = list_delete_first(pgcd_function_stack);
+
+	relids = pgcd_function_relids;
+	pgcd_function_relids = save_relids;
+	if (pgcd_function_stack != NIL)
+		pgcd_function_relids = list_concat_unique_oid(pgcd_function_relids,
+													  relids);
+
+	ReleaseSysCache(proctup);
+
+	/*
+	 * The result is incomplete if the body references a function being
+	 * walked, as the caller will add that function's collations, so only
+	 * remember complete results.  A body that failed to be analyzed is tried
+	 * again next time, as the objects it reads may be created meanwhile.
+	 */
+	if (use_memo && !pgcd_function_cycle && !failed)
+	{
+		MemoryContext oldcontext;
+
+		entry = hash_search(pgcd_function_memo, &funcid, HASH_ENTER, NULL);
+		oldcontext = MemoryContextSwitchTo(pgcd_function_cxt);
+		entry->collations = list_copy(res);
+		entry->relids = list_copy(relids);
+		pgcd_function_memo_relids = list_concat_unique_oid(pgcd_function_memo_relids,
+														   relids);
+		MemoryContextSwitchTo(oldcontext);
+	}
+	pgcd_function_cycle |= save_cycle;
+
+	return res;
+}
@@ -0,0 +1,384 @@
+/*-------------------------------------------------------------------------
+ *
+ * pgcd_gist.c: Verify that the range keys of a GiST index are still
+ *              consistent according to the current collation libraries.
+ *
+ * Range types with a collatable subtype order their bounds using the range
+ * collation, and GiST indexes on ranges store in each internal tuple the
+ * union of all the ranges below it.  Once the collation ordering changes, a
+ * stored range can have its lower bound greater than its upper bound, and an
+ * internal key may not contain the ranges of its child page anymore, in which
+ * case index searches miss rows.  The code here walks the whole tree from the
+ * root and checks both properties using the current comparator.
+ *
+ * This program is open source, licensed under the PostgreSQL license.
+ * For license terms, see the LICENSE file.
+ *
+ * Copyright (C) 2022-2023: Julien Rouhaud
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include "access/genam.h"
+#include "access/gist_private.h"
+#include "catalog/pg_am.h"
+#include "catalog/pg_type.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "storage/bufmgr.h"
+#include "utils/builtins.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/rangetypes.h"
+#include "utils/rel.h"
+#include "utils/typcache.h"
+
+#include "pg_collation_dependencies.h"
+
+#define PGCD_GIST_CHECK_COLS	6
+
+/*
+ * A page to visit, with the keys of the downlink pointing to it if they can
+ * be relied on.
+ */
+typedef struct pgcdGistItem
+{
+	BlockNumber blkno;
+	XLogRecPtr	parentlsn;		/* LSN of the parent page when read */
+	Datum	   *parentkeys;		/* one per checked column, or NULL */
+	bool	   *parentnulls;
+} pgcdGistItem;
+
+typedef struct pgcdGistState
+{
+	Relation	indrel;
+	int			natts;			/* number of key columns */
+	TypeCacheEntry **typcaches; /* for each checked column, or NULL */
+	MemoryContext stackcxt;		/* context of the stack of pages to visit */
+	ReturnSetInfo *rsinfo;
+	uint64		remaining;		/* violations left to report */
+} pgcdGistState;
+
+extern PGDLLEXPORT Datum	pg_collation_gist_check(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(pg_collation_gist_check);
+
+static void pgcd_gist_report(pgcdGistState *state, BlockNumber blkno,
+							 OffsetNumber offnum, int attno, const char *kind,
+							 Datum key, Datum parentkey);
+static void pgcd_gist_check_page(pgcdGistState *state, pgcdGistItem *item,
+								 BufferAccessStrategy strategy, List **stack);
+
+/*
+ * Report a single violation.
+ */
+static void
+pgcd_gist_report(pgcdGistState *state, BlockNumber blkno, OffsetNumber offnum,
+				 int attno, const char *kind, Datum key, Datum parentkey)
+{
+	TypeCacheEntry *typcache = state->typcaches[attno];
+	Datum		values[PGCD_GIST_CHECK_COLS];
+	bool		nulls[PGCD_GIST_CHECK_COLS];
+	Oid			typoutput;
+	bool		typisvarlena;
+
+	memset(nulls, 0, sizeof(nulls));
+
+	getTypeOutputInfo(typcache->type_id, &typoutput, &typisvarlena);
+
+	values[0] = Int64GetDatum((int64) blkno);
+	values[1] = Int32GetDatum((int32) offnum);
+	values[2] = Int32GetDatum(attno + 1);
+	values[3] = CStringGetTextDatum(kind);
+	values[4] = CStringGetTextDatum(OidOutputFunctionCall(typoutput, key));
+	if (parentkey != (Datum) 0)
+		values[5] = CStringGetTextDatum(OidOutputFunctionCall(typoutput,
+															  parentkey));
+	else
+		nulls[5] = true;
+
+	tuplestore_putvalues(state->rsinfo->setResult, state->rsinfo->setDesc,
+						 values, nulls);
+
+	state->remaining--;
+}
+
+/*
+ * Check all the tuples of the given page, and push its children on the stack
+ * if it's an internal page.
+ */
+static void
+pgcd_gist_check_page(pgcdGistState *state, pgcdGistItem *item,
+					 BufferAccessStrategy strategy, List **stack)
+{
+	Buffer		buffer;
+	Page		page;
+	GISTPageOpaque opaque;
+	XLogRecPtr	lsn;
+	OffsetNumber maxoff;
+	Datum	   *parentkeys = item->parentkeys;
+
+	/*
+	 * The range comparison function can be a user-defined SQL function, and
+	 * reporting a violation calls output functions, so work on a local copy
+	 * of the page rather than holding the buffer content lock.
+	 */
+	page = (Page) palloc(BLCKSZ);
+	buffer = ReadBufferExtended(state->indrel, MAIN_FORKNUM, item->blkno,
+								RBM_NORMAL, strategy);
+	LockBuffer(buffer, GIST_SHARE);
+	memcpy(page, BufferGetPage(buffer), BLCKSZ);
+	lsn = BufferGetLSNAtomic(buffer);
+	UnlockReleaseBuffer(buffer);
+
+	opaque = GistPageGetOpaque(page);
+
+	if (GistPageIsDeleted(page))
+		return;
+
+	/*
+	 * If the page was split after its parent was read, some of its tuples
+	 * were moved to the right, so also visit the right sibling.  Its tuples
+	 * are not covered by the downlink we followed, so don't check them
+	 * against it.  The remaining tuples are still covered by it.
+	 */
+	if (!XLogRecPtrIsInvalid(item->parentlsn) &&
+		(GistFollowRight(page) || item->parentlsn < GistPageGetNSN(page)) &&
+		opaque->rightlink != InvalidBlockNumber)
+	{
+		MemoryContext oldcontext = MemoryContextSwitchTo(state->stackcxt);
+		pgcdGistItem *right = palloc0(sizeof(pgcdGistItem));
+
+		right->blkno = opaque->rightlink;
+		right->parentlsn = item->parentlsn;
+		*stack = lappend(*stack, right);
+		MemoryContextSwitchTo(oldcontext);
+	}
+
+	maxoff = PageGetMaxOffsetNumber(page);
+	for (OffsetNumber offnum = FirstOffsetNumber; offnum <= maxoff;
+		 offnum = OffsetNumberNext(offnum))
+	{
+		ItemId		iid = PageGetItemId(page, offnum);
+		IndexTuple	itup;
+		pgcdGistItem *child = NULL;
+
+		CHECK_FOR_INTERRUPTS();
+
+		if (state->remaining == 0)
+			break;
+
+		if (!ItemIdIsUsed(iid) || ItemIdIsDead(iid))
+			continue;
+
+		itup = (IndexTuple) PageGetItem(page, iid);
+
+		/* Left by pre-9.1 crash recovery, ignored by scans too. */
+		if (GistTupleIsInvalid(itup))
+			continue;
+
+		if (!GistPageIsLeaf(page))
+		{
+			child = MemoryContextAllocZero(state->stackcxt,
+										   sizeof(pgcdGistItem));
+			child->blkno = ItemPointerGetBlockNumber(&itup->t_tid);
+			child->parentlsn = lsn;
+			child->parentkeys = MemoryContextAllocZero(state->stackcxt,
+													   sizeof(Datum) * state->natts);
+			child->parentnulls = MemoryContextAllocZero(state->stackcxt,
+														sizeof(bool) * state->natts);
+		}
+
+		for (int attno = 0; attno < state->natts; attno++)
+		{
+			TypeCacheEntry *typcache = state->typcaches[attno];
+			RangeType  *range;
+			RangeBound	lower;
+			RangeBound	upper;
+			bool		empty;
+			bool		isnull;
+			Datum		key;
+
+			if (typcache == NULL)
+				continue;
+
+			key = index_getattr(itup, attno + 1,
+								RelationGetDescr(state->indrel), &isnull);
+
+			if (child != NULL)
+			{
+				child->parentnulls[attno] = isnull;
+				if (!isnull)
+				{
+					MemoryContext oldcontext;
+
+					oldcontext = MemoryContextSwitchTo(state->stackcxt);
+					child->parentkeys[attno] = PointerGetDatum(PG_DETOAST_DATUM_COPY(key));
+					MemoryContextSwitchTo(oldcontext);
+				}
+			}
+
+			if (isnull)
+				continue;
+
+			range = DatumGetRangeTypeP(key);
+
+			range_deserialize(typcache, range, &lower, &upper, &empty);
+			if (!empty && !lower.infinite && !upper.infinite &&
+				range_cmp_bounds(typcache, &lower, &upper) > 0)
+			{
+				pgcd_gist_report(state, item->blkno, offnum, attno, "bounds",
+								 RangeTypePGetDatum(range), (Datum) 0);
+				if (state->remaining == 0)
+					break;
+			}
+
+			if (parentkeys != NULL && !item->parentnulls[attno] &&
+				!range_contains_internal(typcache,
+										 DatumGetRangeTypeP(parentkeys[attno]),
+										 range))
+			{
+				pgcd_gist_report(state, item->blkno, offnum, attno,
+								 "containment", RangeTypePGetDatum(range),
+								 parentkeys[attno]);
+				if (state->remaining == 0)
+					break;
+			}
+		}
+
+		if (child != NULL)
+		{
+			MemoryContext oldcontext = MemoryContextSwitchTo(state->stackcxt);
+
+			*stack = lappend(*stack, child);
+			MemoryContextSwitchTo(oldcontext);
+		}
+	}
+}
+
+/*
+ * SRF returning the range keys of the given GiST index that are not
+ * consistent anymore according to the current collation libraries: ranges
+ * whose lower bound is now greater than their upper bound, and keys not
+ * contained anymore in the key of the downlink pointing to their page.
+ *
+ * Only the key columns of a range type with a collation are checked.
+ */
+Datum
+pg_collation_gist_check(PG_FUNCTION_ARGS)
+{
+	Oid				indexoid = PG_GETARG_OID(0);
+	int32			max_violations = PG_GETARG_INT32(1);
+	ReturnSetInfo  *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	BufferAccessStrategy strategy;
+	pgcdGistState	state;
+	pgcdGistItem   *root;
+	List		   *stack;
+	MemoryContext	pagecxt;
+	MemoryContext	oldcontext;
+	bool			found = false;
+
+	if (max_violations < 1)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("max_violations must be at least 1")));
+
+	InitMaterializedSRF(fcinfo, MAT_SRF_USE_EXPECTED_DESC);
+
+	state.indrel = index_open(indexoid, AccessShareLock);
+	state.rsinfo = rsinfo;
+	state.remaining = max_violations;
+
+	if (state.indrel->rd_rel->relam != GIST_AM_OID)
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("\"%s\" is not a GiST index",
+						RelationGetRelationName(state.indrel)),
+				 errhint("Use pg_collation_range_check() to check the ranges stored in the table.")));
+
+	if (RELATION_IS_OTHER_TEMP(state.indrel))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("cannot check temporary indexes of other sessions")));
+
+	if (!state.indrel->rd_index->indisvalid)
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("cannot check index \"%s\"",
+						RelationGetRelationName(state.indrel)),
+				 errdetail("Index is not valid.")));
+
+	/* Find the key columns whose content depends on a collation. */
+	state.natts = IndexRelationGetNumberOfKeyAttributes(state.indrel);
+	state.typcaches = palloc0(sizeof(TypeCacheEntry *) * state.natts);
+	for (int attno = 0; attno < state.natts; attno++)
+	{
+		Oid			typid = TupleDescAttr(RelationGetDescr(state.indrel),
+										  attno)->atttypid;
+		TypeCacheEntry *typcache;
+
+		if (get_typtype(typid) != TYPTYPE_RANGE)
+			continue;
+
+		typcache = lookup_type_cache(typid, TYPECACHE_RANGE_INFO);
+		if (!OidIsValid(typcache->rng_collation))
+			continue;
+
+		state.typcaches[attno] = typcache;
+		found = true;
+	}
+
+	if (!found)
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("index \"%s\" has no key on a range type with a collation",
+						RelationGetRelationName(state.indrel))));
+
+	strategy = GetAccessStrategy(BAS_BULKREAD);
+	state.stackcxt = CurrentMemoryContext;
+	pagecxt = AllocSetContextCreate(CurrentMemoryContext,
+									"pg_collation_gist_check page",
+									ALLOCSET_DEFAULT_SIZES);
+
+	root = palloc0(sizeof(pgcdGistItem));
+	root->blkno = GIST_ROOT_BLKNO;
+	root->parentlsn = InvalidXLogRecPtr;
+	stack = list_make1(root);
+
+	/*
+	 * The stack items hold detoasted copies of the downlink keys, so they're
+	 * allocated in the stack context and freed once their page is checked.
+	 * Everything else is allocated in the page context.
+	 */
+	while (stack != NIL && state.remaining > 0)
+	{
+		pgcdGistItem *item = (pgcdGistItem *) llast(stack);
+
+		stack = list_truncate(stack, list_length(stack) - 1);
+
+		oldcontext = MemoryContextSwitchTo(pagecxt);
+		pgcd_gist_check_page(&state, item, strategy, &stack);
+		MemoryContextSwitchTo(oldcontext);
+
+		if (item->parentkeys != NULL)
+		{
+			for (int attno = 0; attno < state.natts; attno++)
+			{
+				if (state.typcaches[attno] != NULL && !item->parentnulls[attno])
+					pfree(DatumGetPointer(item->parentkeys[attno]));
+			}
+			pfree(item->parentkeys);
+			pfree(item->parentnulls);
+		}
+		pfree(item);
+
+		MemoryContextReset(pagecxt);
+	}
+
+	FreeAccessStrategy(strategy);
+	index_close(state.indrel, AccessShareLock);
+
+	return (Datum) 0;
+}
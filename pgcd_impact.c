@@ -0,0 +1,254 @@
+/*-------------------------------------------------------------------------
+ *
+ * pgcd_impact.c: Summarize, for each collation, what would have to be
+ *                rebuilt or checked if its ordering changed.
+ *
+ * The report is built from the single catalog pass of the bulk scan.  Sizes
+ * and row counts come from pg_class, as of the last VACUUM, ANALYZE or
+ * CREATE INDEX, so no relation is locked or opened, and the rebuild time is
+ * projected using a simple throughput model configured with GUCs.
+ *
+ * This program is open source, licensed under the PostgreSQL license.
+ * For license terms, see the LICENSE file.
+ *
+ * Copyright (C) 2022-2023: Julien Rouhaud
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include "access/htup_details.h"
+#include "catalog/pg_class.h"
+#include "funcapi.h"
+#include "utils/hsearch.h"
+#include "utils/syscache.h"
+
+#include "pg_collation_dependencies.h"
+
+#define PGCD_IMPACT_COLS		11
+
+/* GUC variables */
+int			pgcd_rebuild_mb_per_second = 100;
+int			pgcd_rebuild_rows_per_second = 1000000;
+
+/* Aggregated impact of a single collation. */
+typedef struct pgcdImpactEntry
+{
+	Oid			collid;			/* hash key, must be first */
+	int64		objects;
+	int64		indexes;
+	int64		index_bytes;
+	int64		matviews;
+	int64		matview_bytes;
+	int64		constraints;
+	int64		tables;
+	int64		table_rows;
+	int64		partitions;
+	double		rebuild_seconds;
+} pgcdImpactEntry;
+
+/* A table already accounted for a given collation. */
+typedef struct pgcdImpactTableKey
+{
+	Oid			collid;
+	Oid			relid;
+} pgcdImpactTableKey;
+
+extern PGDLLEXPORT Datum	pg_collation_impact_summary(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(pg_collation_impact_summary);
+
+static bool pgcd_impact_relstats(Oid relid, int64 *bytes, int64 *rows,
+								 char *relkind, bool *ispartition);
+static double pgcd_impact_rebuild_seconds(int64 bytes, int64 rows);
+
+/*
+ * Get the size and row count of the given relation, as recorded in pg_class.
+ * Returns false if the relation doesn't exist anymore.
+ */
+static bool
+pgcd_impact_relstats(Oid relid, int64 *bytes, int64 *rows, char *relkind,
+					 bool *ispartition)
+{
+	HeapTuple	tup;
+	Form_pg_class classForm;
+
+	tup = SearchSysCache1(RELOID, ObjectIdGetDatum(relid));
+	if (!HeapTupleIsValid(tup))
+		return false;
+
+	classForm = (Form_pg_class) GETSTRUCT(tup);
+	*bytes = (int64) classForm->relpages * BLCKSZ;
+	/* reltuples is -1 for relations never vacuumed or analyzed on pg14+ */
+	*rows = classForm->reltuples > 0 ? (int64) classForm->reltuples : 0;
+	*relkind = classForm->relkind;
+	*ispartition = classForm->relispartition;
+
+	ReleaseSysCache(tup);
+
+	return true;
+}
+
+/*
+ * Projected time to rebuild a relation of the given size and number of rows,
+ * according to the configured throughput.
+ */
+static double
+pgcd_impact_rebuild_seconds(int64 bytes, int64 rows)
+{
+	double		seconds = 0;
+
+	if (pgcd_rebuild_mb_per_second > 0)
+		seconds += (double) bytes / ((double) pgcd_rebuild_mb_per_second * 1024 * 1024);
+	if (pgcd_rebuild_rows_per_second > 0)
+		seconds += (double) rows / pgcd_rebuild_rows_per_second;
+
+	return seconds;
+}
+
+/*
+ * SRF returning, for each collation with at least one dependency, the
+ * objects that depend on it and the projected cost of rebuilding them.
+ *
+ * Indexes and materialized views are counted as rebuilt.  The other objects
+ * are only counted, with their underlying tables and the partitions among
+ * them, as they need to be checked rather than rebuilt.  Only plain and
+ * partitioned tables are counted as underlying tables, not the materialized
+ * views that indexes can be defined on.  Objects that can't be processed are
+ * ignored, see the pg_collation_dependency_errors view.
+ */
+Datum
+pg_collation_impact_summary(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo  *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	pgcdBulkObject *objects;
+	int				nobjects;
+	HTAB		   *impacts;
+	HTAB		   *tables;
+	HASHCTL			ctl;
+	HASH_SEQ_STATUS	status;
+	pgcdImpactEntry *entry;
+	int				i;
+
+	InitMaterializedSRF(fcinfo, MAT_SRF_USE_EXPECTED_DESC);
+
+	memset(&ctl, 0, sizeof(ctl));
+	ctl.keysize = sizeof(Oid);
+	ctl.entrysize = sizeof(pgcdImpactEntry);
+	ctl.hcxt = CurrentMemoryContext;
+	impacts = hash_create("pg_collation_impact_summary collations", 64, &ctl,
+						  HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+
+	memset(&ctl, 0, sizeof(ctl));
+	ctl.keysize = sizeof(pgcdImpactTableKey);
+	ctl.entrysize = sizeof(pgcdImpactTableKey);
+	ctl.hcxt = CurrentMemoryContext;
+	tables = hash_create("pg_collation_impact_summary tables", 1024, &ctl,
+						 HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+
+	objects = pgcd_bulk_scan(&nobjects);
+
+	for (i = 0; i < nobjects; i++)
+	{
+		pgcdBulkObject *obj = &objects[i];
+		int64		objbytes = 0;
+		int64		objrows = 0;
+		char		relkind;
+		bool		ispartition;
+		bool		rebuilt;
+		ListCell   *lc;
+
+		if (obj->error != NULL)
+			continue;
+
+		rebuilt = (obj->kind == PGCD_BULK_INDEX ||
+				   obj->kind == PGCD_BULK_MATVIEW);
+
+		/* The object may have been dropped since the scan. */
+		if (rebuilt &&
+			!pgcd_impact_relstats(obj->objoid, &objbytes, &objrows,
+								  &relkind, &ispartition))
+			continue;
+
+		/* The collation list is sorted and deduplicated. */
+		foreach(lc, obj->collations)
+		{
+			Oid			collid = lfirst_oid(lc);
+			bool		found;
+
+			entry = hash_search(impacts, &collid, HASH_ENTER, &found);
+			if (!found)
+				memset(((char *) entry) + sizeof(Oid), 0,
+					   sizeof(pgcdImpactEntry) - sizeof(Oid));
+
+			entry->objects++;
+			switch (obj->kind)
+			{
+				case PGCD_BULK_INDEX:
+					entry->indexes++;
+					entry->index_bytes += objbytes;
+					break;
+				case PGCD_BULK_MATVIEW:
+					entry->matviews++;
+					entry->matview_bytes += objbytes;
+					break;
+				case PGCD_BULK_CONSTRAINT:
+					entry->constraints++;
+					break;
+				default:
+					break;
+			}
+			if (rebuilt)
+				entry->rebuild_seconds += pgcd_impact_rebuild_seconds(objbytes,
+																	  objrows);
+
+			if (OidIsValid(obj->tbloid))
+			{
+				pgcdImpactTableKey key;
+				int64		tblbytes;
+				int64		tblrows;
+
+				key.collid = collid;
+				key.relid = obj->tbloid;
+				(void) hash_search(tables, &key, HASH_ENTER, &found);
+				if (!found &&
+					pgcd_impact_relstats(obj->tbloid, &tblbytes, &tblrows,
+										 &relkind, &ispartition) &&
+					(relkind == RELKIND_RELATION ||
+					 relkind == RELKIND_PARTITIONED_TABLE))
+				{
+					entry->tables++;
+					entry->table_rows += tblrows;
+					if (ispartition)
+						entry->partitions++;
+				}
+			}
+		}
+	}
+
+	hash_seq_init(&status, impacts);
+	while ((entry = (pgcdImpactEntry *) hash_seq_search(&status)) != NULL)
+	{
+		Datum		values[PGCD_IMPACT_COLS];
+		bool		nulls[PGCD_IMPACT_COLS];
+
+		memset(nulls, 0, sizeof(nulls));
+
+		values[0] = ObjectIdGetDatum(entry->collid);
+		values[1] = Int64GetDatum(entry->objects);
+		values[2] = Int64GetDatum(entry->indexes);
+		values[3] = Int64GetDatum(entry->index_bytes);
+		values[4] = Int64GetDatum(entry->matviews);
+		values[5] = Int64GetDatum(entry->matview_bytes);
+		values[6] = Int64GetDatum(entry->constraints);
+		values[7] = Int64GetDatum(entry->tables);
+		values[8] = Int64GetDatum(entry->table_rows);
+		values[9] = Int64GetDatum(entry->partitions);
+		values[10] = Float8GetDatum(entry->rebuild_seconds);
+
+		tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values, nulls);
+	}
+
+	return (Datum) 0;
+}
@@ -0,0 +1,829 @@
+/*-------------------------------------------------------------------------
+ *
+ * pgcd_snapshot.c: Export the collation dependencies of the database in a
+ *                  compact binary snapshot, and compare two snapshots.
+ *
+ * A snapshot taken before an operating system upgrade can be compared with a
+ * fresh one afterwards, to only report the objects whose collation set or
+ * collation versions changed.
+ *
+ * The file is made of a fixed-size header, followed by the array of the
+ * referenced collations sorted by oid, the area holding their version
+ * strings, and the stream of objects sorted by oid.  Each object is encoded
+ * as the variable-length delta of its oid with the previous object, its kind,
+ * the number of collations and the delta-encoded indexes of its collations in
+ * the collation array.  The fixed-size parts are 4 bytes aligned so that the
+ * file can be mapped in memory, and everything is in the native byte order of
+ * the server.  The header holds a CRC of the rest of the file.
+ *
+ * This program is open source, licensed under the PostgreSQL license.
+ * For license terms, see the LICENSE file.
+ *
+ * Copyright (C) 2022-2023: Julien Rouhaud
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include "catalog/pg_type.h"
+#include "executor/spi.h"
+#include "funcapi.h"
+#include "lib/stringinfo.h"
+#include "miscadmin.h"
+#include "port/pg_crc32c.h"
+#include "storage/fd.h"
+#include "utils/array.h"
+#include "utils/builtins.h"
+
+#include "pg_collation_dependencies.h"
+
+#define PGCD_SNAPSHOT_MAGIC			"PGCDSNAP"
+#define PGCD_SNAPSHOT_VERSION		1
+
+#define PGCD_SNAPSHOT_READ_COLS		4
+#define PGCD_SNAPSHOT_DIFF_COLS		6
+
+/* No version for the collation */
+#define PGCD_SNAPSHOT_NO_VERSION	PG_UINT32_MAX
+
+/* No collation index */
+#define PGCD_SNAPSHOT_NO_COLL		PG_UINT32_MAX
+
+typedef struct pgcdSnapshotHeader
+{
+	char		magic[8];		/* PGCD_SNAPSHOT_MAGIC, without terminator */
+	uint32		version;		/* PGCD_SNAPSHOT_VERSION */
+	uint32		server_version; /* PG_VERSION_NUM of the exporting server */
+	uint32		ncollations;	/* number of pgcdSnapshotCollation */
+	uint32		nobjects;		/* number of encoded objects */
+	uint32		strings_size;	/* size of the version strings area */
+	uint32		objects_size;	/* size of the encoded objects area */
+	pg_crc32c	crc;			/* CRC of everything after the header */
+	uint32		padding;
+} pgcdSnapshotHeader;
+
+typedef struct pgcdSnapshotCollation
+{
+	Oid			collid;
+	uint32		version_off;	/* offset in the strings area */
+	uint32		version_len;	/* or PGCD_SNAPSHOT_NO_VERSION */
+} pgcdSnapshotCollation;
+
+/*
+ * A snapshot being read, either from a file or from an in-memory image.  The
+ * header and collations are read upfront, the objects are then streamed one
+ * at a time.
+ */
+typedef struct pgcdSnapshotReader
+{
+	const char *name;			/* for error messages */
+	FILE	   *file;			/* NULL if reading from memory */
+	const char *data;			/* in-memory image */
+	Size		len;
+	Size		pos;
+	pgcdSnapshotHeader header;
+	pgcdSnapshotCollation *collations;
+	char	   *strings;
+	pg_crc32c	crc;			/* running CRC of the read data */
+	uint32		nread;			/* number of objects read so far */
+	/* current object */
+	Oid			objid;
+	pgcdBulkKind kind;
+	uint32		ncolls;
+	uint32	   *colls;			/* indexes in the collation array */
+	uint32		maxcolls;
+} pgcdSnapshotReader;
+
+extern PGDLLEXPORT Datum	pg_collation_snapshot_export(PG_FUNCTION_ARGS);
+extern PGDLLEXPORT Datum	pg_collation_snapshot_read(PG_FUNCTION_ARGS);
+extern PGDLLEXPORT Datum	pg_collation_snapshot_diff(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(pg_collation_snapshot_export);
+PG_FUNCTION_INFO_V1(pg_collation_snapshot_read);
+PG_FUNCTION_INFO_V1(pg_collation_snapshot_diff);
+
+static int	pgcd_snapshot_object_cmp(const void *a, const void *b);
+static int	pgcd_snapshot_oid_cmp(const void *a, const void *b);
+static void pgcd_snapshot_append_varint(StringInfo buf, uint32 value);
+static void pgcd_snapshot_build(StringInfo buf);
+static void pgcd_snapshot_read_raw(pgcdSnapshotReader *reader, void *dest,
+								   Size len);
+static uint32 pgcd_snapshot_read_varint(pgcdSnapshotReader *reader);
+static void pgcd_snapshot_open(pgcdSnapshotReader *reader, const char *path,
+							   const char *data, Size len);
+static bool pgcd_snapshot_next(pgcdSnapshotReader *reader);
+static void pgcd_snapshot_close(pgcdSnapshotReader *reader);
+static Oid	pgcd_snapshot_collid(pgcdSnapshotReader *reader, uint32 idx);
+static text *pgcd_snapshot_collversion(pgcdSnapshotReader *reader,
+									   uint32 idx);
+static void pgcd_snapshot_put_diff(ReturnSetInfo *rsinfo, const char *change,
+								   pgcdSnapshotReader *oldreader, uint32 oldidx,
+								   pgcdSnapshotReader *newreader, uint32 newidx);
+
+/*
+ * Sort the objects by oid, and kind for the unlikely case of two objects of
+ * different catalogs having the same oid.
+ */
+static int
+pgcd_snapshot_object_cmp(const void *a, const void *b)
+{
+	const pgcdBulkObject *obja = (const pgcdBulkObject *) a;
+	const pgcdBulkObject *objb = (const pgcdBulkObject *) b;
+
+	if (obja->objoid != objb->objoid)
+		return obja->objoid < objb->objoid ? -1 : 1;
+
+	return (int) obja->kind - (int) objb->kind;
+}
+
+static int
+pgcd_snapshot_oid_cmp(const void *a, const void *b)
+{
+	Oid			oida = *(const Oid *) a;
+	Oid			oidb = *(const Oid *) b;
+
+	if (oida == oidb)
+		return 0;
+
+	return oida < oidb ? -1 : 1;
+}
+
+/*
+ * Append the given value using 7 bits per byte, the high bit being set on all
+ * but the last byte.
+ */
+static void
+pgcd_snapshot_append_varint(StringInfo buf, uint32 value)
+{
+	while (value >= 0x80)
+	{
+		appendStringInfoCharMacro(buf, (char) ((value & 0x7F) | 0x80));
+		value >>= 7;
+	}
+	appendStringInfoCharMacro(buf, (char) value);
+}
+
+/*
+ * Build the snapshot of the current database in the given buffer.
+ */
+static void
+pgcd_snapshot_build(StringInfo buf)
+{
+	pgcdSnapshotHeader header;
+	pgcdBulkObject *objects;
+	int			nobjects;
+	int			nerrors = 0;
+	Oid		   *collids;
+	int			ncollids = 0;
+	int			maxcollids = 64;
+	pgcdSnapshotCollation *collations;
+	StringInfoData strings;
+	StringInfoData stream;
+	Oid			prev_objid = InvalidOid;
+	uint32	   *idxs;
+	uint32		nencoded = 0;
+	int			i;
+	int			ret;
+
+	objects = pgcd_bulk_scan(&nobjects);
+	qsort(objects, nobjects, sizeof(pgcdBulkObject), pgcd_snapshot_object_cmp);
+
+	/* Gather all the referenced collations. */
+	collids = palloc(sizeof(Oid) * maxcollids);
+	for (i = 0; i < nobjects; i++)
+	{
+		ListCell   *lc;
+
+		if (objects[i].error != NULL)
+		{
+			nerrors++;
+			continue;
+		}
+
+		foreach(lc, objects[i].collations)
+		{
+			if (ncollids >= maxcollids)
+			{
+				maxcollids *= 2;
+				collids = repalloc(collids, sizeof(Oid) * maxcollids);
+			}
+			collids[ncollids++] = lfirst_oid(lc);
+		}
+	}
+
+	if (nerrors > 0)
+		ereport(WARNING,
+				(errmsg("%d objects could not be processed and are not part of the snapshot",
+						nerrors),
+				 errhint("The objects are listed in the pg_collation_dependency_errors view.")));
+
+	if (ncollids > 1)
+	{
+		int			nunique = 1;
+
+		qsort(collids, ncollids, sizeof(Oid), pgcd_snapshot_oid_cmp);
+		for (i = 1; i < ncollids; i++)
+		{
+			if (collids[i] != collids[nunique - 1])
+				collids[nunique++] = collids[i];
+		}
+		ncollids = nunique;
+	}
+
+	/* Fetch the current version of each collation. */
+	collations = palloc0(sizeof(pgcdSnapshotCollation) * Max(ncollids, 1));
+	initStringInfo(&strings);
+
+	if (ncollids > 0)
+	{
+		Datum	   *elems = palloc(sizeof(Datum) * ncollids);
+		Oid			argtypes[1] = {OIDARRAYOID};
+		Datum		args[1];
+		uint64		row;
+
+		for (i = 0; i < ncollids; i++)
+			elems[i] = ObjectIdGetDatum(collids[i]);
+		args[0] = PointerGetDatum(construct_array(elems, ncollids, OIDOID,
+												  sizeof(Oid), true, 'i'));
+
+		if (SPI_connect() != SPI_OK_CONNECT)
+			elog(ERROR, "SPI_connect failed");
+
+		ret = SPI_execute_with_args("SELECT pg_catalog.pg_collation_actual_version(c.colloid)"
+									" FROM pg_catalog.unnest($1) WITH ORDINALITY AS c(colloid, n)"
+									" ORDER BY c.n",
+									1, argtypes, args, NULL, true, 0);
+		if (ret != SPI_OK_SELECT || SPI_processed != ncollids)
+			elog(ERROR, "could not get collation versions: %s",
+				 SPI_result_code_string(ret));
+
+		for (row = 0; row < SPI_processed; row++)
+		{
+			char	   *version = SPI_getvalue(SPI_tuptable->vals[row],
+											   SPI_tuptable->tupdesc, 1);
+
+			collations[row].collid = collids[row];
+			if (version == NULL)
+			{
+				collations[row].version_off = 0;
+				collations[row].version_len = PGCD_SNAPSHOT_NO_VERSION;
+				continue;
+			}
+
+			/* strings is allocated in the caller's context, not SPI's */
+			collations[row].version_off = strings.len;
+			collations[row].version_len = strlen(version);
+			appendBinaryStringInfo(&strings, version, strlen(version));
+		}
+
+		SPI_finish();
+	}
+
+	/* Keep the objects area aligned. */
+	while (strings.len % sizeof(uint32) != 0)
+		appendStringInfoCharMacro(&strings, '\0');
+
+	/* Encode the objects. */
+	initStringInfo(&stream);
+	idxs = palloc(sizeof(uint32) * Max(ncollids, 1));
+
+	for (i = 0; i < nobjects; i++)
+	{
+		pgcdBulkObject *obj = &objects[i];
+		ListCell   *lc;
+		uint32		nidxs = 0;
+		uint32		prev_idx = 0;
+		uint32		j;
+
+		if (obj->error != NULL)
+			continue;
+
+		foreach(lc, obj->collations)
+		{
+			Oid			collid = lfirst_oid(lc);
+			Oid		   *found;
+
+			found = bsearch(&collid, collids, ncollids, sizeof(Oid),
+							pgcd_snapshot_oid_cmp);
+			Assert(found != NULL);
+			idxs[nidxs++] = found - collids;
+		}
+
+		/* the collations should already be sorted, but make sure */
+		qsort(idxs, nidxs, sizeof(uint32), pgcd_snapshot_oid_cmp);
+
+		pgcd_snapshot_append_varint(&stream, obj->objoid - prev_objid);
+		appendStringInfoCharMacro(&stream, (char) obj->kind);
+		pgcd_snapshot_append_varint(&stream, nidxs);
+		for (j = 0; j < nidxs; j++)
+		{
+			pgcd_snapshot_append_varint(&stream, idxs[j] - prev_idx);
+			prev_idx = idxs[j];
+		}
+
+		prev_objid = obj->objoid;
+		nencoded++;
+	}
+
+	memset(&header, 0, sizeof(pgcdSnapshotHeader));
+	memcpy(header.magic, PGCD_SNAPSHOT_MAGIC, sizeof(header.magic));
+	header.version = PGCD_SNAPSHOT_VERSION;
+	header.server_version = PG_VERSION_NUM;
+	header.ncollations = ncollids;
+	header.nobjects = nencoded;
+	header.strings_size = strings.len;
+	header.objects_size = stream.len;
+
+	INIT_CRC32C(header.crc);
+	COMP_CRC32C(header.crc, collations,
+				sizeof(pgcdSnapshotCollation) * ncollids);
+	COMP_CRC32C(header.crc, strings.data, strings.len);
+	COMP_CRC32C(header.crc, stream.data, stream.len);
+	FIN_CRC32C(header.crc);
+
+	appendBinaryStringInfo(buf, (char *) &header, sizeof(header));
+	appendBinaryStringInfo(buf, (char *) collations,
+						   sizeof(pgcdSnapshotCollation) * ncollids);
+	appendBinaryStringInfo(buf, strings.data, strings.len);
+	appendBinaryStringInfo(buf, stream.data, stream.len);
+
+	pfree(strings.data);
+	pfree(stream.data);
+	pfree(collations);
+	pfree(collids);
+	pfree(idxs);
+}
+
+/*
+ * Read exactly len bytes from the snapshot, erroring out if it's truncated.
+ */
+static void
+pgcd_snapshot_read_raw(pgcdSnapshotReader *reader, void *dest, Size len)
+{
+	if (reader->file != NULL)
+	{
+		if (fread(dest, 1, len, reader->file) != len)
+		{
+			if (ferror(reader->file))
+				ereport(ERROR,
+						(errcode_for_file_access(),
+						 errmsg("could not read file \"%s\": %m",
+								reader->name)));
+			goto truncated;
+		}
+	}
+	else
+	{
+		if (reader->len - reader->pos < len)
+			goto truncated;
+		memcpy(dest, reader->data + reader->pos, len);
+		reader->pos += len;
+	}
+
+	return;
+
+truncated:
+	ereport(ERROR,
+			(errcode(ERRCODE_DATA_CORRUPTED),
+			 errmsg("collation snapshot \"%s\" is truncated", reader->name)));
+}
+
+static uint32
+pgcd_snapshot_read_varint(pgcdSnapshotReader *reader)
+{
+	uint32		value = 0;
+	int			shift = 0;
+	unsigned char byte;
+
+	do
+	{
+		if (shift > 28)
+			ereport(ERROR,
+					(errcode(ERRCODE_DATA_CORRUPTED),
+					 errmsg("invalid variable-length integer in collation snapshot \"%s\"",
+							reader->name)));
+
+		pgcd_snapshot_read_raw(reader, &byte, 1);
+		COMP_CRC32C(reader->crc, &byte, 1);
+		value |= (uint32) (byte & 0x7F) << shift;
+		shift += 7;
+	} while (byte & 0x80);
+
+	return value;
+}
+
+/*
+ * Open the given snapshot file, or the given in-memory image if path is NULL,
+ * and read everything but the objects.
+ */
+static void
+pgcd_snapshot_open(pgcdSnapshotReader *reader, const char *path,
+				   const char *data, Size len)
+{
+	pgcdSnapshotHeader *header = &reader->header;
+
+	memset(reader, 0, sizeof(pgcdSnapshotReader));
+
+	if (path != NULL)
+	{
+		reader->name = path;
+		reader->file = AllocateFile(path, PG_BINARY_R);
+		if (reader->file == NULL)
+			ereport(ERROR,
+					(errcode_for_file_access(),
+					 errmsg("could not open file \"%s\" for reading: %m",
+							path)));
+	}
+	else
+	{
+		reader->name = "current database";
+		reader->data = data;
+		reader->len = len;
+	}
+
+	pgcd_snapshot_read_raw(reader, header, sizeof(pgcdSnapshotHeader));
+
+	if (memcmp(header->magic, PGCD_SNAPSHOT_MAGIC, sizeof(header->magic)) != 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_CORRUPTED),
+				 errmsg("file \"%s\" is not a collation snapshot",
+						reader->name)));
+
+	if (header->version != PGCD_SNAPSHOT_VERSION)
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("collation snapshot \"%s\" has unsupported format version %u",
+						reader->name, header->version),
+				 errdetail("Only format version %d is supported.",
+						   PGCD_SNAPSHOT_VERSION)));
+
+	reader->collations = palloc(sizeof(pgcdSnapshotCollation) *
+								Max(header->ncollations, 1));
+	pgcd_snapshot_read_raw(reader, reader->collations,
+						   sizeof(pgcdSnapshotCollation) * header->ncollations);
+
+	reader->strings = palloc(Max(header->strings_size, 1));
+	pgcd_snapshot_read_raw(reader, reader->strings, header->strings_size);
+
+	INIT_CRC32C(reader->crc);
+	COMP_CRC32C(reader->crc, reader->collations,
+				sizeof(pgcdSnapshotCollation) * header->ncollations);
+	COMP_CRC32C(reader->crc, reader->strings, header->strings_size);
+
+	reader->maxcolls = Max(header->ncollations, 1);
+	reader->colls = palloc(sizeof(uint32) * reader->maxcolls);
+}
+
+/*
+ * Read the next object of the snapshot, returning false once all objects
+ * were read, after checking the CRC.
+ */
+static bool
+pgcd_snapshot_next(pgcdSnapshotReader *reader)
+{
+	uint32		prev_idx = 0;
+	unsigned char kind;
+	uint32		i;
+
+	if (reader->nread >= reader->header.nobjects)
+	{
+		pg_crc32c	crc = reader->crc;
+
+		FIN_CRC32C(crc);
+		if (!EQ_CRC32C(crc, reader->header.crc))
+			ereport(ERROR,
+					(errcode(ERRCODE_DATA_CORRUPTED),
+					 errmsg("collation snapshot \"%s\" is corrupted",
+							reader->name),
+					 errdetail("Calculated CRC checksum does not match value stored in file.")));
+		return false;
+	}
+
+	reader->objid += pgcd_snapshot_read_varint(reader);
+
+	pgcd_snapshot_read_raw(reader, &kind, 1);
+	COMP_CRC32C(reader->crc, &kind, 1);
+	if (kind >= PGCD_BULK_NUM_KINDS)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_CORRUPTED),
+				 errmsg("invalid object kind %d in collation snapshot \"%s\"",
+						kind, reader->name)));
+	reader->kind = (pgcdBulkKind) kind;
+
+	reader->ncolls = pgcd_snapshot_read_varint(reader);
+	if (reader->ncolls > reader->header.ncollations)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_CORRUPTED),
+				 errmsg("invalid number of collations %u in collation snapshot \"%s\"",
+						reader->ncolls, reader->name)));
+
+	for (i = 0; i < reader->ncolls; i++)
+	{
+		uint32		idx = prev_idx + pgcd_snapshot_read_varint(reader);
+
+		if (idx >= reader->header.ncollations)
+			ereport(ERROR,
+					(errcode(ERRCODE_DATA_CORRUPTED),
+					 errmsg("invalid collation index %u in collation snapshot \"%s\"",
+							idx, reader->name)));
+		reader->colls[i] = idx;
+		prev_idx = idx;
+	}
+
+	reader->nread++;
+
+	return true;
+}
+
+static void
+pgcd_snapshot_close(pgcdSnapshotReader *reader)
+{
+	if (reader->file != NULL)
+		FreeFile(reader->file);
+
+	pfree(reader->collations);
+	pfree(reader->strings);
+	pfree(reader->colls);
+}
+
+static Oid
+pgcd_snapshot_collid(pgcdSnapshotReader *reader, uint32 idx)
+{
+	return reader->collations[idx].collid;
+}
+
+/*
+ * Get the recorded version of the given collation, or NULL if none.
+ */
+static text *
+pgcd_snapshot_collversion(pgcdSnapshotReader *reader, uint32 idx)
+{
+	pgcdSnapshotCollation *coll = &reader->collations[idx];
+
+	if (coll->version_len == PGCD_SNAPSHOT_NO_VERSION)
+		return NULL;
+
+	if ((Size) coll->version_off + coll->version_len >
+		reader->header.strings_size)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_CORRUPTED),
+				 errmsg("invalid collation version in collation snapshot \"%s\"",
+						reader->name)));
+
+	return cstring_to_text_with_len(reader->strings + coll->version_off,
+									coll->version_len);
+}
+
+/*
+ * Emit a difference for the current object of the given readers.  For added
+ * and removed objects or collations, only one of the readers is provided, and
+ * the collation index for the other one is PGCD_SNAPSHOT_NO_COLL.
+ */
+static void
+pgcd_snapshot_put_diff(ReturnSetInfo *rsinfo, const char *change,
+					   pgcdSnapshotReader *oldreader, uint32 oldidx,
+					   pgcdSnapshotReader *newreader, uint32 newidx)
+{
+	pgcdSnapshotReader *reader = oldreader ? oldreader : newreader;
+	Datum		values[PGCD_SNAPSHOT_DIFF_COLS];
+	bool		nulls[PGCD_SNAPSHOT_DIFF_COLS];
+	text	   *version = NULL;
+
+	memset(nulls, 0, sizeof(nulls));
+
+	values[0] = CStringGetTextDatum(pgcd_bulk_kind_name(reader->kind));
+	values[1] = ObjectIdGetDatum(reader->objid);
+	values[2] = CStringGetTextDatum(change);
+
+	if (oldidx != PGCD_SNAPSHOT_NO_COLL)
+		values[3] = ObjectIdGetDatum(pgcd_snapshot_collid(oldreader, oldidx));
+	else
+		values[3] = ObjectIdGetDatum(pgcd_snapshot_collid(newreader, newidx));
+
+	if (oldidx != PGCD_SNAPSHOT_NO_COLL)
+		version = pgcd_snapshot_collversion(oldreader, oldidx);
+	values[4] = PointerGetDatum(version);
+	nulls[4] = (version == NULL);
+
+	version = NULL;
+	if (newidx != PGCD_SNAPSHOT_NO_COLL)
+		version = pgcd_snapshot_collversion(newreader, newidx);
+	values[5] = PointerGetDatum(version);
+	nulls[5] = (version == NULL);
+
+	tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values, nulls);
+}
+
+/*
+ * Export the collation dependencies of all the objects of the database, with
+ * the current version of the collations, in the given file.  Returns the
+ * number of exported objects.
+ */
+Datum
+pg_collation_snapshot_export(PG_FUNCTION_ARGS)
+{
+	char	   *path = text_to_cstring(PG_GETARG_TEXT_PP(0));
+	StringInfoData buf;
+	pgcdSnapshotHeader *header;
+	FILE	   *file;
+
+	initStringInfo(&buf);
+	pgcd_snapshot_build(&buf);
+	header = (pgcdSnapshotHeader *) buf.data;
+
+	file = AllocateFile(path, PG_BINARY_W);
+	if (file == NULL)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not open file \"%s\" for writing: %m", path)));
+
+	if (fwrite(buf.data, 1, buf.len, file) != buf.len)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not write file \"%s\": %m", path)));
+
+	if (FreeFile(file) != 0)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not close file \"%s\": %m", path)));
+
+	PG_RETURN_INT64(header->nobjects);
+}
+
+/*
+ * SRF returning the content of the given snapshot file, one row per object
+ * and collation.
+ */
+Datum
+pg_collation_snapshot_read(PG_FUNCTION_ARGS)
+{
+	char		   *path = text_to_cstring(PG_GETARG_TEXT_PP(0));
+	ReturnSetInfo  *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	pgcdSnapshotReader reader;
+
+	InitMaterializedSRF(fcinfo, MAT_SRF_USE_EXPECTED_DESC);
+
+	pgcd_snapshot_open(&reader, path, NULL, 0);
+
+	while (pgcd_snapshot_next(&reader))
+	{
+		uint32		i;
+
+		for (i = 0; i < reader.ncolls; i++)
+		{
+			Datum		values[PGCD_SNAPSHOT_READ_COLS];
+			bool		nulls[PGCD_SNAPSHOT_READ_COLS];
+			text	   *version;
+
+			memset(nulls, 0, sizeof(nulls));
+
+			values[0] = CStringGetTextDatum(pgcd_bulk_kind_name(reader.kind));
+			values[1] = ObjectIdGetDatum(reader.objid);
+			values[2] = ObjectIdGetDatum(pgcd_snapshot_collid(&reader,
+															  reader.colls[i]));
+			version = pgcd_snapshot_collversion(&reader, reader.colls[i]);
+			values[3] = PointerGetDatum(version);
+			nulls[3] = (version == NULL);
+
+			tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values,
+								 nulls);
+		}
+	}
+
+	pgcd_snapshot_close(&reader);
+
+	return (Datum) 0;
+}
+
+/*
+ * SRF returning the differences between two snapshots, or between a snapshot
+ * and the current state of the database if only one file is given.
+ *
+ * Both snapshots are streamed in oid order, and only the added and removed
+ * objects, the added and removed collations of an object and the collations
+ * whose version changed are returned.
+ */
+Datum
+pg_collation_snapshot_diff(PG_FUNCTION_ARGS)
+{
+	char		   *oldpath = text_to_cstring(PG_GETARG_TEXT_PP(0));
+	ReturnSetInfo  *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	pgcdSnapshotReader oldreader;
+	pgcdSnapshotReader newreader;
+	StringInfoData	current;
+	bool			has_old;
+	bool			has_new;
+
+	InitMaterializedSRF(fcinfo, MAT_SRF_USE_EXPECTED_DESC);
+
+	pgcd_snapshot_open(&oldreader, oldpath, NULL, 0);
+
+	if (PG_NARGS() > 1)
+		pgcd_snapshot_open(&newreader,
+						   text_to_cstring(PG_GETARG_TEXT_PP(1)), NULL, 0);
+	else
+	{
+		initStringInfo(&current);
+		pgcd_snapshot_build(&current);
+		pgcd_snapshot_open(&newreader, NULL, current.data, current.len);
+	}
+
+	has_old = pgcd_snapshot_next(&oldreader);
+	has_new = pgcd_snapshot_next(&newreader);
+
+	while (has_old || has_new)
+	{
+		int			cmp;
+		uint32		i = 0;
+		uint32		j = 0;
+
+		CHECK_FOR_INTERRUPTS();
+
+		if (!has_new)
+			cmp = -1;
+		else if (!has_old)
+			cmp = 1;
+		else if (oldreader.objid != newreader.objid)
+			cmp = oldreader.objid < newreader.objid ? -1 : 1;
+		else
+			cmp = (int) oldreader.kind - (int) newreader.kind;
+
+		if (cmp < 0)
+		{
+			for (i = 0; i < oldreader.ncolls; i++)
+				pgcd_snapshot_put_diff(rsinfo, "removed",
+									   &oldreader, oldreader.colls[i],
+									   NULL, PGCD_SNAPSHOT_NO_COLL);
+			has_old = pgcd_snapshot_next(&oldreader);
+			continue;
+		}
+
+		if (cmp > 0)
+		{
+			for (j = 0; j < newreader.ncolls; j++)
+				pgcd_snapshot_put_diff(rsinfo, "added",
+									   NULL, PGCD_SNAPSHOT_NO_COLL,
+									   &newreader, newreader.colls[j]);
+			has_new = pgcd_snapshot_next(&newreader);
+			continue;
+		}
+
+		/* Same object, merge both collation sets, sorted by oid. */
+		while (i < oldreader.ncolls || j < newreader.ncolls)
+		{
+			Oid			oldcoll = InvalidOid;
+			Oid			newcoll = InvalidOid;
+			text	   *oldversion;
+			text	   *newversion;
+
+			if (i < oldreader.ncolls)
+				oldcoll = pgcd_snapshot_collid(&oldreader, oldreader.colls[i]);
+			if (j < newreader.ncolls)
+				newcoll = pgcd_snapshot_collid(&newreader, newreader.colls[j]);
+
+			if (j >= newreader.ncolls ||
+				(i < oldreader.ncolls && oldcoll < newcoll))
+			{
+				pgcd_snapshot_put_diff(rsinfo, "collation removed",
+									   &oldreader, oldreader.colls[i],
+									   NULL, PGCD_SNAPSHOT_NO_COLL);
+				i++;
+				continue;
+			}
+
+			if (i >= oldreader.ncolls || newcoll < oldcoll)
+			{
+				pgcd_snapshot_put_diff(rsinfo, "collation added",
+									   NULL, PGCD_SNAPSHOT_NO_COLL,
+									   &newreader, newreader.colls[j]);
+				j++;
+				continue;
+			}
+
+			oldversion = pgcd_snapshot_collversion(&oldreader,
+												   oldreader.colls[i]);
+			newversion = pgcd_snapshot_collversion(&newreader,
+												   newreader.colls[j]);
+
+			if ((oldversion == NULL) != (newversion == NULL) ||
+				(oldversion != NULL &&
+				 (VARSIZE_ANY_EXHDR(oldversion) != VARSIZE_ANY_EXHDR(newversion) ||
+				  memcmp(VARDATA_ANY(oldversion), VARDATA_ANY(newversion),
+						 VARSIZE_ANY_EXHDR(oldversion)) != 0)))
+				pgcd_snapshot_put_diff(rsinfo, "version changed",
+									   &oldreader, oldreader.colls[i],
+									   &newreader, newreader.colls[j]);
+			i++;
+			j++;
+		}
+
+		has_old = pgcd_snapshot_next(&oldreader);
+		has_new = pgcd_snapshot_next(&newreader);
+	}
+
+	pgcd_snapshot_close(&oldreader);
+	pgcd_snapshot_close(&newreader);
+
+	return (Datum) 0;
+}
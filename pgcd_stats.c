@@ -0,0 +1,300 @@
+/*-------------------------------------------------------------------------
+ *
+ * pgcd_stats.c: Find the planner statistics depending on collations, and
+ *               rebuild the ones depending on outdated collations.
+ *
+ * Histograms and most common values lists are sorted or compared using a
+ * collation when they're built, so they can lead to bad selectivity
+ * estimates after a collation library upgrade, even if no data is corrupted.
+ *
+ * This program is open source, licensed under the PostgreSQL license.
+ * For license terms, see the LICENSE file.
+ *
+ * Copyright (C) 2022-2023: Julien Rouhaud
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include "access/genam.h"
+#include "access/htup_details.h"
+#if PG_VERSION_NUM >= 120000
+#include "access/table.h"
+#endif
+#include "catalog/pg_statistic.h"
+#include "catalog/pg_statistic_ext.h"
+#include "catalog/pg_type.h"
+#include "executor/spi.h"
+#include "funcapi.h"
+#include "lib/stringinfo.h"
+#include "tcop/utility.h"
+#include "utils/builtins.h"
+#include "utils/lsyscache.h"
+#include "utils/rel.h"
+
+#include "pg_collation_dependencies.h"
+
+#define PGCD_STATS_DEP_COLS			4
+
+extern PGDLLEXPORT Datum	pg_collation_statistics_dependencies(PG_FUNCTION_ARGS);
+extern PGDLLEXPORT Datum	pg_collation_reanalyze(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(pg_collation_statistics_dependencies);
+PG_FUNCTION_INFO_V1(pg_collation_reanalyze);
+
+static Oid pgcd_get_attribute_collation(Oid relid, AttrNumber attnum);
+static void pgcd_put_stats_deps(ReturnSetInfo *rsinfo, Oid relid,
+								AttrNumber attnum, Oid statid,
+								List *collations);
+
+/*
+ * Get the collation of the given relation attribute.
+ */
+static Oid
+pgcd_get_attribute_collation(Oid relid, AttrNumber attnum)
+{
+	Oid			typid;
+	int32		typmod;
+	Oid			collid;
+
+	get_atttypetypmodcoll(relid, attnum, &typid, &typmod, &collid);
+
+	return collid;
+}
+
+/*
+ * Add a row for each of the given collations, ignoring duplicates.
+ */
+static void
+pgcd_put_stats_deps(ReturnSetInfo *rsinfo, Oid relid, AttrNumber attnum,
+					Oid statid, List *collations)
+{
+	List	   *seen = NIL;
+	ListCell   *lc;
+
+	foreach(lc, collations)
+	{
+		Oid			colloid = lfirst_oid(lc);
+		Datum		values[PGCD_STATS_DEP_COLS];
+		bool		nulls[PGCD_STATS_DEP_COLS];
+
+		if (!OidIsValid(colloid) || list_member_oid(seen, colloid))
+			continue;
+		seen = lappend_oid(seen, colloid);
+
+		memset(nulls, 0, sizeof(nulls));
+
+		values[0] = ObjectIdGetDatum(relid);
+		values[1] = Int16GetDatum(attnum);
+		nulls[1] = (attnum == InvalidAttrNumber);
+		values[2] = ObjectIdGetDatum(statid);
+		nulls[2] = !OidIsValid(statid);
+		values[3] = ObjectIdGetDatum(colloid);
+
+		tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values, nulls);
+	}
+
+	list_free(seen);
+}
+
+/*
+ * SRF returning the collations used to build the per-column statistics and
+ * the extended statistics.
+ *
+ * For per-column statistics, the collation of each populated slot is used.
+ * Before pg12 the slot collation isn't stored, so the column collation is
+ * used instead.  For extended statistics, the collations of the key columns
+ * and expressions are used.
+ */
+Datum
+pg_collation_statistics_dependencies(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo  *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	Relation		rel;
+	SysScanDesc		scan;
+	HeapTuple		tup;
+
+	InitMaterializedSRF(fcinfo, MAT_SRF_USE_EXPECTED_DESC);
+
+	rel = table_open(StatisticRelationId, AccessShareLock);
+	scan = systable_beginscan(rel, InvalidOid, false, NULL, 0, NULL);
+
+	while (HeapTupleIsValid(tup = systable_getnext(scan)))
+	{
+		Form_pg_statistic stats = (Form_pg_statistic) GETSTRUCT(tup);
+		List	   *collations = NIL;
+		int			i;
+
+		for (i = 0; i < STATISTIC_NUM_SLOTS; i++)
+		{
+			if ((&stats->stakind1)[i] == 0)
+				continue;
+
+#if PG_VERSION_NUM >= 120000
+			collations = lappend_oid(collations, (&stats->stacoll1)[i]);
+#else
+			collations = lappend_oid(collations,
+									 pgcd_get_attribute_collation(stats->starelid,
+																  stats->staattnum));
+#endif
+		}
+
+		pgcd_put_stats_deps(rsinfo, stats->starelid, stats->staattnum,
+							InvalidOid, collations);
+		list_free(collations);
+	}
+
+	systable_endscan(scan);
+	table_close(rel, AccessShareLock);
+
+	rel = table_open(StatisticExtRelationId, AccessShareLock);
+	scan = systable_beginscan(rel, InvalidOid, false, NULL, 0, NULL);
+
+	while (HeapTupleIsValid(tup = systable_getnext(scan)))
+	{
+		Form_pg_statistic_ext stxform = (Form_pg_statistic_ext) GETSTRUCT(tup);
+		List	   *collations = NIL;
+		Oid			statid;
+		int			i;
+
+#if PG_VERSION_NUM >= 120000
+		statid = stxform->oid;
+#else
+		statid = HeapTupleGetOid(tup);
+#endif
+
+		for (i = 0; i < stxform->stxkeys.dim1; i++)
+			collations = lappend_oid(collations,
+									 pgcd_get_attribute_collation(stxform->stxrelid,
+																  stxform->stxkeys.values[i]));
+
+#if PG_VERSION_NUM >= 140000
+		{
+			Datum		datum;
+			bool		isnull;
+
+			datum = heap_getattr(tup, Anum_pg_statistic_ext_stxexprs,
+								 RelationGetDescr(rel), &isnull);
+			if (!isnull)
+				collations = list_concat(collations,
+										 pgcd_get_query_expression_collations(stringToNode(TextDatumGetCString(datum))));
+		}
+#endif
+
+		pgcd_put_stats_deps(rsinfo, stxform->stxrelid, InvalidAttrNumber,
+							statid, collations);
+		list_free(collations);
+	}
+
+	systable_endscan(scan);
+	table_close(rel, AccessShareLock);
+
+	return (Datum) 0;
+}
+
+/*
+ * SRF rebuilding the statistics depending on an outdated collation, and
+ * returning the executed ANALYZE commands.
+ *
+ * Only the affected columns are analyzed, unless extended statistics or
+ * statistics on index expressions are affected, as those are only computed
+ * when the whole table is analyzed.  The tables can be split in modulus
+ * disjoint sets, so that multiple sessions can share the work, each of them
+ * processing the tables in the set number remainder.  If dry_run is true, the
+ * commands are returned but not executed.
+ */
+Datum
+pg_collation_reanalyze(PG_FUNCTION_ARGS)
+{
+	int32			modulus = PG_GETARG_INT32(0);
+	int32			remainder = PG_GETARG_INT32(1);
+	bool			dry_run = PG_GETARG_BOOL(2);
+	ReturnSetInfo  *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	Oid				extnspid = get_func_namespace(fcinfo->flinfo->fn_oid);
+	StringInfoData	query;
+	List		   *commands = NIL;
+	ListCell	   *lc;
+	uint64			i;
+	int				ret;
+
+	if (modulus < 1)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("modulus must be at least 1")));
+
+	if (remainder < 0 || remainder >= modulus)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("remainder must be between 0 and %d", modulus - 1)));
+
+	/* The commands can still be listed on a hot standby. */
+	if (!dry_run)
+		PreventCommandDuringRecovery("pg_collation_reanalyze()");
+
+	InitMaterializedSRF(fcinfo, MAT_SRF_USE_EXPECTED_DESC);
+
+	initStringInfo(&query);
+	appendStringInfo(&query,
+					 "SELECT pg_catalog.format('ANALYZE %%s%%s', t.relid::regclass,"
+					 " CASE WHEN pg_catalog.bool_or(t.whole) THEN ''"
+					 " ELSE ' (' || pg_catalog.string_agg(DISTINCT"
+					 " pg_catalog.quote_ident(t.attname::text), ', ') || ')' END)"
+					 " FROM ("
+					 " SELECT coalesce(i.indrelid, s.tbl_oid) AS relid,"
+					 " s.attname, i.indrelid IS NOT NULL"
+					 " OR s.stat_oid IS NOT NULL AS whole"
+					 " FROM %s.pg_collation_broken_statistics s"
+					 " LEFT JOIN pg_catalog.pg_index i"
+					 " ON i.indexrelid = s.tbl_oid"
+					 " ) t"
+					 " WHERE t.relid::pg_catalog.int8 %% $1 = $2"
+					 " GROUP BY t.relid"
+					 " ORDER BY t.relid",
+					 quote_identifier(get_namespace_name(extnspid)));
+
+	if (SPI_connect() != SPI_OK_CONNECT)
+		elog(ERROR, "SPI_connect failed");
+
+	{
+		Oid			argtypes[2] = {INT4OID, INT4OID};
+		Datum		args[2];
+
+		args[0] = Int32GetDatum(modulus);
+		args[1] = Int32GetDatum(remainder);
+
+		ret = SPI_execute_with_args(query.data, 2, argtypes, args, NULL,
+									true, 0);
+		if (ret != SPI_OK_SELECT)
+			elog(ERROR, "SPI_execute failed: %s", SPI_result_code_string(ret));
+	}
+
+	/* Save the commands, as executing them will release the tuptable. */
+	for (i = 0; i < SPI_processed; i++)
+		commands = lappend(commands,
+						   SPI_getvalue(SPI_tuptable->vals[i],
+										SPI_tuptable->tupdesc, 1));
+
+	foreach(lc, commands)
+	{
+		char	   *command = (char *) lfirst(lc);
+		Datum		values[1];
+		bool		nulls[1] = {false};
+
+		if (!dry_run)
+		{
+			ret = SPI_execute(command, false, 0);
+			if (ret != SPI_OK_UTILITY)
+				elog(ERROR, "could not execute \"%s\": %s", command,
+					 SPI_result_code_string(ret));
+		}
+
+		values[0] = CStringGetTextDatum(command);
+		tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values, nulls);
+	}
+
+	SPI_finish();
+	pfree(query.data);
+
+	return (Datum) 0;
+}
@@ -0,0 +1,214 @@
+/*-------------------------------------------------------------------------
+ *
+ * pgcd_trace.c: Explain why an object depends on each of its collations.
+ *
+ * The dependency lookup recurses through types, domains, composite types,
+ * ranges, constraints and expressions, so the reason an object ends up
+ * depending on a given collation is often far from obvious.  When tracing is
+ * enabled, each step of the lookup pushes a frame describing it, and each
+ * found collation is recorded with the full chain of frames that led to it.
+ *
+ * Tracing is only enabled for the duration of a
+ * pg_collation_dependencies_trace() call.  Otherwise the pgcd_trace pointer
+ * is NULL and the tracing macros cost a single test, without evaluating
+ * their arguments.
+ *
+ * This program is open source, licensed under the PostgreSQL license.
+ * For license terms, see the LICENSE file.
+ *
+ * Copyright (C) 2022-2023: Julien Rouhaud
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include "funcapi.h"
+#include "lib/stringinfo.h"
+#include "utils/builtins.h"
+
+#include "pg_collation_dependencies.h"
+
+#define PG_COLL_TRACE_COLS		2
+
+/* A collation found while tracing, with the chain of frames leading to it. */
+typedef struct pgcdTraceEntry
+{
+	Oid			collid;
+	char	   *path;
+} pgcdTraceEntry;
+
+struct pgcdTrace
+{
+	List	   *frames;			/* current chain, outermost first */
+	List	   *entries;		/* pgcdTraceEntry for each found collation */
+};
+
+/* Current trace, NULL when tracing is disabled. */
+pgcdTrace  *pgcd_trace = NULL;
+
+extern PGDLLEXPORT Datum	pg_collation_dependencies_trace(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(pg_collation_dependencies_trace);
+
+/*
+ * Start a new step in the current chain.
+ */
+void
+pgcd_trace_push(char *frame)
+{
+	Assert(pgcd_trace != NULL);
+
+	pgcd_trace->frames = lappend(pgcd_trace->frames, frame);
+}
+
+/*
+ * End the latest step in the current chain.
+ */
+void
+pgcd_trace_pop(void)
+{
+	Assert(pgcd_trace != NULL);
+	Assert(pgcd_trace->frames != NIL);
+
+	pgcd_trace->frames = list_truncate(pgcd_trace->frames,
+									   list_length(pgcd_trace->frames) - 1);
+}
+
+/*
+ * Remember that the given collation was found, described by "what", at the
+ * end of the current chain.  An invalid collation records a note about the
+ * lookup instead, e.g. a function body that couldn't be analyzed.
+ */
+void
+pgcd_trace_collation(Oid collid, char *what)
+{
+	pgcdTraceEntry *entry;
+	StringInfoData path;
+	ListCell   *lc;
+
+	Assert(pgcd_trace != NULL);
+
+	initStringInfo(&path);
+	foreach(lc, pgcd_trace->frames)
+		appendStringInfo(&path, "%s > ", (char *) lfirst(lc));
+	appendStringInfoString(&path, what);
+
+	entry = (pgcdTraceEntry *) palloc(sizeof(pgcdTraceEntry));
+	entry->collid = collid;
+	entry->path = path.data;
+
+	pgcd_trace->entries = lappend(pgcd_trace->entries, entry);
+}
+
+/*
+ * Name of the given expression node, as recorded in the walker's node handler
+ * table.
+ */
+const char *
+pgcd_trace_node_name(Node *node)
+{
+	const char *name = pgcd_node_name(nodeTag(node));
+
+	return name ? name : psprintf("node %d", (int) nodeTag(node));
+}
+
+/*
+ * Field name of the given stringified field access, e.g. "varcollid" for
+ * "var->varcollid".
+ */
+const char *
+pgcd_trace_field(const char *expr)
+{
+	const char *field = strrchr(expr, '>');
+
+	return field ? field + 1 : expr;
+}
+
+/*
+ * qsort comparator for pgcdTraceEntry pointers, by collation and path.
+ */
+static int
+pgcd_trace_entry_cmp(const void *a, const void *b)
+{
+	const pgcdTraceEntry *e1 = *(pgcdTraceEntry *const *) a;
+	const pgcdTraceEntry *e2 = *(pgcdTraceEntry *const *) b;
+
+	if (e1->collid != e2->collid)
+		return (e1->collid < e2->collid) ? -1 : 1;
+
+	return strcmp(e1->path, e2->path);
+}
+
+/*
+ * Return the collation dependencies of the given object, as returned by
+ * pgcd_object_deps(), with the chain of lookups that found each of them.
+ *
+ * The same collation can be found through multiple chains, in which case all
+ * of them are returned.
+ */
+Datum
+pg_collation_dependencies_trace(PG_FUNCTION_ARGS)
+{
+	Oid			classid = PG_GETARG_OID(0);
+	Oid			objid = PG_GETARG_OID(1);
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	pgcdTrace	trace = {NIL, NIL};
+	pgcdTraceEntry **entries;
+	pgcdTraceEntry *prev = NULL;
+	int			nentries;
+	int			i;
+	ListCell   *lc;
+
+	InitMaterializedSRF(fcinfo, MAT_SRF_USE_EXPECTED_DESC);
+
+	/* Tracing can't be nested, as there's a single chain at a time. */
+	Assert(pgcd_trace == NULL);
+
+	pgcd_trace = &trace;
+	PG_TRY();
+	{
+		(void) pgcd_object_deps(classid, objid);
+	}
+	PG_CATCH();
+	{
+		pgcd_trace = NULL;
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+	pgcd_trace = NULL;
+
+	Assert(trace.frames == NIL);
+
+	nentries = list_length(trace.entries);
+	entries = (pgcdTraceEntry **) palloc(sizeof(pgcdTraceEntry *) *
+										 Max(nentries, 1));
+	i = 0;
+	foreach(lc, trace.entries)
+		entries[i++] = (pgcdTraceEntry *) lfirst(lc);
+
+	qsort(entries, nentries, sizeof(pgcdTraceEntry *), pgcd_trace_entry_cmp);
+
+	for (i = 0; i < nentries; i++)
+	{
+		Datum		values[PG_COLL_TRACE_COLS];
+		bool		nulls[PG_COLL_TRACE_COLS] = {0};
+
+		/* Skip duplicated chains. */
+		if (prev != NULL && pgcd_trace_entry_cmp(&prev, &entries[i]) == 0)
+			continue;
+		prev = entries[i];
+
+		/* Notes about the lookup don't have any collation. */
+		if (OidIsValid(entries[i]->collid))
+			values[0] = ObjectIdGetDatum(entries[i]->collid);
+		else
+			nulls[0] = true;
+		values[1] = CStringGetTextDatum(entries[i]->path);
+
+		tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc,
+							 values, nulls);
+	}
+
+	return (Datum) 0;
+}
@@ -0,0 +1,1553 @@
+/*-------------------------------------------------------------------------
+ *
+ * pgcd_verify.c: Check whether the data depending on an outdated collation
+ *                is still valid according to the current collation libraries.
+ *
+ * The verifications are done by executing plain queries, so they benefit
+ * from everything the executor provides: parallel scans, external sorts and
+ * early exit.  Only AccessShareLock is acquired on the underlying relations,
+ * and the indexes are never used as they may be corrupted.
+ *
+ * This program is open source, licensed under the PostgreSQL license.
+ * For license terms, see the LICENSE file.
+ *
+ * Copyright (C) 2022-2023: Julien Rouhaud
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include "access/genam.h"
+#include "access/htup_details.h"
+#include "access/stratnum.h"
+#if PG_VERSION_NUM >= 120000
+#include "access/table.h"
+#endif
+#if PG_VERSION_NUM < 140000
+#include "catalog/indexing.h"
+#endif
+#include "catalog/partition.h"
+#include "catalog/pg_class.h"
+#include "catalog/pg_constraint.h"
+#include "catalog/pg_depend.h"
+#include "catalog/pg_inherits.h"
+#include "catalog/pg_operator.h"
+#include "catalog/pg_partitioned_table.h"
+#include "catalog/pg_type.h"
+#include "executor/spi.h"
+#include "funcapi.h"
+#include "lib/stringinfo.h"
+#include "miscadmin.h"
+#include "nodes/makefuncs.h"
+#include "nodes/nodeFuncs.h"
+#if PG_VERSION_NUM >= 120000
+#include "optimizer/optimizer.h"
+#else
+#include "optimizer/clauses.h"
+#include "optimizer/predtest.h"
+#endif
+#include "rewrite/rewriteHandler.h"
+#include "utils/array.h"
+#include "utils/builtins.h"
+#include "utils/fmgroids.h"
+#include "utils/guc.h"
+#include "utils/lsyscache.h"
+#if PG_VERSION_NUM >= 120000
+#include "utils/partcache.h"
+#endif
+#include "utils/rel.h"
+#include "utils/ruleutils.h"
+#include "utils/syscache.h"
+#include "utils/typcache.h"
+
+#include "pg_collation_dependencies.h"
+
+#define PGCD_CONSTRAINT_CHECK_COLS	2
+#define PGCD_UNIQUE_CHECK_COLS		2
+#define PGCD_MATVIEW_CHECK_COLS		3
+#define PGCD_PARTITION_CHECK_COLS	2
+#define PGCD_GENERATED_CHECK_COLS	3
+#define PGCD_RANGE_CHECK_COLS		3
+#define PGCD_EXCLUSION_CHECK_COLS	2
+#define PGCD_FOREIGN_KEY_CHECK_COLS	2
+
+extern PGDLLEXPORT Datum	pg_collation_constraint_check(PG_FUNCTION_ARGS);
+extern PGDLLEXPORT Datum	pg_collation_unique_check(PG_FUNCTION_ARGS);
+extern PGDLLEXPORT Datum	pg_collation_matview_check(PG_FUNCTION_ARGS);
+extern PGDLLEXPORT Datum	pg_collation_partition_check(PG_FUNCTION_ARGS);
+extern PGDLLEXPORT Datum	pg_collation_generated_check(PG_FUNCTION_ARGS);
+extern PGDLLEXPORT Datum	pg_collation_range_check(PG_FUNCTION_ARGS);
+extern PGDLLEXPORT Datum	pg_collation_exclusion_check(PG_FUNCTION_ARGS);
+extern PGDLLEXPORT Datum	pg_collation_foreign_key_check(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(pg_collation_constraint_check);
+PG_FUNCTION_INFO_V1(pg_collation_unique_check);
+PG_FUNCTION_INFO_V1(pg_collation_matview_check);
+PG_FUNCTION_INFO_V1(pg_collation_partition_check);
+PG_FUNCTION_INFO_V1(pg_collation_generated_check);
+PG_FUNCTION_INFO_V1(pg_collation_range_check);
+PG_FUNCTION_INFO_V1(pg_collation_exclusion_check);
+PG_FUNCTION_INFO_V1(pg_collation_foreign_key_check);
+
+static Node *pgcd_domain_value_mutator(Node *node, Var *var);
+static List *pgcd_get_domain_columns(Oid typid, List *res);
+static Node *pgcd_get_constraint_expr(HeapTuple contup);
+static char *pgcd_qualified_relname(Oid relid);
+static uint64 pgcd_report_rel_rows(ReturnSetInfo *rsinfo, Oid relid,
+								   const char *query, int flags);
+static uint64 pgcd_check_rel_constraint(ReturnSetInfo *rsinfo, Oid relid,
+										const char *expr, uint64 limit);
+static char *pgcd_get_minmax_key(Oid relid, char **maxkey);
+static char *pgcd_qualified_opname(Oid opno);
+static int	pgcd_get_constraint_keys(HeapTuple contup, AttrNumber attkey,
+									 Datum **keys);
+static void pgcd_hash_relation_query(const char *source, Datum *count,
+									 Datum *hash);
+
+/*
+ * Execute the given read-only query with SPI, making sure that only the table
+ * data is used to compute the result.
+ *
+ * Indexes depending on outdated collations may be corrupted, and constraint
+ * exclusion could use the very constraint being verified to skip the scan,
+ * so both are disabled for the duration of the query, unless the caller
+ * passes PGCD_VERIFY_USE_INDEXES.  With PGCD_VERIFY_SORT_ONLY, hash
+ * aggregation is also disabled.  Caller must be connected to SPI.
+ */
+int
+pgcd_verify_execute(const char *query, int flags, long tcount)
+{
+	int			save_nestlevel;
+	int			ret;
+
+	save_nestlevel = NewGUCNestLevel();
+
+#define PGCD_SET_GUC(name, value) \
+	(void) set_config_option((name), (value), PGC_USERSET, PGC_S_SESSION, \
+							 GUC_ACTION_SAVE, true, 0, false)
+
+	if ((flags & PGCD_VERIFY_USE_INDEXES) == 0)
+	{
+		PGCD_SET_GUC("enable_indexscan", "off");
+		PGCD_SET_GUC("enable_indexonlyscan", "off");
+		PGCD_SET_GUC("enable_bitmapscan", "off");
+	}
+	PGCD_SET_GUC("constraint_exclusion", "off");
+	if ((flags & PGCD_VERIFY_SORT_ONLY) != 0)
+		PGCD_SET_GUC("enable_hashagg", "off");
+
+#undef PGCD_SET_GUC
+
+	ret = SPI_execute(query, true, tcount);
+
+	AtEOXact_GUC(true, save_nestlevel);
+
+	if (ret != SPI_OK_SELECT)
+		elog(ERROR, "SPI_execute failed: %s", SPI_result_code_string(ret));
+
+	return ret;
+}
+
+/*
+ * Get the schema-qualified and quoted name of the given relation.
+ */
+static char *
+pgcd_qualified_relname(Oid relid)
+{
+	return quote_qualified_identifier(get_namespace_name(get_rel_namespace(relid)),
+									  get_rel_name(relid));
+}
+
+/*
+ * Get the OPERATOR() syntax of the given operator, schema-qualified.
+ */
+static char *
+pgcd_qualified_opname(Oid opno)
+{
+	return psprintf("OPERATOR(%s.%s)",
+					quote_identifier(get_namespace_name(get_opnamespace(opno))),
+					get_opname(opno));
+}
+
+/*
+ * Get the elements of the given array column of a constraint tuple, as an
+ * array of Datum.  Returns the number of elements.
+ */
+static int
+pgcd_get_constraint_keys(HeapTuple contup, AttrNumber attkey, Datum **keys)
+{
+	Datum		datum;
+	bool		isnull;
+	ArrayType  *arr;
+	int			nkeys;
+
+	datum = SysCacheGetAttr(CONSTROID, contup, attkey, &isnull);
+	if (isnull)
+		elog(ERROR, "null key array for constraint \"%s\"",
+			 NameStr(((Form_pg_constraint) GETSTRUCT(contup))->conname));
+
+	arr = DatumGetArrayTypeP(datum);
+	if (ARR_NDIM(arr) != 1 || ARR_HASNULL(arr))
+		elog(ERROR, "key array for constraint \"%s\" is not a 1-D array",
+			 NameStr(((Form_pg_constraint) GETSTRUCT(contup))->conname));
+
+	if (ARR_ELEMTYPE(arr) == INT2OID)
+		deconstruct_array(arr, INT2OID, sizeof(int16), true, 's',
+						  keys, NULL, &nkeys);
+	else
+		deconstruct_array(arr, OIDOID, sizeof(Oid), true, 'i',
+						  keys, NULL, &nkeys);
+
+	return nkeys;
+}
+
+/*
+ * Replace references to the domain value by the given Var.
+ */
+static Node *
+pgcd_domain_value_mutator(Node *node, Var *var)
+{
+	if (node == NULL)
+		return NULL;
+
+	if (IsA(node, CoerceToDomainValue))
+		return (Node *) copyObject(var);
+
+	return expression_tree_mutator(node, pgcd_domain_value_mutator,
+								   (void *) var);
+}
+
+/*
+ * Get the list of (relid, attnum) of all the table and materialized view
+ * columns using the given domain, directly or through another domain, as a
+ * list of 2 elements int lists.
+ */
+static List *
+pgcd_get_domain_columns(Oid typid, List *res)
+{
+	Relation	depRel;
+	ScanKeyData key[2];
+	SysScanDesc scan;
+	HeapTuple	tup;
+
+	/* since this function recurses, it could be driven to stack overflow */
+	check_stack_depth();
+
+	depRel = table_open(DependRelationId, AccessShareLock);
+
+	ScanKeyInit(&key[0],
+				Anum_pg_depend_refclassid,
+				BTEqualStrategyNumber, F_OIDEQ,
+				ObjectIdGetDatum(TypeRelationId));
+	ScanKeyInit(&key[1],
+				Anum_pg_depend_refobjid,
+				BTEqualStrategyNumber, F_OIDEQ,
+				ObjectIdGetDatum(typid));
+
+	scan = systable_beginscan(depRel, DependReferenceIndexId, true,
+							  NULL, 2, key);
+
+	while (HeapTupleIsValid(tup = systable_getnext(scan)))
+	{
+		Form_pg_depend pg_depend = (Form_pg_depend) GETSTRUCT(tup);
+
+		if (pg_depend->classid == RelationRelationId &&
+			pg_depend->objsubid > 0)
+		{
+			char		relkind = get_rel_relkind(pg_depend->objid);
+
+			if (relkind == RELKIND_RELATION || relkind == RELKIND_MATVIEW)
+				res = lappend(res, list_make2_int(pg_depend->objid,
+												  pg_depend->objsubid));
+		}
+		else if (pg_depend->classid == TypeRelationId &&
+				 get_typtype(pg_depend->objid) == TYPTYPE_DOMAIN)
+			res = pgcd_get_domain_columns(pg_depend->objid, res);
+	}
+
+	systable_endscan(scan);
+	table_close(depRel, NoLock);
+
+	return res;
+}
+
+/*
+ * Get the stored expression of the given constraint tuple.
+ */
+static Node *
+pgcd_get_constraint_expr(HeapTuple contup)
+{
+	Datum		datum;
+	bool		isnull;
+
+	datum = SysCacheGetAttr(CONSTROID, contup, Anum_pg_constraint_conbin,
+							&isnull);
+	if (isnull)
+		elog(ERROR, "null conbin for constraint %u",
+#if PG_VERSION_NUM >= 120000
+			 ((Form_pg_constraint) GETSTRUCT(contup))->oid
+#else
+			 HeapTupleGetOid(contup)
+#endif
+			);
+
+	return stringToNode(TextDatumGetCString(datum));
+}
+
+/*
+ * Execute the given query returning ctids of the given relation, and report
+ * all of them.  Returns the number of reported rows.
+ */
+static uint64
+pgcd_report_rel_rows(ReturnSetInfo *rsinfo, Oid relid, const char *query,
+					 int flags)
+{
+	uint64		nrows;
+	uint64		i;
+
+	pgcd_verify_execute(query, flags, 0);
+
+	nrows = SPI_processed;
+	for (i = 0; i < nrows; i++)
+	{
+		Datum		values[PGCD_CONSTRAINT_CHECK_COLS];
+		bool		nulls[PGCD_CONSTRAINT_CHECK_COLS];
+
+		memset(nulls, 0, sizeof(nulls));
+
+		values[0] = ObjectIdGetDatum(relid);
+		values[1] = SPI_getbinval(SPI_tuptable->vals[i], SPI_tuptable->tupdesc,
+								  1, &nulls[1]);
+
+		tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values, nulls);
+	}
+
+	return nrows;
+}
+
+/*
+ * Scan the given relation and report up to limit rows for which the given
+ * expression is false.  Returns the number of reported rows.
+ */
+static uint64
+pgcd_check_rel_constraint(ReturnSetInfo *rsinfo, Oid relid, const char *expr,
+						  uint64 limit)
+{
+	StringInfoData query;
+	uint64		nrows;
+
+	initStringInfo(&query);
+	appendStringInfo(&query, "SELECT ctid FROM ONLY %s WHERE NOT (%s) LIMIT "
+					 UINT64_FORMAT,
+					 pgcd_qualified_relname(relid), expr, limit);
+
+	nrows = pgcd_report_rel_rows(rsinfo, relid, query.data, 0);
+
+	pfree(query.data);
+
+	return nrows;
+}
+
+/*
+ * SRF returning the rows that don't satisfy the given CHECK or domain
+ * constraint anymore according to the current collation libraries.
+ *
+ * For constraints on inheritance or partitioning trees, each leaf is checked
+ * separately, and when prune is true leaves whose partition constraint
+ * implies the check constraint are skipped.  This assumes that the partition
+ * bounds themselves are still respected.
+ */
+Datum
+pg_collation_constraint_check(PG_FUNCTION_ARGS)
+{
+	Oid				conoid = PG_GETARG_OID(0);
+	int32			max_violations = PG_GETARG_INT32(1);
+	bool			prune = PG_GETARG_BOOL(2);
+	ReturnSetInfo  *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	HeapTuple		contup;
+	Form_pg_constraint con;
+	uint64			remaining;
+
+	if (max_violations < 1)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("max_violations must be at least 1")));
+	remaining = max_violations;
+
+	InitMaterializedSRF(fcinfo, MAT_SRF_USE_EXPECTED_DESC);
+
+	contup = SearchSysCache1(CONSTROID, ObjectIdGetDatum(conoid));
+	if (!HeapTupleIsValid(contup))
+		ereport(ERROR,
+				(errcode(ERRCODE_UNDEFINED_OBJECT),
+				 errmsg("constraint with OID %u does not exist", conoid)));
+	con = (Form_pg_constraint) GETSTRUCT(contup);
+
+	if (con->contype != CONSTRAINT_CHECK)
+		ereport(ERROR,
+				(errcode(ERRCODE_WRONG_OBJECT_TYPE),
+				 errmsg("constraint \"%s\" is not a check constraint",
+						NameStr(con->conname))));
+
+	if (SPI_connect() != SPI_OK_CONNECT)
+		elog(ERROR, "SPI_connect failed");
+
+	if (OidIsValid(con->contypid))
+	{
+		Node	   *expr = pgcd_get_constraint_expr(contup);
+		ListCell   *lc;
+
+		foreach(lc, pgcd_get_domain_columns(con->contypid, NIL))
+		{
+			Oid			relid = (Oid) linitial_int(lfirst(lc));
+			AttrNumber	attnum = (AttrNumber) lsecond_int(lfirst(lc));
+			Oid			typid;
+			int32		typmod;
+			Oid			collid;
+			Var		   *var;
+			char	   *deparsed;
+
+			LockRelationOid(relid, AccessShareLock);
+
+			get_atttypetypmodcoll(relid, attnum, &typid, &typmod, &collid);
+			var = makeVar(1, attnum, typid, typmod, collid, 0);
+			deparsed = deparse_expression(pgcd_domain_value_mutator(expr, var),
+										  deparse_context_for(get_rel_name(relid),
+															  relid),
+										  false, false);
+
+			remaining -= pgcd_check_rel_constraint(rsinfo, relid, deparsed,
+												   remaining);
+			if (remaining == 0)
+				break;
+		}
+	}
+	else
+	{
+		Oid			relid = con->conrelid;
+		char	   *deparsed;
+		List	   *rels;
+		ListCell   *lc;
+
+		/* Column names are the same in all the inheritance tree. */
+		deparsed = deparse_expression(pgcd_get_constraint_expr(contup),
+									  deparse_context_for(get_rel_name(relid),
+														  relid),
+									  false, false);
+
+		/* NO INHERIT constraints only apply to the table they're defined on. */
+		if (con->connoinherit)
+		{
+			LockRelationOid(relid, AccessShareLock);
+			rels = list_make1_oid(relid);
+		}
+		else
+			rels = find_all_inheritors(relid, AccessShareLock, NULL);
+
+		foreach(lc, rels)
+		{
+			Oid			childid = lfirst_oid(lc);
+			char		relkind = get_rel_relkind(childid);
+			Oid			childconid;
+
+			if (relkind != RELKIND_RELATION)
+				continue;
+
+			/*
+			 * Children created with a NO INHERIT constraint of their own
+			 * don't inherit this one.
+			 */
+			childconid = get_relation_constraint_oid(childid,
+													 NameStr(con->conname),
+													 true);
+			if (!OidIsValid(childconid))
+				continue;
+
+			if (prune && get_rel_relispartition(childid))
+			{
+				HeapTuple	childtup;
+				Node	   *childexpr;
+				Expr	   *partqual;
+
+				childtup = SearchSysCache1(CONSTROID,
+										   ObjectIdGetDatum(childconid));
+				if (!HeapTupleIsValid(childtup))
+					elog(ERROR, "cache lookup failed for constraint %u",
+						 childconid);
+				childexpr = eval_const_expressions(NULL,
+												   pgcd_get_constraint_expr(childtup));
+				ReleaseSysCache(childtup);
+
+				partqual = get_partition_qual_relid(childid);
+
+				/* The constraint can't be false for any row of that leaf. */
+				if (partqual != NULL &&
+					predicate_implied_by(make_ands_implicit((Expr *) childexpr),
+										 make_ands_implicit((Expr *) eval_const_expressions(NULL, (Node *) partqual)),
+										 true))
+					continue;
+			}
+
+			remaining -= pgcd_check_rel_constraint(rsinfo, childid, deparsed,
+												   remaining);
+			if (remaining == 0)
+				break;
+		}
+	}
+
+	SPI_finish();
+	ReleaseSysCache(contup);
+
+	return (Datum) 0;
+}
+
+/*
+ * SRF returning the keys of the given unique index that now appear more than
+ * once in the underlying table according to the current collation libraries.
+ *
+ * The keys are read from the table and grouped using sort-based aggregation
+ * only, which relies on tuplesort for the comparisons and thus gets
+ * abbreviated keys, external sort when the data doesn't fit in work_mem and
+ * parallel workers when the planner thinks they're worth it.
+ */
+Datum
+pg_collation_unique_check(PG_FUNCTION_ARGS)
+{
+	Oid				indexoid = PG_GETARG_OID(0);
+	int32			max_violations = PG_GETARG_INT32(1);
+	ReturnSetInfo  *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	Relation		indrel;
+	Form_pg_index	index;
+	List		   *context;
+	List		   *indexprs;
+	ListCell	   *indexpr_item;
+	bool			nulls_distinct = true;
+	StringInfoData	query;
+	StringInfoData	keys;
+	StringInfoData	quals;
+	int				i;
+	uint64			nrows;
+	uint64			row;
+
+	if (max_violations < 1)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("max_violations must be at least 1")));
+
+	InitMaterializedSRF(fcinfo, MAT_SRF_USE_EXPECTED_DESC);
+
+	indrel = index_open(indexoid, AccessShareLock);
+	index = indrel->rd_index;
+
+	if (!index->indisunique)
+		ereport(ERROR,
+				(errcode(ERRCODE_WRONG_OBJECT_TYPE),
+				 errmsg("index \"%s\" is not unique",
+						RelationGetRelationName(indrel))));
+
+	if (RELATION_IS_OTHER_TEMP(indrel))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("cannot check temporary indexes of other sessions")));
+
+#if PG_VERSION_NUM >= 150000
+	nulls_distinct = !index->indnullsnotdistinct;
+#endif
+
+	LockRelationOid(index->indrelid, AccessShareLock);
+	context = deparse_context_for(get_rel_name(index->indrelid),
+								  index->indrelid);
+
+	initStringInfo(&keys);
+	initStringInfo(&quals);
+	indexprs = RelationGetIndexExpressions(indrel);
+	indexpr_item = list_head(indexprs);
+
+	for (i = 0; i < IndexRelationGetNumberOfKeyAttributes(indrel); i++)
+	{
+		AttrNumber	attnum = index->indkey.values[i];
+		Oid			collid = indrel->rd_indcollation[i];
+
+		if (i > 0)
+		{
+			appendStringInfoString(&keys, ", ");
+			appendStringInfoString(&quals, " AND ");
+		}
+
+		appendStringInfoChar(&keys, '(');
+		if (attnum != 0)
+			appendStringInfoString(&keys,
+								   quote_identifier(get_attname(index->indrelid,
+																attnum, false)));
+		else
+		{
+			Node	   *indexpr;
+
+			if (indexpr_item == NULL)
+				elog(ERROR, "too few entries in indexprs list");
+			indexpr = (Node *) lfirst(indexpr_item);
+			indexpr_item = pgcd_lnext(indexprs, indexpr_item);
+
+			appendStringInfoString(&keys,
+								   deparse_expression(indexpr, context,
+													  false, false));
+		}
+		appendStringInfoChar(&keys, ')');
+
+		/* Use the index collation rather than the expression one. */
+		if (OidIsValid(collid))
+			appendStringInfo(&keys, " COLLATE %s",
+							 generate_collation_name(collid));
+
+		appendStringInfo(&keys, " AS k%d", i + 1);
+		appendStringInfo(&quals, "k%d IS NOT NULL", i + 1);
+	}
+
+	/*
+	 * Only the given relation is covered by the index, unless it's a
+	 * partitioned index.
+	 */
+	initStringInfo(&query);
+	appendStringInfo(&query, "SELECT ROW(s.*)::text, count(*) FROM ("
+					 "SELECT %s FROM %s%s",
+					 keys.data,
+					 get_rel_relkind(index->indrelid) == RELKIND_PARTITIONED_TABLE ?
+					 "" : "ONLY ",
+					 pgcd_qualified_relname(index->indrelid));
+
+	if (RelationGetIndexPredicate(indrel) != NIL)
+		appendStringInfo(&query, " WHERE %s",
+						 deparse_expression((Node *) make_ands_explicit(RelationGetIndexPredicate(indrel)),
+											context, false, false));
+
+	appendStringInfoString(&query, ") s");
+	if (nulls_distinct)
+		appendStringInfo(&query, " WHERE %s", quals.data);
+	appendStringInfoString(&query, " GROUP BY ");
+	for (i = 0; i < IndexRelationGetNumberOfKeyAttributes(indrel); i++)
+		appendStringInfo(&query, "%sk%d", i > 0 ? ", " : "", i + 1);
+	appendStringInfo(&query, " HAVING count(*) > 1 LIMIT %d", max_violations);
+
+	if (SPI_connect() != SPI_OK_CONNECT)
+		elog(ERROR, "SPI_connect failed");
+
+	pgcd_verify_execute(query.data, PGCD_VERIFY_SORT_ONLY, 0);
+
+	nrows = SPI_processed;
+	for (row = 0; row < nrows; row++)
+	{
+		Datum		values[PGCD_UNIQUE_CHECK_COLS];
+		bool		nulls[PGCD_UNIQUE_CHECK_COLS];
+
+		values[0] = SPI_getbinval(SPI_tuptable->vals[row],
+								  SPI_tuptable->tupdesc, 1, &nulls[0]);
+		values[1] = SPI_getbinval(SPI_tuptable->vals[row],
+								  SPI_tuptable->tupdesc, 2, &nulls[1]);
+
+		tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values, nulls);
+	}
+
+	SPI_finish();
+	index_close(indrel, NoLock);
+
+	return (Datum) 0;
+}
+
+/*
+ * Compute the number of rows and an order independent hash of the rows
+ * returned by the given FROM item.  Caller must be connected to SPI.
+ */
+static void
+pgcd_hash_relation_query(const char *source, Datum *count, Datum *hash)
+{
+	StringInfoData query;
+	bool		isnull;
+
+	initStringInfo(&query);
+	appendStringInfo(&query, "SELECT count(*), coalesce(sum("
+					 "hashtextextended(t::text, 0)::numeric), 0) FROM %s t",
+					 source);
+
+	pgcd_verify_execute(query.data, 0, 0);
+
+	Assert(SPI_processed == 1);
+	*count = SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1,
+						   &isnull);
+	*hash = SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 2,
+						  &isnull);
+
+	pfree(query.data);
+}
+
+/*
+ * SRF reporting whether a refresh of the given materialized view would change
+ * its content.
+ *
+ * The stored query of the materialized view is executed and its result is
+ * compared with the current content using the number of rows and the sum of
+ * the 64 bits hash of each row text representation, which doesn't depend on
+ * the row order and lets the executor use parallel query.
+ */
+Datum
+pg_collation_matview_check(PG_FUNCTION_ARGS)
+{
+	Oid				matviewoid = PG_GETARG_OID(0);
+	ReturnSetInfo  *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	Datum			values[PGCD_MATVIEW_CHECK_COLS];
+	bool			nulls[PGCD_MATVIEW_CHECK_COLS];
+	Relation		matviewrel;
+	char		   *relname;
+	char		   *viewdef;
+	int				len;
+	StringInfoData	source;
+	Datum			stored_count;
+	Datum			stored_hash;
+	Datum			query_count;
+	Datum			query_hash;
+
+	InitMaterializedSRF(fcinfo, MAT_SRF_USE_EXPECTED_DESC);
+
+	matviewrel = table_open(matviewoid, AccessShareLock);
+
+	if (matviewrel->rd_rel->relkind != RELKIND_MATVIEW)
+		ereport(ERROR,
+				(errcode(ERRCODE_WRONG_OBJECT_TYPE),
+				 errmsg("\"%s\" is not a materialized view",
+						RelationGetRelationName(matviewrel))));
+
+	memset(nulls, 0, sizeof(nulls));
+
+	/* A materialized view that isn't populated obviously needs a refresh. */
+	if (!RelationIsPopulated(matviewrel))
+	{
+		values[0] = BoolGetDatum(true);
+		nulls[1] = nulls[2] = true;
+		tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values, nulls);
+		table_close(matviewrel, NoLock);
+
+		return (Datum) 0;
+	}
+
+	relname = pgcd_qualified_relname(matviewoid);
+
+	viewdef = TextDatumGetCString(DirectFunctionCall1(pg_get_viewdef,
+													  ObjectIdGetDatum(matviewoid)));
+	len = strlen(viewdef);
+	while (len > 0 && strchr("; \n", viewdef[len - 1]) != NULL)
+		viewdef[--len] = '\0';
+
+	if (SPI_connect() != SPI_OK_CONNECT)
+		elog(ERROR, "SPI_connect failed");
+
+	initStringInfo(&source);
+	appendStringInfo(&source, "ONLY %s", relname);
+	pgcd_hash_relation_query(source.data, &stored_count, &stored_hash);
+
+	resetStringInfo(&source);
+	appendStringInfo(&source, "(%s)", viewdef);
+	pgcd_hash_relation_query(source.data, &query_count, &query_hash);
+
+	values[0] = BoolGetDatum(DatumGetInt64(stored_count) != DatumGetInt64(query_count) ||
+							 DatumGetBool(DirectFunctionCall2(numeric_ne,
+															  stored_hash,
+															  query_hash)));
+	values[1] = stored_count;
+	values[2] = query_count;
+
+	tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values, nulls);
+
+	SPI_finish();
+	table_close(matviewrel, NoLock);
+
+	return (Datum) 0;
+}
+
+/*
+ * Get the ORDER BY clauses to use to find the minimum and maximum key of the
+ * given partition, or NULL if checking those isn't enough to verify that all
+ * the rows satisfy the partition bound.  The maximum one is returned in
+ * *maxkey.
+ *
+ * This is only the case for non default range partitions on a single column,
+ * whose parent isn't itself a partition, as the bound is then a single
+ * interval.  The keys are ordered with the operators of the partition key
+ * operator class, which are the ones used by the partition bound.
+ */
+static char *
+pgcd_get_minmax_key(Oid relid, char **maxkey)
+{
+	Oid			parentid;
+	HeapTuple	tup;
+	Form_pg_partitioned_table form;
+	Datum		datum;
+	bool		isnull;
+	Oid			collid;
+	Oid			opclass;
+	Oid			opfamily;
+	Oid			opcintype;
+	Oid			ltop;
+	Oid			gtop;
+	char	   *res = NULL;
+
+#if PG_VERSION_NUM >= 140000
+	parentid = get_partition_parent(relid, true);
+#else
+	parentid = get_partition_parent(relid);
+#endif
+
+	if (get_rel_relispartition(parentid))
+		return NULL;
+
+	tup = SearchSysCache1(PARTRELID, ObjectIdGetDatum(parentid));
+	if (!HeapTupleIsValid(tup))
+		elog(ERROR, "cache lookup failed for partition key of relation %u",
+			 parentid);
+	form = (Form_pg_partitioned_table) GETSTRUCT(tup);
+
+	if (form->partstrat == PARTITION_STRATEGY_RANGE &&
+		form->partnatts == 1 &&
+		form->partattrs.values[0] != 0 &&
+		form->partdefid != relid)
+	{
+		StringInfoData key;
+
+		datum = SysCacheGetAttr(PARTRELID, tup,
+								Anum_pg_partitioned_table_partcollation,
+								&isnull);
+		Assert(!isnull);
+		collid = ((oidvector *) DatumGetPointer(datum))->values[0];
+
+		datum = SysCacheGetAttr(PARTRELID, tup,
+								Anum_pg_partitioned_table_partclass,
+								&isnull);
+		Assert(!isnull);
+		opclass = ((oidvector *) DatumGetPointer(datum))->values[0];
+		opfamily = get_opclass_family(opclass);
+		opcintype = get_opclass_input_type(opclass);
+
+		ltop = get_opfamily_member(opfamily, opcintype, opcintype,
+								   BTLessStrategyNumber);
+		gtop = get_opfamily_member(opfamily, opcintype, opcintype,
+								   BTGreaterStrategyNumber);
+		if (!OidIsValid(ltop) || !OidIsValid(gtop))
+			elog(ERROR, "missing operator for opfamily %u", opfamily);
+
+		initStringInfo(&key);
+		appendStringInfoString(&key,
+							   quote_identifier(get_attname(parentid,
+															form->partattrs.values[0],
+															false)));
+		if (OidIsValid(collid))
+			appendStringInfo(&key, " COLLATE %s",
+							 generate_collation_name(collid));
+
+		res = psprintf("%s USING %s", key.data, pgcd_qualified_opname(ltop));
+		*maxkey = psprintf("%s USING %s", key.data,
+						   pgcd_qualified_opname(gtop));
+		pfree(key.data);
+	}
+
+	ReleaseSysCache(tup);
+
+	return res;
+}
+
+/*
+ * SRF returning the rows that don't satisfy their partition bound anymore
+ * according to the current collation libraries.
+ *
+ * Each leaf partition of the given partitioned table is checked with a
+ * separate query, which can use parallel query.  If minmax is true, only the
+ * rows with the minimum and maximum key are checked for the partitions where
+ * it's enough, and indexes are used to find them.  This is only safe if the
+ * indexes on the partition key have been verified first.
+ */
+Datum
+pg_collation_partition_check(PG_FUNCTION_ARGS)
+{
+	Oid				relid = PG_GETARG_OID(0);
+	int32			max_violations = PG_GETARG_INT32(1);
+	bool			minmax = PG_GETARG_BOOL(2);
+	ReturnSetInfo  *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	uint64			remaining;
+	ListCell	   *lc;
+
+	if (max_violations < 1)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("max_violations must be at least 1")));
+	remaining = max_violations;
+
+	if (get_rel_relkind(relid) != RELKIND_PARTITIONED_TABLE)
+		ereport(ERROR,
+				(errcode(ERRCODE_WRONG_OBJECT_TYPE),
+				 errmsg("\"%s\" is not a partitioned table",
+						get_rel_name(relid))));
+
+	InitMaterializedSRF(fcinfo, MAT_SRF_USE_EXPECTED_DESC);
+
+	if (SPI_connect() != SPI_OK_CONNECT)
+		elog(ERROR, "SPI_connect failed");
+
+	foreach(lc, find_all_inheritors(relid, AccessShareLock, NULL))
+	{
+		Oid			childid = lfirst_oid(lc);
+		Expr	   *partqual;
+		char	   *deparsed;
+		char	   *key = NULL;
+		char	   *maxkey = NULL;
+		StringInfoData query;
+
+		if (get_rel_relkind(childid) != RELKIND_RELATION)
+			continue;
+
+		partqual = get_partition_qual_relid(childid);
+		if (partqual == NULL)
+			continue;
+
+		deparsed = deparse_expression((Node *) partqual,
+									  deparse_context_for(get_rel_name(childid),
+														  childid),
+									  false, false);
+
+		if (minmax)
+			key = pgcd_get_minmax_key(childid, &maxkey);
+
+		initStringInfo(&query);
+		if (key != NULL)
+		{
+			char	   *relname = pgcd_qualified_relname(childid);
+
+			appendStringInfo(&query,
+							 "SELECT ctid FROM ONLY %s"
+							 " WHERE ctid = ANY (ARRAY["
+							 "(SELECT ctid FROM ONLY %s ORDER BY %s LIMIT 1), "
+							 "(SELECT ctid FROM ONLY %s ORDER BY %s LIMIT 1)])"
+							 " AND (%s) IS NOT TRUE LIMIT " UINT64_FORMAT,
+							 relname, relname, key, relname, maxkey, deparsed,
+							 remaining);
+			remaining -= pgcd_report_rel_rows(rsinfo, childid, query.data,
+											  PGCD_VERIFY_USE_INDEXES);
+		}
+		else
+		{
+			appendStringInfo(&query,
+							 "SELECT ctid FROM ONLY %s"
+							 " WHERE (%s) IS NOT TRUE LIMIT " UINT64_FORMAT,
+							 pgcd_qualified_relname(childid), deparsed,
+							 remaining);
+			remaining -= pgcd_report_rel_rows(rsinfo, childid, query.data, 0);
+		}
+
+		pfree(query.data);
+
+		if (remaining == 0)
+			break;
+	}
+
+	SPI_finish();
+
+	return (Datum) 0;
+}
+
+/*
+ * SRF returning the rows whose stored generated columns differ from what the
+ * generation expression now returns according to the current collation
+ * libraries.
+ *
+ * Each stored generated column of each leaf table is checked with a separate
+ * query, which can use parallel query and doesn't rewrite anything.  Values
+ * are compared using their text representation and the "C" collation, so
+ * that values only equal according to a nondeterministic collation are
+ * still reported.
+ */
+Datum
+pg_collation_generated_check(PG_FUNCTION_ARGS)
+{
+#if PG_VERSION_NUM < 120000
+	ereport(ERROR,
+			(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+			 errmsg("generated columns are only supported on PostgreSQL 12 and later")));
+#else
+	Oid				relid = PG_GETARG_OID(0);
+	int32			max_violations = PG_GETARG_INT32(1);
+	ReturnSetInfo  *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	uint64			remaining;
+	ListCell	   *lc;
+
+	if (max_violations < 1)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("max_violations must be at least 1")));
+	remaining = max_violations;
+
+	InitMaterializedSRF(fcinfo, MAT_SRF_USE_EXPECTED_DESC);
+
+	if (SPI_connect() != SPI_OK_CONNECT)
+		elog(ERROR, "SPI_connect failed");
+
+	foreach(lc, find_all_inheritors(relid, AccessShareLock, NULL))
+	{
+		Oid			childid = lfirst_oid(lc);
+		Relation	rel;
+		TupleDesc	tupdesc;
+		List	   *context;
+		int			i;
+
+		if (get_rel_relkind(childid) != RELKIND_RELATION)
+			continue;
+
+		rel = table_open(childid, NoLock);
+		tupdesc = RelationGetDescr(rel);
+
+		if (!tupdesc->constr || !tupdesc->constr->has_generated_stored)
+		{
+			table_close(rel, NoLock);
+			continue;
+		}
+
+		context = deparse_context_for(RelationGetRelationName(rel), childid);
+
+		for (i = 0; i < tupdesc->natts && remaining > 0; i++)
+		{
+			Form_pg_attribute att = TupleDescAttr(tupdesc, i);
+			char	   *attname;
+			StringInfoData query;
+			uint64		nrows;
+			uint64		row;
+
+			if (att->attisdropped ||
+				att->attgenerated != ATTRIBUTE_GENERATED_STORED)
+				continue;
+
+			attname = quote_identifier(NameStr(att->attname));
+
+			initStringInfo(&query);
+			appendStringInfo(&query,
+							 "SELECT ctid FROM ONLY %s"
+							 " WHERE (%s)::text COLLATE \"C\""
+							 " IS DISTINCT FROM (%s)::text COLLATE \"C\""
+							 " LIMIT " UINT64_FORMAT,
+							 pgcd_qualified_relname(childid), attname,
+							 deparse_expression(build_column_default(rel, i + 1),
+												context, false, false),
+							 remaining);
+
+			pgcd_verify_execute(query.data, 0, 0);
+
+			nrows = SPI_processed;
+			for (row = 0; row < nrows; row++)
+			{
+				Datum		values[PGCD_GENERATED_CHECK_COLS];
+				bool		nulls[PGCD_GENERATED_CHECK_COLS];
+
+				memset(nulls, 0, sizeof(nulls));
+
+				values[0] = ObjectIdGetDatum(childid);
+				values[1] = NameGetDatum(&att->attname);
+				values[2] = SPI_getbinval(SPI_tuptable->vals[row],
+										  SPI_tuptable->tupdesc, 1, &nulls[2]);
+
+				tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc,
+									 values, nulls);
+			}
+
+			remaining -= nrows;
+			pfree(query.data);
+		}
+
+		table_close(rel, NoLock);
+
+		if (remaining == 0)
+			break;
+	}
+
+	SPI_finish();
+#endif
+
+	return (Datum) 0;
+}
+
+/*
+ * SRF returning the rows storing a range whose lower bound is now greater
+ * than its upper bound according to the current collation libraries.
+ *
+ * Such ranges can't be built anymore, and break any index or exclusion
+ * constraint on them, whatever the access method.  Each range column whose
+ * subtype ordering depends on a collation is checked for each leaf table or
+ * materialized view with a separate query.
+ */
+Datum
+pg_collation_range_check(PG_FUNCTION_ARGS)
+{
+	Oid				relid = PG_GETARG_OID(0);
+	int32			max_violations = PG_GETARG_INT32(1);
+	ReturnSetInfo  *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	uint64			remaining;
+	ListCell	   *lc;
+
+	if (max_violations < 1)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("max_violations must be at least 1")));
+	remaining = max_violations;
+
+	InitMaterializedSRF(fcinfo, MAT_SRF_USE_EXPECTED_DESC);
+
+	if (SPI_connect() != SPI_OK_CONNECT)
+		elog(ERROR, "SPI_connect failed");
+
+	foreach(lc, find_all_inheritors(relid, AccessShareLock, NULL))
+	{
+		Oid			childid = lfirst_oid(lc);
+		char		relkind = get_rel_relkind(childid);
+		Relation	rel;
+		TupleDesc	tupdesc;
+		int			i;
+
+		if (relkind != RELKIND_RELATION && relkind != RELKIND_MATVIEW)
+			continue;
+
+		rel = table_open(childid, NoLock);
+		tupdesc = RelationGetDescr(rel);
+
+		for (i = 0; i < tupdesc->natts && remaining > 0; i++)
+		{
+			Form_pg_attribute att = TupleDescAttr(tupdesc, i);
+			TypeCacheEntry *typcache;
+			Oid			subtype;
+			Oid			gtop;
+			char	   *attname;
+			char	   *collname;
+			StringInfoData query;
+			uint64		nrows;
+			uint64		row;
+
+			if (att->attisdropped || get_typtype(att->atttypid) != TYPTYPE_RANGE)
+				continue;
+
+			typcache = lookup_type_cache(att->atttypid, TYPECACHE_RANGE_INFO);
+			if (!OidIsValid(typcache->rng_collation))
+				continue;
+
+			subtype = typcache->rngelemtype->type_id;
+			gtop = get_opfamily_member(typcache->rng_opfamily, subtype, subtype,
+									   BTGreaterStrategyNumber);
+			if (!OidIsValid(gtop))
+				elog(ERROR, "missing operator %d(%u,%u) in opfamily %u",
+					 BTGreaterStrategyNumber, subtype, subtype,
+					 typcache->rng_opfamily);
+
+			attname = quote_identifier(NameStr(att->attname));
+			collname = generate_collation_name(typcache->rng_collation);
+
+			initStringInfo(&query);
+			appendStringInfo(&query,
+							 "SELECT ctid FROM ONLY %s"
+							 " WHERE NOT pg_catalog.isempty(%s)"
+							 " AND NOT pg_catalog.lower_inf(%s)"
+							 " AND NOT pg_catalog.upper_inf(%s)"
+							 " AND pg_catalog.lower(%s) COLLATE %s"
+							 " %s pg_catalog.upper(%s) COLLATE %s"
+							 " LIMIT " UINT64_FORMAT,
+							 pgcd_qualified_relname(childid),
+							 attname, attname, attname,
+							 attname, collname, pgcd_qualified_opname(gtop),
+							 attname, collname,
+							 remaining);
+
+			pgcd_verify_execute(query.data, 0, 0);
+
+			nrows = SPI_processed;
+			for (row = 0; row < nrows; row++)
+			{
+				Datum		values[PGCD_RANGE_CHECK_COLS];
+				bool		nulls[PGCD_RANGE_CHECK_COLS];
+
+				memset(nulls, 0, sizeof(nulls));
+
+				values[0] = ObjectIdGetDatum(childid);
+				values[1] = NameGetDatum(&att->attname);
+				values[2] = SPI_getbinval(SPI_tuptable->vals[row],
+										  SPI_tuptable->tupdesc, 1, &nulls[2]);
+
+				tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc,
+									 values, nulls);
+			}
+
+			remaining -= nrows;
+			pfree(query.data);
+		}
+
+		table_close(rel, NoLock);
+
+		if (remaining == 0)
+			break;
+	}
+
+	SPI_finish();
+
+	return (Datum) 0;
+}
+
+/*
+ * SRF returning the pairs of rows that now conflict according to the given
+ * exclusion constraint and the current collation libraries.
+ *
+ * The index backing the constraint may be corrupted, so the table is read
+ * without using any index.  In the common case of a single range overlap
+ * operator, possibly with equality operators, the rows are sorted by range
+ * within each group of equal keys and only adjacent rows are compared: if
+ * any two ranges of a sorted group overlap, then at least one range overlaps
+ * with the next one.  Other constraints are checked with a nested loop
+ * self-join, which is quadratic in the number of rows.
+ */
+Datum
+pg_collation_exclusion_check(PG_FUNCTION_ARGS)
+{
+	Oid				conoid = PG_GETARG_OID(0);
+	int32			max_violations = PG_GETARG_INT32(1);
+	ReturnSetInfo  *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	HeapTuple		contup;
+	Form_pg_constraint con;
+	Datum			datum;
+	bool			isnull;
+	Datum		   *opdatums;
+	int				nops;
+	Relation		indrel;
+	Form_pg_index	index;
+	List		   *indexprs;
+	ListCell	   *indexpr_item;
+	List		   *pred;
+	char		  **keys[2];
+	int				rangekey = -1;
+	bool			sweep = true;
+	char		   *relname;
+	StringInfoData	query;
+	int				i;
+	uint64			nrows;
+	uint64			row;
+
+	if (max_violations < 1)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("max_violations must be at least 1")));
+
+	InitMaterializedSRF(fcinfo, MAT_SRF_USE_EXPECTED_DESC);
+
+	contup = SearchSysCache1(CONSTROID, ObjectIdGetDatum(conoid));
+	if (!HeapTupleIsValid(contup))
+		ereport(ERROR,
+				(errcode(ERRCODE_UNDEFINED_OBJECT),
+				 errmsg("constraint with OID %u does not exist", conoid)));
+	con = (Form_pg_constraint) GETSTRUCT(contup);
+
+	if (con->contype != CONSTRAINT_EXCLUSION)
+		ereport(ERROR,
+				(errcode(ERRCODE_WRONG_OBJECT_TYPE),
+				 errmsg("constraint \"%s\" is not an exclusion constraint",
+						NameStr(con->conname))));
+
+	datum = SysCacheGetAttr(CONSTROID, contup, Anum_pg_constraint_conexclop,
+							&isnull);
+	if (isnull)
+		elog(ERROR, "null conexclop for constraint %u", conoid);
+	deconstruct_array(DatumGetArrayTypeP(datum), OIDOID, sizeof(Oid), true,
+					  'i', &opdatums, NULL, &nops);
+
+	indrel = index_open(con->conindid, AccessShareLock);
+	index = indrel->rd_index;
+
+	if (RELATION_IS_OTHER_TEMP(indrel))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("cannot check temporary indexes of other sessions")));
+
+	Assert(nops == IndexRelationGetNumberOfKeyAttributes(indrel));
+
+	LockRelationOid(index->indrelid, AccessShareLock);
+	relname = pgcd_qualified_relname(index->indrelid);
+
+	/*
+	 * Deparse each key for both sides of the comparison, using the index
+	 * collation rather than the expression one.
+	 */
+	indexprs = RelationGetIndexExpressions(indrel);
+	pred = RelationGetIndexPredicate(indrel);
+	for (int side = 0; side < 2; side++)
+	{
+		List	   *context;
+
+		context = deparse_context_for(side == 0 ? "a" : "b", index->indrelid);
+		keys[side] = palloc(sizeof(char *) * nops);
+		indexpr_item = list_head(indexprs);
+
+		for (i = 0; i < nops; i++)
+		{
+			AttrNumber	attnum = index->indkey.values[i];
+			Oid			collid = indrel->rd_indcollation[i];
+			StringInfoData key;
+
+			initStringInfo(&key);
+			appendStringInfoChar(&key, '(');
+			if (attnum != 0)
+				appendStringInfo(&key, "%s.%s", side == 0 ? "a" : "b",
+								 quote_identifier(get_attname(index->indrelid,
+															  attnum, false)));
+			else
+			{
+				if (indexpr_item == NULL)
+					elog(ERROR, "too few entries in indexprs list");
+				appendStringInfoString(&key,
+									   deparse_expression((Node *) lfirst(indexpr_item),
+														  context, true, false));
+				indexpr_item = pgcd_lnext(indexprs, indexpr_item);
+			}
+			appendStringInfoChar(&key, ')');
+
+			if (OidIsValid(collid))
+				appendStringInfo(&key, " COLLATE %s",
+								 generate_collation_name(collid));
+
+			keys[side][i] = key.data;
+		}
+	}
+
+	/* Can the rows be compared to their neighbour only? */
+	for (i = 0; i < nops; i++)
+	{
+		Oid			opno = DatumGetObjectId(opdatums[i]);
+		Oid			keytype = TupleDescAttr(RelationGetDescr(indrel),
+											i)->atttypid;
+
+		if (opno == OID_RANGE_OVERLAP_OP && rangekey == -1)
+			rangekey = i;
+		else if (!op_mergejoinable(opno, keytype))
+		{
+			sweep = false;
+			break;
+		}
+	}
+	if (rangekey == -1)
+		sweep = false;
+
+	initStringInfo(&query);
+	if (sweep)
+	{
+		appendStringInfoString(&query,
+							   "SELECT prev_ctid, ctid FROM (SELECT a.ctid,");
+		appendStringInfo(&query, " %s AS k,"
+						 " pg_catalog.lag(a.ctid) OVER w AS prev_ctid,"
+						 " pg_catalog.lag(%s) OVER w AS prev_k"
+						 " FROM ONLY %s a WHERE NOT pg_catalog.isempty(%s)",
+						 keys[0][rangekey], keys[0][rangekey], relname,
+						 keys[0][rangekey]);
+		for (i = 0; i < nops; i++)
+			appendStringInfo(&query, " AND %s IS NOT NULL", keys[0][i]);
+		if (pred != NIL)
+			appendStringInfo(&query, " AND %s",
+							 deparse_expression((Node *) make_ands_explicit(pred),
+												deparse_context_for("a", index->indrelid),
+												true, false));
+		appendStringInfoString(&query, " WINDOW w AS (");
+		if (nops > 1)
+		{
+			bool		first = true;
+
+			appendStringInfoString(&query, "PARTITION BY ");
+			for (i = 0; i < nops; i++)
+			{
+				if (i == rangekey)
+					continue;
+				appendStringInfo(&query, "%s%s", first ? "" : ", ",
+								 keys[0][i]);
+				first = false;
+			}
+			appendStringInfoChar(&query, ' ');
+		}
+		appendStringInfo(&query, "ORDER BY %s)) s"
+						 " WHERE prev_k %s k LIMIT %d",
+						 keys[0][rangekey],
+						 pgcd_qualified_opname(OID_RANGE_OVERLAP_OP),
+						 max_violations);
+	}
+	else
+	{
+		appendStringInfo(&query, "SELECT a.ctid, b.ctid FROM ONLY %s a,"
+						 " ONLY %s b WHERE a.ctid < b.ctid",
+						 relname, relname);
+		for (i = 0; i < nops; i++)
+			appendStringInfo(&query, " AND %s %s %s",
+							 keys[0][i],
+							 pgcd_qualified_opname(DatumGetObjectId(opdatums[i])),
+							 keys[1][i]);
+		if (pred != NIL)
+		{
+			for (int side = 0; side < 2; side++)
+				appendStringInfo(&query, " AND %s",
+								 deparse_expression((Node *) make_ands_explicit(pred),
+													deparse_context_for(side == 0 ? "a" : "b",
+																		index->indrelid),
+													true, false));
+		}
+		appendStringInfo(&query, " LIMIT %d", max_violations);
+	}
+
+	if (SPI_connect() != SPI_OK_CONNECT)
+		elog(ERROR, "SPI_connect failed");
+
+	pgcd_verify_execute(query.data, 0, 0);
+
+	nrows = SPI_processed;
+	for (row = 0; row < nrows; row++)
+	{
+		Datum		values[PGCD_EXCLUSION_CHECK_COLS];
+		bool		nulls[PGCD_EXCLUSION_CHECK_COLS];
+
+		values[0] = SPI_getbinval(SPI_tuptable->vals[row],
+								  SPI_tuptable->tupdesc, 1, &nulls[0]);
+		values[1] = SPI_getbinval(SPI_tuptable->vals[row],
+								  SPI_tuptable->tupdesc, 2, &nulls[1]);
+
+		tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values, nulls);
+	}
+
+	SPI_finish();
+	index_close(indrel, NoLock);
+	ReleaseSysCache(contup);
+
+	return (Datum) 0;
+}
+
+/*
+ * SRF returning the referencing rows of the given foreign key constraint that
+ * don't have a matching referenced row according to the current collation
+ * libraries, typically left behind when the referential integrity triggers
+ * looked up a corrupted index.
+ *
+ * This is the check done by ALTER TABLE ... VALIDATE CONSTRAINT, but written
+ * as a single anti-join that the planner can execute as a parallel hash or
+ * merge anti-join, and that only needs AccessShareLock on both tables.  As
+ * with the referential integrity triggers, the keys are compared using the
+ * referenced columns collation.  Keys containing NULLs are never checked, as
+ * they can't be affected by a collation change.
+ */
+Datum
+pg_collation_foreign_key_check(PG_FUNCTION_ARGS)
+{
+	Oid				conoid = PG_GETARG_OID(0);
+	int32			max_violations = PG_GETARG_INT32(1);
+	ReturnSetInfo  *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	HeapTuple		contup;
+	Form_pg_constraint con;
+	Datum		   *fkkeys;
+	Datum		   *pkkeys;
+	Datum		   *pfeqops;
+	int				nkeys;
+	StringInfoData	query;
+	int				i;
+	uint64			nrows;
+	uint64			row;
+
+	if (max_violations < 1)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("max_violations must be at least 1")));
+
+	InitMaterializedSRF(fcinfo, MAT_SRF_USE_EXPECTED_DESC);
+
+	contup = SearchSysCache1(CONSTROID, ObjectIdGetDatum(conoid));
+	if (!HeapTupleIsValid(contup))
+		ereport(ERROR,
+				(errcode(ERRCODE_UNDEFINED_OBJECT),
+				 errmsg("constraint with OID %u does not exist", conoid)));
+	con = (Form_pg_constraint) GETSTRUCT(contup);
+
+	if (con->contype != CONSTRAINT_FOREIGN)
+		ereport(ERROR,
+				(errcode(ERRCODE_WRONG_OBJECT_TYPE),
+				 errmsg("constraint \"%s\" is not a foreign key constraint",
+						NameStr(con->conname))));
+
+	nkeys = pgcd_get_constraint_keys(contup, Anum_pg_constraint_conkey,
+									 &fkkeys);
+	if (pgcd_get_constraint_keys(contup, Anum_pg_constraint_confkey,
+								 &pkkeys) != nkeys ||
+		pgcd_get_constraint_keys(contup, Anum_pg_constraint_conpfeqop,
+								 &pfeqops) != nkeys)
+		elog(ERROR, "inconsistent key arrays for constraint \"%s\"",
+			 NameStr(con->conname));
+
+	LockRelationOid(con->conrelid, AccessShareLock);
+	LockRelationOid(con->confrelid, AccessShareLock);
+
+	/*
+	 * Foreign keys on a partitioned table are enforced for all its partitions,
+	 * while they're not inherited by regular inheritance children.  The same
+	 * goes for the referenced table.
+	 */
+	initStringInfo(&query);
+	appendStringInfo(&query, "SELECT f.tableoid, f.ctid FROM %s%s f WHERE",
+					 get_rel_relkind(con->conrelid) == RELKIND_PARTITIONED_TABLE ?
+					 "" : "ONLY ",
+					 pgcd_qualified_relname(con->conrelid));
+	for (i = 0; i < nkeys; i++)
+		appendStringInfo(&query, "%s f.%s IS NOT NULL",
+						 i == 0 ? "" : " AND",
+						 quote_identifier(get_attname(con->conrelid,
+													  DatumGetInt16(fkkeys[i]),
+													  false)));
+
+	appendStringInfo(&query, " AND NOT EXISTS (SELECT 1 FROM %s%s p WHERE",
+					 get_rel_relkind(con->confrelid) == RELKIND_PARTITIONED_TABLE ?
+					 "" : "ONLY ",
+					 pgcd_qualified_relname(con->confrelid));
+	for (i = 0; i < nkeys; i++)
+	{
+		AttrNumber	pkattnum = DatumGetInt16(pkkeys[i]);
+		Oid			typid;
+		int32		typmod;
+		Oid			collid;
+
+		get_atttypetypmodcoll(con->confrelid, pkattnum, &typid, &typmod,
+							  &collid);
+
+		appendStringInfo(&query, "%s p.%s %s f.%s",
+						 i == 0 ? "" : " AND",
+						 quote_identifier(get_attname(con->confrelid, pkattnum,
+													  false)),
+						 pgcd_qualified_opname(DatumGetObjectId(pfeqops[i])),
+						 quote_identifier(get_attname(con->conrelid,
+													  DatumGetInt16(fkkeys[i]),
+													  false)));
+		if (OidIsValid(collid))
+			appendStringInfo(&query, " COLLATE %s",
+							 generate_collation_name(collid));
+	}
+	appendStringInfo(&query, ") LIMIT %d", max_violations);
+
+	if (SPI_connect() != SPI_OK_CONNECT)
+		elog(ERROR, "SPI_connect failed");
+
+	pgcd_verify_execute(query.data, 0, 0);
+
+	nrows = SPI_processed;
+	for (row = 0; row < nrows; row++)
+	{
+		Datum		values[PGCD_FOREIGN_KEY_CHECK_COLS];
+		bool		nulls[PGCD_FOREIGN_KEY_CHECK_COLS];
+
+		values[0] = SPI_getbinval(SPI_tuptable->vals[row],
+								  SPI_tuptable->tupdesc, 1, &nulls[0]);
+		values[1] = SPI_getbinval(SPI_tuptable->vals[row],
+								  SPI_tuptable->tupdesc, 2, &nulls[1]);
+
+		tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values, nulls);
+	}
+
+	SPI_finish();
+	ReleaseSysCache(contup);
+
+	return (Datum) 0;
+}
@@ -0,0 +1,33 @@
+CREATE TABLE coll_check (id integer, val text COLLATE "en_US");
+INSERT INTO coll_check SELECT i, 'val ' || i FROM generate_series(1, 10000) i;
+CREATE INDEX coll_check_idx ON coll_check (val, id);
+
+SELECT * FROM pg_collation_index_check('coll_check_idx');
+SELECT * FROM pg_collation_index_check('coll_check_idx', 0.5, 1, 2);
+
+-- simulate a change of ordering with an operator class whose comparison
+-- function is redefined after the index is built
+CREATE FUNCTION coll_check_cmp(text, text) RETURNS integer
+LANGUAGE sql IMMUTABLE AS $$ SELECT pg_catalog.bttextcmp($1, $2) $$;
+CREATE OPERATOR CLASS coll_check_ops FOR TYPE text USING btree AS
+    OPERATOR 1 <, OPERATOR 2 <=, OPERATOR 3 =, OPERATOR 4 >=, OPERATOR 5 >,
+    FUNCTION 1 coll_check_cmp(text, text);
+CREATE TABLE coll_check_inv (val text COLLATE "en_US");
+INSERT INTO coll_check_inv
+SELECT 'val ' || lpad(i::text, 5, '0') FROM generate_series(1, 1000) i;
+CREATE INDEX coll_check_inv_idx ON coll_check_inv (val coll_check_ops);
+
+SELECT count(*) FROM pg_collation_index_check('coll_check_inv_idx');
+
+CREATE OR REPLACE FUNCTION coll_check_cmp(text, text) RETURNS integer
+LANGUAGE sql IMMUTABLE AS $$ SELECT pg_catalog.bttextcmp($2, $1) $$;
+
+SELECT kind, count(*) > 0 AS found
+FROM pg_collation_index_check('coll_check_inv_idx', max_violations => 10000,
+    parallel_workers => 0)
+GROUP BY kind
+ORDER BY kind;
+
+DROP TABLE coll_check_inv;
+DROP OPERATOR FAMILY coll_check_ops USING btree;
+DROP FUNCTION coll_check_cmp(text, text);
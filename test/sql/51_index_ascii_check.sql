@@ -0,0 +1,32 @@
+CREATE INDEX coll_check_id_idx ON coll_check ((id::text COLLATE "en_US"));
+
+SELECT stable, nvalues, reason IS NULL AS no_reason
+FROM pg_collation_index_ascii_check('coll_check_id_idx');
+-- expressions can't be checked in the table
+SELECT stable, nvalues, reason IS NULL AS no_reason
+FROM pg_collation_index_ascii_check('coll_check_id_idx', true);
+-- keys contain a space
+SELECT stable, reason IS NULL AS no_reason
+FROM pg_collation_index_ascii_check('coll_check_idx');
+
+SELECT stable
+FROM pg_collation_index_ascii_check('coll_check_id_idx', mark_safe => true);
+SELECT c.collname, v.method
+FROM pg_collation_verified_objects v
+JOIN pg_collation c ON c.oid = v.collid
+WHERE v.classid = 'pg_class'::regclass
+AND v.objid = 'coll_check_id_idx'::regclass
+ORDER BY c.collname COLLATE "C";
+
+-- the key collation doesn't matter if the expression depends on another one
+CREATE INDEX coll_check_lower_c_idx ON coll_check
+    ((lower(val COLLATE "en_US") COLLATE "C"));
+SELECT stable, nvalues, reason
+FROM pg_collation_index_ascii_check('coll_check_lower_c_idx', mark_safe => true);
+DROP INDEX coll_check_lower_c_idx;
+
+-- partitioned indexes have no storage
+CREATE TABLE coll_ascii_part (val text COLLATE "en_US") PARTITION BY LIST (val);
+CREATE INDEX coll_ascii_part_idx ON coll_ascii_part (val);
+SELECT * FROM pg_collation_index_ascii_check('coll_ascii_part_idx');
+DROP TABLE coll_ascii_part;
@@ -0,0 +1,22 @@
+CREATE TABLE coll_triage (val text COLLATE "en_US");
+INSERT INTO coll_triage VALUES ('a b'), ('c d');
+CREATE INDEX coll_triage_idx ON coll_triage (val);
+ANALYZE coll_check, coll_triage;
+
+BEGIN;
+
+-- ignore the indexes already marked as verified
+DELETE FROM pg_collation_verified_objects;
+
+UPDATE pg_collation SET collversion = 'not_a_version'
+WHERE collname = 'en_US';
+
+-- the biggest relations come first within a verdict
+SELECT dep_kind, object_name, collname, triage
+FROM pg_collation_broken_dependencies_triage
+WHERE table_name IN ('coll_check', 'coll_triage')
+ORDER BY triage_rank, object_name COLLATE "C";
+
+ROLLBACK;
+
+DROP TABLE coll_triage;
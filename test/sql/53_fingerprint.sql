@@ -0,0 +1,36 @@
+CREATE TEMP VIEW coll_en_us AS
+    SELECT oid FROM pg_collation
+    WHERE collname = 'en_US'
+    AND collencoding IN (-1, pg_char_to_encoding(getdatabaseencoding()));
+
+SELECT pg_collation_fingerprint(oid) = pg_collation_fingerprint(oid) AS same
+FROM coll_en_us;
+SELECT pg_collation_fingerprint(a.oid) <> pg_collation_fingerprint(b.oid) AS differ
+FROM coll_en_us a, pg_collation b
+WHERE b.collname = 'C';
+
+SELECT pg_collation_fingerprint_record(oid) = pg_collation_fingerprint(oid) AS recorded
+FROM coll_en_us;
+
+BEGIN;
+
+-- the version changed but not the behavior
+UPDATE pg_collation SET collversion = 'not_a_version'
+WHERE collname = 'en_US';
+
+SELECT dep_kind, object_name, collname
+FROM pg_collation_broken_dependencies
+WHERE collname = 'en_US';
+
+-- the behavior changed
+UPDATE pg_collation_fingerprints SET fingerprint = 'not_a_fingerprint'
+WHERE collid IN (SELECT oid FROM coll_en_us);
+
+SELECT dep_kind, object_name, collname
+FROM pg_collation_broken_dependencies
+WHERE collname = 'en_US'
+ORDER BY dep_kind COLLATE "C", object_name COLLATE "C";
+
+ROLLBACK;
+
+DELETE FROM pg_collation_fingerprints;
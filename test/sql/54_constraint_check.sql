@@ -0,0 +1,53 @@
+CREATE TABLE coll_part (
+    val text COLLATE "en_US",
+    CONSTRAINT coll_part_val_check CHECK (val > 'b')
+) PARTITION BY RANGE (val);
+CREATE TABLE coll_part_1 PARTITION OF coll_part FOR VALUES FROM ('c') TO ('m');
+CREATE TABLE coll_part_2 PARTITION OF coll_part FOR VALUES FROM ('m') TO (MAXVALUE);
+INSERT INTO coll_part VALUES ('cat'), ('zebra');
+
+SELECT * FROM pg_collation_constraint_check(
+    (SELECT oid FROM pg_constraint
+     WHERE conname = 'coll_part_val_check'
+     AND conrelid = 'coll_part'::regclass));
+SELECT * FROM pg_collation_constraint_check(
+    (SELECT oid FROM pg_constraint
+     WHERE conname = 'coll_part_val_check'
+     AND conrelid = 'coll_part'::regclass), 10, false);
+
+-- existing rows are not checked for NOT VALID constraints
+ALTER TABLE coll_check ADD CONSTRAINT coll_check_val_check
+    CHECK (val < 'val 5') NOT VALID;
+SELECT relid, count(*) FROM pg_collation_constraint_check(
+    (SELECT oid FROM pg_constraint WHERE conname = 'coll_check_val_check'), 3)
+GROUP BY relid;
+
+CREATE DOMAIN d_en_check AS text COLLATE "en_US";
+CREATE TABLE coll_dom (val d_en_check);
+INSERT INTO coll_dom VALUES ('abc'), ('xyz');
+ALTER DOMAIN d_en_check ADD CONSTRAINT d_en_check_check
+    CHECK (VALUE < 'm') NOT VALID;
+SELECT * FROM pg_collation_constraint_check(
+    (SELECT oid FROM pg_constraint WHERE conname = 'd_en_check_check'));
+
+-- NO INHERIT constraints are not checked on the children
+CREATE TABLE coll_noinh (val text COLLATE "en_US");
+CREATE TABLE coll_noinh_child () INHERITS (coll_noinh);
+INSERT INTO coll_noinh VALUES ('abc'), ('xyz');
+INSERT INTO coll_noinh_child VALUES ('zzz');
+ALTER TABLE coll_noinh ADD CONSTRAINT coll_noinh_check
+    CHECK (val < 'm') NO INHERIT NOT VALID;
+SELECT * FROM pg_collation_constraint_check(
+    (SELECT oid FROM pg_constraint WHERE conname = 'coll_noinh_check'));
+DROP TABLE coll_noinh_child;
+DROP TABLE coll_noinh;
+
+-- only CHECK constraints are supported
+ALTER TABLE coll_dom ADD CONSTRAINT coll_dom_uniq UNIQUE (val);
+SELECT * FROM pg_collation_constraint_check(
+    (SELECT oid FROM pg_constraint WHERE conname = 'coll_dom_uniq'));
+
+DROP TABLE coll_dom;
+DROP DOMAIN d_en_check;
+ALTER TABLE coll_check DROP CONSTRAINT coll_check_val_check;
+DROP TABLE coll_part;
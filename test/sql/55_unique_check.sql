@@ -0,0 +1,35 @@
+CREATE UNIQUE INDEX coll_check_uniq ON coll_check (val);
+CREATE UNIQUE INDEX coll_check_uniq_expr ON coll_check (lower(val), id)
+    WHERE id > 10;
+
+SELECT * FROM pg_collation_unique_check('coll_check_uniq');
+SELECT * FROM pg_collation_unique_check('coll_check_uniq_expr', 1);
+
+-- only unique indexes are supported
+SELECT * FROM pg_collation_unique_check('coll_check_idx');
+
+DROP INDEX coll_check_uniq;
+DROP INDEX coll_check_uniq_expr;
+
+-- simulate duplicates let in by an ordering that changed, with an operator
+-- class whose comparison function is redefined after the index is built
+CREATE FUNCTION coll_uniq_cmp(text, text) RETURNS integer
+LANGUAGE sql IMMUTABLE AS $$ SELECT pg_catalog.bttextcmp($1, $2) $$;
+CREATE OPERATOR CLASS coll_uniq_ops FOR TYPE text USING btree AS
+    OPERATOR 1 <, OPERATOR 2 <=, OPERATOR 3 =, OPERATOR 4 >=, OPERATOR 5 >,
+    FUNCTION 1 coll_uniq_cmp(text, text);
+CREATE TABLE coll_uniq (val text COLLATE "en_US", id integer);
+CREATE UNIQUE INDEX coll_uniq_idx ON coll_uniq (val coll_uniq_ops);
+INSERT INTO coll_uniq VALUES ('a', 1), ('b', 2);
+
+CREATE OR REPLACE FUNCTION coll_uniq_cmp(text, text) RETURNS integer
+LANGUAGE sql IMMUTABLE
+AS $$ SELECT CASE WHEN pg_catalog.bttextcmp($1, $2) < 0 THEN -1 ELSE 1 END $$;
+INSERT INTO coll_uniq VALUES ('a', 3), ('a', 4), (NULL, 5), (NULL, 6);
+
+-- NULLs are distinct
+SELECT * FROM pg_collation_unique_check('coll_uniq_idx');
+
+DROP TABLE coll_uniq;
+DROP OPERATOR FAMILY coll_uniq_ops USING btree;
+DROP FUNCTION coll_uniq_cmp(text, text);
@@ -0,0 +1,26 @@
+SELECT * FROM pg_collation_matview_check('mv_coll');
+
+BEGIN;
+INSERT INTO coll (id, val) VALUES (1, 'a');
+SELECT * FROM pg_collation_matview_check('mv_coll');
+ROLLBACK;
+
+CREATE MATERIALIZED VIEW mv_coll_check AS
+    SELECT val COLLATE "en_US" AS val, count(*) AS nb
+    FROM coll_check
+    GROUP BY 1;
+SELECT * FROM pg_collation_matview_check('mv_coll_check');
+
+BEGIN;
+UPDATE coll_check SET val = 'val 0' WHERE id = 1;
+SELECT * FROM pg_collation_matview_check('mv_coll_check');
+ROLLBACK;
+
+CREATE MATERIALIZED VIEW mv_coll_empty AS SELECT * FROM coll WITH NO DATA;
+SELECT * FROM pg_collation_matview_check('mv_coll_empty');
+
+DROP MATERIALIZED VIEW mv_coll_check;
+DROP MATERIALIZED VIEW mv_coll_empty;
+
+-- only materialized views are supported
+SELECT * FROM pg_collation_matview_check('coll');
@@ -0,0 +1,29 @@
+CREATE VIEW v_coll AS
+    SELECT val
+    FROM coll
+    WHERE val COLLATE "it_IT" > ''
+    ORDER BY val COLLATE "en_GB";
+
+SELECT view_name, collname
+FROM pg_collation_view_dependencies
+WHERE view_name = 'v_coll'
+ORDER BY collname::text COLLATE "C";
+
+SELECT matview_name, collname
+FROM pg_collation_matview_dependencies
+WHERE matview_name = 'mv_coll'
+ORDER BY collname::text COLLATE "C";
+
+-- views don't store anything, so they're never reported as broken
+BEGIN;
+
+UPDATE pg_collation SET collversion = 'not_a_version'
+WHERE collname = 'it_IT';
+
+SELECT dep_kind, table_name, object_name, collname
+FROM pg_collation_broken_dependencies
+WHERE dep_kind = 'view';
+
+ROLLBACK;
+
+DROP VIEW v_coll;
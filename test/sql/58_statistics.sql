@@ -0,0 +1,32 @@
+CREATE STATISTICS coll_check_stats (ndistinct) ON id, val FROM coll_check;
+CREATE TABLE coll_stats (a text COLLATE "en_US", b text COLLATE "fr_FR", c integer);
+INSERT INTO coll_stats SELECT 'a' || i, 'b' || i, i FROM generate_series(1, 100) i;
+ANALYZE coll_stats;
+ANALYZE coll_check;
+
+SELECT table_name, attname, stat_name, collname
+FROM pg_collation_statistics_dependencies
+WHERE tbl_oid IN ('coll_check'::regclass, 'coll_check_id_idx'::regclass,
+    'coll_stats'::regclass)
+ORDER BY table_name::text COLLATE "C", attname::text COLLATE "C";
+
+BEGIN;
+
+UPDATE pg_collation SET collversion = 'not_a_version'
+WHERE collname = 'en_US';
+
+SELECT table_name, attname, stat_name, collname
+FROM pg_collation_broken_statistics
+WHERE tbl_oid IN ('coll_check'::regclass, 'coll_check_id_idx'::regclass,
+    'coll_stats'::regclass)
+ORDER BY table_name::text COLLATE "C", attname::text COLLATE "C";
+
+SELECT * FROM pg_collation_reanalyze(dry_run => true);
+SELECT count(*) FROM pg_collation_reanalyze();
+
+ROLLBACK;
+
+SELECT * FROM pg_collation_reanalyze(2, 2);
+
+DROP TABLE coll_stats;
+DROP STATISTICS coll_check_stats;
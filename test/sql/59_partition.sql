@@ -0,0 +1,89 @@
+CREATE TABLE coll_range (id integer, val text COLLATE "en_US")
+    PARTITION BY RANGE (val);
+CREATE TABLE coll_range_1 PARTITION OF coll_range FOR VALUES FROM ('a') TO ('m');
+CREATE TABLE coll_range_2 PARTITION OF coll_range FOR VALUES FROM ('m') TO ('z');
+CREATE TABLE coll_range_def PARTITION OF coll_range DEFAULT;
+CREATE INDEX coll_range_val_idx ON coll_range (val);
+INSERT INTO coll_range
+    SELECT i, chr(97 + i % 26) || i FROM generate_series(1, 1000) i;
+
+SELECT table_name, collname
+FROM pg_collation_partition_dependencies
+WHERE table_name::text LIKE 'coll_range%'
+ORDER BY table_name::text COLLATE "C";
+
+BEGIN;
+
+UPDATE pg_collation SET collversion = 'not_a_version'
+WHERE collname = 'en_US';
+
+SELECT dep_kind, table_name, object_name, collname
+FROM pg_collation_broken_dependencies
+WHERE dep_kind = 'partition'
+ORDER BY table_name::text COLLATE "C";
+
+ROLLBACK;
+
+SELECT * FROM pg_collation_partition_check('coll_range');
+SELECT * FROM pg_collation_partition_check('coll_range', 1, true);
+
+-- only partitioned tables are supported
+SELECT * FROM pg_collation_partition_check('coll_range_1');
+
+DROP TABLE coll_range;
+
+-- simulate a change of ordering with an operator class whose comparison
+-- function is redefined after the rows are routed: "q" now sorts as "b"
+CREATE FUNCTION coll_part_cmp(text, text) RETURNS integer
+LANGUAGE sql IMMUTABLE AS $$ SELECT pg_catalog.bttextcmp($1, $2) $$;
+CREATE FUNCTION coll_part_lt(text, text) RETURNS boolean
+LANGUAGE sql IMMUTABLE AS $$ SELECT coll_part_cmp($1, $2) < 0 $$;
+CREATE FUNCTION coll_part_le(text, text) RETURNS boolean
+LANGUAGE sql IMMUTABLE AS $$ SELECT coll_part_cmp($1, $2) <= 0 $$;
+CREATE FUNCTION coll_part_eq(text, text) RETURNS boolean
+LANGUAGE sql IMMUTABLE AS $$ SELECT coll_part_cmp($1, $2) = 0 $$;
+CREATE FUNCTION coll_part_ge(text, text) RETURNS boolean
+LANGUAGE sql IMMUTABLE AS $$ SELECT coll_part_cmp($1, $2) >= 0 $$;
+CREATE FUNCTION coll_part_gt(text, text) RETURNS boolean
+LANGUAGE sql IMMUTABLE AS $$ SELECT coll_part_cmp($1, $2) > 0 $$;
+CREATE OPERATOR #<# (LEFTARG = text, RIGHTARG = text, FUNCTION = coll_part_lt);
+CREATE OPERATOR #<=# (LEFTARG = text, RIGHTARG = text, FUNCTION = coll_part_le);
+CREATE OPERATOR #=# (LEFTARG = text, RIGHTARG = text, FUNCTION = coll_part_eq);
+CREATE OPERATOR #>=# (LEFTARG = text, RIGHTARG = text, FUNCTION = coll_part_ge);
+CREATE OPERATOR #># (LEFTARG = text, RIGHTARG = text, FUNCTION = coll_part_gt);
+CREATE OPERATOR CLASS coll_part_ops FOR TYPE text USING btree AS
+    OPERATOR 1 #<#, OPERATOR 2 #<=#, OPERATOR 3 #=#, OPERATOR 4 #>=#,
+    OPERATOR 5 #>#, FUNCTION 1 coll_part_cmp(text, text);
+
+CREATE TABLE coll_part (id integer, val text COLLATE "en_US")
+    PARTITION BY RANGE (val coll_part_ops);
+CREATE TABLE coll_part_1 PARTITION OF coll_part FOR VALUES FROM ('a') TO ('m');
+CREATE TABLE coll_part_2 PARTITION OF coll_part FOR VALUES FROM ('m') TO ('z');
+INSERT INTO coll_part
+    SELECT i, chr(97 + i % 25) || lpad(i::text, 4, '0')
+    FROM generate_series(1, 1000) i;
+
+SELECT * FROM pg_collation_partition_check('coll_part');
+
+CREATE OR REPLACE FUNCTION coll_part_cmp(text, text) RETURNS integer
+LANGUAGE sql IMMUTABLE AS $$
+    SELECT pg_catalog.bttextcmp(pg_catalog.translate($1, 'q', 'b'),
+        pg_catalog.translate($2, 'q', 'b'))
+$$;
+
+SELECT partition, count(*)
+FROM pg_collation_partition_check('coll_part', 1000)
+GROUP BY partition;
+
+-- the row with the minimum key of coll_part_2 is now out of its bound
+SELECT c.partition, t.id, t.val
+FROM pg_collation_partition_check('coll_part', 1000, true) c
+JOIN coll_part t ON t.tableoid = c.partition AND t.ctid = c.ctid;
+
+DROP TABLE coll_part;
+DROP OPERATOR FAMILY coll_part_ops USING btree;
+DROP OPERATOR #<# (text, text), #<=# (text, text), #=# (text, text),
+    #>=# (text, text), #># (text, text);
+DROP FUNCTION coll_part_lt(text, text), coll_part_le(text, text),
+    coll_part_eq(text, text), coll_part_ge(text, text),
+    coll_part_gt(text, text), coll_part_cmp(text, text);
@@ -0,0 +1,57 @@
+CREATE TABLE coll_gen (
+    id integer,
+    val text COLLATE "en_US",
+    val_upper text GENERATED ALWAYS AS (upper(val COLLATE "fr_FR")) STORED,
+    val_len integer GENERATED ALWAYS AS (length(val)) STORED
+);
+CREATE INDEX coll_gen_upper_idx ON coll_gen (val_upper COLLATE "C");
+INSERT INTO coll_gen (id, val) VALUES (1, 'abc'), (2, 'xyz');
+
+SELECT table_name, attname, collname
+FROM pg_collation_generated_dependencies
+WHERE table_name = 'coll_gen'
+ORDER BY attname::text COLLATE "C", collname::text COLLATE "C";
+
+SELECT c.collname
+FROM pg_collation_index_dependencies('coll_gen_upper_idx') as d(o)
+JOIN pg_collation c ON d.o = c.oid
+ORDER BY c.collname::text COLLATE "C";
+
+BEGIN;
+
+UPDATE pg_collation SET collversion = 'not_a_version'
+WHERE collname = 'fr_FR';
+
+SELECT dep_kind, table_name, object_name, collname
+FROM pg_collation_broken_dependencies
+WHERE table_name = 'coll_gen'
+ORDER BY dep_kind COLLATE "C";
+
+ROLLBACK;
+
+SELECT * FROM pg_collation_generated_check('coll_gen');
+
+DROP TABLE coll_gen;
+
+-- simulate a change of an immutable function used in the generation
+-- expression, which leaves the stored values stale
+CREATE FUNCTION coll_gen_norm(text) RETURNS text
+LANGUAGE sql IMMUTABLE AS $$ SELECT lower($1) $$;
+CREATE TABLE coll_gen_fn (
+    id integer,
+    val text COLLATE "en_US",
+    val_norm text GENERATED ALWAYS AS (coll_gen_norm(val)) STORED
+);
+INSERT INTO coll_gen_fn (id, val) VALUES (1, 'abc'), (2, '123'), (3, NULL);
+
+SELECT * FROM pg_collation_generated_check('coll_gen_fn');
+
+CREATE OR REPLACE FUNCTION coll_gen_norm(text) RETURNS text
+LANGUAGE sql IMMUTABLE AS $$ SELECT upper($1) $$;
+
+SELECT g.relation, g.attname, t.id
+FROM pg_collation_generated_check('coll_gen_fn') g
+JOIN coll_gen_fn t ON t.ctid = g.ctid;
+
+DROP TABLE coll_gen_fn;
+DROP FUNCTION coll_gen_norm(text);
@@ -0,0 +1,86 @@
+SELECT d.dep_kind, d.tbl_oid IS NULL AS no_table, coll.collname, d.error
+FROM pg_collation_all_dependencies() d
+JOIN pg_catalog.pg_collation coll ON coll.oid = d.colloid
+WHERE d.object_oid = 'mv_coll'::regclass
+ORDER BY coll.collname::text COLLATE "C";
+
+SELECT count(*) FROM pg_collation_dependency_errors;
+
+-- the streaming variant returns the same rows
+SELECT count(*) = (SELECT count(*) FROM pg_collation_all_dependencies())
+    AS same_count
+FROM (SELECT pg_collation_all_dependencies_stream() AS d) s;
+
+BEGIN;
+
+UPDATE pg_collation SET collversion = 'not_a_version'
+WHERE collname = 'en_US';
+
+SELECT EXISTS (SELECT pg_collation_all_dependencies_stream(true))
+    AS has_broken;
+
+-- coll_check_id_idx was marked as safe by pg_collation_index_ascii_check
+SELECT (s.d).dep_kind, (s.d).object_oid::regclass AS object_name, c.collname
+FROM (SELECT pg_collation_all_dependencies_stream(true) AS d) s
+JOIN pg_catalog.pg_collation c ON c.oid = (s.d).colloid
+WHERE (s.d).tbl_oid = 'coll_check'::regclass;
+
+ROLLBACK;
+
+-- the impact summary is built from the same dependencies
+SELECT count(*) = (SELECT count(DISTINCT colloid)
+        FROM pg_collation_all_dependencies() WHERE error IS NULL)
+    AND bool_and(i.objects = d.objects AND i.indexes = d.indexes)
+    AS consistent
+FROM pg_collation_impact_summary() i
+LEFT JOIN (SELECT colloid, count(*) AS objects,
+        count(*) FILTER (WHERE dep_kind = 'index') AS indexes
+    FROM pg_collation_all_dependencies()
+    WHERE error IS NULL
+    GROUP BY colloid) d ON d.colloid = i.colloid;
+
+SET pg_collation_dependencies.rebuild_mb_per_second = 0;
+SET pg_collation_dependencies.rebuild_rows_per_second = 0;
+SELECT max(rebuild_time) FROM pg_collation_impact;
+RESET pg_collation_dependencies.rebuild_mb_per_second;
+RESET pg_collation_dependencies.rebuild_rows_per_second;
+
+-- an object that can't be processed is reported as an error, without
+-- preventing the other objects of its batch from being processed
+CREATE VIEW coll_err_view AS SELECT 'a' COLLATE "fr_FR" AS val;
+SELECT count(*) AS nb_other_deps FROM pg_collation_all_dependencies()
+WHERE object_oid <> 'coll_err_view'::regclass \gset
+
+BEGIN;
+
+DELETE FROM pg_rewrite WHERE ev_class = 'coll_err_view'::regclass;
+
+SELECT dep_kind, tbl_oid, object_oid::regclass AS object_name, error
+FROM pg_collation_dependency_errors;
+
+SELECT count(*) = :nb_other_deps AS same_count
+FROM pg_collation_all_dependencies()
+WHERE object_oid <> 'coll_err_view'::regclass;
+
+SELECT (s.d).dep_kind, (s.d).colloid, (s.d).error
+FROM (SELECT pg_collation_all_dependencies_stream() AS d) s
+WHERE (s.d).object_oid = 'coll_err_view'::regclass;
+
+SELECT count(*) = :nb_other_deps AS same_count
+FROM (SELECT pg_collation_all_dependencies_stream() AS d) s
+WHERE (s.d).object_oid <> 'coll_err_view'::regclass;
+
+ROLLBACK;
+
+DROP VIEW coll_err_view;
+
+-- a materialized view isn't an underlying table, even for its own indexes
+CREATE COLLATION coll_impact (provider = libc, locale = 'C');
+CREATE MATERIALIZED VIEW coll_impact_mv AS
+    SELECT 'a'::text COLLATE coll_impact AS val;
+CREATE INDEX coll_impact_mv_idx ON coll_impact_mv (val);
+SELECT objects, indexes, matviews, tables, table_rows, partitions
+FROM pg_collation_impact_summary()
+WHERE colloid = (SELECT oid FROM pg_collation WHERE collname = 'coll_impact');
+DROP MATERIALIZED VIEW coll_impact_mv;
+DROP COLLATION coll_impact;
@@ -0,0 +1,22 @@
+SELECT pg_collation_snapshot_export('pgcd_test.snapshot') > 0 AS exported;
+
+SELECT count(*) > 0 AS has_rows
+FROM pg_collation_snapshot_read('pgcd_test.snapshot');
+
+-- nothing changed
+SELECT count(*) FROM pg_collation_snapshot_diff('pgcd_test.snapshot',
+    'pgcd_test.snapshot');
+SELECT count(*) FROM pg_collation_snapshot_diff('pgcd_test.snapshot');
+
+CREATE INDEX coll_snapshot_idx ON coll ((val COLLATE "it_IT"));
+
+SELECT d.dep_kind, d.object_oid = 'coll_snapshot_idx'::regclass AS is_idx,
+    d.change, c.collname
+FROM pg_collation_snapshot_diff('pgcd_test.snapshot') d
+JOIN pg_catalog.pg_collation c ON c.oid = d.colloid
+ORDER BY c.collname::text COLLATE "C";
+
+DROP INDEX coll_snapshot_idx;
+
+-- not a snapshot
+SELECT * FROM pg_collation_snapshot_read('PG_VERSION');
@@ -0,0 +1,35 @@
+BEGIN;
+
+UPDATE pg_collation SET collversion = 'not_a_version'
+WHERE collname = 'en_US';
+
+-- coll_check_id_idx was marked as safe by pg_collation_index_ascii_check
+SELECT dep_kind, object_name, collname
+FROM pg_collation_broken_dependencies
+WHERE table_name = 'coll_check'
+ORDER BY object_name COLLATE "C";
+
+SELECT pg_collation_mark_verified('pg_class', 'coll_check_idx'::regclass,
+    'reindex');
+
+SELECT dep_kind, object_name, collname
+FROM pg_collation_broken_dependencies
+WHERE table_name = 'coll_check'
+ORDER BY object_name COLLATE "C";
+
+-- the ledger only applies to the version the object was verified under
+UPDATE pg_collation_verified_objects SET collversion = 'old_version'
+WHERE objid = 'coll_check_idx'::regclass;
+
+SELECT dep_kind, object_name, collname
+FROM pg_collation_broken_dependencies
+WHERE table_name = 'coll_check'
+ORDER BY object_name COLLATE "C";
+
+ROLLBACK;
+
+-- tables only depend on collations through other objects
+SELECT pg_collation_mark_verified('pg_class', 'coll_check'::regclass);
+
+-- the backend-local ledger is only used during recovery
+SELECT count(*) FROM pg_collation_session_verified_objects();
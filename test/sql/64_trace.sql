@@ -0,0 +1,18 @@
+CREATE INDEX coll_trace_idx ON coll (enfres, (val COLLATE "POSIX"));
+
+-- the trace finds the same collations as the plain lookup
+SELECT (SELECT array_agg(DISTINCT colloid ORDER BY colloid)
+        FROM pg_collation_dependencies_trace('pg_class',
+            'coll_trace_idx'::regclass))
+    = (SELECT array_agg(d.o ORDER BY d.o)
+       FROM pg_collation_index_dependencies('coll_trace_idx') AS d(o))
+    AS same;
+
+SELECT c.collname, t.path
+FROM pg_collation_dependencies_trace('pg_class',
+    'coll_trace_idx'::regclass) AS t
+JOIN pg_collation c ON c.oid = t.colloid
+WHERE c.collname IN ('POSIX', 'es-x-icu', 'fr-x-icu')
+ORDER BY c.collname COLLATE "C", t.path COLLATE "C";
+
+DROP INDEX coll_trace_idx;
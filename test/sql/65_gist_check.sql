@@ -0,0 +1,118 @@
+CREATE TABLE coll_gist (
+    id integer,
+    r af_range,
+    CONSTRAINT coll_gist_overlap EXCLUDE USING gist (r WITH &&),
+    CONSTRAINT coll_gist_eq EXCLUDE USING gist (r WITH =)
+);
+INSERT INTO coll_gist
+SELECT i, af_range('val ' || lpad(i::text, 5, '0'),
+    'val ' || lpad(i::text, 5, '0') || 'z')
+FROM generate_series(1, 1000) i;
+INSERT INTO coll_gist VALUES (1001, NULL), (1002, af_range('a', 'a'));
+
+SELECT * FROM pg_collation_gist_check('coll_gist_overlap');
+
+SELECT * FROM pg_collation_range_check('coll_gist');
+
+-- single overlap operator, checked by comparing adjacent rows
+SELECT * FROM pg_collation_exclusion_check((SELECT oid FROM pg_constraint
+    WHERE conname = 'coll_gist_overlap'));
+
+-- any other operator, checked with a self-join
+SELECT * FROM pg_collation_exclusion_check((SELECT oid FROM pg_constraint
+    WHERE conname = 'coll_gist_eq'));
+
+SELECT * FROM pg_collation_gist_check('coll_check_idx');
+
+DROP TABLE coll_gist;
+
+-- simulate a change of ordering with a range type over an operator class
+-- whose comparison function is redefined after the rows are stored
+CREATE FUNCTION coll_gist_cmp(text, text) RETURNS integer
+LANGUAGE sql IMMUTABLE AS $$ SELECT pg_catalog.bttextcmp($1, $2) $$;
+CREATE FUNCTION coll_gist_lt(text, text) RETURNS boolean
+LANGUAGE sql IMMUTABLE AS $$ SELECT coll_gist_cmp($1, $2) < 0 $$;
+CREATE FUNCTION coll_gist_le(text, text) RETURNS boolean
+LANGUAGE sql IMMUTABLE AS $$ SELECT coll_gist_cmp($1, $2) <= 0 $$;
+CREATE FUNCTION coll_gist_eq(text, text) RETURNS boolean
+LANGUAGE sql IMMUTABLE AS $$ SELECT coll_gist_cmp($1, $2) = 0 $$;
+CREATE FUNCTION coll_gist_ge(text, text) RETURNS boolean
+LANGUAGE sql IMMUTABLE AS $$ SELECT coll_gist_cmp($1, $2) >= 0 $$;
+CREATE FUNCTION coll_gist_gt(text, text) RETURNS boolean
+LANGUAGE sql IMMUTABLE AS $$ SELECT coll_gist_cmp($1, $2) > 0 $$;
+CREATE OPERATOR #<# (LEFTARG = text, RIGHTARG = text, FUNCTION = coll_gist_lt);
+CREATE OPERATOR #<=# (LEFTARG = text, RIGHTARG = text, FUNCTION = coll_gist_le);
+CREATE OPERATOR #=# (LEFTARG = text, RIGHTARG = text, FUNCTION = coll_gist_eq);
+CREATE OPERATOR #>=# (LEFTARG = text, RIGHTARG = text, FUNCTION = coll_gist_ge);
+CREATE OPERATOR #># (LEFTARG = text, RIGHTARG = text, FUNCTION = coll_gist_gt);
+CREATE OPERATOR CLASS coll_gist_ops FOR TYPE text USING btree AS
+    OPERATOR 1 #<#, OPERATOR 2 #<=#, OPERATOR 3 #=#, OPERATOR 4 #>=#,
+    OPERATOR 5 #>#, FUNCTION 1 coll_gist_cmp(text, text);
+CREATE TYPE coll_gist_range AS RANGE (
+    SUBTYPE = text,
+    SUBTYPE_OPCLASS = coll_gist_ops,
+    COLLATION = "C"
+);
+
+CREATE TABLE coll_gist_inv (
+    id integer,
+    r coll_gist_range,
+    CONSTRAINT coll_gist_inv_overlap EXCLUDE USING gist (r WITH &&),
+    CONSTRAINT coll_gist_inv_eq EXCLUDE USING gist (r WITH =)
+);
+INSERT INTO coll_gist_inv
+SELECT i, coll_gist_range('val ' || lpad(i::text, 5, '0'),
+    'val ' || lpad(i::text, 5, '0') || 'z')
+FROM generate_series(1, 1000) i;
+-- don't overlap as long as uppercase letters sort before lowercase ones
+INSERT INTO coll_gist_inv VALUES (1001, coll_gist_range('A', 'B')),
+    (1002, coll_gist_range('a', 'b'));
+
+SELECT count(*) FROM pg_collation_gist_check('coll_gist_inv_overlap');
+
+-- reverse the ordering: the bounds of all the stored ranges are now swapped,
+-- and the internal keys don't contain the keys of their children anymore
+CREATE OR REPLACE FUNCTION coll_gist_cmp(text, text) RETURNS integer
+LANGUAGE sql IMMUTABLE AS $$ SELECT pg_catalog.bttextcmp($2, $1) $$;
+
+SELECT kind, count(*) > 0 AS found
+FROM pg_collation_gist_check('coll_gist_inv_overlap', 10000)
+GROUP BY kind
+ORDER BY kind;
+
+SELECT relation, attname, count(*)
+FROM pg_collation_range_check('coll_gist_inv', 10000)
+GROUP BY relation, attname;
+
+-- ignore the case: the ranges of rows 1001 and 1002 now conflict
+CREATE OR REPLACE FUNCTION coll_gist_cmp(text, text) RETURNS integer
+LANGUAGE sql IMMUTABLE AS $$
+    SELECT pg_catalog.bttextcmp(pg_catalog.lower($1), pg_catalog.lower($2))
+$$;
+
+SELECT * FROM pg_collation_range_check('coll_gist_inv');
+
+SELECT least(a.id, b.id) AS id1, greatest(a.id, b.id) AS id2
+FROM pg_collation_exclusion_check((SELECT oid FROM pg_constraint
+    WHERE conname = 'coll_gist_inv_overlap')) e
+JOIN coll_gist_inv a ON a.ctid = e.ctid1
+JOIN coll_gist_inv b ON b.ctid = e.ctid2;
+
+-- the hash function of the subtype doesn't follow the redefined comparison
+-- function, so don't let the self-join use it
+SET enable_hashjoin = off;
+SELECT least(a.id, b.id) AS id1, greatest(a.id, b.id) AS id2
+FROM pg_collation_exclusion_check((SELECT oid FROM pg_constraint
+    WHERE conname = 'coll_gist_inv_eq')) e
+JOIN coll_gist_inv a ON a.ctid = e.ctid1
+JOIN coll_gist_inv b ON b.ctid = e.ctid2;
+RESET enable_hashjoin;
+
+DROP TABLE coll_gist_inv;
+DROP TYPE coll_gist_range;
+DROP OPERATOR FAMILY coll_gist_ops USING btree;
+DROP OPERATOR #<# (text, text), #<=# (text, text), #=# (text, text),
+    #>=# (text, text), #># (text, text);
+DROP FUNCTION coll_gist_lt(text, text), coll_gist_le(text, text),
+    coll_gist_eq(text, text), coll_gist_ge(text, text),
+    coll_gist_gt(text, text), coll_gist_cmp(text, text);
@@ -0,0 +1,88 @@
+CREATE FUNCTION coll_fr_lower(t text) RETURNS text LANGUAGE sql IMMUTABLE
+AS $$ SELECT lower(t COLLATE "fr_FR") $$;
+CREATE FUNCTION coll_fr_wrap(t text) RETURNS text LANGUAGE sql IMMUTABLE
+AS $$ SELECT coll_fr_lower(t) $$;
+CREATE FUNCTION coll_rec(t text, n integer) RETURNS text LANGUAGE sql IMMUTABLE
+AS $$ SELECT CASE WHEN n > 0 THEN coll_rec(t, n - 1)
+    ELSE t COLLATE "en_US" END $$;
+
+CREATE TABLE coll_func (val text COLLATE "C");
+CREATE INDEX coll_func_wrap_idx ON coll_func (coll_fr_wrap(val));
+CREATE INDEX coll_func_rec_idx ON coll_func (coll_rec(val, 1));
+
+-- collations used in the body of nested SQL functions
+SELECT c.collname
+FROM pg_collation_index_dependencies('coll_func_wrap_idx') as d(o)
+JOIN pg_collation c ON d.o = c.oid
+ORDER BY c.collname::text COLLATE "C";
+
+-- recursive SQL functions
+SELECT c.collname
+FROM pg_collation_index_dependencies('coll_func_rec_idx') as d(o)
+JOIN pg_collation c ON d.o = c.oid
+ORDER BY c.collname::text COLLATE "C";
+
+-- the function bodies are remembered until they change
+CREATE OR REPLACE FUNCTION coll_fr_lower(t text) RETURNS text LANGUAGE sql
+IMMUTABLE AS $$ SELECT lower(t COLLATE "de_DE") $$;
+
+SELECT c.collname
+FROM pg_collation_index_dependencies('coll_func_wrap_idx') as d(o)
+JOIN pg_collation c ON d.o = c.oid
+ORDER BY c.collname::text COLLATE "C";
+
+-- and until the columns they read change
+CREATE TABLE coll_func_lookup (k text COLLATE "en_US");
+CREATE FUNCTION coll_func_min() RETURNS text LANGUAGE sql STABLE
+AS $$ SELECT min(k) FROM coll_func_lookup $$;
+CREATE TABLE coll_func_chk (
+    val text CONSTRAINT coll_func_chk_check CHECK (val <> coll_func_min())
+);
+
+SELECT c.collname
+FROM pg_collation_constraint_dependencies((SELECT oid FROM pg_constraint
+    WHERE conname = 'coll_func_chk_check')) as d(o)
+JOIN pg_collation c ON d.o = c.oid
+ORDER BY c.collname::text COLLATE "C";
+
+ALTER TABLE coll_func_lookup ALTER COLUMN k TYPE text COLLATE "fr_FR";
+
+SELECT c.collname
+FROM pg_collation_constraint_dependencies((SELECT oid FROM pg_constraint
+    WHERE conname = 'coll_func_chk_check')) as d(o)
+JOIN pg_collation c ON d.o = c.oid
+ORDER BY c.collname::text COLLATE "C";
+
+-- a body that can't be analyzed anymore is ignored, with a note in the trace
+DROP TABLE coll_func_lookup;
+
+SELECT c.collname
+FROM pg_collation_constraint_dependencies((SELECT oid FROM pg_constraint
+    WHERE conname = 'coll_func_chk_check')) as d(o)
+JOIN pg_collation c ON d.o = c.oid
+ORDER BY c.collname::text COLLATE "C";
+
+SELECT t.path
+FROM pg_collation_dependencies_trace('pg_constraint', (SELECT oid
+    FROM pg_constraint WHERE conname = 'coll_func_chk_check')) AS t
+WHERE t.colloid IS NULL;
+
+DROP TABLE coll_func_chk;
+DROP FUNCTION coll_func_min();
+
+-- functions with SET clauses aren't analyzed, as their body could resolve to
+-- other objects
+CREATE FUNCTION coll_fr_lower_set(t text) RETURNS text LANGUAGE sql IMMUTABLE
+SET search_path = public AS $$ SELECT lower(t COLLATE "fr_FR") $$;
+CREATE INDEX coll_func_set_idx ON coll_func (coll_fr_lower_set(val));
+
+SELECT c.collname
+FROM pg_collation_index_dependencies('coll_func_set_idx') as d(o)
+JOIN pg_collation c ON d.o = c.oid
+ORDER BY c.collname::text COLLATE "C";
+
+DROP TABLE coll_func;
+DROP FUNCTION coll_fr_lower_set(text);
+DROP FUNCTION coll_fr_wrap(text);
+DROP FUNCTION coll_fr_lower(text);
+DROP FUNCTION coll_rec(text, integer);
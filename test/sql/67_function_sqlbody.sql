@@ -0,0 +1,42 @@
+CREATE FUNCTION coll_es_upper(t text) RETURNS text LANGUAGE sql IMMUTABLE
+RETURN upper(t COLLATE "es_ES");
+CREATE FUNCTION coll_it_upper(t text) RETURNS text LANGUAGE sql IMMUTABLE
+BEGIN ATOMIC
+    SELECT upper(coll_es_upper(t) COLLATE "it_IT");
+END;
+
+CREATE TABLE coll_func (val text COLLATE "C",
+    CONSTRAINT coll_func_check CHECK (coll_it_upper(val) > ''));
+
+SELECT c.collname
+FROM pg_constraint con,
+LATERAL pg_collation_constraint_dependencies(con.oid) as d(o)
+JOIN pg_collation c ON d.o = c.oid
+WHERE con.conname = 'coll_func_check'
+ORDER BY c.collname::text COLLATE "C";
+
+DROP TABLE coll_func;
+DROP FUNCTION coll_it_upper(text);
+DROP FUNCTION coll_es_upper(text);
+
+-- bodies can also contain INSERT ... ON CONFLICT and DEFAULT
+CREATE TABLE coll_func_log (k text COLLATE "de_DE" PRIMARY KEY,
+    n integer DEFAULT 0);
+CREATE FUNCTION coll_log(t text) RETURNS boolean LANGUAGE sql
+BEGIN ATOMIC
+    INSERT INTO coll_func_log VALUES (t, DEFAULT) ON CONFLICT (k) DO NOTHING;
+    SELECT true;
+END;
+CREATE TABLE coll_func_logged (val text COLLATE "C",
+    CONSTRAINT coll_func_logged_check CHECK (coll_log(val)));
+
+SELECT c.collname
+FROM pg_constraint con,
+LATERAL pg_collation_constraint_dependencies(con.oid) as d(o)
+JOIN pg_collation c ON d.o = c.oid
+WHERE con.conname = 'coll_func_logged_check'
+ORDER BY c.collname::text COLLATE "C";
+
+DROP TABLE coll_func_logged;
+DROP FUNCTION coll_log(text);
+DROP TABLE coll_func_log;
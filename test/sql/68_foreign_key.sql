@@ -0,0 +1,31 @@
+CREATE TABLE coll_fk_pk (val text COLLATE "en_US" PRIMARY KEY);
+CREATE TABLE coll_fk_ref (
+    id integer,
+    val text COLLATE "fr_FR" REFERENCES coll_fk_pk
+);
+INSERT INTO coll_fk_pk VALUES ('a'), ('b');
+INSERT INTO coll_fk_ref VALUES (1, 'a'), (2, 'b'), (3, NULL);
+
+-- both sides of the constraint and the referenced index are reported together
+SELECT constraint_name, table_name, columns, ref_table_name, ref_columns,
+    ref_index_name, collname
+FROM pg_collation_foreign_key_dependencies
+WHERE table_name = 'coll_fk_ref'
+ORDER BY collname::text COLLATE "C";
+
+SELECT * FROM pg_collation_foreign_key_check((SELECT oid FROM pg_constraint
+    WHERE conname = 'coll_fk_ref_val_fkey'));
+
+-- simulate a row left behind by a lookup in a corrupted index
+ALTER TABLE coll_fk_ref DISABLE TRIGGER ALL;
+INSERT INTO coll_fk_ref VALUES (4, 'zzz');
+ALTER TABLE coll_fk_ref ENABLE TRIGGER ALL;
+
+SELECT * FROM pg_collation_foreign_key_check((SELECT oid FROM pg_constraint
+    WHERE conname = 'coll_fk_ref_val_fkey'));
+
+SELECT * FROM pg_collation_foreign_key_check((SELECT oid FROM pg_constraint
+    WHERE conname = 'coll_fk_pk_pkey'));
+
+DROP TABLE coll_fk_ref;
+DROP TABLE coll_fk_pk;
@@ -0,0 +1,22 @@
+CREATE TABLE coll_sub (vals text[] COLLATE "fr_FR");
+CREATE INDEX coll_sub_idx ON coll_sub ((vals[1]));
+
+-- subscripting depends on the collations of the container and element types
+SELECT c.collname
+FROM pg_collation_index_dependencies('coll_sub_idx') as d(o)
+JOIN pg_collation c ON d.o = c.oid
+ORDER BY c.collname::text COLLATE "C";
+
+-- and never on the types themselves
+SELECT count(*) AS not_collations
+FROM pg_collation_index_dependencies('coll_sub_idx') as d(o)
+WHERE NOT EXISTS (SELECT 1 FROM pg_collation c WHERE c.oid = d.o);
+
+SELECT c.collname, t.path
+FROM pg_collation_dependencies_trace('pg_class',
+    'coll_sub_idx'::regclass) AS t
+JOIN pg_collation c ON c.oid = t.colloid
+WHERE t.path LIKE '%SubscriptingRef%' AND t.path NOT LIKE '%refrestype%'
+ORDER BY c.collname COLLATE "C", t.path COLLATE "C";
+
+DROP TABLE coll_sub;
@@ -0,0 +1,26 @@
+-- SQL/JSON constructors and predicates were introduced in pg16
+SELECT current_setting('server_version_num')::integer < 160000 AS skip_test \gset
+\if :skip_test
+\quit
+\endif
+
+CREATE TABLE coll_json (val text COLLATE "fr_FR",
+    CONSTRAINT coll_json_check
+        CHECK (JSON_OBJECT('k': val RETURNING text) IS JSON OBJECT));
+
+SELECT c.collname
+FROM pg_constraint con,
+LATERAL pg_collation_constraint_dependencies(con.oid) as d(o)
+JOIN pg_collation c ON d.o = c.oid
+WHERE con.conname = 'coll_json_check'
+ORDER BY c.collname::text COLLATE "C";
+
+-- the RETURNING clause of the constructor
+SELECT c.collname, t.path
+FROM pg_collation_dependencies_trace('pg_constraint', (SELECT oid
+    FROM pg_constraint WHERE conname = 'coll_json_check')) AS t
+JOIN pg_collation c ON c.oid = t.colloid
+WHERE t.path LIKE '%JsonConstructorExpr%'
+ORDER BY c.collname COLLATE "C", t.path COLLATE "C";
+
+DROP TABLE coll_json;